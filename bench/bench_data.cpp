@@ -0,0 +1,185 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:            bench_data.cpp
+// Purpose:         Times the data path of the layers, apart from drawing
+// Licence:         wxWindows licence
+/////////////////////////////////////////////////////////////////////////////
+
+#include <wx/wx.h>
+
+#include <cmath>
+#include <vector>
+
+#include "mathplot.h"
+#include "mpbench.h"
+
+// Gives access to the bounding box update of the plot
+class MyBenchView : public mpOffscreenPlot {
+ public:
+  bool UpdateBBox() { return mpOffscreenPlot::UpdateBBox(); }
+};
+
+// Renderer discarding everything, to time the reduction of mpDecimatingRenderer alone
+class MyNullRenderer : public mpRenderer {
+ public:
+  MyNullRenderer() : m_count(0) {}
+  virtual void SetPen(const wxPen &) {}
+  virtual void SetBrush(const wxBrush &) {}
+  virtual void SetFont(const wxFont &) {}
+  virtual void SetTextForeground(const wxColour &) {}
+  virtual void DrawLines(const wxPoint *, size_t n) { m_count += n; }
+  virtual void DrawPoints(const wxPoint *, size_t n) { m_count += n; }
+  virtual void DrawRectangles(const wxRect *, size_t) {}
+  virtual void DrawText(const wxString &, wxCoord, wxCoord) {}
+  virtual void DrawRotatedText(const wxString &, wxCoord, wxCoord, double) {}
+  virtual void GetTextExtent(const wxString &, wxCoord *w, wxCoord *h) { *w = *h = 0; }
+  virtual void DrawImage(const wxImage &, wxCoord, wxCoord) {}
+  virtual wxDC *GetDC() { return NULL; }
+
+  size_t m_count;  //!< Points received
+};
+
+class MyApp : public wxApp {
+ public:
+  virtual bool OnInit() { return true; }
+  virtual int OnRun();
+
+ private:
+  void BenchSize(size_t n);
+  void BenchLayers(size_t layers, size_t n);
+  void Measure(const wxString &name, size_t samples, const std::function<void()> &body);
+
+  std::vector<double> m_xs, m_ys;
+};
+
+IMPLEMENT_APP(MyApp)
+
+// Time a body, and report the growth of the peak memory it causes. The
+// allocations made before the call, such as the input samples, do not count.
+void MyApp::Measure(const wxString &name, size_t samples, const std::function<void()> &body) {
+  const size_t before = mpBenchRSS();
+  mpBenchResetPeakRSS();
+  mpBenchCounters counters;
+  const double t = mpBenchBest(body, samples >= 10000000 ? 2 : 5, 0.2, &counters);
+  const size_t peak = mpBenchPeakRSS();
+  mpBenchMemory(name, samples, t, peak > before ? peak - before : 0, &counters);
+}
+
+void MyApp::BenchSize(size_t n) {
+  m_xs.resize(n);
+  m_ys.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    m_xs[i] = (double)i;
+    m_ys[i] = sin((double)i * 1e-3) + 0.1 * sin((double)i * 0.7);
+  }
+
+  Measure(wxT("mpComputeBounds"), n, [&] {
+    double minX, maxX, minY, maxY;
+    mpComputeBounds(&m_xs[0], &m_ys[0], n, minX, maxX, minY, maxY);
+  });
+
+  {
+    mpFXYVector vector;
+    Measure(wxT("mpFXYVector::SetData"), n, [&] { vector.SetData(m_xs, m_ys); });
+  }
+  {
+    mpFXYSnapshot snapshot;
+    Measure(wxT("mpFXYSnapshot::SetData"), n, [&] { snapshot.SetData(&m_xs[0], &m_ys[0], n); });
+  }
+  {
+    // Appended in blocks, as an acquisition would
+    const size_t block = 4096;
+    mpFXYSeries series;
+    Measure(wxT("mpFXYSeries::AddData"), n, [&] {
+      series.Clear();
+      for (size_t i = 0; i < n; i += block) series.AddData(&m_xs[i], &m_ys[i], wxMin(block, n - i));
+    });
+
+    mpSampleQueue *queue = series.CreateQueue(1 << 16);
+    Measure(wxT("mpSampleQueue Push + UpdateData"), n, [&] {
+      series.Clear();
+      for (size_t i = 0; i < n; i += block) {
+        queue->Push(&m_xs[i], &m_ys[i], wxMin(block, n - i));
+        series.UpdateData();
+      }
+    });
+  }
+  {
+    mpPolygon polygon;
+    polygon.setPoints(m_xs, m_ys, false);
+    double phi = 0;
+    Measure(wxT("mpMovableObject::ShapeUpdated"), n, [&] {
+      phi += 0.1;
+      polygon.SetCoordinateBase(1, 2, phi);
+    });
+  }
+  {
+    mpCovarianceEllipse ellipse;
+    ellipse.SetSegments((int)wxMin(n, (size_t)100000000));
+    double cov = 1;
+    Measure(wxT("mpCovarianceEllipse::RecalculateShape"), n, [&] {
+      cov += 0.1;
+      ellipse.SetCovarianceMatrix(cov, 0.5, 2);
+    });
+  }
+  {
+    // Screen points of a dense series on a 1920 pixels wide plot
+    std::vector<wxPoint> points(n);
+    for (size_t i = 0; i < n; ++i)
+      points[i] = wxPoint((int)(i * 1920 / n), (int)(540 + 400 * m_ys[i] / 1.1));
+    MyNullRenderer target;
+    mpDecimatingRenderer decimating(target);
+    Measure(wxT("mpDecimatingRenderer::DrawLines"), n, [&] { decimating.DrawLines(&points[0], n); });
+  }
+
+  m_xs.clear();
+  m_ys.clear();
+}
+
+// Bounding box of a plot holding many layers, after new data in all of them:
+// the layers compute their own bounding box in SetData, which UpdateBBox merges
+void MyApp::BenchLayers(size_t layers, size_t n) {
+  std::vector<std::vector<double> > xs(layers, std::vector<double>(n)), ys(layers, std::vector<double>(n));
+  std::vector<mpFXYVector *> vectors(layers);
+  MyBenchView view;
+  for (size_t l = 0; l < layers; ++l) {
+    for (size_t i = 0; i < n; ++i) {
+      xs[l][i] = (double)(i + l);
+      ys[l][i] = cos((double)(i * (l + 1)) * 1e-3);
+    }
+    vectors[l] = new mpFXYVector();
+    view.AddLayer(vectors[l], false);
+  }
+  Measure(wxString::Format(wxT("SetData + UpdateBBox %zu layers"), layers), layers * n, [&] {
+    for (size_t l = 0; l < layers; ++l) vectors[l]->SetData(xs[l], ys[l]);
+    view.UpdateBBox();
+  });
+}
+
+int MyApp::OnRun() {
+  size_t maxSamples = 100000000;
+  for (int i = 1; i < argc; ++i) {
+    const wxString arg = argv[i];
+    double value;
+    if ((arg == wxT("-n") || arg == wxT("--max-samples")) && i + 1 < argc && wxString(argv[++i]).ToDouble(&value) &&
+        value >= 1) {
+      maxSamples = (size_t)value;
+    } else if (arg == wxT("--perf")) {
+      if (!mpBenchPerf::Get().Enable()) fprintf(stderr, "Hardware counters are not available, reporting times only\n");
+    } else {
+      printf("Usage: bench_data [-n|--max-samples N] [--perf]\n"
+             "  Times the data path of the layers, with 1e3 to N samples (default 1e8).\n"
+             "  --perf also reports hardware counters per sample: IPC, cache and branch misses.\n");
+      return 2;
+    }
+  }
+
+  mpBenchMemoryHeader();
+  for (size_t n = 1000; n <= maxSamples; n *= 10) {
+    printf("\n%zu samples\n", n);
+    BenchSize(n);
+  }
+
+  printf("\n");
+  for (size_t layers = 10; layers <= 1000; layers *= 10) BenchLayers(layers, 1000);
+  return 0;
+}
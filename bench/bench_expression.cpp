@@ -0,0 +1,84 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:            bench_expression.cpp
+// Purpose:         Compares mpFXExpression evaluation with a hand-written mpFX
+// Licence:         wxWindows licence
+/////////////////////////////////////////////////////////////////////////////
+
+#include <wx/wx.h>
+
+#include <cmath>
+#include <vector>
+
+#include "mathplot.h"
+#include "mpbench.h"
+
+// The compiled version of the formulas benchmarked below
+class MyHandWrittenFX : public mpFX {
+ public:
+  MyHandWrittenFX(int formula) : mpFX(wxT("hand-written")), m_formula(formula) {}
+  virtual double GetY(double x) {
+    switch (m_formula) {
+      case 0:
+        return sin(3 * x) * exp(-x / 5);
+      case 1:
+        return 0.5 * x * x * x - 2 * x * x + x - 7;
+      default:
+        return sqrt(fabs(x)) * cos(x) + atan2(x, 2);
+    }
+  }
+
+ private:
+  int m_formula;
+};
+
+class MyApp : public wxApp {
+ public:
+  virtual bool OnInit() { return true; }
+  virtual int OnRun();
+};
+
+IMPLEMENT_APP(MyApp)
+
+int MyApp::OnRun() {
+  static const char *formulas[] = {"sin(3*x)*exp(-x/5)", "0.5*x^3 - 2*x^2 + x - 7", "sqrt(abs(x))*cos(x) + atan2(x, 2)"};
+  const size_t sizes[] = {1000, 100000, 1000000};
+
+  mpBenchHeader();
+  for (int f = 0; f < 3; ++f) {
+    mpFXExpression expr(wxString(formulas[f]));
+    MyHandWrittenFX hand(f);
+    if (!expr.IsOk()) return 1;
+    printf("\n%s (%zu instructions)\n", formulas[f], expr.GetExpression().GetProgramSize());
+
+    for (size_t n : sizes) {
+      std::vector<double> xs(n), ys(n), ref(n);
+      for (size_t i = 0; i < n; ++i) xs[i] = -50.0 + 100.0 * (double)i / (double)n;
+
+      double t = mpBenchBest([&] {
+        for (size_t i = 0; i < n; ++i) ref[i] = hand.GetY(xs[i]);
+      });
+      mpBenchReport(wxT("mpFX::GetY (hand-written)"), n, t);
+
+      t = mpBenchBest([&] {
+        for (size_t i = 0; i < n; ++i) ys[i] = expr.GetY(xs[i]);
+      });
+      mpBenchReport(wxT("mpFXExpression::GetY"), n, t);
+
+      t = mpBenchBest([&] { expr.GetYs(&xs[0], &ys[0], n); });
+      mpBenchReport(wxT("mpFXExpression::GetYs"), n, t);
+
+      // Check the results, allowing for rounding differences between the
+      // compiler folding and the bytecode
+      double maxError = 0;
+      for (size_t i = 0; i < n; ++i) {
+        double err = fabs(ys[i] - ref[i]) / (1 + fabs(ref[i]));
+        if (err > maxError) maxError = err;
+      }
+      if (maxError > 1e-9) {
+        printf("Result mismatch: relative error %g\n", maxError);
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,210 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:            bench_latency.cpp
+// Purpose:         Times mouse navigation in mpWindow, from event to painted frame
+// Licence:         wxWindows licence
+/////////////////////////////////////////////////////////////////////////////
+
+// Needs a display; on a headless machine, run it under a virtual one:
+//   xvfb-run -a -s "-screen 0 1920x1080x24" ./bench_latency
+
+#include <wx/wx.h>
+
+#include <cmath>
+#include <vector>
+
+#include "mathplot.h"
+#include "mpbench.h"
+
+typedef std::chrono::steady_clock MyClock;
+
+// mpWindow noting when each paint ends, and feeding mouse events to its handlers
+class MyLatencyWindow : public mpWindow {
+ public:
+  MyLatencyWindow(wxWindow *parent) : mpWindow(parent, wxID_ANY), m_paints(0) {
+    Bind(wxEVT_PAINT, &MyLatencyWindow::OnTimedPaint, this);
+  }
+
+  /** Run an injection, and wait for the frame it causes to be painted.
+      @return The time from injection to painted frame in seconds, negative if nothing was painted */
+  double Measure(const std::function<void()> &inject) {
+    const unsigned int paints = m_paints;
+    const MyClock::time_point start = MyClock::now();
+    inject();
+    Update();
+    // Some ports only paint on the next event loop iteration
+    while (m_paints == paints && MyClock::now() - start < std::chrono::seconds(10)) wxYield();
+    if (m_paints == paints) return -1;
+    return std::chrono::duration<double>(m_lastPaint - start).count();
+  }
+
+  /** Run an injection drawing on the window without painting it, as the
+      zoom rectangle drawn on the overlay by the motion handler.
+      @return The time taken by the injection in seconds */
+  double MeasureDirect(const std::function<void()> &inject) {
+    const MyClock::time_point start = MyClock::now();
+    inject();
+    return std::chrono::duration<double>(MyClock::now() - start).count();
+  }
+
+  void Wheel(int x, int y, int rotation, bool control) {
+    wxMouseEvent event(wxEVT_MOUSEWHEEL);
+    event.m_x = x;
+    event.m_y = y;
+    event.m_wheelRotation = rotation;
+    event.m_controlDown = control;
+    OnMouseWheel(event);
+  }
+
+  void Button(wxEventType type, int x, int y) {
+    wxMouseEvent event(type);
+    event.m_x = x;
+    event.m_y = y;
+    if (type == wxEVT_RIGHT_DOWN)
+      OnMouseRightDown(event);
+    else if (type == wxEVT_LEFT_DOWN)
+      OnMouseLeftDown(event);
+    else if (type == wxEVT_LEFT_UP)
+      OnMouseLeftRelease(event);
+  }
+
+  void Drag(int x, int y, bool left) {
+    wxMouseEvent event(wxEVT_MOTION);
+    event.m_x = x;
+    event.m_y = y;
+    event.m_leftDown = left;
+    event.m_rightDown = !left;
+    OnMouseMove(event);
+  }
+
+ private:
+  void OnTimedPaint(wxPaintEvent &event) {
+    OnPaint(event);
+    m_lastPaint = MyClock::now();
+    ++m_paints;
+  }
+
+  unsigned int m_paints;
+  MyClock::time_point m_lastPaint;
+};
+
+class MyApp : public wxApp {
+ public:
+  MyApp() : m_frame(NULL), m_window(NULL), m_maxPoints(100000000), m_status(0) {}
+  virtual bool OnInit();
+  virtual int OnRun() {
+    wxApp::OnRun();
+    return m_status;
+  }
+
+ private:
+  void RunScenes();
+  void SetScene(size_t layers, size_t points);
+  void RunScene(const wxString &name);
+
+  wxFrame *m_frame;
+  MyLatencyWindow *m_window;
+  size_t m_maxPoints;
+  int m_status;
+};
+
+IMPLEMENT_APP(MyApp)
+
+bool MyApp::OnInit() {
+  for (int i = 1; i < argc; ++i) {
+    const wxString arg = argv[i];
+    double value;
+    if ((arg == wxT("-n") || arg == wxT("--max-points")) && i + 1 < argc && wxString(argv[++i]).ToDouble(&value) &&
+        value >= 1) {
+      m_maxPoints = (size_t)value;
+    } else {
+      printf("Usage: bench_latency [-n|--max-points N]\n"
+             "  Times wheel, pan and rectangle zoom, from event to painted frame, in scenes of up to N points\n"
+             "  (default 1e8). Needs a display, e.g. xvfb-run.\n");
+      m_status = 2;
+      return false;
+    }
+  }
+
+  m_frame = new wxFrame(NULL, wxID_ANY, wxT("bench_latency"), wxDefaultPosition, wxSize(1280, 800));
+  m_window = new MyLatencyWindow(m_frame);
+  m_frame->Show();
+  CallAfter([this] { RunScenes(); });
+  return true;
+}
+
+// Replace the layers by the given number of series, sharing the points
+void MyApp::SetScene(size_t layers, size_t points) {
+  m_window->DelAllLayers(true, false);
+  m_window->AddLayer(new mpScaleX(wxT("X"), mpALIGN_BORDER_BOTTOM, true), false);
+  m_window->AddLayer(new mpScaleY(wxT("Y"), mpALIGN_BORDER_LEFT, true), false);
+  for (size_t l = 0; l < layers; ++l) {
+    // Filled in place, to avoid holding a copy of the largest scenes
+    mpFXYSnapshot *series = new mpFXYSnapshot(wxString::Format(wxT("series %zu"), l));
+    double *xs, *ys;
+    series->BeginWrite(points, xs, ys);
+    for (size_t i = 0; i < points; ++i) {
+      xs[i] = (double)i;
+      ys[i] = (double)l + sin((double)i * 20.0 / (double)points) + 0.2 * sin((double)i * 0.7);
+    }
+    series->Publish();
+    series->UpdateData();  // Take in the points now, so that Fit sees them
+    series->SetPen(wxPen(wxColour((unsigned char)(l * 40), 80, (unsigned char)(255 - l * 20)), 1));
+    m_window->AddLayer(series, false);
+  }
+  m_window->AddLayer(new mpInfoCoords(wxRect(80, 20, 10, 10), wxWHITE_BRUSH), false);
+}
+
+void MyApp::RunScene(const wxString &name) {
+  int width, height;
+  m_window->GetClientSize(&width, &height);
+  const int cx = width / 2, cy = height / 2;
+  const int steps = 50;
+  std::vector<double> zoom, scroll, pan, band, rect;
+
+  m_window->Measure([&] { m_window->Fit(); });
+  for (int i = 0; i < steps; ++i) {
+    const double t = m_window->Measure([&] { m_window->Wheel(cx, cy, (i % 2) ? -120 : 120, true); });
+    if (t >= 0) zoom.push_back(t);
+  }
+  for (int i = 0; i < steps; ++i) {
+    const double t = m_window->Measure([&] { m_window->Wheel(cx, cy, (i % 2) ? -120 : 120, false); });
+    if (t >= 0) scroll.push_back(t);
+  }
+
+  m_window->Button(wxEVT_RIGHT_DOWN, cx, cy);
+  for (int i = 0; i < steps; ++i) {
+    const int x = cx + (int)(100 * sin(i * 0.3)), y = cy + (int)(60 * cos(i * 0.3));
+    const double t = m_window->Measure([&] { m_window->Drag(x, y, false); });
+    if (t >= 0) pan.push_back(t);
+  }
+
+  // Rectangle zooms, each dragged over a few steps, back to the whole data in between
+  for (int i = 0; i < steps / 5; ++i) {
+    m_window->Measure([&] { m_window->Fit(); });
+    m_window->Button(wxEVT_LEFT_DOWN, cx - 200, cy - 100);
+    for (int s = 1; s <= 5; ++s)
+      band.push_back(m_window->MeasureDirect([&] { m_window->Drag(cx - 200 + 60 * s, cy - 100 + 30 * s, true); }));
+    const double t = m_window->Measure([&] { m_window->Button(wxEVT_LEFT_UP, cx + 100, cy + 50); });
+    if (t >= 0) rect.push_back(t);
+  }
+
+  printf("\n%s\n", (const char *)name.utf8_str());
+  mpBenchLatency(wxT("wheel zoom (ctrl)"), zoom);
+  mpBenchLatency(wxT("wheel scroll"), scroll);
+  mpBenchLatency(wxT("right drag pan"), pan);
+  mpBenchLatency(wxT("rectangle drag"), band);
+  mpBenchLatency(wxT("rectangle zoom"), rect);
+}
+
+void MyApp::RunScenes() {
+  static const size_t scenes[][2] = {{10, 1000}, {10, 100000}, {10, 1000000}, {1, 10000000}, {1, 100000000}};
+  mpBenchLatencyHeader();
+  for (size_t s = 0; s < sizeof(scenes) / sizeof(scenes[0]); ++s) {
+    const size_t layers = scenes[s][0], points = scenes[s][1];
+    if (layers * points > m_maxPoints) break;
+    SetScene(layers, points);
+    RunScene(wxString::Format(wxT("%zu layers x %zu points"), layers, points));
+  }
+  m_frame->Destroy();
+  ExitMainLoop();
+}
@@ -0,0 +1,179 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:            bench_mathplot.cpp
+// Purpose:         Times mpLayer::Plot of every layer type into a wxMemoryDC
+// Licence:         wxWindows licence
+/////////////////////////////////////////////////////////////////////////////
+
+#include <wx/wx.h>
+
+#include <cmath>
+#include <vector>
+
+#include "mathplot.h"
+#include "mpbench.h"
+
+// Functions drawn by the function layers, one evaluation per pixel
+class MyBenchFX : public mpFX {
+ public:
+  MyBenchFX() : mpFX(wxT("sin(x)")) {}
+  virtual double GetY(double x) { return sin(x); }
+};
+
+class MyBenchFY : public mpFY {
+ public:
+  MyBenchFY() : mpFY(wxT("sin(y)")) {}
+  virtual double GetX(double y) { return sin(y); }
+};
+
+class MyBenchProfile : public mpProfile {
+ public:
+  MyBenchProfile() : mpProfile(wxT("profile")) {}
+  virtual double GetY(double x) { return sin(x); }
+};
+
+class MyApp : public wxApp {
+ public:
+  virtual bool OnInit() { return true; }
+  virtual int OnRun();
+
+ private:
+  void BenchFunctions(int width, int height);
+  void BenchData(size_t n, int width, int height);
+  void BenchLayer(const wxString &name, mpLayer *layer, size_t points, int width, int height, bool fit = true,
+                  bool rescale = false);
+
+  std::vector<double> m_xs, m_ys;
+};
+
+IMPLEMENT_APP(MyApp)
+
+// Time the drawing of a layer, owned by the plot created for it. The
+// function and axis layers are shown over [-10, 10] x [-1.5, 1.5]; the data
+// layers are fitted to their bounding box. With rescale, the X scale changes
+// by 1% between runs, so that layers caching their scaled drawing redo it.
+void MyApp::BenchLayer(const wxString &name, mpLayer *layer, size_t points, int width, int height, bool fit,
+                       bool rescale) {
+  mpOffscreenPlot plot(width, height);
+  plot.AddLayer(layer, false);
+  if (fit)
+    plot.Fit();
+  else
+    plot.Fit(-10, 10, -1.5, 1.5);
+
+  wxBitmap bitmap(width, height);
+  wxMemoryDC dc(bitmap);
+  dc.SetBackground(*wxWHITE_BRUSH);
+  const int runs = points >= 10000000 ? 2 : 5;
+  const double scaleX = plot.GetScaleX();
+  bool zoomed = false;
+  mpBenchCounters counters;
+  const double t = mpBenchBest(
+      [&] {
+        if (rescale) {
+          zoomed = !zoomed;
+          plot.SetScaleX(zoomed ? scaleX * 1.01 : scaleX);
+        }
+        dc.Clear();
+        layer->Plot(dc, plot);
+      },
+      runs, 0.2, &counters);
+  mpBenchFrame(name + wxString::Format(wxT(" %dx%d"), width, height), points, t, &counters);
+}
+
+// Layers whose cost depends on the size of the image only
+void MyApp::BenchFunctions(int width, int height) {
+  const size_t columns = (size_t)width, rows = (size_t)height;
+  BenchLayer(wxT("mpFX"), new MyBenchFX(), columns, width, height, false);
+  BenchLayer(wxT("mpFY"), new MyBenchFY(), rows, width, height, false);
+  BenchLayer(wxT("mpProfile"), new MyBenchProfile(), columns, width, height, false);
+
+  static const unsigned int labelTypes[] = {mpX_NORMAL, mpX_TIME, mpX_HOURS, mpX_DATE, mpX_DATETIME};
+  static const wxChar *labelNames[] = {wxT("normal"), wxT("time"), wxT("hours"), wxT("date"), wxT("datetime")};
+  for (int i = 0; i < 5; ++i) {
+    mpScaleX *scale = new mpScaleX(wxT("X"), mpALIGN_BORDER_BOTTOM, true, labelTypes[i]);
+    BenchLayer(wxString(wxT("mpScaleX ")) + labelNames[i], scale, columns, width, height, false);
+  }
+  BenchLayer(wxT("mpScaleX grid"), new mpScaleX(wxT("X"), mpALIGN_CENTER, false), columns, width, height, false);
+  BenchLayer(wxT("mpScaleY ticks"), new mpScaleY(wxT("Y"), mpALIGN_BORDER_LEFT, true), rows, width, height, false);
+  BenchLayer(wxT("mpScaleY grid"), new mpScaleY(wxT("Y"), mpALIGN_CENTER, false), rows, width, height, false);
+
+  BenchLayer(wxT("mpInfoLayer"), new mpInfoLayer(wxRect(20, 20, 200, 100), wxWHITE_BRUSH), 1, width, height, false);
+  BenchLayer(wxT("mpInfoCoords"), new mpInfoCoords(wxRect(20, 20, 10, 10), wxWHITE_BRUSH), 1, width, height, false);
+
+  // The legend lists the other layers of the plot
+  mpOffscreenPlot legendPlot(width, height);
+  for (int i = 0; i < 8; ++i) legendPlot.AddLayer(new MyBenchFX(), false);
+  mpInfoLegend *legend = new mpInfoLegend(wxRect(20, 20, 10, 10), wxWHITE_BRUSH);
+  legendPlot.AddLayer(legend, false);
+  legendPlot.Fit(-10, 10, -1.5, 1.5);
+  wxBitmap bitmap(width, height);
+  wxMemoryDC dc(bitmap);
+  mpBenchCounters counters;
+  const double t = mpBenchBest([&] { legend->Plot(dc, legendPlot); }, 5, 0.2, &counters);
+  mpBenchFrame(wxString::Format(wxT("mpInfoLegend %dx%d"), width, height), 8, t, &counters);
+}
+
+// Layers drawing n data points, sharing the samples in m_xs, m_ys
+void MyApp::BenchData(size_t n, int width, int height) {
+  m_xs.resize(n);
+  m_ys.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    m_xs[i] = (double)i;
+    m_ys[i] = sin((double)i * 1e-3) + 0.1 * sin((double)i * 0.7);
+  }
+
+  mpFXYVector *line = new mpFXYVector(wxT("line"));
+  line->SetData(m_xs, m_ys);
+  line->SetContinuity(true);
+  BenchLayer(wxT("mpFXYVector continuous"), line, n, width, height);
+
+  mpFXYVector *scatter = new mpFXYVector(wxT("scatter"));
+  scatter->SetData(m_xs, m_ys);
+  scatter->SetContinuity(false);
+  BenchLayer(wxT("mpFXYVector scatter"), scatter, n, width, height);
+
+  mpPolygon *polygon = new mpPolygon(wxT("polygon"));
+  polygon->setPoints(m_xs, m_ys, true);
+  BenchLayer(wxT("mpMovableObject (mpPolygon)"), polygon, n, width, height);
+
+  // Square image of about n pixels
+  const int side = wxMax(1, (int)sqrt((double)n));
+  wxImage image(side, side, false);
+  unsigned char *rgb = image.GetData();
+  for (size_t i = 0; i < (size_t)side * (size_t)side * 3; ++i) rgb[i] = (unsigned char)(i * 7);
+  mpBitmapLayer *bitmap = new mpBitmapLayer();
+  bitmap->SetBitmap(image, 0, 0, (double)n, 2);
+  BenchLayer(wxT("mpBitmapLayer"), bitmap, (size_t)side * (size_t)side, width, height, true, true);
+
+  m_xs.clear();
+  m_ys.clear();
+}
+
+int MyApp::OnRun() {
+  size_t maxPoints = 100000000;
+  for (int i = 1; i < argc; ++i) {
+    const wxString arg = argv[i];
+    double value;
+    if ((arg == wxT("-n") || arg == wxT("--max-points")) && i + 1 < argc && wxString(argv[++i]).ToDouble(&value) &&
+        value >= 1) {
+      maxPoints = (size_t)value;
+    } else if (arg == wxT("--perf")) {
+      if (!mpBenchPerf::Get().Enable()) fprintf(stderr, "Hardware counters are not available, reporting times only\n");
+    } else {
+      printf("Usage: bench_mathplot [-n|--max-points N] [--perf]\n"
+             "  Times the drawing of every layer type, with 1e3 to N data points (default 1e8).\n"
+             "  --perf also reports hardware counters per point: IPC, cache and branch misses.\n");
+      return 2;
+    }
+  }
+
+  mpBenchFrameHeader();
+  static const int sizes[][2] = {{640, 480}, {1920, 1080}, {3840, 2160}};
+  for (int s = 0; s < 3; ++s) BenchFunctions(sizes[s][0], sizes[s][1]);
+
+  for (size_t n = 1000; n <= maxPoints; n *= 10) {
+    printf("\n%zu points\n", n);
+    BenchData(n, 1920, 1080);
+  }
+  return 0;
+}
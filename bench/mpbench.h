@@ -0,0 +1,313 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:            mpbench.h
+// Purpose:         Small timing harness shared by the wxMathPlot benchmarks
+// Licence:         wxWindows licence
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef _MP_BENCH_H_
+#define _MP_BENCH_H_
+
+#include <wx/string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/** Hardware event counts of a benchmark run, negative for the events not counted. */
+struct mpBenchCounters {
+  mpBenchCounters() : cycles(-1), instructions(-1), l1Misses(-1), llcMisses(-1), branchMisses(-1) {}
+
+  double cycles;        //!< CPU cycles
+  double instructions;  //!< Instructions retired
+  double l1Misses;      //!< L1 data cache read misses
+  double llcMisses;     //!< Last level cache read misses
+  double branchMisses;  //!< Mispredicted branches
+};
+
+/** Hardware performance counters of the process, read with the Linux
+    perf_event_open system call. The threads created after Enable, such as
+    the workers of the library, are counted too. The counters the system does
+    not provide (other platforms, virtual machines, perf_event_paranoid) stay
+    unavailable and the benchmarks report times only. */
+class mpBenchPerf {
+ public:
+  /** Get the counters shared by the benchmarks of the process. */
+  static mpBenchPerf &Get() {
+    static mpBenchPerf perf;
+    return perf;
+  }
+
+  ~mpBenchPerf() {
+#ifdef __linux__
+    for (int i = 0; i < COUNTERS; ++i)
+      if (m_fds[i] >= 0) close(m_fds[i]);
+#endif
+  }
+
+  /** Open the counters.
+      @return true if at least one counter could be opened */
+  bool Enable() {
+#ifdef __linux__
+    static const unsigned types[COUNTERS] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+                                             PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE};
+    static const unsigned long long configs[COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+        PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+        PERF_COUNT_HW_BRANCH_MISSES};
+    for (int i = 0; i < COUNTERS; ++i) {
+      if (m_fds[i] >= 0) continue;
+      perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = types[i];
+      attr.config = configs[i];
+      attr.disabled = 1;
+      attr.inherit = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      // Scale the counts when the counters are multiplexed
+      attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      m_fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+      if (m_fds[i] >= 0) m_enabled = true;
+    }
+#endif
+    return m_enabled;
+  }
+
+  /** Check whether at least one counter is open. */
+  bool IsEnabled() const { return m_enabled; }
+
+  /** Reset and start the open counters. */
+  void Start() {
+#ifdef __linux__
+    for (int i = 0; i < COUNTERS; ++i) {
+      if (m_fds[i] < 0) continue;
+      ioctl(m_fds[i], PERF_EVENT_IOC_RESET, 0);
+      ioctl(m_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+  }
+
+  /** Stop the open counters and read them.
+      @param counters Returns the counts since Start */
+  void Stop(mpBenchCounters &counters) {
+    double *values[COUNTERS] = {&counters.cycles, &counters.instructions, &counters.l1Misses, &counters.llcMisses,
+                                &counters.branchMisses};
+#ifdef __linux__
+    for (int i = 0; i < COUNTERS; ++i)
+      if (m_fds[i] >= 0) ioctl(m_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+#endif
+    for (int i = 0; i < COUNTERS; ++i) {
+      *values[i] = -1;
+#ifdef __linux__
+      unsigned long long data[3];  // Value, time enabled, time running
+      if (m_fds[i] >= 0 && read(m_fds[i], data, sizeof(data)) == (ssize_t)sizeof(data) && data[2] > 0)
+        *values[i] = (double)data[0] * ((double)data[1] / (double)data[2]);
+#endif
+    }
+  }
+
+ private:
+  enum { COUNTERS = 5 };
+
+  mpBenchPerf() : m_enabled(false) {
+    for (int i = 0; i < COUNTERS; ++i) m_fds[i] = -1;
+  }
+
+  int m_fds[COUNTERS];  //!< Counter descriptors, -1 where not open
+  bool m_enabled;       //!< Whether a counter is open
+};
+
+/** Print the headers of the hardware counter columns, if the counters are enabled. */
+inline void mpBenchPerfHeader() {
+  if (mpBenchPerf::Get().IsEnabled()) printf(" %8s %12s %12s %12s", "IPC", "L1 miss/it", "LLC miss/it", "br miss/it");
+}
+
+/** Print the hardware counter columns of a row, if the counters are enabled.
+    @param counters Counts of the run, NULL if none
+    @param items Number of items processed by the run */
+inline void mpBenchPerfColumns(const mpBenchCounters *counters, size_t items) {
+  if (!mpBenchPerf::Get().IsEnabled()) return;
+  mpBenchCounters none;
+  const mpBenchCounters &c = counters ? *counters : none;
+  if (c.cycles > 0 && c.instructions >= 0)
+    printf(" %8.2f", c.instructions / c.cycles);
+  else
+    printf(" %8s", "-");
+  const double perItem[3] = {c.l1Misses, c.llcMisses, c.branchMisses};
+  for (int i = 0; i < 3; ++i) {
+    if (perItem[i] >= 0 && items > 0)
+      printf(" %12.3f", perItem[i] / (double)items);
+    else
+      printf(" %12s", "-");
+  }
+}
+
+/** Run a benchmark body repeatedly and keep the best time.
+    The body is run once as a warm up, then at least minRuns times and until
+    minSeconds of total run time have been spent.
+    @param body The code to time
+    @param minRuns Minimum number of timed runs
+    @param minSeconds Minimum total timed duration
+    @param counters If not NULL and the hardware counters are enabled, returns the counts of the fastest run
+    @return The fastest run, in seconds */
+inline double mpBenchBest(const std::function<void()> &body, int minRuns = 5, double minSeconds = 0.2,
+                          mpBenchCounters *counters = NULL) {
+  typedef std::chrono::steady_clock clock;
+  mpBenchPerf &perf = mpBenchPerf::Get();
+  const bool count = counters && perf.IsEnabled();
+  body();
+  double best = 1e300, total = 0;
+  for (int run = 0; run < minRuns || total < minSeconds; ++run) {
+    mpBenchCounters runCounters;
+    if (count) perf.Start();
+    clock::time_point start = clock::now();
+    body();
+    double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    if (count) perf.Stop(runCounters);
+    total += elapsed;
+    if (elapsed < best) {
+      best = elapsed;
+      if (count) *counters = runCounters;
+    }
+  }
+  return best;
+}
+
+/** Print the header of a result table, matching mpBenchReport columns. */
+inline void mpBenchHeader() {
+  printf("%-40s %12s %12s %12s", "benchmark", "items", "best [ms]", "ns/item");
+  mpBenchPerfHeader();
+  printf("\n");
+}
+
+/** Print one row of a result table.
+    @param name Benchmark name
+    @param items Number of items (points, samples, ...) processed by one run
+    @param seconds Best run time as returned by mpBenchBest
+    @param counters Hardware counts of the best run, NULL if none */
+inline void mpBenchReport(const wxString &name, size_t items, double seconds,
+                          const mpBenchCounters *counters = NULL) {
+  printf("%-40s %12zu %12.3f %12.3f", (const char *)name.utf8_str(), items, seconds * 1e3,
+         items ? seconds * 1e9 / (double)items : 0.0);
+  mpBenchPerfColumns(counters, items);
+  printf("\n");
+  fflush(stdout);
+}
+
+/** Print the header of a frame table, matching mpBenchFrame columns. */
+inline void mpBenchFrameHeader() {
+  printf("%-40s %12s %12s %12s", "benchmark", "points", "ms/frame", "Mpoints/s");
+  mpBenchPerfHeader();
+  printf("\n");
+}
+
+/** Print one row of a frame table.
+    @param name Benchmark name
+    @param points Number of points drawn or visited by one frame
+    @param seconds Best frame time as returned by mpBenchBest
+    @param counters Hardware counts of the best frame, NULL if none */
+inline void mpBenchFrame(const wxString &name, size_t points, double seconds, const mpBenchCounters *counters = NULL) {
+  printf("%-40s %12zu %12.3f %12.3f", (const char *)name.utf8_str(), points, seconds * 1e3,
+         seconds > 0 ? (double)points / seconds * 1e-6 : 0.0);
+  mpBenchPerfColumns(counters, points);
+  printf("\n");
+  fflush(stdout);
+}
+
+/** Read a size field of /proc/self/status, such as "VmRSS:".
+    @return The size in bytes, 0 where the field is not available */
+inline size_t mpBenchProcStatus(const char *field) {
+  size_t bytes = 0;
+  FILE *status = fopen("/proc/self/status", "r");
+  if (!status) return 0;
+  char line[256];
+  const size_t length = strlen(field);
+  while (fgets(line, sizeof(line), status)) {
+    if (strncmp(line, field, length) == 0) {
+      unsigned long kb = 0;
+      if (sscanf(line + length, "%lu", &kb) == 1) bytes = (size_t)kb * 1024;
+      break;
+    }
+  }
+  fclose(status);
+  return bytes;
+}
+
+/** Get the resident set size of the process in bytes, 0 if unknown. */
+inline size_t mpBenchRSS() { return mpBenchProcStatus("VmRSS:"); }
+
+/** Get the peak resident set size of the process in bytes, 0 if unknown. */
+inline size_t mpBenchPeakRSS() { return mpBenchProcStatus("VmHWM:"); }
+
+/** Reset the peak resident set size to the current one, where the system
+    allows it (Linux), so that the peak of a single benchmark can be read. */
+inline void mpBenchResetPeakRSS() {
+  FILE *refs = fopen("/proc/self/clear_refs", "w");
+  if (!refs) return;
+  fputs("5", refs);
+  fclose(refs);
+}
+
+/** Print the header of a memory table, matching mpBenchMemory columns. */
+inline void mpBenchMemoryHeader() {
+  printf("%-40s %12s %12s %12s %12s %12s", "benchmark", "samples", "best [ms]", "Msamples/s", "peak [MB]", "B/sample");
+  mpBenchPerfHeader();
+  printf("\n");
+}
+
+/** Print one row of a memory table.
+    @param name Benchmark name
+    @param samples Number of samples processed by one run
+    @param seconds Best run time as returned by mpBenchBest
+    @param bytes Growth of the peak resident set size during the benchmark
+    @param counters Hardware counts of the best run, NULL if none */
+inline void mpBenchMemory(const wxString &name, size_t samples, double seconds, size_t bytes,
+                          const mpBenchCounters *counters = NULL) {
+  printf("%-40s %12zu %12.3f %12.3f %12.1f %12.2f", (const char *)name.utf8_str(), samples, seconds * 1e3,
+         seconds > 0 ? (double)samples / seconds * 1e-6 : 0.0, (double)bytes / (1024.0 * 1024.0),
+         samples ? (double)bytes / (double)samples : 0.0);
+  mpBenchPerfColumns(counters, samples);
+  printf("\n");
+  fflush(stdout);
+}
+
+/** Get a percentile of a set of samples, by the nearest rank.
+    @param samples Samples, sorted in place
+    @param p Percentile, from 0 to 100
+    @return The percentile, 0 for an empty set */
+inline double mpBenchPercentile(std::vector<double> &samples, double p) {
+  if (samples.empty()) return 0;
+  std::sort(samples.begin(), samples.end());
+  size_t rank = (size_t)(p / 100.0 * (double)samples.size() + 0.5);
+  if (rank > 0) --rank;
+  return samples[rank < samples.size() ? rank : samples.size() - 1];
+}
+
+/** Print the header of a latency table, matching mpBenchLatency columns. */
+inline void mpBenchLatencyHeader() {
+  printf("%-40s %12s %12s %12s %12s\n", "benchmark", "events", "p50 [ms]", "p99 [ms]", "max [ms]");
+}
+
+/** Print one row of a latency table.
+    @param name Benchmark name
+    @param latencies Latency of each event in seconds, sorted in place */
+inline void mpBenchLatency(const wxString &name, std::vector<double> &latencies) {
+  const double p50 = mpBenchPercentile(latencies, 50), p99 = mpBenchPercentile(latencies, 99);
+  printf("%-40s %12zu %12.3f %12.3f %12.3f\n", (const char *)name.utf8_str(), latencies.size(), p50 * 1e3, p99 * 1e3,
+         latencies.empty() ? 0.0 : latencies.back() * 1e3);
+  fflush(stdout);
+}
+
+#endif  // _MP_BENCH_H_
@@ -12,12 +12,16 @@
 
 #include "mathplot.h"
 
+#include <wx/base64.h>
 #include <wx/bmpbuttn.h>
 #include <wx/brush.h>
 #include <wx/colour.h>
 #include <wx/cursor.h>
 #include <wx/dcbuffer.h>
 #include <wx/dcclient.h>
+#include <wx/dcgraph.h>
+#include <wx/ffile.h>
+#include <wx/filefn.h>
 #include <wx/font.h>
 #include <wx/image.h>
 #include <wx/intl.h>
@@ -29,10 +33,30 @@
 #include <wx/settings.h>
 #include <wx/sizer.h>
 #include <wx/tipwin.h>
+#include <wx/wfstream.h>
 #include <wx/window.h>
+#include <wx/zstream.h>
 
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <climits>
 #include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
 #include <ctime>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define mpUSE_SSE2
+#endif
 
 // Legend margins
 #define mpLEGEND_MARGIN 5
@@ -48,6 +72,497 @@
 // See doxygen comments.
 double mpWindow::zoomIncrementalFactor = 1.5;
 
+//-----------------------------------------------------------------------------
+// Data utilities
+//-----------------------------------------------------------------------------
+
+// Minimum number of elements handled by each thread of mpParallelFor
+#define mpPARALLEL_GRAIN 262144
+
+// Number of parts mpParallelFor should split n elements into
+static unsigned mpParallelParts(size_t n) {
+  const size_t maxParts = n / mpPARALLEL_GRAIN;
+  const unsigned cores = std::thread::hardware_concurrency();
+  if (maxParts < 2 || cores < 2) return 1;
+  return (maxParts < cores) ? (unsigned)maxParts : cores;
+}
+
+// Split the range [0, n) into parts contiguous slices and call body(part,
+// begin, end) for each one, the first slice in the calling thread and the
+// others in temporary threads. Slices whose thread cannot be created are
+// processed by the calling thread.
+static void mpParallelFor(unsigned parts, size_t n, const std::function<void(unsigned, size_t, size_t)> &body) {
+  std::vector<std::thread> threads;
+  std::vector<unsigned> serial;
+  for (unsigned p = 1; p < parts; ++p) {
+    try {
+      threads.push_back(std::thread([&body, p, n, parts] {
+        mpTRACE_SCOPE("worker", "slice");
+        body(p, n * p / parts, n * (p + 1) / parts);
+      }));
+    } catch (const std::system_error &) {
+      serial.push_back(p);
+    }
+  }
+  body(0, 0, n / parts);
+  for (size_t i = 0; i < serial.size(); ++i) body(serial[i], n * serial[i] / parts, n * (serial[i] + 1) / parts);
+  for (size_t i = 0; i < threads.size(); ++i) threads[i].join();
+}
+
+// Persistent worker threads running batches of independent tasks. Used by
+// mpWindow, from the GUI thread only.
+class mpThreadPool {
+ public:
+  // Start the given number of worker threads (possibly fewer, if threads
+  // cannot be created)
+  mpThreadPool(unsigned threads) : m_task(NULL), m_count(0), m_next(0), m_pending(0), m_stop(false) {
+    for (unsigned t = 0; t < threads; ++t) {
+      try {
+        m_threads.push_back(std::thread(&mpThreadPool::Work, this));
+      } catch (const std::system_error &) {
+        break;
+      }
+    }
+  }
+
+  ~mpThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_wake.notify_all();
+    for (size_t t = 0; t < m_threads.size(); ++t) m_threads[t].join();
+  }
+
+  // Call task(i) for each i in [0, count), on the workers and the calling
+  // thread, and return when all the calls are done. While a batch is
+  // running, for instance when called from a task, the calls are made in
+  // the calling thread.
+  void Run(size_t count, const std::function<void(size_t)> &task) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_count != 0) {
+      lock.unlock();
+      for (size_t i = 0; i < count; ++i) task(i);
+      return;
+    }
+    m_task = &task;
+    m_count = count;
+    m_next = 0;
+    m_pending = count;
+    m_wake.notify_all();
+    while (m_next < m_count) {
+      size_t i = m_next++;
+      lock.unlock();
+      {
+        mpTRACE_SCOPE("worker", "task");
+        task(i);
+      }
+      lock.lock();
+      m_pending--;
+    }
+    m_done.wait(lock, [this] { return m_pending == 0; });
+    m_task = NULL;
+    m_count = m_next = 0;
+  }
+
+ private:
+  void Work() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+      m_wake.wait(lock, [this] { return m_stop || m_next < m_count; });
+      if (m_stop) return;
+      size_t i = m_next++;
+      lock.unlock();
+      {
+        mpTRACE_SCOPE("worker", "task");
+        (*m_task)(i);
+      }
+      lock.lock();
+      if (--m_pending == 0) m_done.notify_all();
+    }
+  }
+
+  std::vector<std::thread> m_threads;
+  std::mutex m_mutex;
+  std::condition_variable m_wake, m_done;
+  const std::function<void(size_t)> *m_task;  // Task of the running batch
+  size_t m_count, m_next, m_pending;         // Batch size, next index to run, calls not finished
+  bool m_stop;
+};
+
+// Serial part of mpComputeBounds. Non-finite points are replaced by neutral
+// values instead of being skipped with a branch; compilers do not vectorize
+// floating point min/max reductions on their own (NaN semantics), so the
+// bulk of the points is handled with explicit SSE2 where available.
+static size_t mpComputeBoundsKernel(const double *xs, const double *ys, size_t n, double bounds[4]) {
+  double minX = HUGE_VAL, maxX = -HUGE_VAL, minY = HUGE_VAL, maxY = -HUGE_VAL;
+  size_t nonFinite = 0, i = 0;
+
+#ifdef mpUSE_SSE2
+  if (n >= 2) {
+    const __m128d zero = _mm_setzero_pd(), inf = _mm_set1_pd(HUGE_VAL), ninf = _mm_set1_pd(-HUGE_VAL);
+    __m128d vMinX = inf, vMaxX = ninf, vMinY = inf, vMaxY = ninf;
+    __m128i vFinite = _mm_setzero_si128();
+    for (; i + 2 <= n; i += 2) {
+      const __m128d x = _mm_loadu_pd(xs + i), y = _mm_loadu_pd(ys + i);
+      // All bits set in the lanes where both x - x and y - y are 0, i.e. finite
+      const __m128d finite =
+          _mm_and_pd(_mm_cmpeq_pd(_mm_sub_pd(x, x), zero), _mm_cmpeq_pd(_mm_sub_pd(y, y), zero));
+      vFinite = _mm_sub_epi64(vFinite, _mm_castpd_si128(finite));
+      vMinX = _mm_min_pd(vMinX, _mm_or_pd(_mm_and_pd(finite, x), _mm_andnot_pd(finite, inf)));
+      vMaxX = _mm_max_pd(vMaxX, _mm_or_pd(_mm_and_pd(finite, x), _mm_andnot_pd(finite, ninf)));
+      vMinY = _mm_min_pd(vMinY, _mm_or_pd(_mm_and_pd(finite, y), _mm_andnot_pd(finite, inf)));
+      vMaxY = _mm_max_pd(vMaxY, _mm_or_pd(_mm_and_pd(finite, y), _mm_andnot_pd(finite, ninf)));
+    }
+    double lanes[2];
+    long long counts[2];
+    _mm_storeu_si128((__m128i *)counts, vFinite);
+    nonFinite = i - (size_t)(counts[0] + counts[1]);
+    _mm_storeu_pd(lanes, vMinX);
+    minX = (lanes[0] < lanes[1]) ? lanes[0] : lanes[1];
+    _mm_storeu_pd(lanes, vMaxX);
+    maxX = (lanes[0] > lanes[1]) ? lanes[0] : lanes[1];
+    _mm_storeu_pd(lanes, vMinY);
+    minY = (lanes[0] < lanes[1]) ? lanes[0] : lanes[1];
+    _mm_storeu_pd(lanes, vMaxY);
+    maxY = (lanes[0] > lanes[1]) ? lanes[0] : lanes[1];
+  }
+#endif
+
+  for (; i < n; ++i) {
+    const double x = xs[i], y = ys[i];
+    // v - v is 0 for finite values, NaN for NaN and infinities
+    const bool finite = ((x - x) == 0) & ((y - y) == 0);
+    nonFinite += !finite;
+    const double lowX = finite ? x : HUGE_VAL, highX = finite ? x : -HUGE_VAL;
+    const double lowY = finite ? y : HUGE_VAL, highY = finite ? y : -HUGE_VAL;
+    minX = (lowX < minX) ? lowX : minX;
+    maxX = (highX > maxX) ? highX : maxX;
+    minY = (lowY < minY) ? lowY : minY;
+    maxY = (highY > maxY) ? highY : maxY;
+  }
+  bounds[0] = minX;
+  bounds[1] = maxX;
+  bounds[2] = minY;
+  bounds[3] = maxY;
+  return nonFinite;
+}
+
+size_t mpComputeBounds(const double *xs, const double *ys, size_t n, double &minX, double &maxX, double &minY,
+                       double &maxY) {
+  const unsigned parts = mpParallelParts(n);
+  std::vector<double> bounds(4 * parts);
+  std::vector<size_t> nonFinite(parts);
+  mpParallelFor(parts, n, [&](unsigned p, size_t begin, size_t end) {
+    nonFinite[p] = mpComputeBoundsKernel(xs + begin, ys + begin, end - begin, &bounds[4 * p]);
+  });
+
+  size_t total = nonFinite[0];
+  minX = bounds[0];
+  maxX = bounds[1];
+  minY = bounds[2];
+  maxY = bounds[3];
+  for (unsigned p = 1; p < parts; ++p) {
+    total += nonFinite[p];
+    if (bounds[4 * p] < minX) minX = bounds[4 * p];
+    if (bounds[4 * p + 1] > maxX) maxX = bounds[4 * p + 1];
+    if (bounds[4 * p + 2] < minY) minY = bounds[4 * p + 2];
+    if (bounds[4 * p + 3] > maxY) maxY = bounds[4 * p + 3];
+  }
+  return total;
+}
+
+//-----------------------------------------------------------------------------
+// Render statistics
+//-----------------------------------------------------------------------------
+
+#ifdef MATHPLOT_ENABLE_STATS
+void mpRollingStats::Add(double value) {
+  m_values[m_next] = value;
+  m_next = (m_next + 1) % mpSTATS_WINDOW;
+  if (m_count < mpSTATS_WINDOW) m_count++;
+}
+
+// The values are stored from index 0 until the ring is full, so that the
+// first m_count entries always are the values of the window
+double mpRollingStats::GetMean() const {
+  double sum = 0;
+  for (size_t i = 0; i < m_count; ++i) sum += m_values[i];
+  return m_count ? sum / (double)m_count : 0;
+}
+
+double mpRollingStats::GetMax() const {
+  double max = 0;
+  for (size_t i = 0; i < m_count; ++i)
+    if (i == 0 || m_values[i] > max) max = m_values[i];
+  return max;
+}
+
+double mpRollingStats::GetPercentile(double p) const {
+  if (m_count == 0) return 0;
+  std::vector<double> values(m_values, m_values + m_count);
+  size_t rank = (size_t)(p / 100.0 * (double)m_count + 0.5);
+  if (rank > 0) --rank;
+  if (rank >= m_count) rank = m_count - 1;
+  std::nth_element(values.begin(), values.begin() + (std::ptrdiff_t)rank, values.end());
+  return values[rank];
+}
+
+void mpRollingStats::GetHistogram(std::vector<size_t> &buckets, double unit) const {
+  std::fill(buckets.begin(), buckets.end(), 0);
+  if (buckets.empty()) return;
+  for (size_t i = 0; i < m_count; ++i) {
+    size_t bucket = 0;
+    for (double bound = unit; m_values[i] >= bound && bucket + 1 < buckets.size(); bound *= 2) bucket++;
+    buckets[bucket]++;
+  }
+}
+
+// Counters of the layer drawn by each thread
+static thread_local mpLayerCounters *mpCurrentCounters = NULL;
+
+mpLayerCounters *mpGetLayerCounters() { return mpCurrentCounters; }
+
+// Measures the drawing of a layer by the calling thread during its lifetime,
+// then adds the time and the counters to the statistics of the layer
+class mpLayerTimer {
+ public:
+  mpLayerTimer(mpLayer *layer)
+      : m_layer(layer), m_previous(mpCurrentCounters), m_start(std::chrono::steady_clock::now()) {
+    m_counters.pointsVisited = m_counters.pointsDrawn = m_counters.primitives = 0;
+    mpCurrentCounters = &m_counters;
+  }
+
+  ~mpLayerTimer() {
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+    mpLayerStats &stats = m_layer->GetStats();
+    stats.time.Add(elapsed);
+    stats.pointsVisited.Add((double)m_counters.pointsVisited);
+    stats.pointsDrawn.Add((double)m_counters.pointsDrawn);
+    stats.primitives.Add((double)m_counters.primitives);
+    mpCurrentCounters = m_previous;
+  }
+
+ private:
+  mpLayer *m_layer;
+  mpLayerCounters m_counters;
+  mpLayerCounters *m_previous;
+  std::chrono::steady_clock::time_point m_start;
+};
+
+#define mpSTATS_LAYER(layer) mpLayerTimer mpLayerTimer_(layer)
+#else
+#define mpSTATS_LAYER(layer)
+#endif  // MATHPLOT_ENABLE_STATS
+
+//-----------------------------------------------------------------------------
+// Tracing
+//-----------------------------------------------------------------------------
+
+#ifdef MATHPLOT_ENABLE_TRACE
+// Number of events kept per thread and trace, the following ones are dropped
+#define mpTRACE_EVENTS 65536
+
+struct mpTraceEvent {
+  const char *category;
+  char name[mpTRACE_NAME];
+  double start, duration;  // Microseconds, from the start of the trace
+};
+
+// Events of a thread. Only the owning thread appends to it, publishing the
+// new size with a release store, so mpTraceStop can read it without locking.
+struct mpTraceBuffer {
+  mpTraceEvent events[mpTRACE_EVENTS];
+  std::atomic<size_t> size;
+  std::atomic<size_t> dropped;
+  std::thread::id thread;
+  bool exited;  // The thread ended, the next new thread appends to the buffer
+};
+
+static std::atomic<bool> mpTraceRunning(false);
+static std::chrono::steady_clock::time_point mpTraceOrigin;
+static std::thread::id mpTraceGUIThread;
+static wxFFile *mpTraceFile = NULL;
+static wxString mpTraceFilename;
+// Buffers of all the threads that recorded events. The lock is only taken
+// when a thread records its first event or ends. The buffer of an ended
+// thread goes to the next thread starting to record, as worker threads are
+// created for each parallel task, so there are no more buffers than threads
+// running at once. They are freed with the program.
+static std::mutex mpTraceMutex;
+static std::vector<mpTraceBuffer *> mpTraceBuffers;
+
+// Buffer of the calling thread, handed over when the thread ends
+struct mpTraceThreadBuffer {
+  mpTraceBuffer *buffer;
+  mpTraceThreadBuffer() : buffer(NULL) {}
+  ~mpTraceThreadBuffer() {
+    if (!buffer) return;
+    std::lock_guard<std::mutex> lock(mpTraceMutex);
+    buffer->exited = true;
+  }
+};
+static thread_local mpTraceThreadBuffer mpTraceCurrentBuffer;
+
+// Copy a name, truncated if needed without splitting an UTF-8 sequence
+static void mpTraceCopyName(char *dst, const char *src) {
+  size_t len = strlen(src);
+  if (len >= mpTRACE_NAME) {
+    len = mpTRACE_NAME - 1;
+    while (len > 0 && (src[len] & 0xC0) == 0x80) len--;
+  }
+  memcpy(dst, src, len);
+  dst[len] = 0;
+}
+
+mpTraceScope::mpTraceScope(const char *category, const char *name) : m_category(NULL) {
+  if (!mpTraceRunning.load(std::memory_order_acquire)) return;
+  m_category = category;
+  mpTraceCopyName(m_name, name);
+  m_start = std::chrono::steady_clock::now();
+}
+
+mpTraceScope::mpTraceScope(const char *category, const wxString &name) : m_category(NULL) {
+  if (!mpTraceRunning.load(std::memory_order_acquire)) return;
+  m_category = category;
+  if (name.IsEmpty())
+    mpTraceCopyName(m_name, category);
+  else
+    mpTraceCopyName(m_name, name.utf8_str());
+  m_start = std::chrono::steady_clock::now();
+}
+
+mpTraceScope::~mpTraceScope() {
+  if (!m_category || !mpTraceRunning.load(std::memory_order_acquire)) return;
+  const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+  mpTraceBuffer *buffer = mpTraceCurrentBuffer.buffer;
+  if (!buffer) {
+    std::lock_guard<std::mutex> lock(mpTraceMutex);
+    // The GUI thread keeps a timeline of its own
+    const bool gui = std::this_thread::get_id() == mpTraceGUIThread;
+    for (size_t i = 0; i < mpTraceBuffers.size() && !buffer && !gui; ++i)
+      if (mpTraceBuffers[i]->exited) buffer = mpTraceBuffers[i];
+    if (!buffer) {
+      buffer = new mpTraceBuffer();
+      mpTraceBuffers.push_back(buffer);
+    }
+    buffer->thread = std::this_thread::get_id();
+    buffer->exited = false;
+    mpTraceCurrentBuffer.buffer = buffer;
+  }
+  const size_t n = buffer->size.load(std::memory_order_relaxed);
+  if (n == mpTRACE_EVENTS) {
+    buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  mpTraceEvent &event = buffer->events[n];
+  event.category = m_category;
+  memcpy(event.name, m_name, sizeof(m_name));
+  event.start = std::chrono::duration<double, std::micro>(m_start - mpTraceOrigin).count();
+  event.duration = std::chrono::duration<double, std::micro>(end - m_start).count();
+  buffer->size.store(n + 1, std::memory_order_release);
+}
+
+bool mpTraceStart(const wxString &filename) {
+  mpTraceStop();
+  wxFFile *file = new wxFFile(filename, wxT("wb"));
+  if (!file->IsOpened()) {
+    wxLogError(_("wxMathPlot error: cannot create the trace \"%s\""), filename);
+    delete file;
+    return false;
+  }
+  mpTraceFile = file;
+  mpTraceFilename = filename;
+  {
+    std::lock_guard<std::mutex> lock(mpTraceMutex);
+    for (size_t i = 0; i < mpTraceBuffers.size(); ++i) {
+      mpTraceBuffers[i]->size.store(0, std::memory_order_relaxed);
+      mpTraceBuffers[i]->dropped.store(0, std::memory_order_relaxed);
+    }
+  }
+  mpTraceGUIThread = std::this_thread::get_id();
+  mpTraceOrigin = std::chrono::steady_clock::now();
+  mpTraceRunning.store(true, std::memory_order_release);
+  return true;
+}
+
+bool mpTraceIsActive() { return mpTraceRunning.load(std::memory_order_acquire); }
+
+// Append a time in microseconds to JSON text, independently of the locale
+static void mpTraceAppendTime(std::string &json, double micros) {
+  char text[32];
+  const std::to_chars_result r = std::to_chars(text, text + sizeof(text), micros, std::chars_format::fixed, 3);
+  json.append(text, r.ptr);
+}
+
+// Append a string to JSON text, quoted and escaped
+static void mpTraceAppendString(std::string &json, const char *text) {
+  json += '"';
+  for (const char *c = text; *c; ++c) {
+    if (*c == '"' || *c == '\\') {
+      json += '\\';
+      json += *c;
+    } else if ((unsigned char)*c < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned)*c);
+      json += escaped;
+    } else {
+      json += *c;
+    }
+  }
+  json += '"';
+}
+
+bool mpTraceStop() {
+  if (!mpTraceRunning.exchange(false, std::memory_order_acq_rel)) return false;
+
+  // Chrome Trace Event format: one complete ("X") event per scope, and the
+  // names of the threads as metadata ("M") events
+  std::string json = "{\"traceEvents\":[";
+  bool first = true;
+  char number[128];
+  std::lock_guard<std::mutex> lock(mpTraceMutex);
+  for (size_t t = 0; t < mpTraceBuffers.size(); ++t) {
+    const mpTraceBuffer &buffer = *mpTraceBuffers[t];
+    const size_t n = buffer.size.load(std::memory_order_acquire);
+    const size_t dropped = buffer.dropped.load(std::memory_order_relaxed);
+    if (n == 0 && dropped == 0) continue;
+    const unsigned tid = (unsigned)t + 1;
+    wxString threadName = (buffer.thread == mpTraceGUIThread) ? wxString(wxT("GUI thread"))
+                                                              : wxString::Format(wxT("Worker thread %u"), tid);
+    if (dropped) threadName += wxString::Format(wxT(" (%u events dropped)"), (unsigned)dropped);
+    json += first ? "\n" : ",\n";
+    first = false;
+    snprintf(number, sizeof(number), "{\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"name\":\"thread_name\",", tid);
+    json += number;
+    json += "\"args\":{\"name\":";
+    mpTraceAppendString(json, threadName.utf8_str());
+    json += "}}";
+    for (size_t i = 0; i < n; ++i) {
+      const mpTraceEvent &event = buffer.events[i];
+      json += ",\n{\"name\":";
+      mpTraceAppendString(json, event.name);
+      json += ",\"cat\":";
+      mpTraceAppendString(json, event.category);
+      json += ",\"ph\":\"X\",\"ts\":";
+      mpTraceAppendTime(json, event.start);
+      json += ",\"dur\":";
+      mpTraceAppendTime(json, event.duration);
+      snprintf(number, sizeof(number), ",\"pid\":1,\"tid\":%u}", tid);
+      json += number;
+    }
+  }
+  json += "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+  const bool written = mpTraceFile->Write(json.data(), json.size()) == json.size() && mpTraceFile->Close();
+  if (!written) wxLogError(_("wxMathPlot error: cannot write the trace \"%s\""), mpTraceFilename);
+  delete mpTraceFile;
+  mpTraceFile = NULL;
+  return written;
+}
+#endif  // MATHPLOT_ENABLE_TRACE
+
 //-----------------------------------------------------------------------------
 // mpLayer
 //-----------------------------------------------------------------------------
@@ -55,6 +570,8 @@ double mpWindow::zoomIncrementalFactor = 1.5;
 IMPLEMENT_ABSTRACT_CLASS(mpLayer, wxObject)
 
 mpLayer::mpLayer() : m_type(mpLAYER_UNDEF) {
+  m_parallelPlot = false;
+  m_plottingWindow = false;
   m_pen = *wxBLACK_PEN;
   m_font = *wxNORMAL_FONT;
   m_continuous = false;  // Default
@@ -64,6 +581,61 @@ mpLayer::mpLayer() : m_type(mpLAYER_UNDEF) {
   m_brush = *wxTRANSPARENT_BRUSH;
 }
 
+void mpLayer::Plot(wxDC &dc, mpWindow &w) { Plot(dc, static_cast<mpPlotView &>(w)); }
+
+void mpLayer::Plot(wxDC &dc, mpPlotView &w) {
+  // The layers overriding neither overload come back here from the mpWindow one
+  mpWindow *window = dynamic_cast<mpWindow *>(&w);
+  if (!window || m_plottingWindow) return;
+  m_plottingWindow = true;
+  Plot(dc, *window);
+  m_plottingWindow = false;
+}
+
+void mpLayer::Render(mpRenderer &r, mpPlotView &w) {
+  wxDC *dc = r.GetDC();
+  if (!dc) return;
+  mpWindow *window = dynamic_cast<mpWindow *>(&w);
+  if (window)
+    Plot(*dc, *window);
+  else
+    Plot(*dc, w);
+}
+
+bool mpLayer::GetBBoxScreenBounds(mpPlotView &w, wxRect &bounds, int margin) {
+  if (!HasBBox()) return false;
+  double x0 = (GetMinX() - w.GetPosX()) * w.GetScaleX();
+  double x1 = (GetMaxX() - w.GetPosX()) * w.GetScaleX();
+  double y0 = (w.GetPosY() - GetMaxY()) * w.GetScaleY();
+  double y1 = (w.GetPosY() - GetMinY()) * w.GetScaleY();
+  if (!std::isfinite(x0) || !std::isfinite(x1) || !std::isfinite(y0) || !std::isfinite(y1)) return false;
+  if (x0 > x1) std::swap(x0, x1);
+  if (y0 > y1) std::swap(y0, y1);
+
+  // When zoomed in the box may be far larger than the window, and overflow wxCoord
+  const double scrX = w.GetScrX(), scrY = w.GetScrY();
+  x0 = std::clamp(std::floor(x0), -1.0, scrX + 1);
+  x1 = std::clamp(std::ceil(x1), -1.0, scrX + 1);
+  y0 = std::clamp(std::floor(y0), -1.0, scrY + 1);
+  y1 = std::clamp(std::ceil(y1), -1.0, scrY + 1);
+  bounds = wxRect(wxPoint((int)x0, (int)y0), wxPoint((int)x1, (int)y1));
+  bounds.Inflate(margin);
+  return true;
+}
+
+void mpLayer::UnshareDrawingObjects() {
+  // The setters allocate exclusive reference data, and the colours are rebuilt from their components
+  if (m_pen.IsOk()) {
+    const wxColour &c = m_pen.GetColour();
+    m_pen.SetColour(wxColour(c.Red(), c.Green(), c.Blue(), c.Alpha()));
+  }
+  if (m_brush.IsOk()) {
+    const wxColour &c = m_brush.GetColour();
+    m_brush.SetColour(wxColour(c.Red(), c.Green(), c.Blue(), c.Alpha()));
+  }
+  if (m_font.IsOk()) m_font.SetStyle(m_font.GetStyle());
+}
+
 wxBitmap mpLayer::GetColourSquare(int side) {
   wxBitmap square(side, side, -1);
   wxColour filler = m_pen.GetColour();
@@ -87,6 +659,7 @@ mpInfoLayer::mpInfoLayer() {
   m_reference.y = 0;
   m_winX = 1;  // parent->GetScrX();
   m_winY = 1;  // parent->GetScrY();
+  m_savedWinX = m_savedWinY = 1;
   m_type = mpLAYER_INFO;
 }
 
@@ -96,11 +669,26 @@ mpInfoLayer::mpInfoLayer(wxRect rect, const wxBrush *brush) : m_dim(rect) {
   m_reference.y = rect.y;
   m_winX = 1;  // parent->GetScrX();
   m_winY = 1;  // parent->GetScrY();
+  m_savedWinX = m_savedWinY = 1;
   m_type = mpLAYER_INFO;
 }
 
 mpInfoLayer::~mpInfoLayer() {}
 
+void mpInfoLayer::SaveViewState() {
+  m_savedDim = m_dim;
+  m_savedReference = m_reference;
+  m_savedWinX = m_winX;
+  m_savedWinY = m_winY;
+}
+
+void mpInfoLayer::RestoreViewState() {
+  m_dim = m_savedDim;
+  m_reference = m_savedReference;
+  m_winX = m_savedWinX;
+  m_winY = m_savedWinY;
+}
+
 void mpInfoLayer::UpdateInfo(mpWindow &, wxEvent &) {}
 
 bool mpInfoLayer::Inside(wxPoint &point) { return m_dim.Contains(point); }
@@ -115,7 +703,12 @@ void mpInfoLayer::UpdateReference() {
   m_reference.y = m_dim.y;
 }
 
-void mpInfoLayer::Plot(wxDC &dc, mpWindow &w) {
+void mpInfoLayer::Plot(wxDC &dc, mpPlotView &w) {
+  mpDCRenderer r(dc);
+  Render(r, w);
+}
+
+void mpInfoLayer::Render(mpRenderer &r, mpPlotView &w) {
   if (m_visible) {
     // Adjust relative position inside the window
     int scrx = w.GetScrX();
@@ -134,9 +727,9 @@ void mpInfoLayer::Plot(wxDC &dc, mpWindow &w) {
       m_winX = scrx;
       m_winY = scry;
     }
-    dc.SetPen(m_pen);
-    dc.SetBrush(m_brush);
-    dc.DrawRectangle(m_dim.x, m_dim.y, m_dim.width, m_dim.height);
+    r.SetPen(m_pen);
+    r.SetBrush(m_brush);
+    r.DrawRectangle(m_dim.x, m_dim.y, m_dim.width, m_dim.height);
   }
 }
 
@@ -167,7 +760,12 @@ void mpInfoCoords::UpdateInfo(mpWindow &w, wxEvent &event) {
   }
 }
 
-void mpInfoCoords::Plot(wxDC &dc, mpWindow &w) {
+void mpInfoCoords::Plot(wxDC &dc, mpPlotView &w) {
+  mpDCRenderer r(dc);
+  Render(r, w);
+}
+
+void mpInfoCoords::Render(mpRenderer &r, mpPlotView &w) {
   if (m_visible) {
     // Adjust relative position inside the window
     int scrx = w.GetScrX();
@@ -182,15 +780,15 @@ void mpInfoCoords::Plot(wxDC &dc, mpWindow &w) {
       m_winX = scrx;
       m_winY = scry;
     }
-    dc.SetPen(m_pen);
-    dc.SetBrush(m_brush);
-    dc.SetFont(m_font);
+    r.SetPen(m_pen);
+    r.SetBrush(m_brush);
+    r.SetFont(m_font);
     int textX, textY;
-    dc.GetTextExtent(m_content, &textX, &textY);
+    r.GetTextExtent(m_content, &textX, &textY);
     if (m_dim.width < textX + 10) m_dim.width = textX + 10;
     if (m_dim.height < textY + 10) m_dim.height = textY + 10;
-    dc.DrawRectangle(m_dim.x, m_dim.y, m_dim.width, m_dim.height);
-    dc.DrawText(m_content, m_dim.x + 5, m_dim.y + 5);
+    r.DrawRectangle(m_dim.x, m_dim.y, m_dim.width, m_dim.height);
+    r.DrawText(m_content, m_dim.x + 5, m_dim.y + 5);
   }
 }
 
@@ -202,7 +800,12 @@ mpInfoLegend::~mpInfoLegend() {}
 
 void mpInfoLegend::UpdateInfo(mpWindow &, wxEvent &) {}
 
-void mpInfoLegend::Plot(wxDC &dc, mpWindow &w) {
+void mpInfoLegend::Plot(wxDC &dc, mpPlotView &w) {
+  mpDCRenderer r(dc);
+  Render(r, w);
+}
+
+void mpInfoLegend::Render(mpRenderer &r, mpPlotView &w) {
   if (m_visible) {
     // Adjust relative position inside the window
     int scrx = w.GetScrX();
@@ -217,8 +820,8 @@ void mpInfoLegend::Plot(wxDC &dc, mpWindow &w) {
       m_winX = scrx;
       m_winY = scry;
     }
-    dc.SetBrush(m_brush);
-    dc.SetFont(m_font);
+    r.SetBrush(m_brush);
+    r.SetFont(m_font);
     const int baseWidth = (mpLEGEND_MARGIN * 2 + mpLEGEND_LINEWIDTH);
     int textX = baseWidth, textY = mpLEGEND_MARGIN;
     int tmpX = 0, tmpY = 0;
@@ -229,19 +832,19 @@ void mpInfoLegend::Plot(wxDC &dc, mpWindow &w) {
       ly = w.GetLayer(p);
       if ((ly->GetLayerType() == mpLAYER_PLOT) && (ly->IsVisible())) {
         label = ly->GetName();
-        dc.GetTextExtent(label, &tmpX, &tmpY);
+        r.GetTextExtent(label, &tmpX, &tmpY);
         textX = (textX > (tmpX + baseWidth)) ? textX : (tmpX + baseWidth + mpLEGEND_MARGIN);
         textY += (tmpY);
       }
     }
-    dc.SetPen(m_pen);
-    dc.SetBrush(m_brush);
+    r.SetPen(m_pen);
+    r.SetBrush(m_brush);
     m_dim.width = textX;
     if (textY != mpLEGEND_MARGIN) {  // Don't draw any thing if there are no
                                      // visible layers
       textY += mpLEGEND_MARGIN;
       m_dim.height = textY;
-      dc.DrawRectangle(m_dim.x, m_dim.y, m_dim.width, m_dim.height);
+      r.DrawRectangle(m_dim.x, m_dim.y, m_dim.width, m_dim.height);
       for (unsigned int p2 = 0; p2 < w.CountAllLayers(); p2++) {
         ly = w.GetLayer(p2);
         if ((ly->GetLayerType() == mpLAYER_PLOT) && (ly->IsVisible())) {
@@ -249,14 +852,14 @@ void mpInfoLegend::Plot(wxDC &dc, mpWindow &w) {
           int posY = 0;
           label = ly->GetName();
           lpen = ly->GetPen();
-          dc.GetTextExtent(label, &tmpX, &tmpY);
-          dc.SetPen(lpen);
+          r.GetTextExtent(label, &tmpX, &tmpY);
+          r.SetPen(lpen);
           posY = m_dim.y + mpLEGEND_MARGIN + plotCount * tmpY + (tmpY >> 1);
-          dc.DrawLine(m_dim.x + mpLEGEND_MARGIN,                       // X start coord
+          r.DrawLine(m_dim.x + mpLEGEND_MARGIN,                       // X start coord
                       posY,                                            // Y start coord
                       m_dim.x + mpLEGEND_LINEWIDTH + mpLEGEND_MARGIN,  // X end coord
                       posY);
-          dc.DrawText(label, m_dim.x + baseWidth, m_dim.y + mpLEGEND_MARGIN + plotCount * tmpY);
+          r.DrawText(label, m_dim.x + baseWidth, m_dim.y + mpLEGEND_MARGIN + plotCount * tmpY);
           plotCount++;
         }
       }
@@ -264,431 +867,2426 @@ void mpInfoLegend::Plot(wxDC &dc, mpWindow &w) {
   }
 }
 
+#ifdef MATHPLOT_ENABLE_STATS
+mpInfoPerf::mpInfoPerf() : mpInfoLayer(), m_layerCount(5) {}
+
+mpInfoPerf::mpInfoPerf(wxRect rect, const wxBrush *brush, size_t layers)
+    : mpInfoLayer(rect, brush), m_layerCount(layers) {}
+
+void mpInfoPerf::UpdateInfo(mpWindow &, wxEvent &) {}
+
+void mpInfoPerf::Plot(wxDC &dc, mpPlotView &w) {
+  mpDCRenderer r(dc);
+  Render(r, w);
+}
+
+void mpInfoPerf::Render(mpRenderer &r, mpPlotView &w) {
+  if (!m_visible) return;
+
+  // The statistics of the previous paint, this one being in progress
+  std::vector<wxString> lines;
+  std::vector<mpLayer *> layers;
+  mpWindow *window = dynamic_cast<mpWindow *>(&w);
+  if (window) {
+    const mpRollingStats &frames = window->GetFrameTimes();
+    lines.push_back(wxString::Format(_("%.1f FPS, frame %.2f ms (p99 %.2f ms)"), window->GetFPS(),
+                                     frames.GetLast() * 1e3, frames.GetPercentile(99) * 1e3));
+    window->GetSlowestLayers(layers, m_layerCount + 1);
+  }
+  for (size_t i = 0; i < layers.size() && lines.size() <= m_layerCount; ++i) {
+    if (layers[i] == this) continue;
+    const mpLayerStats &stats = layers[i]->GetStats();
+    wxString name = layers[i]->GetName();
+    if (name.IsEmpty()) {
+      // Numbered as added to the plot, whatever their rank here
+      unsigned int index = 0;
+      while (index < w.CountAllLayers() && w.GetLayer((int)index) != layers[i]) ++index;
+      name = wxString::Format(_("Layer %u"), index + 1);
+    }
+    lines.push_back(wxString::Format(_("%s: %.2f ms, %.0f points, %.0f calls"), name, stats.time.GetLast() * 1e3,
+                                     stats.pointsDrawn.GetLast(), stats.primitives.GetLast()));
+  }
+
+  r.SetPen(m_pen);
+  r.SetBrush(m_brush);
+  r.SetFont(m_font);
+  int width = 0, lineHeight = 0;
+  for (size_t i = 0; i < lines.size(); ++i) {
+    int tx, ty;
+    r.GetTextExtent(lines[i], &tx, &ty);
+    width = (tx > width) ? tx : width;
+    lineHeight = (ty > lineHeight) ? ty : lineHeight;
+  }
+  m_dim.width = width + 10;
+  m_dim.height = lineHeight * (int)lines.size() + 10;
+  r.DrawRectangle(m_dim.x, m_dim.y, m_dim.width, m_dim.height);
+  for (size_t i = 0; i < lines.size(); ++i) r.DrawText(lines[i], m_dim.x + 5, m_dim.y + 5 + (int)i * lineHeight);
+}
+#endif  // MATHPLOT_ENABLE_STATS
+
 //-----------------------------------------------------------------------------
-// mpLayer implementations - functions
+// mpRasterBuffer
 //-----------------------------------------------------------------------------
 
-IMPLEMENT_ABSTRACT_CLASS(mpFX, mpLayer)
-
-mpFX::mpFX(wxString name, int flags) {
-  SetName(name);
-  m_flags = flags;
-  m_type = mpLAYER_PLOT;
+void mpRasterBuffer::Create(int width, int height, int x, int y) {
+  m_width = (width > 0) ? width : 0;
+  m_height = (height > 0) ? height : 0;
+  m_originX = x;
+  m_originY = y;
+  m_pixels.assign((size_t)m_width * (size_t)m_height, 0);
 }
 
-void mpFX::Plot(wxDC &dc, mpWindow &w) {
-  if (m_visible) {
-    dc.SetPen(m_pen);
+void mpRasterBuffer::Clear(wxUint32 argb) { std::fill(m_pixels.begin(), m_pixels.end(), argb); }
+
+void mpRasterBuffer::DrawPoint(int x, int y, wxUint32 argb, int width, const wxRect &clip) {
+  if (width < 1) width = 1;
+  int left = x - (width - 1) / 2, top = y - (width - 1) / 2;
+  int right = left + width - 1, bottom = top + width - 1;
+  if (left < clip.x) left = clip.x;
+  if (top < clip.y) top = clip.y;
+  if (right > clip.GetRight()) right = clip.GetRight();
+  if (bottom > clip.GetBottom()) bottom = clip.GetBottom();
+  if (left < m_originX) left = m_originX;
+  if (top < m_originY) top = m_originY;
+  if (right >= m_originX + m_width) right = m_originX + m_width - 1;
+  if (bottom >= m_originY + m_height) bottom = m_originY + m_height - 1;
+  for (int py = top; py <= bottom; ++py) {
+    wxUint32 *row = GetRow(py - m_originY);
+    for (int px = left; px <= right; ++px) row[px - m_originX] = argb;
+  }
+}
 
-    wxCoord startPx = m_drawOutsideMargins ? 0 : w.GetMarginLeft();
-    wxCoord endPx = m_drawOutsideMargins ? w.GetScrX() : w.GetScrX() - w.GetMarginRight();
-    wxCoord minYpx = m_drawOutsideMargins ? 0 : w.GetMarginTop();
-    wxCoord maxYpx = m_drawOutsideMargins ? w.GetScrY() : w.GetScrY() - w.GetMarginBottom();
+void mpRasterBuffer::DrawLine(int x0, int y0, int x1, int y1, wxUint32 argb, int width, const wxRect &clip) {
+  const int half = (width > 1) ? width / 2 + 1 : 0;
+  if ((x0 < x1 ? x1 : x0) + half < clip.x || (x0 < x1 ? x0 : x1) - half > clip.GetRight()) return;
+  if ((y0 < y1 ? y1 : y0) + half < clip.y || (y0 < y1 ? y0 : y1) - half > clip.GetBottom()) return;
+
+  const int dx = (x1 > x0) ? x1 - x0 : x0 - x1, sx = (x0 < x1) ? 1 : -1;
+  const int dy = (y1 > y0) ? y0 - y1 : y1 - y0, sy = (y0 < y1) ? 1 : -1;
+  const int left = (clip.x > m_originX) ? clip.x : m_originX, top = (clip.y > m_originY) ? clip.y : m_originY;
+  const int right = (clip.GetRight() < m_originX + m_width) ? clip.GetRight() : m_originX + m_width - 1;
+  const int bottom = (clip.GetBottom() < m_originY + m_height) ? clip.GetBottom() : m_originY + m_height - 1;
+  int err = dx + dy;
+  for (;;) {
+    if (width > 1)
+      DrawPoint(x0, y0, argb, width, clip);
+    else if (x0 >= left && x0 <= right && y0 >= top && y0 <= bottom)
+      GetRow(y0 - m_originY)[x0 - m_originX] = argb;
+    if (x0 == x1 && y0 == y1) break;
+    const int e2 = 2 * err;
+    if (e2 >= dy) {
+      err += dy;
+      x0 += sx;
+    }
+    if (e2 <= dx) {
+      err += dx;
+      y0 += sy;
+    }
+  }
+}
 
-    wxCoord iy = 0;
-    if (m_pen.GetWidth() <= 1) {
-      for (wxCoord i = startPx; i < endPx; ++i) {
-        iy = w.y2p(GetY(w.p2x(i)));
-        // Draw the point only if you can draw outside margins or if the point
-        // is inside margins
-        if (m_drawOutsideMargins || ((iy >= minYpx) && (iy <= maxYpx))) {
-          dc.DrawPoint(i, iy);
-        }
-      }
+bool mpRasterBuffer::ClipLine(double &x0, double &y0, double &x1, double &y1, const wxRect &clip) {
+  // Cohen-Sutherland. The moved end point is interpolated from the other
+  // one, which keeps the precision when one end point is very far away.
+  const double left = clip.x, right = clip.GetRight(), top = clip.y, bottom = clip.GetBottom();
+  for (int moves = 0; moves < 4; ++moves) {
+    const double over0 = wxMax(wxMax(left - x0, x0 - right), wxMax(top - y0, y0 - bottom));
+    const double over1 = wxMax(wxMax(left - x1, x1 - right), wxMax(top - y1, y1 - bottom));
+    if (over0 <= 0 && over1 <= 0) return true;
+    if ((x0 < left && x1 < left) || (x0 > right && x1 > right) || (y0 < top && y1 < top) ||
+        (y0 > bottom && y1 > bottom))
+      return false;
+
+    // Move the end point lying farthest outside, along the axis where it is farthest outside
+    const bool first = over0 >= over1;
+    double &mx = first ? x0 : x1, &my = first ? y0 : y1;
+    const double ox = first ? x1 : x0, oy = first ? y1 : y0;
+    const double outX = wxMax(left - mx, mx - right), outY = wxMax(top - my, my - bottom);
+    if (outX >= outY) {
+      const double edge = (mx < left) ? left : right;
+      my = oy + (my - oy) * (edge - ox) / (mx - ox);
+      mx = edge;
     } else {
-      for (wxCoord i = startPx; i < endPx; ++i) {
-        iy = w.y2p(GetY(w.p2x(i)));
-        // Draw the point only if you can draw outside margins or if the point
-        // is inside margins
-        if (m_drawOutsideMargins || ((iy >= minYpx) && (iy <= maxYpx))) {
-          dc.DrawLine(i, iy, i, iy);
-        }
-      }
+      const double edge = (my < top) ? top : bottom;
+      mx = ox + (mx - ox) * (edge - oy) / (my - oy);
+      my = edge;
     }
+  }
+  return wxMax(wxMax(left - x0, x0 - right), wxMax(top - y0, y0 - bottom)) <= 0 &&
+         wxMax(wxMax(left - x1, x1 - right), wxMax(top - y1, y1 - bottom)) <= 0;
+}
 
-    if (!m_name.IsEmpty() && m_showName) {
-      dc.SetFont(m_font);
+void mpRasterBuffer::FillRect(const wxRect &rect, wxUint32 argb, const wxRect &clip) {
+  const wxRect area = rect.Intersect(clip).Intersect(GetRect());
+  if (area.IsEmpty()) return;
+  for (int py = area.y; py <= area.GetBottom(); ++py) {
+    wxUint32 *row = GetRow(py - m_originY);
+    std::fill(row + (area.x - m_originX), row + (area.GetRight() - m_originX) + 1, argb);
+  }
+}
 
-      wxCoord tx, ty;
-      dc.GetTextExtent(m_name, &tx, &ty);
+/** Blend a colour with alpha over a pixel, both with straight alpha (the "over" operator).
+    @param src Colour without alpha
+    @param a Alpha of the colour, from 1 to 254 */
+static inline wxUint32 mpBlendARGB(wxUint32 dst, wxUint32 src, wxUint32 a) {
+  const wxUint32 da = (dst >> 24) * (255 - a) / 255, outA = a + da;
+  wxUint32 out = outA << 24;
+  for (int shift = 0; shift <= 16; shift += 8)
+    out |= ((((src >> shift) & 0xFF) * a + ((dst >> shift) & 0xFF) * da) / outA) << shift;
+  return out;
+}
 
-      if ((m_flags & mpALIGNMASK) == mpALIGN_RIGHT) {
-        tx = (w.GetScrX() - tx) - w.GetMarginRight() - 8;
-      } else if ((m_flags & mpALIGNMASK) == mpALIGN_CENTER) {
-        tx = ((w.GetScrX() - w.GetMarginRight() - w.GetMarginLeft() - tx) / 2) + w.GetMarginLeft();
-      } else {
-        tx = w.GetMarginLeft() + 8;
-      }
-      dc.DrawText(m_name, tx, w.y2p(GetY(w.p2x(tx))));
+void mpRasterBuffer::DrawImage(const wxImage &image, int x, int y, const wxRect &clip) {
+  if (!image.IsOk()) return;
+  const wxRect area = wxRect(x, y, image.GetWidth(), image.GetHeight()).Intersect(clip).Intersect(GetRect());
+  if (area.IsEmpty()) return;
+
+  const unsigned char *rgb = image.GetData();
+  const unsigned char *alpha = image.HasAlpha() ? image.GetAlpha() : NULL;
+  const bool hasMask = image.HasMask();
+  const unsigned char maskR = hasMask ? image.GetMaskRed() : 0, maskG = hasMask ? image.GetMaskGreen() : 0,
+                      maskB = hasMask ? image.GetMaskBlue() : 0;
+  for (int py = area.y; py <= area.GetBottom(); ++py) {
+    wxUint32 *row = GetRow(py - m_originY);
+    const size_t line = (size_t)(py - y) * (size_t)image.GetWidth();
+    for (int px = area.x; px <= area.GetRight(); ++px) {
+      const size_t i = line + (size_t)(px - x);
+      const unsigned char *c = rgb + 3 * i;
+      wxUint32 a = alpha ? alpha[i] : 255;
+      if (hasMask && c[0] == maskR && c[1] == maskG && c[2] == maskB) a = 0;
+      if (a == 0) continue;
+      const wxUint32 src = ((wxUint32)c[0] << 16) | ((wxUint32)c[1] << 8) | (wxUint32)c[2];
+      row[px - m_originX] = (a == 255) ? 0xFF000000u | src : mpBlendARGB(row[px - m_originX], src, a);
     }
   }
 }
 
-IMPLEMENT_ABSTRACT_CLASS(mpFY, mpLayer)
+void mpRasterBuffer::DrawBuffer(const mpRasterBuffer &buffer, const wxRect &clip) {
+  const wxRect area = buffer.GetRect().Intersect(clip).Intersect(GetRect());
+  if (area.IsEmpty()) return;
+  for (int py = area.y; py <= area.GetBottom(); ++py) {
+    wxUint32 *row = GetRow(py - m_originY);
+    const wxUint32 *src = buffer.GetRow(py - buffer.m_originY);
+    for (int px = area.x; px <= area.GetRight(); ++px) {
+      const wxUint32 p = src[px - buffer.m_originX], a = p >> 24;
+      if (a == 255)
+        row[px - m_originX] = p;
+      else if (a != 0)
+        row[px - m_originX] = mpBlendARGB(row[px - m_originX], p & 0xFFFFFFu, a);
+    }
+  }
+}
 
-mpFY::mpFY(wxString name, int flags) {
-  SetName(name);
-  m_flags = flags;
-  m_type = mpLAYER_PLOT;
+wxImage mpRasterBuffer::ToImage() const {
+  wxImage image(m_width, m_height, false);
+  if (!image.IsOk()) return image;
+  image.InitAlpha();
+  unsigned char *rgb = image.GetData(), *alpha = image.GetAlpha();
+  const size_t count = m_pixels.size();
+  for (size_t i = 0; i < count; ++i) {
+    const wxUint32 p = m_pixels[i];
+    rgb[3 * i] = (unsigned char)(p >> 16);
+    rgb[3 * i + 1] = (unsigned char)(p >> 8);
+    rgb[3 * i + 2] = (unsigned char)p;
+    alpha[i] = (unsigned char)(p >> 24);
+  }
+  return image;
 }
 
-void mpFY::Plot(wxDC &dc, mpWindow &w) {
-  if (m_visible) {
-    dc.SetPen(m_pen);
+//-----------------------------------------------------------------------------
+// mpPNGWriter
+//-----------------------------------------------------------------------------
 
-    wxCoord i, ix;
+// Output stream collecting the bytes in memory
+class mpByteStream : public wxOutputStream {
+ public:
+  std::vector<unsigned char> m_bytes;
 
-    wxCoord startPx = m_drawOutsideMargins ? 0 : w.GetMarginLeft();
-    wxCoord endPx = m_drawOutsideMargins ? w.GetScrX() : w.GetScrX() - w.GetMarginRight();
-    wxCoord minYpx = m_drawOutsideMargins ? 0 : w.GetMarginTop();
-    wxCoord maxYpx = m_drawOutsideMargins ? w.GetScrY() : w.GetScrY() - w.GetMarginBottom();
+ protected:
+  virtual size_t OnSysWrite(const void *buffer, size_t size) {
+    const unsigned char *bytes = static_cast<const unsigned char *>(buffer);
+    m_bytes.insert(m_bytes.end(), bytes, bytes + size);
+    return size;
+  }
+};
 
-    if (m_pen.GetWidth() <= 1) {
-      for (i = minYpx; i < maxYpx; ++i) {
-        ix = w.x2p(GetX(w.p2y(i)));
-        if (m_drawOutsideMargins || ((ix >= startPx) && (ix <= endPx))) dc.DrawPoint(ix, i);
-      }
-    } else {
-      for (i = 0; i < w.GetScrY(); ++i) {
-        ix = w.x2p(GetX(w.p2y(i)));
-        if (m_drawOutsideMargins || ((ix >= startPx) && (ix <= endPx))) {
-          dc.DrawLine(ix, i, ix, i);
-        }
-      }
+// CRC-32 of the PNG chunks, continuing from crc (0 to start)
+static wxUint32 mpCRC32(wxUint32 crc, const unsigned char *data, size_t size) {
+  static const std::vector<wxUint32> table = [] {
+    std::vector<wxUint32> t(256);
+    for (wxUint32 n = 0; n < 256; ++n) {
+      wxUint32 c = n;
+      for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      t[n] = c;
     }
+    return t;
+  }();
+  crc = ~crc;
+  for (size_t i = 0; i < size; ++i) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
 
-    if (!m_name.IsEmpty() && m_showName) {
-      dc.SetFont(m_font);
+static void mpPutBigEndian(unsigned char *p, wxUint32 value) {
+  p[0] = (unsigned char)(value >> 24);
+  p[1] = (unsigned char)(value >> 16);
+  p[2] = (unsigned char)(value >> 8);
+  p[3] = (unsigned char)value;
+}
 
-      wxCoord tx, ty;
-      dc.GetTextExtent(m_name, &tx, &ty);
+mpPNGWriter::mpPNGWriter(wxOutputStream &stream, int width, int height, bool alpha)
+    : m_stream(stream), m_width(width), m_height(height), m_rows(0), m_alpha(alpha), m_ok(width > 0 && height > 0) {
+  m_data = new mpByteStream;
+  m_zlib = new wxZlibOutputStream(*m_data, -1, wxZLIB_ZLIB);
+
+  static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  m_stream.Write(signature, sizeof(signature));
+  if (m_stream.LastWrite() != sizeof(signature)) m_ok = false;
+
+  unsigned char header[13];
+  mpPutBigEndian(header, (wxUint32)width);
+  mpPutBigEndian(header + 4, (wxUint32)height);
+  header[8] = 8;   // Bits per channel
+  header[9] = alpha ? 6 : 2;  // RGBA or RGB
+  header[10] = 0;  // Deflate
+  header[11] = 0;  // Adaptive filtering
+  header[12] = 0;  // No interlace
+  WriteChunk("IHDR", header, sizeof(header));
+}
 
-      if ((m_flags & mpALIGNMASK) == mpALIGN_TOP) {
-        ty = w.GetMarginTop() + 8;
-      } else if ((m_flags & mpALIGNMASK) == mpALIGN_CENTER) {
-        ty = ((w.GetScrY() - w.GetMarginTop() - w.GetMarginBottom() - ty) / 2) + w.GetMarginTop();
-      } else {
-        ty = w.GetScrY() - 8 - ty - w.GetMarginBottom();
-      }
+mpPNGWriter::~mpPNGWriter() {
+  delete m_zlib;
+  delete m_data;
+}
 
-      dc.DrawText(m_name, w.x2p(GetX(w.p2y(ty))), ty);
-    }
+void mpPNGWriter::WriteChunk(const char *type, const unsigned char *data, size_t size) {
+  unsigned char head[8], tail[4];
+  mpPutBigEndian(head, (wxUint32)size);
+  memcpy(head + 4, type, 4);
+  mpPutBigEndian(tail, mpCRC32(mpCRC32(0, head + 4, 4), data, size));
+  m_stream.Write(head, sizeof(head));
+  if (m_stream.LastWrite() != sizeof(head)) m_ok = false;
+  if (size > 0) {
+    m_stream.Write(data, size);
+    if (m_stream.LastWrite() != size) m_ok = false;
   }
+  m_stream.Write(tail, sizeof(tail));
+  if (m_stream.LastWrite() != sizeof(tail)) m_ok = false;
 }
 
-IMPLEMENT_ABSTRACT_CLASS(mpFXY, mpLayer)
+void mpPNGWriter::WriteData() {
+  if (m_data->m_bytes.empty()) return;
+  WriteChunk("IDAT", m_data->m_bytes.data(), m_data->m_bytes.size());
+  m_data->m_bytes.clear();
+}
 
-mpFXY::mpFXY(wxString name, int flags) {
-  SetName(name);
-  m_flags = flags;
-  m_type = mpLAYER_PLOT;
+bool mpPNGWriter::WriteRows(const unsigned char *rgb, int rows, const unsigned char *alpha) {
+  if (!m_ok || rows < 0 || rows > m_height - m_rows || (m_alpha && !alpha)) return false;
+  const size_t stride = 3 * (size_t)m_width;
+  const unsigned char filter = 0;  // Rows are stored unfiltered
+  for (int y = 0; y < rows; ++y) {
+    m_zlib->Write(&filter, 1);
+    if (m_alpha) {
+      m_line.resize(4 * (size_t)m_width);
+      const unsigned char *c = rgb + (size_t)y * stride, *a = alpha + (size_t)y * (size_t)m_width;
+      for (size_t x = 0; x < (size_t)m_width; ++x) {
+        m_line[4 * x] = c[3 * x];
+        m_line[4 * x + 1] = c[3 * x + 1];
+        m_line[4 * x + 2] = c[3 * x + 2];
+        m_line[4 * x + 3] = a[x];
+      }
+      m_zlib->Write(m_line.data(), m_line.size());
+    } else {
+      m_zlib->Write(rgb + (size_t)y * stride, stride);
+    }
+  }
+  m_rows += rows;
+  m_zlib->Sync();  // Everything given so far goes in this chunk
+  WriteData();
+  return m_ok;
 }
 
-void mpFXY::UpdateViewBoundary(wxCoord xnew, wxCoord ynew) {
-  // Keep track of how many points have been drawn and the bouding box
-  maxDrawX = (xnew > maxDrawX) ? xnew : maxDrawX;
-  minDrawX = (xnew < minDrawX) ? xnew : minDrawX;
-  maxDrawY = (maxDrawY > ynew) ? maxDrawY : ynew;
-  minDrawY = (minDrawY < ynew) ? minDrawY : ynew;
-  // drawnPoints++;
+bool mpPNGWriter::Close() {
+  if (!m_zlib->Close()) m_ok = false;
+  WriteData();
+  WriteChunk("IEND", NULL, 0);
+  return m_ok && m_rows == m_height;
 }
 
-void mpFXY::Plot(wxDC &dc, mpWindow &w) {
-  if (m_visible) {
-    dc.SetPen(m_pen);
+//-----------------------------------------------------------------------------
+// mpRenderer - render backends
+//-----------------------------------------------------------------------------
 
-    double x, y;
-    // Do this to reset the counters to evaluate bounding box for label positioning
-    Rewind();
-    GetNextXY(x, y);
-    maxDrawX = static_cast<int>(x);
-    minDrawX = static_cast<int>(x);
-    maxDrawY = static_cast<int>(y);
-    minDrawY = static_cast<int>(y);
-    Rewind();
+void mpDCRenderer::SetPen(const wxPen &pen) {
+  m_dc.SetPen(pen);
+  m_fat = pen.GetWidth() > 1;
+}
 
-    wxCoord startPx = m_drawOutsideMargins ? 0 : w.GetMarginLeft();
-    wxCoord endPx = m_drawOutsideMargins ? w.GetScrX() : w.GetScrX() - w.GetMarginRight();
-    wxCoord minYpx = m_drawOutsideMargins ? 0 : w.GetMarginTop();
-    wxCoord maxYpx = m_drawOutsideMargins ? w.GetScrY() : w.GetScrY() - w.GetMarginBottom();
+void mpDCRenderer::DrawLines(const wxPoint *points, size_t n) {
+  if (n < 2) return;
+  mpSTATS_COUNT(primitives, 1);
+  mpSTATS_COUNT(pointsDrawn, n);
+  if (m_fat) {
+    // As the layers did before drawing polylines: the joins of wide lines differ
+    for (size_t i = 1; i < n; ++i) m_dc.DrawLine(points[i - 1], points[i]);
+  } else {
+    m_dc.DrawLines((int)n, points);
+  }
+}
 
-    wxCoord ix = 0, iy = 0;
-
-    if (!m_continuous) {
-      // for some reason DrawPoint does not use the current pen,
-      // so we use DrawLine for fat pens
-      if (m_pen.GetWidth() <= 1) {
-        while (GetNextXY(x, y)) {
-          ix = w.x2p(x);
-          iy = w.y2p(y);
-          if (m_drawOutsideMargins || ((ix >= startPx) && (ix <= endPx) && (iy >= minYpx) && (iy <= maxYpx))) {
-            dc.DrawPoint(ix, iy);
-            UpdateViewBoundary(ix, iy);
-          };
-        }
-      } else {
-        while (GetNextXY(x, y)) {
-          ix = w.x2p(x);
-          iy = w.y2p(y);
-          if (m_drawOutsideMargins || ((ix >= startPx) && (ix <= endPx) && (iy >= minYpx) && (iy <= maxYpx))) {
-            dc.DrawLine(ix, iy, ix, iy);
-            UpdateViewBoundary(ix, iy);
-          }
-        }
-      }
-    } else {
-      // Old code
-      wxCoord x0 = 0, c0 = 0;
-      bool first = true;
-      while (GetNextXY(x, y)) {
-        wxCoord x1 = w.x2p(x);  // (wxCoord) ((x - w.GetPosX()) * w.GetScaleX());
-        wxCoord c1 = w.y2p(y);  // (wxCoord) ((w.GetPosY() - y) * w.GetScaleY());
-        if (first) {
-          first = false;
-          x0 = x1;
-          c0 = c1;
-        }
-        if ((x1 >= startPx) && (x0 <= endPx)) {
-          bool outDown = (c0 > maxYpx) && (c1 > maxYpx);
-          bool outUp = (c0 < minYpx) && (c1 < minYpx);
-          if (!outUp && !outDown) {
-            if (c1 != c0) {
-              if (c0 < minYpx) {
-                x0 = (int)(((float)(minYpx - c0)) / ((float)(c1 - c0)) * static_cast<float>(x1 - x0)) + x0;
-                c0 = minYpx;
-              }
-              if (c0 > maxYpx) {
-                x0 = (int)(((float)(maxYpx - c0)) / ((float)(c1 - c0)) * static_cast<float>(x1 - x0)) + x0;
-                c0 = maxYpx;
-              }
-              if (c1 < minYpx) {
-                x1 = (int)(((float)(minYpx - c0)) / ((float)(c1 - c0)) * static_cast<float>(x1 - x0)) + x0;
-                c1 = minYpx;
-              }
-              if (c1 > maxYpx) {
-                x1 = (int)(((float)(maxYpx - c0)) / ((float)(c1 - c0)) * static_cast<float>(x1 - x0)) + x0;
-                // wxLogDebug(wxT("old x0 = %d, old x1 = %d, new x1 = %d, c0 =
-                // %d, c1 = %d, maxYpx = %d"), x0, x1, newX1, c0, c1, maxYpx);
-                // x1 = newX1;
-                c1 = maxYpx;
-              }
-            }
-            if (x1 != x0) {
-              if (x0 < startPx) {
-                c0 = (int)(((float)(startPx - x0)) / ((float)(x1 - x0)) * static_cast<float>(c1 - c0)) + c0;
-                x0 = startPx;
-              }
-              if (x1 > endPx) {
-                c1 = (int)(((float)(endPx - x0)) / ((float)(x1 - x0)) * static_cast<float>(c1 - c0)) + c0;
-                x1 = endPx;
-              }
-            }
-            dc.DrawLine(x0, c0, x1, c1);
-            UpdateViewBoundary(x1, c1);
-          }
-        }
-        x0 = x1;
-        c0 = c1;
-      }
-    }
+void mpDCRenderer::DrawPoints(const wxPoint *points, size_t n) {
+  // for some reason DrawPoint does not use the current pen,
+  // so we use DrawLine for fat pens
+  mpSTATS_COUNT(primitives, n);
+  mpSTATS_COUNT(pointsDrawn, n);
+  if (m_fat) {
+    for (size_t i = 0; i < n; ++i) m_dc.DrawLine(points[i], points[i]);
+  } else {
+    for (size_t i = 0; i < n; ++i) m_dc.DrawPoint(points[i]);
+  }
+}
 
-    if (!m_name.IsEmpty() && m_showName) {
-      dc.SetFont(m_font);
+void mpDCRenderer::DrawRectangles(const wxRect *rects, size_t n) {
+  mpSTATS_COUNT(primitives, n);
+  for (size_t i = 0; i < n; ++i) m_dc.DrawRectangle(rects[i]);
+}
 
-      wxCoord tx, ty;
-      dc.GetTextExtent(m_name, &tx, &ty);
+void mpDCRenderer::DrawImage(const wxImage &image, wxCoord x, wxCoord y) {
+  mpSTATS_COUNT(primitives, 1);
+  if (image.IsOk()) m_dc.DrawBitmap(wxBitmap(image), x, y, true);
+}
 
-      // xxx implement else ... if (!HasBBox())
-      {
-        if ((m_flags & mpALIGNMASK) == mpALIGN_NW) {
-          tx = minDrawX + 8;
-          ty = maxDrawY + 8;
-        } else if ((m_flags & mpALIGNMASK) == mpALIGN_NE) {
-          tx = maxDrawX - tx - 8;
-          ty = maxDrawY + 8;
-        } else if ((m_flags & mpALIGNMASK) == mpALIGN_SE) {
-          tx = maxDrawX - tx - 8;
-          ty = minDrawY - ty - 8;
-        } else {  // mpALIGN_SW
-          tx = minDrawX + 8;
-          ty = minDrawY - ty - 8;
-        }
-      }
+#if wxUSE_GRAPHICS_CONTEXT
+mpGCRenderer::mpGCRenderer(wxDC &dc)
+    : m_dc(&dc), m_gcdc(NULL), m_gc(wxGraphicsContext::CreateFromUnknownDC(dc)), m_hasLines(false),
+      m_hasPoints(false), m_pen(*wxBLACK_PEN), m_brush(*wxTRANSPARENT_BRUSH), m_font(*wxNORMAL_FONT),
+      m_textColour(dc.GetTextForeground()) {
+  if (m_gc) {
+    m_lines = m_gc->CreatePath();
+    m_points = m_gc->CreatePath();
+  }
+}
 
-      dc.DrawText(m_name, tx, ty);
-    }
+mpGCRenderer::mpGCRenderer(wxGraphicsContext *context)
+    : m_dc(NULL), m_gcdc(NULL), m_gc(context), m_hasLines(false), m_hasPoints(false), m_pen(wxColour(0, 0, 0)),
+      m_brush(wxColour(0, 0, 0), wxBRUSHSTYLE_TRANSPARENT),
+      m_font(10, wxFONTFAMILY_SWISS, wxFONTSTYLE_NORMAL, wxFONTWEIGHT_NORMAL), m_textColour(0, 0, 0) {
+  // No stock objects: an offscreen renderer may run on any thread, and copies share their reference count
+  if (m_gc) {
+    m_lines = m_gc->CreatePath();
+    m_points = m_gc->CreatePath();
   }
 }
 
-//-----------------------------------------------------------------------------
-// mpProfile implementation
-//-----------------------------------------------------------------------------
+mpGCRenderer::~mpGCRenderer() {
+  Flush();
+  if (m_gcdc)
+    delete m_gcdc;
+  else
+    delete m_gc;
+}
 
-IMPLEMENT_ABSTRACT_CLASS(mpProfile, mpLayer)
+void mpGCRenderer::SetPen(const wxPen &pen) {
+  if ((m_hasLines || m_hasPoints) && pen != m_pen) Flush();
+  m_pen = pen;
+}
 
-mpProfile::mpProfile(wxString name, int flags) {
-  SetName(name);
-  m_flags = flags;
-  m_type = mpLAYER_PLOT;
+void mpGCRenderer::SetTextForeground(const wxColour &colour) {
+  m_textColour = colour;
+  if (m_gcdc) m_gcdc->SetTextForeground(colour);
 }
 
-void mpProfile::Plot(wxDC &dc, mpWindow &w) {
-  if (m_visible) {
-    dc.SetPen(m_pen);
+void mpGCRenderer::DrawLines(const wxPoint *points, size_t n) {
+  if (!m_gc || n < 2) return;
+  mpSTATS_COUNT(primitives, 1);
+  mpSTATS_COUNT(pointsDrawn, n);
+  // Put the lines of odd width on the pixel centres, to keep them sharp
+  const double offset = (m_pen.GetWidth() <= 1 || m_pen.GetWidth() % 2) ? 0.5 : 0;
+  m_lines.MoveToPoint(points[0].x + offset, points[0].y + offset);
+  for (size_t i = 1; i < n; ++i) m_lines.AddLineToPoint(points[i].x + offset, points[i].y + offset);
+  m_hasLines = true;
+}
 
-    wxCoord startPx = m_drawOutsideMargins ? 0 : w.GetMarginLeft();
-    wxCoord endPx = m_drawOutsideMargins ? w.GetScrX() : w.GetScrX() - w.GetMarginRight();
-    wxCoord minYpx = m_drawOutsideMargins ? 0 : w.GetMarginTop();
-    wxCoord maxYpx = m_drawOutsideMargins ? w.GetScrY() : w.GetScrY() - w.GetMarginBottom();
+void mpGCRenderer::DrawPoints(const wxPoint *points, size_t n) {
+  if (!m_gc || n == 0) return;
+  mpSTATS_COUNT(primitives, 1);
+  mpSTATS_COUNT(pointsDrawn, n);
+  // Same squares as mpRasterBuffer::DrawPoint
+  const int width = (m_pen.GetWidth() > 1) ? m_pen.GetWidth() : 1, half = (width - 1) / 2;
+  for (size_t i = 0; i < n; ++i) m_points.AddRectangle(points[i].x - half, points[i].y - half, width, width);
+  m_hasPoints = true;
+}
 
-    // Plot profile linking subsequent point of the profile, instead of mpFY,
-    // which plots simple points.
-    for (wxCoord i = startPx; i < endPx; ++i) {
-      wxCoord c0 = w.y2p(GetY(w.p2x(i)));
-      wxCoord c1 = w.y2p(GetY(w.p2x(i + 1)));
-      if (!m_drawOutsideMargins) {
-        c0 = (c0 <= maxYpx) ? ((c0 >= minYpx) ? c0 : minYpx) : maxYpx;
-        c1 = (c1 <= maxYpx) ? ((c1 >= minYpx) ? c1 : minYpx) : maxYpx;
-      }
-      dc.DrawLine(i, c0, i + 1, c1);
-    }
+void mpGCRenderer::DrawRectangles(const wxRect *rects, size_t n) {
+  if (!m_gc || n == 0) return;
+  mpSTATS_COUNT(primitives, 1);
+  Flush();
+  wxGraphicsPath path = m_gc->CreatePath();
+  for (size_t i = 0; i < n; ++i) path.AddRectangle(rects[i].x, rects[i].y, rects[i].width, rects[i].height);
+  m_gc->SetPen(m_pen);
+  m_gc->SetBrush(m_brush);
+  m_gc->DrawPath(path);
+}
 
-    if (!m_name.IsEmpty()) {
-      dc.SetFont(m_font);
+void mpGCRenderer::DrawText(const wxString &text, wxCoord x, wxCoord y) {
+  if (!m_gc) return;
+  mpSTATS_COUNT(primitives, 1);
+  Flush();
+  m_gc->SetFont(m_font, m_textColour);
+  m_gc->DrawText(text, x, y);
+}
 
-      wxCoord tx, ty;
-      dc.GetTextExtent(m_name, &tx, &ty);
+void mpGCRenderer::DrawRotatedText(const wxString &text, wxCoord x, wxCoord y, double angle) {
+  if (!m_gc) return;
+  mpSTATS_COUNT(primitives, 1);
+  Flush();
+  m_gc->SetFont(m_font, m_textColour);
+  m_gc->DrawText(text, x, y, angle * M_PI / 180);
+}
 
-      if ((m_flags & mpALIGNMASK) == mpALIGN_RIGHT) {
-        tx = (w.GetScrX() - tx) - w.GetMarginRight() - 8;
-      } else if ((m_flags & mpALIGNMASK) == mpALIGN_CENTER) {
-        tx = ((w.GetScrX() - w.GetMarginRight() - w.GetMarginLeft() - tx) / 2) + w.GetMarginLeft();
-      } else {
-        tx = w.GetMarginLeft() + 8;
-      }
+void mpGCRenderer::GetTextExtent(const wxString &text, wxCoord *w, wxCoord *h) {
+  if (!m_gc) {
+    if (w) *w = 0;
+    if (h) *h = 0;
+    if (m_dc) {
+      m_dc->SetFont(m_font);
+      m_dc->GetTextExtent(text, w, h);
+    }
+    return;
+  }
+  wxDouble tw = 0, th = 0;
+  m_gc->SetFont(m_font, m_textColour);
+  m_gc->GetTextExtent(text, &tw, &th);
+  if (w) *w = (wxCoord)ceil(tw);
+  if (h) *h = (wxCoord)ceil(th);
+}
+
+void mpGCRenderer::DrawImage(const wxImage &image, wxCoord x, wxCoord y) {
+  if (!m_gc || !image.IsOk()) return;
+  mpSTATS_COUNT(primitives, 1);
+  Flush();
+  m_gc->DrawBitmap(m_gc->CreateBitmapFromImage(image), x, y, image.GetWidth(), image.GetHeight());
+}
 
-      dc.DrawText(m_name, tx, w.y2p(GetY(w.p2x(tx))));
+void mpGCRenderer::Clip(const wxRect &area) {
+  SetVisibleArea(area);
+  if (!m_gc || area.IsEmpty()) return;
+  Flush();
+  m_gc->Clip(area.x, area.y, area.width, area.height);
+}
+
+void mpGCRenderer::Flush() {
+  if (m_hasLines) {
+    m_gc->SetPen(m_pen);
+    m_gc->StrokePath(m_lines);
+    m_lines = m_gc->CreatePath();
+    m_hasLines = false;
+  }
+  if (m_hasPoints) {
+    if (!m_pen.IsTransparent()) {
+      m_gc->SetBrush(wxBrush(m_pen.GetColour()));
+      m_gc->FillPath(m_points);
     }
+    m_points = m_gc->CreatePath();
+    m_hasPoints = false;
   }
 }
 
-//-----------------------------------------------------------------------------
-// mpLayer implementations - furniture (scales, ...)
-//-----------------------------------------------------------------------------
+wxDC *mpGCRenderer::GetDC() {
+  if (!m_gc) return m_dc;
+  Flush();
+  if (!m_gcdc) {
+    // Created on first use, as wxGCDC copies the stock pens, brushes and fonts
+    m_gcdc = new wxGCDC(m_gc);
+    m_gcdc->SetTextForeground(m_textColour);
+  }
+  return m_gcdc;
+}
+#endif  // wxUSE_GRAPHICS_CONTEXT
+
+mpRasterRenderer::mpRasterRenderer(wxDC &dc, int width, int height)
+    : m_dc(dc),
+      m_buffer(width, height),
+      m_clip(0, 0, m_buffer.GetWidth(), m_buffer.GetHeight()),
+      m_dirty(false),
+      m_penColour(0xFF000000u),
+      m_penWidth(1),
+      m_brushColour(0),
+      m_font(*wxNORMAL_FONT),
+      m_textColour(dc.GetTextForeground()),
+      m_textLock(NULL),
+      m_dcRequested(false) {}
+
+mpRasterRenderer::mpRasterRenderer(wxDC &dc, const wxRect &area)
+    : m_dc(dc),
+      m_clip(area),
+      m_dirty(false),
+      m_penColour(0xFF000000u),
+      m_penWidth(1),
+      m_brushColour(0),
+      m_font(*wxNORMAL_FONT),
+      m_textColour(dc.GetTextForeground()),
+      m_textLock(NULL),
+      m_dcRequested(false) {
+  m_buffer.Create(area.width, area.height, area.x, area.y);
+  SetVisibleArea(area);
+}
 
-#define mpLN10 2.3025850929940456840179914546844
+mpRasterRenderer::~mpRasterRenderer() { Flush(); }
 
-IMPLEMENT_DYNAMIC_CLASS(mpScaleX, mpLayer)
+void mpRasterRenderer::SetPen(const wxPen &pen) {
+  m_penColour = pen.IsTransparent() ? 0 : mpRasterBuffer::ToARGB(pen.GetColour());
+  m_penWidth = (pen.GetWidth() > 1) ? pen.GetWidth() : 1;
+}
 
-mpScaleX::mpScaleX(wxString name, int flags, bool ticks, unsigned int type) {
-  SetName(name);
-  SetFont((wxFont &)*wxSMALL_FONT);
-  SetPen((wxPen &)*wxGREY_PEN);
-  m_flags = flags;
-  m_ticks = ticks;
-  m_labelType = type;
-  m_type = mpLAYER_AXIS;
-  m_labelFormat = wxT("");
+void mpRasterRenderer::SetBrush(const wxBrush &brush) {
+  m_brushColour = brush.IsTransparent() ? 0 : mpRasterBuffer::ToARGB(brush.GetColour());
 }
 
-void mpScaleX::Plot(wxDC &dc, mpWindow &w) {
-  if (m_visible) {
-    dc.SetPen(m_pen);
-    dc.SetFont(m_font);
-    int orgy = 0;
+void mpRasterRenderer::DrawLines(const wxPoint *points, size_t n) {
+  if (!(m_penColour >> 24)) return;
+  mpSTATS_COUNT(primitives, 1);
+  mpSTATS_COUNT(pointsDrawn, n);
+  // Clip to an area including the fat lines running along the border
+  const wxRect area = wxRect(m_clip).Inflate(m_penWidth);
+  for (size_t i = 1; i < n; ++i) {
+    double x0 = points[i - 1].x, y0 = points[i - 1].y, x1 = points[i].x, y1 = points[i].y;
+    if (mpRasterBuffer::ClipLine(x0, y0, x1, y1, area))
+      m_buffer.DrawLine((int)x0, (int)y0, (int)x1, (int)y1, m_penColour, m_penWidth, m_clip);
+  }
+  m_dirty = true;
+}
 
-    const int extend = w.GetScrX();
-    if (m_flags == mpALIGN_CENTER) {
-      orgy = w.y2p(0);
-    }
+void mpRasterRenderer::DrawPoints(const wxPoint *points, size_t n) {
+  if (!(m_penColour >> 24)) return;
+  mpSTATS_COUNT(primitives, 1);
+  mpSTATS_COUNT(pointsDrawn, n);
+  for (size_t i = 0; i < n; ++i) m_buffer.DrawPoint(points[i].x, points[i].y, m_penColour, m_penWidth, m_clip);
+  m_dirty = true;
+}
 
-    if (m_flags == mpALIGN_TOP) {
-      if (m_drawOutsideMargins)
-        orgy = X_BORDER_SEPARATION;
-      else
-        orgy = w.GetMarginTop();
+void mpRasterRenderer::DrawRectangles(const wxRect *rects, size_t n) {
+  mpSTATS_COUNT(primitives, 1);
+  for (size_t i = 0; i < n; ++i) {
+    const wxRect &r = rects[i];
+    if (m_brushColour >> 24) m_buffer.FillRect(r, m_brushColour, m_clip);
+    const wxPoint outline[5] = {r.GetTopLeft(), r.GetTopRight(), r.GetBottomRight(), r.GetBottomLeft(),
+                                r.GetTopLeft()};
+    DrawLines(outline, 5);
+  }
+  m_dirty = true;
+}
+
+void mpRasterRenderer::DrawText(const wxString &text, wxCoord x, wxCoord y) { DrawRotatedText(text, x, y, 0); }
+
+void mpRasterRenderer::DrawRotatedText(const wxString &text, wxCoord x, wxCoord y, double angle) {
+  mpSTATS_COUNT(primitives, 1);
+  Text t;
+  t.text = text;
+  t.x = x;
+  t.y = y;
+  t.angle = angle;
+  t.font = m_font;
+  t.colour = m_textColour;
+  m_texts.push_back(t);
+}
+
+void mpRasterRenderer::GetTextExtent(const wxString &text, wxCoord *w, wxCoord *h) {
+  if (!m_textLock) {
+    m_dc.SetFont(m_font);
+    m_dc.GetTextExtent(text, w, h);
+    return;
+  }
+  // Measured without selecting the font, which would keep a reference to it in the DC
+  std::lock_guard<std::mutex> lock(*m_textLock);
+  m_dc.GetTextExtent(text, w, h, NULL, NULL, &m_font);
+}
+
+void mpRasterRenderer::DrawImage(const wxImage &image, wxCoord x, wxCoord y) {
+  mpSTATS_COUNT(primitives, 1);
+  m_buffer.DrawImage(image, x, y, m_clip);
+  m_dirty = true;
+}
+
+void mpRasterRenderer::Flush() {
+  if (m_textLock) return;  // Kept for MergeInto
+  if (m_dirty) {
+    m_dc.DrawBitmap(wxBitmap(m_buffer.ToImage()), m_clip.x, m_clip.y, true);
+    m_buffer.Clear();
+    m_dirty = false;
+  }
+  for (size_t i = 0; i < m_texts.size(); ++i) {
+    m_dc.SetFont(m_texts[i].font);
+    m_dc.SetTextForeground(m_texts[i].colour);
+    if (m_texts[i].angle != 0)
+      m_dc.DrawRotatedText(m_texts[i].text, m_texts[i].x, m_texts[i].y, m_texts[i].angle);
+    else
+      m_dc.DrawText(m_texts[i].text, m_texts[i].x, m_texts[i].y);
+  }
+  m_texts.clear();
+}
+
+wxDC *mpRasterRenderer::GetDC() {
+  if (m_textLock) {
+    m_dcRequested = true;
+    return NULL;
+  }
+  Flush();
+  return &m_dc;
+}
+
+void mpRasterRenderer::SetWorker(std::mutex *textLock) {
+  m_textLock = textLock;
+  m_font.SetStyle(m_font.GetStyle());
+  m_textColour = wxColour(m_textColour.Red(), m_textColour.Green(), m_textColour.Blue(), m_textColour.Alpha());
+}
+
+void mpRasterRenderer::MergeInto(mpRasterRenderer &target) {
+  if (m_dirty) {
+    target.m_buffer.DrawBuffer(m_buffer, target.m_clip);
+    target.m_dirty = true;
+    m_buffer.Clear();
+    m_dirty = false;
+  }
+  target.m_texts.insert(target.m_texts.end(), m_texts.begin(), m_texts.end());
+  m_texts.clear();
+}
+
+void mpDecimatingRenderer::SetPen(const wxPen &pen) {
+  ClearPoints();  // The points of another pen are drawn again
+  m_target.SetPen(pen);
+}
+
+void mpDecimatingRenderer::ClearPoints() {
+  for (size_t i = 0; i < m_pointWords.size(); ++i) m_pointMask[m_pointWords[i]] = 0;
+  m_pointWords.clear();
+}
+
+void mpDecimatingRenderer::DrawLines(const wxPoint *points, size_t n) {
+  ClearPoints();
+  if (n < 2) {
+    m_target.DrawLines(points, n);
+    return;
+  }
+  m_reduced.clear();
+  size_t first = 0;
+  while (first < n) {
+    // Run of points in the same column, reduced to its extremes in drawing order
+    size_t low = first, high = first, last = first;
+    while (last + 1 < n && points[last + 1].x == points[first].x) {
+      ++last;
+      if (points[last].y < points[low].y) low = last;
+      if (points[last].y > points[high].y) high = last;
     }
-    if (m_flags == mpALIGN_BOTTOM) {
-      if (m_drawOutsideMargins)
-        orgy = X_BORDER_SEPARATION;
-      else
-        orgy = w.GetScrY() - w.GetMarginBottom();
+    const size_t run[4] = {first, low < high ? low : high, low < high ? high : low, last};
+    for (int i = 0; i < 4; ++i)
+      if (m_reduced.empty() || m_reduced.back() != points[run[i]]) m_reduced.push_back(points[run[i]]);
+    first = last + 1;
+  }
+  if (m_reduced.size() == 1) m_reduced.push_back(m_reduced[0]);  // Keep the single pixel drawn
+  m_target.DrawLines(m_reduced.data(), m_reduced.size());
+}
+
+void mpDecimatingRenderer::DrawPoints(const wxPoint *points, size_t n) {
+  // The points of the other bands are dropped too, as some reach into the visible area
+  const wxRect area = (m_width > 0 && m_height > 0) ? wxRect(0, 0, m_width, m_height) : GetVisibleArea();
+  if (area != m_pointArea) {
+    ClearPoints();
+    m_pointArea = area;
+    m_pointMask.assign(area.IsEmpty() ? 0 : ((size_t)area.width * (size_t)area.height + 63) / 64, 0);
+  }
+  m_reduced.clear();
+  for (size_t i = 0; i < n; ++i) {
+    const wxPoint &p = points[i];
+    if (m_pointArea.Contains(p)) {
+      const size_t bit = (size_t)(p.y - m_pointArea.y) * (size_t)m_pointArea.width + (size_t)(p.x - m_pointArea.x);
+      uint64_t &word = m_pointMask[bit / 64];
+      const uint64_t mask = (uint64_t)1 << (bit % 64);
+      if (word & mask) continue;
+      if (!word) m_pointWords.push_back(bit / 64);
+      word |= mask;
+    } else if (!m_reduced.empty() && m_reduced.back() == p) {
+      continue;
     }
+    m_reduced.push_back(p);
+  }
+  m_target.DrawPoints(m_reduced.data(), m_reduced.size());
+}
 
-    if (m_flags == mpALIGN_BORDER_BOTTOM) orgy = w.GetScrY() - 1;
-    if (m_flags == mpALIGN_BORDER_TOP) orgy = 1;
+#if wxUSE_GRAPHICS_CONTEXT
+// Append a number to SVG data, independently of the locale
+static void mpAppendNumber(std::string &out, double value) {
+  char text[32];
+  const std::to_chars_result r = std::to_chars(text, text + sizeof(text), value, std::chars_format::general, 6);
+  out.append(text, r.ptr);
+}
 
-    dc.DrawLine(0, orgy, w.GetScrX(), orgy);
+static void mpAppendNumber(std::string &out, int value) {
+  char text[16];
+  const std::to_chars_result r = std::to_chars(text, text + sizeof(text), value);
+  out.append(text, r.ptr);
+}
 
-    const double dig = floor(log(128.0 / w.GetScaleX()) / mpLN10);
-    const double step = exp(mpLN10 * dig);
-    const double end = w.GetPosX() + (double)extend / w.GetScaleX();
+static std::string mpSVGColour(const wxColour &colour) {
+  char text[8];
+  snprintf(text, sizeof(text), "#%02x%02x%02x", colour.Red(), colour.Green(), colour.Blue());
+  return text;
+}
 
-    wxCoord tx, ty;
-    wxString s;
-    wxString fmt;
-    int tmp = (int)dig;
-    if (m_labelType == mpX_NORMAL) {
-      if (!m_labelFormat.IsEmpty()) {
-        fmt = m_labelFormat;
-      } else {
-        if (tmp >= 1) {
-          fmt = wxT("%.f");
-        } else {
-          tmp = 8 - tmp;
-          fmt.Printf(wxT("%%.%df"), tmp >= -1 ? 2 : -tmp);
-        }
-      }
-    } else {
-      // Date and/or time axis representation
-      if (m_labelType == mpX_DATETIME) {
-        fmt = (wxT("%04.0f-%02.0f-%02.0fT%02.0f:%02.0f:%02.0f"));
-      } else if (m_labelType == mpX_DATE) {
-        fmt = (wxT("%04.0f-%02.0f-%02.0f"));
-      } else if ((m_labelType == mpX_TIME) && (end / 60 < 2)) {
-        fmt = (wxT("%02.0f:%02.3f"));
-      } else {
-        fmt = (wxT("%02.0f:%02.0f:%02.0f"));
+static std::string mpSVGEscape(const wxString &text) {
+  const std::string utf8 = (const char *)text.utf8_str();
+  std::string escaped;
+  for (size_t i = 0; i < utf8.size(); ++i) {
+    switch (utf8[i]) {
+      case '&':
+        escaped += "&amp;";
+        break;
+      case '<':
+        escaped += "&lt;";
+        break;
+      case '>':
+        escaped += "&gt;";
+        break;
+      case '"':
+        escaped += "&quot;";
+        break;
+      default:
+        escaped += utf8[i];
+    }
+  }
+  return escaped;
+}
+
+// Most lines simplified at once by mpSimplifyPolyline
+#define mpSVG_SIMPLIFY_LINES 256
+
+// Douglas-Peucker simplification, keeping the points farther than tolerance
+// from the line joining the kept points around them. The time is quadratic in
+// the number of points when the polyline turns back on itself, as noisy data
+// does: the polyline is simplified in pieces whose ends are kept.
+static void mpSimplifyPolyline(std::vector<wxPoint> &points, double tolerance) {
+  const size_t n = points.size();
+  if (n < 3) return;
+  std::vector<char> keep(n, 0);
+  const double tolerance2 = tolerance * tolerance;
+  std::vector<std::pair<size_t, size_t> > ranges;
+  for (size_t a = 0; a + 1 < n; a += mpSVG_SIMPLIFY_LINES) {
+    const size_t b = std::min(a + mpSVG_SIMPLIFY_LINES, n - 1);
+    keep[a] = keep[b] = 1;
+    ranges.push_back(std::make_pair(a, b));
+  }
+  while (!ranges.empty()) {
+    const size_t a = ranges.back().first, b = ranges.back().second;
+    ranges.pop_back();
+    if (b <= a + 1) continue;
+    const double x0 = points[a].x, y0 = points[a].y;
+    const double dx = points[b].x - x0, dy = points[b].y - y0, length2 = dx * dx + dy * dy;
+    double farthest = -1;
+    size_t index = a;
+    for (size_t i = a + 1; i < b; ++i) {
+      const double px = points[i].x - x0, py = points[i].y - y0;
+      // Squared distance to the line, times length2 (to the point if the ends are equal)
+      const double cross = px * dy - py * dx;
+      const double d = (length2 > 0) ? cross * cross : px * px + py * py;
+      if (d > farthest) {
+        farthest = d;
+        index = i;
       }
     }
+    if (farthest > tolerance2 * (length2 > 0 ? length2 : 1)) {
+      keep[index] = 1;
+      ranges.push_back(std::make_pair(a, index));
+      ranges.push_back(std::make_pair(index, b));
+    }
+  }
+  size_t kept = 0;
+  for (size_t i = 0; i < n; ++i)
+    if (keep[i]) points[kept++] = points[i];
+  points.resize(kept);
+}
 
-    // double n = floor( (w.GetPosX() - (double)extend / w.GetScaleX()) / step )
-    // * step ;
-    double n0 =
-        floor((w.GetPosX() /* - (double)(extend - w.GetMarginLeft() - w.GetMarginRight())/ w.GetScaleX() */) / step) *
-        step;
-    double n = 0;
+mpSVGRenderer::mpSVGRenderer(wxOutputStream &stream, int width, int height, double dpi)
+    : m_stream(stream),
+      m_width(width),
+      m_height(height),
+      m_tolerance(0.5),
+      m_ok(true),
+      m_closed(false),
+      m_pen(wxColour(0, 0, 0)),
+      m_brush(wxColour(0, 0, 0), wxBRUSHSTYLE_TRANSPARENT),
+      m_textColour(0, 0, 0),
+      m_textScale(1),
+      m_hasColumn(false),
+      m_lowFirst(true),
+      m_fallbackDC(NULL) {
+  m_measure = wxGraphicsContext::Create();
+  if (dpi <= 0) dpi = 96;
+  m_textScale = dpi / 96;  // The texts are measured in screen pixels
+  m_buffer =
+      "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"no\"?>\n"
+      "<svg xmlns=\"http://www.w3.org/2000/svg\" xmlns:xlink=\"http://www.w3.org/1999/xlink\" version=\"1.1\" width=\"";
+  mpAppendNumber(m_buffer, width / dpi);
+  m_buffer += "in\" height=\"";
+  mpAppendNumber(m_buffer, height / dpi);
+  m_buffer += "in\" viewBox=\"0 0 ";
+  mpAppendNumber(m_buffer, width);
+  m_buffer += ' ';
+  mpAppendNumber(m_buffer, height);
+  m_buffer += "\">\n";
+}
 
-    wxCoord startPx = m_drawOutsideMargins ? 0 : w.GetMarginLeft();
-    wxCoord endPx = m_drawOutsideMargins ? w.GetScrX() : w.GetScrX() - w.GetMarginRight();
-    wxCoord minYpx = m_drawOutsideMargins ? 0 : w.GetMarginTop();
-    wxCoord maxYpx = m_drawOutsideMargins ? w.GetScrY() : w.GetScrY() - w.GetMarginBottom();
+mpSVGRenderer::~mpSVGRenderer() {
+  Close();
+  delete m_measure;
+}
 
-    int labelH = 0;  // Control labels heigth to decide where to put axis name
-                     // (below labels or on top of axis)
+bool mpSVGRenderer::Close() {
+  if (!m_closed) {
+    Flush();
+    m_buffer += "</svg>\n";
+    m_stream.Write(m_buffer.data(), m_buffer.size());
+    if (m_stream.LastWrite() != m_buffer.size()) m_ok = false;
+    m_buffer.clear();
+    m_closed = true;
+  }
+  return m_ok;
+}
+
+void mpSVGRenderer::Write(const wxString &text) {
+  m_buffer += (const char *)text.utf8_str();
+  if (m_buffer.size() >= 65536) {
+    m_stream.Write(m_buffer.data(), m_buffer.size());
+    if (m_stream.LastWrite() != m_buffer.size()) m_ok = false;
+    m_buffer.clear();
+  }
+}
+
+wxString mpSVGRenderer::PenStyle() const {
+  const int width = (m_pen.GetWidth() > 1) ? m_pen.GetWidth() : 1;
+  std::string style = " stroke=\"" + mpSVGColour(m_pen.GetColour()) + "\" stroke-width=\"";
+  mpAppendNumber(style, width);
+  style += '"';
+  if (m_pen.GetColour().Alpha() < 255) {
+    style += " stroke-opacity=\"";
+    mpAppendNumber(style, m_pen.GetColour().Alpha() / 255.0);
+    style += '"';
+  }
+  const char *dashes = NULL;
+  switch (m_pen.GetStyle()) {
+    case wxPENSTYLE_DOT:
+      dashes = "1 2";
+      break;
+    case wxPENSTYLE_SHORT_DASH:
+      dashes = "2 2";
+      break;
+    case wxPENSTYLE_LONG_DASH:
+      dashes = "4 4";
+      break;
+    case wxPENSTYLE_DOT_DASH:
+      dashes = "4 2 1 2";
+      break;
+    default:
+      break;
+  }
+  if (dashes) {
+    // Dashes scale with the width of the pen, as with wxDC
+    style += " stroke-dasharray=\"";
+    for (const char *d = dashes; *d; ++d) {
+      if (*d == ' ')
+        style += ' ';
+      else
+        mpAppendNumber(style, (*d - '0') * width);
+    }
+    style += '"';
+  }
+  return wxString::FromUTF8(style.c_str());
+}
+
+void mpSVGRenderer::SetPen(const wxPen &pen) {
+  if (pen == m_pen) return;
+  Flush();
+  m_pen = pen;
+}
+
+void mpSVGRenderer::EndColumn() {
+  if (!m_hasColumn) return;
+  const wxPoint &low = m_column[1], &high = m_column[2];
+  const wxPoint run[4] = {m_column[0], m_lowFirst ? low : high, m_lowFirst ? high : low, m_column[3]};
+  for (int i = 0; i < 4; ++i)
+    if (m_polyline.empty() || m_polyline.back() != run[i]) m_polyline.push_back(run[i]);
+  m_hasColumn = false;
+}
+
+void mpSVGRenderer::EndPolyline() {
+  EndColumn();
+  if (m_polyline.size() >= 2) {
+    mpSimplifyPolyline(m_polyline, m_tolerance);
+    // Relative coordinates, shorter for close points
+    m_path += 'M';
+    mpAppendNumber(m_path, m_polyline[0].x);
+    m_path += ' ';
+    mpAppendNumber(m_path, m_polyline[0].y);
+    m_path += 'l';
+    for (size_t i = 1; i < m_polyline.size(); ++i) {
+      if (i > 1) m_path += ' ';
+      mpAppendNumber(m_path, m_polyline[i].x - m_polyline[i - 1].x);
+      m_path += ' ';
+      mpAppendNumber(m_path, m_polyline[i].y - m_polyline[i - 1].y);
+    }
+  }
+  m_polyline.clear();
+}
+
+void mpSVGRenderer::DrawLines(const wxPoint *points, size_t n) {
+  EndFallback();
+  if (n < 2 || m_pen.IsTransparent()) return;
+  // A polyline starting where the previous one ended continues it
+  const bool open = m_hasColumn || !m_polyline.empty();
+  const wxPoint last = m_hasColumn ? m_column[3] : (open ? m_polyline.back() : wxPoint());
+  if (!open || last != points[0]) EndPolyline();
+
+  for (size_t i = 0; i < n; ++i) {
+    const wxPoint &p = points[i];
+    if (m_hasColumn && p.x == m_column[0].x) {
+      if (p.y < m_column[1].y) {
+        m_column[1] = p;
+        m_lowFirst = false;
+      } else if (p.y > m_column[2].y) {
+        m_column[2] = p;
+        m_lowFirst = true;
+      }
+      m_column[3] = p;
+    } else {
+      EndColumn();
+      m_column[0] = m_column[1] = m_column[2] = m_column[3] = p;
+      m_hasColumn = true;
+      m_lowFirst = true;
+    }
+  }
+}
+
+void mpSVGRenderer::DrawPoints(const wxPoint *points, size_t n) {
+  EndFallback();
+  if (m_pen.IsTransparent() || n == 0 || m_width <= 0 || m_height <= 0) return;
+  if (m_pointMask.empty()) m_pointMask.resize(((size_t)m_width * (size_t)m_height + 63) / 64, 0);
+  for (size_t i = 0; i < n; ++i) {
+    const wxPoint &p = points[i];
+    if (p.x >= 0 && p.x < m_width && p.y >= 0 && p.y < m_height) {
+      const size_t bit = (size_t)p.y * (size_t)m_width + (size_t)p.x;
+      const uint64_t mask = (uint64_t)1 << (bit % 64);
+      if (m_pointMask[bit / 64] & mask) continue;
+      m_pointMask[bit / 64] |= mask;
+    }
+    m_points.push_back(p);
+  }
+}
+
+void mpSVGRenderer::DrawRectangles(const wxRect *rects, size_t n) {
+  Flush();
+  for (size_t i = 0; i < n; ++i) {
+    std::string rect = "<rect x=\"";
+    mpAppendNumber(rect, rects[i].x);
+    rect += "\" y=\"";
+    mpAppendNumber(rect, rects[i].y);
+    rect += "\" width=\"";
+    mpAppendNumber(rect, rects[i].width);
+    rect += "\" height=\"";
+    mpAppendNumber(rect, rects[i].height);
+    rect += "\" fill=\"";
+    rect += m_brush.IsTransparent() ? std::string("none") : mpSVGColour(m_brush.GetColour());
+    rect += '"';
+    Write(wxString::FromUTF8(rect.c_str()));
+    Write(m_pen.IsTransparent() ? wxString(wxT(" stroke=\"none\"")) : PenStyle());
+    Write(wxT("/>\n"));
+  }
+}
+
+void mpSVGRenderer::DrawRotatedText(const wxString &text, wxCoord x, wxCoord y, double angle) {
+  Flush();
+  if (!m_measure || text.IsEmpty()) return;
+  const wxFont font = m_font.IsOk() ? m_font : *wxNORMAL_FONT;
+  m_measure->SetFont(font, m_textColour);
+
+  std::string attributes = " font-family=\"";
+  if (!font.GetFaceName().IsEmpty()) attributes += mpSVGEscape(font.GetFaceName()) + ", ";
+  switch (font.GetFamily()) {
+    case wxFONTFAMILY_ROMAN:
+      attributes += "serif";
+      break;
+    case wxFONTFAMILY_MODERN:
+    case wxFONTFAMILY_TELETYPE:
+      attributes += "monospace";
+      break;
+    default:
+      attributes += "sans-serif";
+  }
+  attributes += "\" font-size=\"";
+  mpAppendNumber(attributes, font.GetPointSize() * 96.0 / 72.0 * m_textScale);  // Points to pixels
+  attributes += '"';
+  if (font.GetWeight() >= wxFONTWEIGHT_BOLD) attributes += " font-weight=\"bold\"";
+  if (font.GetStyle() != wxFONTSTYLE_NORMAL) attributes += " font-style=\"italic\"";
+  attributes += " fill=\"" + mpSVGColour(m_textColour) + '"';
+  if (angle != 0) {
+    attributes += " transform=\"rotate(";
+    mpAppendNumber(attributes, -angle);
+    attributes += ' ';
+    mpAppendNumber(attributes, x);
+    attributes += ' ';
+    mpAppendNumber(attributes, y);
+    attributes += ")\"";
+  }
+
+  // One element per line, placed on its baseline
+  wxCoord top = y;
+  wxString rest = text;
+  for (;;) {
+    const wxString line = rest.BeforeFirst('\n');
+    wxDouble w = 0, h = 0, descent = 0;
+    m_measure->GetTextExtent(line.IsEmpty() ? wxString(wxT(" ")) : line, &w, &h, &descent);
+    if (!line.IsEmpty()) {
+      std::string element = "<text x=\"";
+      mpAppendNumber(element, x);
+      element += "\" y=\"";
+      mpAppendNumber(element, top + (h - descent) * m_textScale);
+      element += '"' + attributes + '>' + mpSVGEscape(line) + "</text>\n";
+      Write(wxString::FromUTF8(element.c_str()));
+    }
+    top += (wxCoord)ceil(h * m_textScale);
+    if (rest.Find('\n') == wxNOT_FOUND) break;
+    rest = rest.AfterFirst('\n');
+  }
+}
+
+void mpSVGRenderer::GetTextExtent(const wxString &text, wxCoord *w, wxCoord *h) {
+  wxDouble tw = 0, th = 0;
+  if (m_measure) {
+    m_measure->SetFont(m_font.IsOk() ? m_font : *wxNORMAL_FONT, m_textColour);
+    m_measure->GetTextExtent(text, &tw, &th);
+  }
+  if (w) *w = (wxCoord)ceil(tw * m_textScale);
+  if (h) *h = (wxCoord)ceil(th * m_textScale);
+}
+
+void mpSVGRenderer::DrawImage(const wxImage &image, wxCoord x, wxCoord y) {
+  Flush();
+  if (!image.IsOk()) return;
+  wxImage source = image;
+  if (source.HasMask() && !source.HasAlpha()) source.InitAlpha();  // The mask becomes transparency
+
+  mpByteStream png;
+  {
+    mpPNGWriter writer(png, source.GetWidth(), source.GetHeight(), source.HasAlpha());
+    writer.WriteRows(source.GetData(), source.GetHeight(), source.GetAlpha());
+    if (!writer.Close()) return;
+  }
+
+  std::string element = "<image x=\"";
+  mpAppendNumber(element, x);
+  element += "\" y=\"";
+  mpAppendNumber(element, y);
+  element += "\" width=\"";
+  mpAppendNumber(element, source.GetWidth());
+  element += "\" height=\"";
+  mpAppendNumber(element, source.GetHeight());
+  element += "\" xlink:href=\"data:image/png;base64,";
+  Write(wxString::FromUTF8(element.c_str()));
+  Write(wxBase64Encode(png.m_bytes.data(), png.m_bytes.size()));
+  Write(wxT("\"/>\n"));
+}
+
+void mpSVGRenderer::Flush() {
+  EndFallback();
+  EndPolyline();
+  if (!m_path.empty()) {
+    Write(wxT("<path fill=\"none\" stroke-linejoin=\"round\""));
+    Write(PenStyle());
+    Write(wxT(" d=\""));
+    // Written in pieces, to keep the buffer small
+    for (size_t i = 0; i < m_path.size(); i += 65536) Write(wxString::FromUTF8(m_path.substr(i, 65536).c_str()));
+    Write(wxT("\"/>\n"));
+    m_path.clear();
+  }
+  if (!m_points.empty()) {
+    // Squares of the pen width, drawn once per pixel
+    const int width = (m_pen.GetWidth() > 1) ? m_pen.GetWidth() : 1;
+    std::string path = "<path stroke=\"none\" fill=\"" + mpSVGColour(m_pen.GetColour()) + "\" d=\"";
+    for (size_t i = 0; i < m_points.size(); ++i) {
+      path += 'M';
+      mpAppendNumber(path, m_points[i].x - (width - 1) / 2);
+      path += ' ';
+      mpAppendNumber(path, m_points[i].y - (width - 1) / 2);
+      path += 'h';
+      mpAppendNumber(path, width);
+      path += 'v';
+      mpAppendNumber(path, width);
+      path += 'h';
+      mpAppendNumber(path, -width);
+      path += 'z';
+      if (path.size() >= 65536) {
+        Write(wxString::FromUTF8(path.c_str()));
+        path.clear();
+      }
+    }
+    Write(wxString::FromUTF8(path.c_str()));
+    Write(wxT("\"/>\n"));
+    for (size_t i = 0; i < m_points.size(); ++i) {
+      const wxPoint &p = m_points[i];
+      if (p.x >= 0 && p.x < m_width && p.y >= 0 && p.y < m_height)
+        m_pointMask[((size_t)p.y * (size_t)m_width + (size_t)p.x) / 64] = 0;
+    }
+    m_points.clear();
+  }
+}
+
+void mpSVGRenderer::EndFallback() {
+  if (!m_fallbackDC) return;
+  delete m_fallbackDC;  // Draws on m_fallbackImage
+  m_fallbackDC = NULL;
+
+  // Only embed the area which was drawn
+  const unsigned char *alpha = m_fallbackImage.GetAlpha();
+  int left = m_width, right = -1, top = m_height, bottom = -1;
+  for (int y = 0; y < m_height; ++y) {
+    for (int x = 0; x < m_width; ++x) {
+      if (alpha[(size_t)y * (size_t)m_width + (size_t)x]) {
+        left = (x < left) ? x : left;
+        right = (x > right) ? x : right;
+        top = (y < top) ? y : top;
+        bottom = (y > bottom) ? y : bottom;
+      }
+    }
+  }
+  if (right >= 0) {
+    const wxRect drawn(wxPoint(left, top), wxPoint(right, bottom));
+    DrawImage(m_fallbackImage.GetSubImage(drawn), drawn.x, drawn.y);
+  }
+  m_fallbackImage = wxImage();
+}
+
+wxDC *mpSVGRenderer::GetDC() {
+  Flush();
+  if (m_width <= 0 || m_height <= 0) return NULL;
+  m_fallbackImage.Create(m_width, m_height, true);
+  m_fallbackImage.InitAlpha();
+  memset(m_fallbackImage.GetAlpha(), 0, (size_t)m_width * (size_t)m_height);
+  wxGraphicsContext *gc = wxGraphicsContext::Create(m_fallbackImage);
+  if (!gc) return NULL;
+  m_fallbackDC = new wxGCDC(gc);
+  m_fallbackDC->SetTextForeground(m_textColour);
+  return m_fallbackDC;
+}
+#endif  // wxUSE_GRAPHICS_CONTEXT
+
+//-----------------------------------------------------------------------------
+// mpLayer implementations - functions
+//-----------------------------------------------------------------------------
+
+IMPLEMENT_ABSTRACT_CLASS(mpFX, mpLayer)
+
+mpFX::mpFX(wxString name, int flags) {
+  SetName(name);
+  m_flags = flags;
+  m_type = mpLAYER_PLOT;
+}
+
+void mpFX::GetYs(const double *xs, double *ys, size_t n) {
+  for (size_t i = 0; i < n; ++i) ys[i] = GetY(xs[i]);
+}
+
+void mpFX::Plot(wxDC &dc, mpPlotView &w) {
+  mpDCRenderer r(dc);
+  Render(r, w);
+}
+
+void mpFX::Render(mpRenderer &r, mpPlotView &w) {
+  if (m_visible) {
+    r.SetPen(m_pen);
+
+    wxCoord startPx = m_drawOutsideMargins ? 0 : w.GetMarginLeft();
+    wxCoord endPx = m_drawOutsideMargins ? w.GetScrX() : w.GetScrX() - w.GetMarginRight();
+    wxCoord minYpx = m_drawOutsideMargins ? 0 : w.GetMarginTop();
+    wxCoord maxYpx = m_drawOutsideMargins ? w.GetScrY() : w.GetScrY() - w.GetMarginBottom();
+
+    // Evaluate the whole visible range with a single call, so that
+    // implementations of GetYs can work on the batch at once.
+    std::vector<double> xs, ys;
+    if (endPx > startPx) {
+      xs.resize((size_t)(endPx - startPx));
+      ys.resize(xs.size());
+      for (wxCoord i = startPx; i < endPx; ++i) xs[(size_t)(i - startPx)] = w.p2x(i);
+      GetYs(&xs[0], &ys[0], xs.size());
+      mpSTATS_COUNT(pointsVisited, xs.size());
+    }
+
+    std::vector<wxPoint> points;
+    points.reserve(xs.size());
+    for (wxCoord i = startPx; i < endPx; ++i) {
+      wxCoord iy = w.y2p(ys[(size_t)(i - startPx)]);
+      // Draw the point only if you can draw outside margins or if the point
+      // is inside margins
+      if (m_drawOutsideMargins || ((iy >= minYpx) && (iy <= maxYpx))) points.push_back(wxPoint(i, iy));
+    }
+    r.DrawPoints(points.data(), points.size());
+
+    if (!m_name.IsEmpty() && m_showName) {
+      r.SetFont(m_font);
+
+      wxCoord tx, ty;
+      r.GetTextExtent(m_name, &tx, &ty);
+
+      if ((m_flags & mpALIGNMASK) == mpALIGN_RIGHT) {
+        tx = (w.GetScrX() - tx) - w.GetMarginRight() - 8;
+      } else if ((m_flags & mpALIGNMASK) == mpALIGN_CENTER) {
+        tx = ((w.GetScrX() - w.GetMarginRight() - w.GetMarginLeft() - tx) / 2) + w.GetMarginLeft();
+      } else {
+        tx = w.GetMarginLeft() + 8;
+      }
+      r.DrawText(m_name, tx, w.y2p(GetY(w.p2x(tx))));
+    }
+  }
+}
+
+IMPLEMENT_ABSTRACT_CLASS(mpFY, mpLayer)
+
+mpFY::mpFY(wxString name, int flags) {
+  SetName(name);
+  m_flags = flags;
+  m_type = mpLAYER_PLOT;
+}
+
+void mpFY::Plot(wxDC &dc, mpPlotView &w) {
+  mpDCRenderer r(dc);
+  Render(r, w);
+}
+
+void mpFY::Render(mpRenderer &r, mpPlotView &w) {
+  if (m_visible) {
+    r.SetPen(m_pen);
+
+    wxCoord i, ix;
+
+    wxCoord startPx = m_drawOutsideMargins ? 0 : w.GetMarginLeft();
+    wxCoord endPx = m_drawOutsideMargins ? w.GetScrX() : w.GetScrX() - w.GetMarginRight();
+    wxCoord minYpx = m_drawOutsideMargins ? 0 : w.GetMarginTop();
+    wxCoord maxYpx = m_drawOutsideMargins ? w.GetScrY() : w.GetScrY() - w.GetMarginBottom();
+
+    // As Plot always did, the rows of wide pens are not limited by the margins
+    const wxCoord firstPx = (m_pen.GetWidth() <= 1) ? minYpx : 0;
+    const wxCoord lastPx = (m_pen.GetWidth() <= 1) ? maxYpx : w.GetScrY();
+    std::vector<wxPoint> points;
+    if (lastPx > firstPx) points.reserve((size_t)(lastPx - firstPx));
+    if (lastPx > firstPx) mpSTATS_COUNT(pointsVisited, lastPx - firstPx);
+    for (i = firstPx; i < lastPx; ++i) {
+      ix = w.x2p(GetX(w.p2y(i)));
+      if (m_drawOutsideMargins || ((ix >= startPx) && (ix <= endPx))) points.push_back(wxPoint(ix, i));
+    }
+    r.DrawPoints(points.data(), points.size());
+
+    if (!m_name.IsEmpty() && m_showName) {
+      r.SetFont(m_font);
+
+      wxCoord tx, ty;
+      r.GetTextExtent(m_name, &tx, &ty);
+
+      if ((m_flags & mpALIGNMASK) == mpALIGN_TOP) {
+        ty = w.GetMarginTop() + 8;
+      } else if ((m_flags & mpALIGNMASK) == mpALIGN_CENTER) {
+        ty = ((w.GetScrY() - w.GetMarginTop() - w.GetMarginBottom() - ty) / 2) + w.GetMarginTop();
+      } else {
+        ty = w.GetScrY() - 8 - ty - w.GetMarginBottom();
+      }
+
+      r.DrawText(m_name, w.x2p(GetX(w.p2y(ty))), ty);
+    }
+  }
+}
+
+IMPLEMENT_ABSTRACT_CLASS(mpFXY, mpLayer)
+
+mpFXY::mpFXY(wxString name, int flags) {
+  SetName(name);
+  m_flags = flags;
+  m_rasterTiles = 0;
+  m_type = mpLAYER_PLOT;
+  maxDrawX = minDrawX = maxDrawY = minDrawY = 0;
+  m_savedDraw[0] = m_savedDraw[1] = m_savedDraw[2] = m_savedDraw[3] = 0;
+}
+
+void mpFXY::SaveViewState() {
+  m_savedDraw[0] = maxDrawX;
+  m_savedDraw[1] = minDrawX;
+  m_savedDraw[2] = maxDrawY;
+  m_savedDraw[3] = minDrawY;
+}
+
+void mpFXY::RestoreViewState() {
+  maxDrawX = m_savedDraw[0];
+  minDrawX = m_savedDraw[1];
+  maxDrawY = m_savedDraw[2];
+  minDrawY = m_savedDraw[3];
+}
+
+void mpFXY::UpdateViewBoundary(wxCoord xnew, wxCoord ynew) {
+  // Keep track of how many points have been drawn and the bouding box
+  maxDrawX = (xnew > maxDrawX) ? xnew : maxDrawX;
+  minDrawX = (xnew < minDrawX) ? xnew : minDrawX;
+  maxDrawY = (maxDrawY > ynew) ? maxDrawY : ynew;
+  minDrawY = (minDrawY < ynew) ? minDrawY : ynew;
+  // drawnPoints++;
+}
+
+bool mpFXY::GetLocusScreenBounds(mpPlotView &w, wxRect &bounds) {
+  if (!m_visible) {
+    bounds = wxRect();
+    return true;
+  }
+  if (!m_name.IsEmpty() && m_showName) return false;
+  return GetBBoxScreenBounds(w, bounds, m_pen.GetWidth() + 1);
+}
+
+size_t mpFXY::GetChunk(size_t WXUNUSED(start), size_t WXUNUSED(maxCount), const double *&xs, const double *&ys) {
+  xs = NULL;
+  ys = NULL;
+  return 0;
+}
+
+size_t mpFXY::ReadChunk(size_t start, const double *&xs, const double *&ys, std::vector<double> &bufX,
+                        std::vector<double> &bufY) {
+  if (SupportsChunks()) {
+    const size_t n = GetChunk(start, mpFXY_CHUNK_SIZE, xs, ys);
+    mpSTATS_COUNT(pointsVisited, n);
+    return n;
+  }
+
+  // Fallback for implementations of the Rewind/GetNextXY protocol only
+  bufX.resize(mpFXY_CHUNK_SIZE);
+  bufY.resize(mpFXY_CHUNK_SIZE);
+  size_t n = 0;
+  while (n < mpFXY_CHUNK_SIZE && GetNextXY(bufX[n], bufY[n])) n++;
+  xs = &bufX[0];
+  ys = &bufY[0];
+  mpSTATS_COUNT(pointsVisited, n);
+  return n;
+}
+
+// Number of lines or points per block in the X range culling of mpFXY::PlotRaster
+#define mpRASTER_BLOCK 4096
+
+// Block of pixels traced by mpFXY::TraceLocus, with the X range it covers
+struct mpRasterBlock {
+  size_t begin, end;  // Points of the block; when continuous, lines join each one to the previous one
+  int minX, maxX;
+};
+
+void mpFXY::PlotRaster(mpRenderer &r, mpPlotView &w) {
+  // The pixels are traced in this thread, as the clipping of each line
+  // moves the start of the next one, and split in blocks
+  const size_t linked = m_continuous ? 1 : 0;  // Points shared by consecutive blocks
+  std::vector<wxPoint> points;
+  std::vector<mpRasterBlock> blocks;
+  TraceLocus(w, r.GetVisibleArea(), [&](const wxPoint *traced, size_t count) {
+    if (count <= linked) return;
+    const size_t first = points.size();
+    points.insert(points.end(), traced, traced + count);
+    for (size_t begin = first; begin + linked < points.size(); begin += mpRASTER_BLOCK) {
+      mpRasterBlock b;
+      b.begin = begin;
+      b.end = std::min(begin + mpRASTER_BLOCK + linked, points.size());
+      b.minX = INT_MAX;
+      b.maxX = INT_MIN;
+      for (size_t i = b.begin; i < b.end; ++i) {
+        b.minX = std::min(b.minX, points[i].x);
+        b.maxX = std::max(b.maxX, points[i].x);
+      }
+      blocks.push_back(b);
+    }
+  });
+
+  // The buffer covers the part of the plot being drawn, as the one of mpRasterRenderer
+  const wxRect plot(0, 0, w.GetScrX(), w.GetScrY());
+  const wxRect clip = r.GetVisibleArea().IsEmpty() ? plot : plot.Intersect(r.GetVisibleArea());
+  if (clip.IsEmpty() || blocks.empty() || m_pen.IsTransparent()) return;
+
+  int tiles = m_rasterTiles;
+  if (tiles < 0) tiles = (int)std::thread::hardware_concurrency();
+  if (tiles < 1) tiles = 1;
+  if (tiles > clip.width) tiles = clip.width;
+
+  m_raster.Create(clip.width, clip.height, clip.x, clip.y);
+  const wxUint32 argb = mpRasterBuffer::ToARGB(m_pen.GetColour());
+  const int penWidth = (m_pen.GetWidth() > 1) ? m_pen.GetWidth() : 1;
+  const wxRect lineClip = wxRect(clip).Inflate(penWidth);  // As in mpRasterRenderer::DrawLines
+
+  w.ParallelFor((size_t)tiles, [&](size_t t) {
+    const int tx0 = clip.x + (int)((long long)clip.width * (long long)t / tiles);
+    const int tx1 = clip.x + (int)((long long)clip.width * (long long)(t + 1) / tiles);
+    const wxRect tile(tx0, clip.y, tx1 - tx0, clip.height);
+    for (size_t i = 0; i < blocks.size(); ++i) {
+      const mpRasterBlock &b = blocks[i];
+      // Fat lines and points spill over the neighbour tiles
+      if (b.maxX + penWidth < tx0 || b.minX - penWidth >= tx1) continue;
+      if (!m_continuous) {
+        for (size_t k = b.begin; k < b.end; ++k) m_raster.DrawPoint(points[k].x, points[k].y, argb, penWidth, tile);
+        continue;
+      }
+      // Every tile clips the lines to the same rectangle, so that they rasterize the exact same lines
+      for (size_t k = b.begin + 1; k < b.end; ++k) {
+        double x0 = points[k - 1].x, y0 = points[k - 1].y, x1 = points[k].x, y1 = points[k].y;
+        if (mpRasterBuffer::ClipLine(x0, y0, x1, y1, lineClip))
+          m_raster.DrawLine((int)x0, (int)y0, (int)x1, (int)y1, argb, penWidth, tile);
+      }
+    }
+  });
+
+  // All the tiles are drawn at once
+  r.DrawImage(m_raster.ToImage(), clip.x, clip.y);
+}
+
+void mpFXY::TraceLocus(mpPlotView &w, const wxRect &visible,
+                       const std::function<void(const wxPoint *, size_t)> &draw) {
+  const double *xs, *ys;
+  std::vector<double> bufX, bufY;
+  size_t n, start = 0;
+
+  wxCoord startPx = m_drawOutsideMargins ? 0 : w.GetMarginLeft();
+  wxCoord endPx = m_drawOutsideMargins ? w.GetScrX() : w.GetScrX() - w.GetMarginRight();
+  wxCoord minYpx = m_drawOutsideMargins ? 0 : w.GetMarginTop();
+  wxCoord maxYpx = m_drawOutsideMargins ? w.GetScrY() : w.GetScrY() - w.GetMarginBottom();
+
+  wxCoord ix = 0, iy = 0;
+
+  // Only draw what reaches the area being repainted, the label is still placed from all the points
+  wxRect area = visible;
+  const bool cull = !area.IsEmpty();
+  if (cull) area.Inflate(m_pen.GetWidth() + 1);
+
+  if (!m_continuous) {
+    std::vector<wxPoint> points;
+    while ((n = ReadChunk(start, xs, ys, bufX, bufY)) > 0) {
+      start += n;
+      points.clear();
+      for (size_t i = 0; i < n; ++i) {
+        ix = w.x2p(xs[i]);
+        iy = w.y2p(ys[i]);
+        if (m_drawOutsideMargins || ((ix >= startPx) && (ix <= endPx) && (iy >= minYpx) && (iy <= maxYpx))) {
+          if (!cull || area.Contains(ix, iy)) points.push_back(wxPoint(ix, iy));
+          UpdateViewBoundary(ix, iy);
+        }
+      }
+      draw(points.data(), points.size());
+    }
+  } else {
+    // Old code
+    wxCoord x0 = 0, c0 = 0;
+    bool first = true;
+    std::vector<wxPoint> line;  // Consecutive segments, drawn as one polyline
+    while ((n = ReadChunk(start, xs, ys, bufX, bufY)) > 0) {
+      start += n;
+      for (size_t i = 0; i < n; ++i) {
+        wxCoord x1 = w.x2p(xs[i]);  // (wxCoord) ((x - w.GetPosX()) * w.GetScaleX());
+        wxCoord c1 = w.y2p(ys[i]);  // (wxCoord) ((w.GetPosY() - y) * w.GetScaleY());
+        if (first) {
+          first = false;
+          x0 = x1;
+          c0 = c1;
+        }
+        if ((x1 >= startPx) && (x0 <= endPx)) {
+          bool outDown = (c0 > maxYpx) && (c1 > maxYpx);
+          bool outUp = (c0 < minYpx) && (c1 < minYpx);
+          if (!outUp && !outDown) {
+            if (c1 != c0) {
+              if (c0 < minYpx) {
+                x0 = (int)(((float)(minYpx - c0)) / ((float)(c1 - c0)) * static_cast<float>(x1 - x0)) + x0;
+                c0 = minYpx;
+              }
+              if (c0 > maxYpx) {
+                x0 = (int)(((float)(maxYpx - c0)) / ((float)(c1 - c0)) * static_cast<float>(x1 - x0)) + x0;
+                c0 = maxYpx;
+              }
+              if (c1 < minYpx) {
+                x1 = (int)(((float)(minYpx - c0)) / ((float)(c1 - c0)) * static_cast<float>(x1 - x0)) + x0;
+                c1 = minYpx;
+              }
+              if (c1 > maxYpx) {
+                x1 = (int)(((float)(maxYpx - c0)) / ((float)(c1 - c0)) * static_cast<float>(x1 - x0)) + x0;
+                // wxLogDebug(wxT("old x0 = %d, old x1 = %d, new x1 = %d, c0 =
+                // %d, c1 = %d, maxYpx = %d"), x0, x1, newX1, c0, c1, maxYpx);
+                // x1 = newX1;
+                c1 = maxYpx;
+              }
+            }
+            if (x1 != x0) {
+              if (x0 < startPx) {
+                c0 = (int)(((float)(startPx - x0)) / ((float)(x1 - x0)) * static_cast<float>(c1 - c0)) + c0;
+                x0 = startPx;
+              }
+              if (x1 > endPx) {
+                c1 = (int)(((float)(endPx - x0)) / ((float)(x1 - x0)) * static_cast<float>(c1 - c0)) + c0;
+                x1 = endPx;
+              }
+            }
+            const bool outArea = cull && ((x0 < area.GetLeft() && x1 < area.GetLeft()) ||
+                                          (x0 > area.GetRight() && x1 > area.GetRight()) ||
+                                          (c0 < area.GetTop() && c1 < area.GetTop()) ||
+                                          (c0 > area.GetBottom() && c1 > area.GetBottom()));
+            if (!outArea) {
+              if (line.empty() || line.back() != wxPoint(x0, c0)) {
+                draw(line.data(), line.size());
+                line.assign(1, wxPoint(x0, c0));
+              }
+              line.push_back(wxPoint(x1, c1));
+            }
+            UpdateViewBoundary(x1, c1);
+          }
+        }
+        x0 = x1;
+        c0 = c1;
+      }
+      // Keep the polyline short, restarting it from its last point
+      if (line.size() >= mpFXY_CHUNK_SIZE) {
+        draw(line.data(), line.size());
+        line.erase(line.begin(), line.end() - 1);
+      }
+    }
+    draw(line.data(), line.size());
+  }
+}
+
+void mpFXY::Plot(wxDC &dc, mpPlotView &w) {
+  mpDCRenderer r(dc);
+  Render(r, w);
+}
+
+void mpFXY::Render(mpRenderer &r, mpPlotView &w) {
+  if (m_visible) {
+    r.SetPen(m_pen);
+
+    const double *xs, *ys;
+    double x = 0, y = 0;
+    // Do this to reset the counters to evaluate bounding box for label positioning
+    Rewind();
+    if (!SupportsChunks())
+      GetNextXY(x, y);
+    else if (GetChunk(0, 1, xs, ys) > 0) {
+      x = xs[0];
+      y = ys[0];
+    }
+    maxDrawX = static_cast<int>(x);
+    minDrawX = static_cast<int>(x);
+    maxDrawY = static_cast<int>(y);
+    minDrawY = static_cast<int>(y);
+    Rewind();
+
+    if (m_rasterTiles != 0)
+      PlotRaster(r, w);
+    else
+      TraceLocus(w, r.GetVisibleArea(), [this, &r](const wxPoint *points, size_t count) {
+        if (m_continuous)
+          r.DrawLines(points, count);
+        else
+          r.DrawPoints(points, count);
+      });
+
+    if (!m_name.IsEmpty() && m_showName) {
+      r.SetFont(m_font);
+
+      wxCoord tx, ty;
+      r.GetTextExtent(m_name, &tx, &ty);
+
+      // xxx implement else ... if (!HasBBox())
+      {
+        if ((m_flags & mpALIGNMASK) == mpALIGN_NW) {
+          tx = minDrawX + 8;
+          ty = maxDrawY + 8;
+        } else if ((m_flags & mpALIGNMASK) == mpALIGN_NE) {
+          tx = maxDrawX - tx - 8;
+          ty = maxDrawY + 8;
+        } else if ((m_flags & mpALIGNMASK) == mpALIGN_SE) {
+          tx = maxDrawX - tx - 8;
+          ty = minDrawY - ty - 8;
+        } else {  // mpALIGN_SW
+          tx = minDrawX + 8;
+          ty = minDrawY - ty - 8;
+        }
+      }
+
+      r.DrawText(m_name, tx, ty);
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// mpProfile implementation
+//-----------------------------------------------------------------------------
+
+IMPLEMENT_ABSTRACT_CLASS(mpProfile, mpLayer)
+
+mpProfile::mpProfile(wxString name, int flags) {
+  SetName(name);
+  m_flags = flags;
+  m_type = mpLAYER_PLOT;
+}
+
+void mpProfile::Plot(wxDC &dc, mpPlotView &w) {
+  mpDCRenderer r(dc);
+  Render(r, w);
+}
+
+void mpProfile::Render(mpRenderer &r, mpPlotView &w) {
+  if (m_visible) {
+    r.SetPen(m_pen);
+
+    wxCoord startPx = m_drawOutsideMargins ? 0 : w.GetMarginLeft();
+    wxCoord endPx = m_drawOutsideMargins ? w.GetScrX() : w.GetScrX() - w.GetMarginRight();
+    wxCoord minYpx = m_drawOutsideMargins ? 0 : w.GetMarginTop();
+    wxCoord maxYpx = m_drawOutsideMargins ? w.GetScrY() : w.GetScrY() - w.GetMarginBottom();
+
+    // Plot profile linking subsequent point of the profile, instead of mpFY,
+    // which plots simple points.
+    std::vector<wxPoint> points;
+    for (wxCoord i = startPx; i <= endPx && endPx > startPx; ++i) {
+      wxCoord c = w.y2p(GetY(w.p2x(i)));
+      if (!m_drawOutsideMargins) c = (c <= maxYpx) ? ((c >= minYpx) ? c : minYpx) : maxYpx;
+      points.push_back(wxPoint(i, c));
+    }
+    mpSTATS_COUNT(pointsVisited, points.size());
+    r.DrawLines(points.data(), points.size());
+
+    if (!m_name.IsEmpty()) {
+      r.SetFont(m_font);
+
+      wxCoord tx, ty;
+      r.GetTextExtent(m_name, &tx, &ty);
+
+      if ((m_flags & mpALIGNMASK) == mpALIGN_RIGHT) {
+        tx = (w.GetScrX() - tx) - w.GetMarginRight() - 8;
+      } else if ((m_flags & mpALIGNMASK) == mpALIGN_CENTER) {
+        tx = ((w.GetScrX() - w.GetMarginRight() - w.GetMarginLeft() - tx) / 2) + w.GetMarginLeft();
+      } else {
+        tx = w.GetMarginLeft() + 8;
+      }
+
+      r.DrawText(m_name, tx, w.y2p(GetY(w.p2x(tx))));
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// mpExpression implementation
+//-----------------------------------------------------------------------------
+
+// Number of arguments processed by each pass of mpExpression::EvalBatch
+#define mpEXPRESSION_BLOCK 256
+
+// Maximum evaluation stack depth (i.e. nesting) of an expression
+#define mpEXPRESSION_MAX_DEPTH 64
+
+// Maximum nesting of parentheses, signs, powers and function calls while
+// parsing, which bounds the recursion of the parser
+#define mpEXPRESSION_MAX_NESTING 100
+
+// Maximum height of the syntax tree, which bounds the recursion of the code
+// generation and of the destruction of the tree
+#define mpEXPRESSION_MAX_HEIGHT 1000
+
+// Syntax tree node, only used while compiling. Leaves are opX and opConst,
+// binary operators use both children, unary ones only lhs.
+struct mpExpressionNode {
+  mpExpression::Opcode op;
+  double value;
+  size_t height;  // Number of nodes on the longest path to a leaf
+  std::unique_ptr<mpExpressionNode> lhs, rhs;
+};
+
+// Apply an operation to scalar operands: shared by the constant folding and
+// the single argument evaluation, so that both give the same results.
+static double mpExpressionApply(mpExpression::Opcode op, double a, double b) {
+  switch (op) {
+    case mpExpression::opAdd:
+    case mpExpression::opAddC:
+      return a + b;
+    case mpExpression::opSub:
+    case mpExpression::opSubC:
+      return a - b;
+    case mpExpression::opRSubC:
+      return b - a;
+    case mpExpression::opMul:
+    case mpExpression::opMulC:
+      return a * b;
+    case mpExpression::opDiv:
+    case mpExpression::opDivC:
+      return a / b;
+    case mpExpression::opRDivC:
+      return b / a;
+    case mpExpression::opPow:
+    case mpExpression::opPowC:
+      return pow(a, b);
+    case mpExpression::opRPowC:
+      return pow(b, a);
+    case mpExpression::opAtan2:
+      return atan2(a, b);
+    case mpExpression::opMin:
+      return (b < a) ? b : a;
+    case mpExpression::opMax:
+      return (b > a) ? b : a;
+    case mpExpression::opSqr:
+      return a * a;
+    case mpExpression::opNeg:
+      return -a;
+    case mpExpression::opSin:
+      return sin(a);
+    case mpExpression::opCos:
+      return cos(a);
+    case mpExpression::opTan:
+      return tan(a);
+    case mpExpression::opAsin:
+      return asin(a);
+    case mpExpression::opAcos:
+      return acos(a);
+    case mpExpression::opAtan:
+      return atan(a);
+    case mpExpression::opSinh:
+      return sinh(a);
+    case mpExpression::opCosh:
+      return cosh(a);
+    case mpExpression::opTanh:
+      return tanh(a);
+    case mpExpression::opExp:
+      return exp(a);
+    case mpExpression::opLog:
+      return log(a);
+    case mpExpression::opLog10:
+      return log10(a);
+    case mpExpression::opSqrt:
+      return sqrt(a);
+    case mpExpression::opAbs:
+      return fabs(a);
+    case mpExpression::opFloor:
+      return floor(a);
+    case mpExpression::opCeil:
+      return ceil(a);
+    default:
+      return a;
+  }
+}
+
+// Recursive descent parser building a constant-folded syntax tree:
+//   sum     := product (('+' | '-') product)*
+//   product := unary (('*' | '/') unary)*
+//   unary   := ('-' | '+') unary | power
+//   power   := primary ('^' unary)?
+//   primary := number | name | name '(' sum (',' sum)? ')' | '(' sum ')'
+class mpExpressionParser {
+ public:
+  mpExpressionParser(const std::string &text) : m_text(text), m_pos(0), m_nesting(0) {}
+
+  std::unique_ptr<mpExpressionNode> Parse() {
+    std::unique_ptr<mpExpressionNode> root = ParseSum();
+    SkipBlanks();
+    if (root && m_pos < m_text.size()) return Fail(_("unexpected character"));
+    return root;
+  }
+
+  wxString m_error;  // Error description, empty on success
+
+ private:
+  std::unique_ptr<mpExpressionNode> Fail(const wxString &what) {
+    if (m_error.IsEmpty()) m_error.Printf(_("%s at position %d"), what, (int)m_pos + 1);
+    return nullptr;
+  }
+
+  void SkipBlanks() {
+    while (m_pos < m_text.size() && isspace((unsigned char)m_text[m_pos])) m_pos++;
+  }
+
+  bool Accept(char c) {
+    SkipBlanks();
+    if (m_pos < m_text.size() && m_text[m_pos] == c) {
+      m_pos++;
+      return true;
+    }
+    return false;
+  }
+
+  static std::unique_ptr<mpExpressionNode> Leaf(mpExpression::Opcode op, double value) {
+    std::unique_ptr<mpExpressionNode> n(new mpExpressionNode);
+    n->op = op;
+    n->value = value;
+    n->height = 1;
+    return n;
+  }
+
+  // Build an operator node, folding it into a constant when all its operands
+  // are constants. Fails when the tree gets too high, as with long chains of
+  // operators: the operands are then destroyed while still low enough.
+  std::unique_ptr<mpExpressionNode> Node(mpExpression::Opcode op, std::unique_ptr<mpExpressionNode> lhs,
+                                         std::unique_ptr<mpExpressionNode> rhs = nullptr) {
+    if (lhs->op == mpExpression::opConst && (!rhs || rhs->op == mpExpression::opConst))
+      return Leaf(mpExpression::opConst, mpExpressionApply(op, lhs->value, rhs ? rhs->value : 0));
+    const size_t height = 1 + ((rhs && rhs->height > lhs->height) ? rhs->height : lhs->height);
+    if (height > mpEXPRESSION_MAX_HEIGHT) return Fail(_("expression too long"));
+    std::unique_ptr<mpExpressionNode> n = Leaf(op, 0);
+    n->height = height;
+    n->lhs = std::move(lhs);
+    n->rhs = std::move(rhs);
+    return n;
+  }
+
+  std::unique_ptr<mpExpressionNode> ParseSum() {
+    std::unique_ptr<mpExpressionNode> lhs = ParseProduct();
+    while (lhs) {
+      mpExpression::Opcode op;
+      if (Accept('+'))
+        op = mpExpression::opAdd;
+      else if (Accept('-'))
+        op = mpExpression::opSub;
+      else
+        break;
+      std::unique_ptr<mpExpressionNode> rhs = ParseProduct();
+      if (!rhs) return nullptr;
+      lhs = Node(op, std::move(lhs), std::move(rhs));
+      if (!lhs) return nullptr;
+    }
+    return lhs;
+  }
+
+  std::unique_ptr<mpExpressionNode> ParseProduct() {
+    std::unique_ptr<mpExpressionNode> lhs = ParseUnary();
+    while (lhs) {
+      mpExpression::Opcode op;
+      if (Accept('*'))
+        op = mpExpression::opMul;
+      else if (Accept('/'))
+        op = mpExpression::opDiv;
+      else
+        break;
+      std::unique_ptr<mpExpressionNode> rhs = ParseUnary();
+      if (!rhs) return nullptr;
+      lhs = Node(op, std::move(lhs), std::move(rhs));
+      if (!lhs) return nullptr;
+    }
+    return lhs;
+  }
+
+  // Every recursion of the parser goes through ParseUnary, which counts the nesting
+  std::unique_ptr<mpExpressionNode> ParseUnary() {
+    if (m_nesting >= mpEXPRESSION_MAX_NESTING) return Fail(_("expression too deeply nested"));
+    m_nesting++;
+    std::unique_ptr<mpExpressionNode> n;
+    if (Accept('-')) {
+      std::unique_ptr<mpExpressionNode> arg = ParseUnary();
+      if (arg) n = Node(mpExpression::opNeg, std::move(arg));
+    } else if (Accept('+')) {
+      n = ParseUnary();
+    } else {
+      n = ParsePower();
+    }
+    m_nesting--;
+    return n;
+  }
+
+  std::unique_ptr<mpExpressionNode> ParsePower() {
+    std::unique_ptr<mpExpressionNode> base = ParsePrimary();
+    if (base && Accept('^')) {
+      // Right associative, and binding tighter than unary minus on its left:
+      // -x^2 is -(x^2), 2^-x is 2^(-x).
+      std::unique_ptr<mpExpressionNode> exponent = ParseUnary();
+      if (!exponent) return nullptr;
+      return Node(mpExpression::opPow, std::move(base), std::move(exponent));
+    }
+    return base;
+  }
+
+  std::unique_ptr<mpExpressionNode> ParsePrimary() {
+    SkipBlanks();
+    if (m_pos >= m_text.size()) return Fail(_("unexpected end of expression"));
+
+    if (Accept('(')) {
+      std::unique_ptr<mpExpressionNode> inner = ParseSum();
+      if (!inner) return nullptr;
+      if (!Accept(')')) return Fail(_("missing ')'"));
+      return inner;
+    }
+
+    const char c = m_text[m_pos];
+    if (isdigit((unsigned char)c) || c == '.') {
+      // std::from_chars does not depend on the current locale decimal point
+      double value = 0;
+      std::from_chars_result res = std::from_chars(m_text.data() + m_pos, m_text.data() + m_text.size(), value);
+      if (res.ec != std::errc()) return Fail(_("invalid number"));
+      m_pos = (size_t)(res.ptr - m_text.data());
+      return Leaf(mpExpression::opConst, value);
+    }
+
+    if (!isalpha((unsigned char)c)) return Fail(_("unexpected character"));
+    size_t start = m_pos;
+    while (m_pos < m_text.size() && (isalnum((unsigned char)m_text[m_pos]) || m_text[m_pos] == '_')) m_pos++;
+    const std::string name = m_text.substr(start, m_pos - start);
+
+    if (name == "x") return Leaf(mpExpression::opX, 0);
+    if (name == "pi") return Leaf(mpExpression::opConst, M_PI);
+    if (name == "e") return Leaf(mpExpression::opConst, M_E);
+
+    static const struct {
+      const char *name;
+      mpExpression::Opcode op;
+      int args;
+    } functions[] = {{"sin", mpExpression::opSin, 1},     {"cos", mpExpression::opCos, 1},
+                     {"tan", mpExpression::opTan, 1},     {"asin", mpExpression::opAsin, 1},
+                     {"acos", mpExpression::opAcos, 1},   {"atan", mpExpression::opAtan, 1},
+                     {"sinh", mpExpression::opSinh, 1},   {"cosh", mpExpression::opCosh, 1},
+                     {"tanh", mpExpression::opTanh, 1},   {"exp", mpExpression::opExp, 1},
+                     {"log", mpExpression::opLog, 1},     {"ln", mpExpression::opLog, 1},
+                     {"log10", mpExpression::opLog10, 1}, {"sqrt", mpExpression::opSqrt, 1},
+                     {"abs", mpExpression::opAbs, 1},     {"floor", mpExpression::opFloor, 1},
+                     {"ceil", mpExpression::opCeil, 1},   {"pow", mpExpression::opPow, 2},
+                     {"atan2", mpExpression::opAtan2, 2}, {"min", mpExpression::opMin, 2},
+                     {"max", mpExpression::opMax, 2}};
+    for (size_t f = 0; f < sizeof(functions) / sizeof(functions[0]); ++f) {
+      if (name != functions[f].name) continue;
+      if (!Accept('(')) return Fail(_("missing '(' after function name"));
+      std::unique_ptr<mpExpressionNode> arg0 = ParseSum();
+      if (!arg0) return nullptr;
+      std::unique_ptr<mpExpressionNode> arg1;
+      if (functions[f].args == 2) {
+        if (!Accept(',')) return Fail(_("missing second function argument"));
+        arg1 = ParseSum();
+        if (!arg1) return nullptr;
+      }
+      if (!Accept(')')) return Fail(_("missing ')'"));
+      return Node(functions[f].op, std::move(arg0), std::move(arg1));
+    }
+    m_pos = start;
+    return Fail(_("unknown name"));
+  }
+
+  std::string m_text;
+  size_t m_pos;
+  size_t m_nesting;  // Calls of ParseUnary in progress
+};
+
+// Generate the bytecode of a syntax tree. Constant operands of binary
+// operators are merged into the instruction, which saves both a stack slot
+// and a whole pass over the batch.
+static void mpExpressionEmit(const mpExpressionNode &n, std::vector<mpExpression::Instruction> &program, size_t &depth,
+                             size_t &maxDepth) {
+  mpExpression::Instruction ins;
+  ins.op = n.op;
+  ins.value = n.value;
+
+  if (n.op == mpExpression::opX || n.op == mpExpression::opConst) {
+    program.push_back(ins);
+    if (++depth > maxDepth) maxDepth = depth;
+    return;
+  }
+  if (!n.rhs) {
+    mpExpressionEmit(*n.lhs, program, depth, maxDepth);
+    program.push_back(ins);
+    return;
+  }
+
+  const bool rhsConst = n.rhs->op == mpExpression::opConst;
+  const bool lhsConst = n.lhs->op == mpExpression::opConst;
+  mpExpression::Opcode withConst = n.op;
+  mpExpression::Opcode withConstLeft = n.op;
+  switch (n.op) {
+    case mpExpression::opAdd:
+      withConst = withConstLeft = mpExpression::opAddC;
+      break;
+    case mpExpression::opSub:
+      withConst = mpExpression::opSubC;
+      withConstLeft = mpExpression::opRSubC;
+      break;
+    case mpExpression::opMul:
+      withConst = withConstLeft = mpExpression::opMulC;
+      break;
+    case mpExpression::opDiv:
+      withConst = mpExpression::opDivC;
+      withConstLeft = mpExpression::opRDivC;
+      break;
+    case mpExpression::opPow:
+      withConst = mpExpression::opPowC;
+      withConstLeft = mpExpression::opRPowC;
+      break;
+    default:
+      break;
+  }
+
+  if (rhsConst && withConst != n.op) {
+    mpExpressionEmit(*n.lhs, program, depth, maxDepth);
+    ins.op = (withConst == mpExpression::opPowC && n.rhs->value == 2) ? mpExpression::opSqr : withConst;
+    ins.value = n.rhs->value;
+    program.push_back(ins);
+  } else if (lhsConst && withConstLeft != n.op) {
+    mpExpressionEmit(*n.rhs, program, depth, maxDepth);
+    ins.op = withConstLeft;
+    ins.value = n.lhs->value;
+    program.push_back(ins);
+  } else {
+    mpExpressionEmit(*n.lhs, program, depth, maxDepth);
+    mpExpressionEmit(*n.rhs, program, depth, maxDepth);
+    program.push_back(ins);
+    depth--;
+  }
+}
+
+mpExpression::mpExpression() : m_depth(0) {}
+
+mpExpression::mpExpression(const wxString &expr) : m_depth(0) { Compile(expr); }
+
+bool mpExpression::Compile(const wxString &expr) {
+  m_expression = expr;
+  m_error.Clear();
+  m_program.clear();
+  m_depth = 0;
+
+  mpExpressionParser parser(std::string(expr.utf8_str()));
+  std::unique_ptr<mpExpressionNode> root = parser.Parse();
+  if (!root) {
+    m_error = parser.m_error;
+    return false;
+  }
+
+  std::vector<Instruction> program;
+  size_t depth = 0, maxDepth = 0;
+  mpExpressionEmit(*root, program, depth, maxDepth);
+  if (maxDepth > mpEXPRESSION_MAX_DEPTH) {
+    m_error = _("expression too deeply nested");
+    return false;
+  }
+  m_program.swap(program);
+  m_depth = maxDepth;
+  return true;
+}
+
+double mpExpression::Eval(double x) const {
+  if (m_program.empty()) return NAN;
+
+  double stack[mpEXPRESSION_MAX_DEPTH];
+  size_t sp = 0;
+  for (std::vector<Instruction>::const_iterator it = m_program.begin(); it != m_program.end(); ++it) {
+    switch (it->op) {
+      case opX:
+        stack[sp++] = x;
+        break;
+      case opConst:
+        stack[sp++] = it->value;
+        break;
+      case opAdd:
+      case opSub:
+      case opMul:
+      case opDiv:
+      case opPow:
+      case opAtan2:
+      case opMin:
+      case opMax:
+        sp--;
+        stack[sp - 1] = mpExpressionApply(it->op, stack[sp - 1], stack[sp]);
+        break;
+      default:
+        stack[sp - 1] = mpExpressionApply(it->op, stack[sp - 1], it->value);
+        break;
+    }
+  }
+  return stack[0];
+}
+
+// Loops of mpExpression::EvalBatch: "a" is the topmost block, "b" the one
+// below it for binary operators, "k" the instruction constant.
+#define mpEXPR_LOOP(statement)                \
+  for (size_t i = 0; i < len; ++i) {          \
+    statement;                                \
+  }
+#define mpEXPR_UNARY(function) mpEXPR_LOOP(a[i] = function(a[i]))
+#define mpEXPR_BINARY(expr)                   \
+  {                                           \
+    double *b = a - mpEXPRESSION_BLOCK;       \
+    mpEXPR_LOOP(b[i] = (expr));               \
+    a = b;                                    \
+    sp--;                                     \
+  }
+
+void mpExpression::EvalBatch(const double *xs, double *ys, size_t n) const {
+  if (m_program.empty()) {
+    for (size_t i = 0; i < n; ++i) ys[i] = NAN;
+    return;
+  }
+
+  std::vector<double> stack(m_depth * mpEXPRESSION_BLOCK);
+  for (size_t start = 0; start < n; start += mpEXPRESSION_BLOCK) {
+    const size_t len = (n - start < mpEXPRESSION_BLOCK) ? n - start : mpEXPRESSION_BLOCK;
+    const double *x = xs + start;
+    double *a = NULL;  // Topmost block of the stack
+    size_t sp = 0;
+
+    for (std::vector<Instruction>::const_iterator it = m_program.begin(); it != m_program.end(); ++it) {
+      const double k = it->value;
+      switch (it->op) {
+        case opX:
+          a = &stack[mpEXPRESSION_BLOCK * sp++];
+          mpEXPR_LOOP(a[i] = x[i]);
+          break;
+        case opConst:
+          a = &stack[mpEXPRESSION_BLOCK * sp++];
+          mpEXPR_LOOP(a[i] = k);
+          break;
+        case opAdd:
+          mpEXPR_BINARY(b[i] + a[i]);
+          break;
+        case opSub:
+          mpEXPR_BINARY(b[i] - a[i]);
+          break;
+        case opMul:
+          mpEXPR_BINARY(b[i] * a[i]);
+          break;
+        case opDiv:
+          mpEXPR_BINARY(b[i] / a[i]);
+          break;
+        case opPow:
+          mpEXPR_BINARY(pow(b[i], a[i]));
+          break;
+        case opAtan2:
+          mpEXPR_BINARY(atan2(b[i], a[i]));
+          break;
+        case opMin:
+          mpEXPR_BINARY((a[i] < b[i]) ? a[i] : b[i]);
+          break;
+        case opMax:
+          mpEXPR_BINARY((a[i] > b[i]) ? a[i] : b[i]);
+          break;
+        case opAddC:
+          mpEXPR_LOOP(a[i] += k);
+          break;
+        case opSubC:
+          mpEXPR_LOOP(a[i] -= k);
+          break;
+        case opRSubC:
+          mpEXPR_LOOP(a[i] = k - a[i]);
+          break;
+        case opMulC:
+          mpEXPR_LOOP(a[i] *= k);
+          break;
+        case opDivC:
+          mpEXPR_LOOP(a[i] /= k);
+          break;
+        case opRDivC:
+          mpEXPR_LOOP(a[i] = k / a[i]);
+          break;
+        case opPowC:
+          mpEXPR_LOOP(a[i] = pow(a[i], k));
+          break;
+        case opRPowC:
+          mpEXPR_LOOP(a[i] = pow(k, a[i]));
+          break;
+        case opSqr:
+          mpEXPR_LOOP(a[i] *= a[i]);
+          break;
+        case opNeg:
+          mpEXPR_LOOP(a[i] = -a[i]);
+          break;
+        case opSin:
+          mpEXPR_UNARY(sin);
+          break;
+        case opCos:
+          mpEXPR_UNARY(cos);
+          break;
+        case opTan:
+          mpEXPR_UNARY(tan);
+          break;
+        case opAsin:
+          mpEXPR_UNARY(asin);
+          break;
+        case opAcos:
+          mpEXPR_UNARY(acos);
+          break;
+        case opAtan:
+          mpEXPR_UNARY(atan);
+          break;
+        case opSinh:
+          mpEXPR_UNARY(sinh);
+          break;
+        case opCosh:
+          mpEXPR_UNARY(cosh);
+          break;
+        case opTanh:
+          mpEXPR_UNARY(tanh);
+          break;
+        case opExp:
+          mpEXPR_UNARY(exp);
+          break;
+        case opLog:
+          mpEXPR_UNARY(log);
+          break;
+        case opLog10:
+          mpEXPR_UNARY(log10);
+          break;
+        case opSqrt:
+          mpEXPR_UNARY(sqrt);
+          break;
+        case opAbs:
+          mpEXPR_UNARY(fabs);
+          break;
+        case opFloor:
+          mpEXPR_UNARY(floor);
+          break;
+        case opCeil:
+          mpEXPR_UNARY(ceil);
+          break;
+      }
+    }
+    double *y = ys + start;
+    mpEXPR_LOOP(y[i] = a[i]);
+  }
+}
+
+#undef mpEXPR_LOOP
+#undef mpEXPR_UNARY
+#undef mpEXPR_BINARY
+
+IMPLEMENT_DYNAMIC_CLASS(mpFXExpression, mpFX)
+
+mpFXExpression::mpFXExpression(const wxString &expr, wxString name, int flags)
+    : mpFX(name.IsEmpty() ? expr : name, flags) {
+  if (!expr.IsEmpty()) SetExpression(expr);
+}
+
+bool mpFXExpression::SetExpression(const wxString &expr) {
+  if (!m_expression.Compile(expr)) {
+    wxLogError(_("wxMathPlot error: invalid expression \"%s\": %s"), expr, m_expression.GetError());
+    return false;
+  }
+  return true;
+}
+
+double mpFXExpression::GetY(double x) { return m_expression.Eval(x); }
+
+void mpFXExpression::GetYs(const double *xs, double *ys, size_t n) { m_expression.EvalBatch(xs, ys, n); }
+
+void mpFXExpression::Render(mpRenderer &r, mpPlotView &w) {
+  if (m_expression.IsOk()) mpFX::Render(r, w);
+}
+
+//-----------------------------------------------------------------------------
+// mpLayer implementations - furniture (scales, ...)
+//-----------------------------------------------------------------------------
+
+#define mpLN10 2.3025850929940456840179914546844
+
+IMPLEMENT_DYNAMIC_CLASS(mpScaleX, mpLayer)
+
+mpScaleX::mpScaleX(wxString name, int flags, bool ticks, unsigned int type) {
+  SetName(name);
+  SetFont((wxFont &)*wxSMALL_FONT);
+  SetPen((wxPen &)*wxGREY_PEN);
+  m_flags = flags;
+  m_ticks = ticks;
+  m_labelType = type;
+  m_type = mpLAYER_AXIS;
+  m_labelFormat = wxT("");
+}
+
+void mpScaleX::Plot(wxDC &dc, mpPlotView &w) {
+  mpDCRenderer r(dc);
+  Render(r, w);
+}
+
+void mpScaleX::Render(mpRenderer &r, mpPlotView &w) {
+  if (m_visible) {
+    r.SetPen(m_pen);
+    r.SetFont(m_font);
+    int orgy = 0;
+
+    const int extend = w.GetScrX();
+    if (m_flags == mpALIGN_CENTER) {
+      orgy = w.y2p(0);
+    }
+
+    if (m_flags == mpALIGN_TOP) {
+      if (m_drawOutsideMargins)
+        orgy = X_BORDER_SEPARATION;
+      else
+        orgy = w.GetMarginTop();
+    }
+    if (m_flags == mpALIGN_BOTTOM) {
+      if (m_drawOutsideMargins)
+        orgy = X_BORDER_SEPARATION;
+      else
+        orgy = w.GetScrY() - w.GetMarginBottom();
+    }
+
+    if (m_flags == mpALIGN_BORDER_BOTTOM) orgy = w.GetScrY() - 1;
+    if (m_flags == mpALIGN_BORDER_TOP) orgy = 1;
+
+    r.DrawLine(0, orgy, w.GetScrX(), orgy);
+
+    const double dig = floor(log(128.0 / w.GetScaleX()) / mpLN10);
+    const double step = exp(mpLN10 * dig);
+    const double end = w.GetPosX() + (double)extend / w.GetScaleX();
+
+    wxCoord tx, ty;
+    wxString s;
+    wxString fmt;
+    int tmp = (int)dig;
+    if (m_labelType == mpX_NORMAL) {
+      if (!m_labelFormat.IsEmpty()) {
+        fmt = m_labelFormat;
+      } else {
+        if (tmp >= 1) {
+          fmt = wxT("%.f");
+        } else {
+          tmp = 8 - tmp;
+          fmt.Printf(wxT("%%.%df"), tmp >= -1 ? 2 : -tmp);
+        }
+      }
+    } else {
+      // Date and/or time axis representation
+      if (m_labelType == mpX_DATETIME) {
+        fmt = (wxT("%04.0f-%02.0f-%02.0fT%02.0f:%02.0f:%02.0f"));
+      } else if (m_labelType == mpX_DATE) {
+        fmt = (wxT("%04.0f-%02.0f-%02.0f"));
+      } else if ((m_labelType == mpX_TIME) && (end / 60 < 2)) {
+        fmt = (wxT("%02.0f:%02.3f"));
+      } else {
+        fmt = (wxT("%02.0f:%02.0f:%02.0f"));
+      }
+    }
+
+    // double n = floor( (w.GetPosX() - (double)extend / w.GetScaleX()) / step )
+    // * step ;
+    double n0 =
+        floor((w.GetPosX() /* - (double)(extend - w.GetMarginLeft() - w.GetMarginRight())/ w.GetScaleX() */) / step) *
+        step;
+    double n = 0;
+
+    wxCoord startPx = m_drawOutsideMargins ? 0 : w.GetMarginLeft();
+    wxCoord endPx = m_drawOutsideMargins ? w.GetScrX() : w.GetScrX() - w.GetMarginRight();
+    wxCoord minYpx = m_drawOutsideMargins ? 0 : w.GetMarginTop();
+    wxCoord maxYpx = m_drawOutsideMargins ? w.GetScrY() : w.GetScrY() - w.GetMarginBottom();
+
+    int labelH = 0;  // Control labels heigth to decide where to put axis name
+                     // (below labels or on top of axis)
     int maxExtent = 0;
     for (n = n0; n < end; n += step) {
       const int p = (int)((n - w.GetPosX()) * w.GetScaleX());
       if ((p >= startPx) && (p <= endPx)) {
         if (m_ticks) {  // draw axis ticks
           if (m_flags == mpALIGN_BORDER_BOTTOM)
-            dc.DrawLine(p, orgy, p, orgy - 4);
+            r.DrawLine(p, orgy, p, orgy - 4);
           else
-            dc.DrawLine(p, orgy, p, orgy + 4);
+            r.DrawLine(p, orgy, p, orgy + 4);
         } else {  // draw grid dotted lines
           m_pen.SetStyle(wxPENSTYLE_DOT);
-          dc.SetPen(m_pen);
+          r.SetPen(m_pen);
           if ((m_flags == mpALIGN_BOTTOM) && !m_drawOutsideMargins) {
-            dc.DrawLine(p, orgy + 4, p, minYpx);
+            r.DrawLine(p, orgy + 4, p, minYpx);
           } else {
             if ((m_flags == mpALIGN_TOP) && !m_drawOutsideMargins) {
-              dc.DrawLine(p, orgy - 4, p, maxYpx);
+              r.DrawLine(p, orgy - 4, p, maxYpx);
             } else {
-              dc.DrawLine(p, 0 /*-w.GetScrY()*/, p, w.GetScrY());
+              r.DrawLine(p, 0 /*-w.GetScrY()*/, p, w.GetScrY());
             }
           }
           m_pen.SetStyle(wxPENSTYLE_SOLID);
-          dc.SetPen(m_pen);
+          r.SetPen(m_pen);
         }
         // Write ticks labels in s string
         if (m_labelType == mpX_NORMAL)
@@ -713,7 +3311,7 @@ void mpScaleX::Plot(wxDC &dc, mpWindow &w) {
           else
             s.Printf(fmt, sign * mm, ss);
         }
-        dc.GetTextExtent(s, &tx, &ty);
+        r.GetTextExtent(s, &tx, &ty);
         labelH = (labelH <= ty) ? ty : labelH;
         maxExtent = (tx > maxExtent) ? tx : maxExtent;  // Keep in mind max label width
       }
@@ -747,40 +3345,192 @@ void mpScaleX::Plot(wxDC &dc, mpWindow &w) {
           else
             s.Printf(fmt, sign * mm, ss);
         }
-        dc.GetTextExtent(s, &tx, &ty);
+        r.GetTextExtent(s, &tx, &ty);
         if ((m_flags == mpALIGN_BORDER_BOTTOM) || (m_flags == mpALIGN_TOP)) {
-          dc.DrawText(s, p - tx / 2, orgy - 4 - ty);
+          r.DrawText(s, p - tx / 2, orgy - 4 - ty);
+        } else {
+          r.DrawText(s, p - tx / 2, orgy + 4);
+        }
+      }
+    }
+
+    // Draw axis name
+    r.GetTextExtent(m_name, &tx, &ty);
+    switch (m_flags) {
+      case mpALIGN_BORDER_BOTTOM:
+        r.DrawText(m_name, extend - tx - 4, orgy - 8 - ty - labelH);
+        break;
+      case mpALIGN_BOTTOM: {
+        if ((!m_drawOutsideMargins) && (w.GetMarginBottom() > (ty + labelH + 8))) {
+          r.DrawText(m_name, (endPx - startPx - tx) >> 1, orgy + 6 + labelH);
+        } else {
+          r.DrawText(m_name, extend - tx - 4, orgy - 4 - ty);
+        }
+      } break;
+      case mpALIGN_CENTER:
+        r.DrawText(m_name, extend - tx - 4, orgy - 4 - ty);
+        break;
+      case mpALIGN_TOP: {
+        if ((!m_drawOutsideMargins) && (w.GetMarginTop() > (ty + labelH + 8))) {
+          r.DrawText(m_name, (endPx - startPx - tx) >> 1, orgy - 6 - ty - labelH);
+        } else {
+          r.DrawText(m_name, extend - tx - 4, orgy + 4);
+        }
+      } break;
+      case mpALIGN_BORDER_TOP:
+        r.DrawText(m_name, extend - tx - 4, orgy + 6 + labelH);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+IMPLEMENT_DYNAMIC_CLASS(mpScaleY, mpLayer)
+
+mpScaleY::mpScaleY(wxString name, int flags, bool ticks) {
+  SetName(name);
+  SetFont((wxFont &)*wxSMALL_FONT);
+  SetPen((wxPen &)*wxGREY_PEN);
+  m_flags = flags;
+  m_ticks = ticks;
+  m_type = mpLAYER_AXIS;
+  m_labelFormat = wxT("");
+}
+
+void mpScaleY::Plot(wxDC &dc, mpPlotView &w) {
+  mpDCRenderer r(dc);
+  Render(r, w);
+}
+
+void mpScaleY::Render(mpRenderer &r, mpPlotView &w) {
+  if (m_visible) {
+    r.SetPen(m_pen);
+    r.SetFont(m_font);
+
+    int orgx = 0;
+    const int extend = w.GetScrY();                  // /2;
+    if (m_flags == mpALIGN_CENTER) orgx = w.x2p(0);  //(int)(w.GetPosX() * w.GetScaleX());
+    if (m_flags == mpALIGN_LEFT) {
+      if (m_drawOutsideMargins)
+        orgx = Y_BORDER_SEPARATION;
+      else
+        orgx = w.GetMarginLeft();
+    }
+    if (m_flags == mpALIGN_RIGHT) {
+      if (m_drawOutsideMargins)
+        orgx = w.GetScrX() - Y_BORDER_SEPARATION;
+      else
+        orgx = w.GetScrX() - w.GetMarginRight();
+    }
+    if (m_flags == mpALIGN_BORDER_RIGHT) orgx = w.GetScrX() - 1;  // r.LogicalToDeviceX(0) - 1;
+    if (m_flags == mpALIGN_BORDER_LEFT) orgx = 1;                 //-r.LogicalToDeviceX(0);
+
+    r.DrawLine(orgx, 0, orgx, extend);
+
+    // To cut the axis line when draw outside margin is false, use this code
+    /* if (m_drawOutsideMargins == true)
+                r.DrawLine( orgx, 0, orgx, extend);
+    else
+                r.DrawLine( orgx, w.GetMarginTop(), orgx, w.GetScrY() -
+    w.GetMarginBottom()); */
+
+    const double dig = floor(log(128.0 / w.GetScaleY()) / mpLN10);
+    const double step = exp(mpLN10 * dig);
+    const double end = w.GetPosY() + (double)extend / w.GetScaleY();
+
+    wxCoord tx, ty;
+    wxString s;
+    wxString fmt;
+    int tmp = (int)dig;
+    double maxScaleAbs = fabs(w.GetDesiredYmax());
+    double minScaleAbs = fabs(w.GetDesiredYmin());
+    double endscale = (maxScaleAbs > minScaleAbs) ? maxScaleAbs : minScaleAbs;
+    if (m_labelFormat.IsEmpty()) {
+      if ((endscale < 1e4) && (endscale > 1e-3))
+        fmt = wxT("%.2f");
+      else
+        fmt = wxT("%.1e");
+    } else {
+      fmt = m_labelFormat;
+    }
+
+    double n =
+        floor((w.GetPosY() - (double)(extend - w.GetMarginTop() - w.GetMarginBottom()) / w.GetScaleY()) / step) * step;
+
+    wxCoord endPx = m_drawOutsideMargins ? w.GetScrX() : w.GetScrX() - w.GetMarginRight();
+    wxCoord minYpx = m_drawOutsideMargins ? 0 : w.GetMarginTop();
+    wxCoord maxYpx = m_drawOutsideMargins ? w.GetScrY() : w.GetScrY() - w.GetMarginBottom();
+
+    tmp = 65536;
+    int labelW = 0;
+    // Before staring cycle, calculate label height
+    int labelHeigth = 0;
+    s.Printf(fmt, n);
+    r.GetTextExtent(s, &tx, &labelHeigth);
+    for (; n < end; n += step) {
+      const int p = (int)((w.GetPosY() - n) * w.GetScaleY());
+      if ((p >= minYpx) && (p <= maxYpx)) {
+        if (m_ticks) {  // Draw axis ticks
+          if (m_flags == mpALIGN_BORDER_LEFT) {
+            r.DrawLine(orgx, p, orgx + 4, p);
+          } else {
+            r.DrawLine(orgx - 4, p, orgx, p);  //( orgx, p, orgx+4, p);
+          }
         } else {
-          dc.DrawText(s, p - tx / 2, orgy + 4);
+          m_pen.SetStyle(wxPENSTYLE_DOT);
+          r.SetPen(m_pen);
+          if ((m_flags == mpALIGN_LEFT) && !m_drawOutsideMargins) {
+            r.DrawLine(orgx - 4, p, endPx, p);
+          } else {
+            if ((m_flags == mpALIGN_RIGHT) && !m_drawOutsideMargins) {
+              r.DrawLine(minYpx, p, orgx + 4, p);
+            } else {
+              r.DrawLine(0 /*-w.GetScrX()*/, p, w.GetScrX(), p);
+            }
+          }
+          m_pen.SetStyle(wxPENSTYLE_SOLID);
+          r.SetPen(m_pen);
+        }
+        // Print ticks labels
+        s.Printf(fmt, n);
+        r.GetTextExtent(s, &tx, &ty);
+        labelW = (labelW <= tx) ? tx : labelW;
+        if ((tmp - p + labelHeigth / 2) > mpMIN_Y_AXIS_LABEL_SEPARATION) {
+          if ((m_flags == mpALIGN_BORDER_LEFT) || (m_flags == mpALIGN_RIGHT))
+            r.DrawText(s, orgx + 4, p - ty / 2);
+          else
+            r.DrawText(s, orgx - 4 - tx, p - ty / 2);  //( s, orgx+4, p-ty/2);
+          tmp = p - labelHeigth / 2;
         }
       }
     }
 
     // Draw axis name
-    dc.GetTextExtent(m_name, &tx, &ty);
+    r.GetTextExtent(m_name, &tx, &ty);
     switch (m_flags) {
-      case mpALIGN_BORDER_BOTTOM:
-        dc.DrawText(m_name, extend - tx - 4, orgy - 8 - ty - labelH);
+      case mpALIGN_BORDER_LEFT:
+        r.DrawText(m_name, labelW + 8, 4);
         break;
-      case mpALIGN_BOTTOM: {
-        if ((!m_drawOutsideMargins) && (w.GetMarginBottom() > (ty + labelH + 8))) {
-          dc.DrawText(m_name, (endPx - startPx - tx) >> 1, orgy + 6 + labelH);
+      case mpALIGN_LEFT: {
+        if ((!m_drawOutsideMargins) && (w.GetMarginLeft() > (ty + labelW + 8))) {
+          r.DrawRotatedText(m_name, orgx - 6 - labelW - ty, (maxYpx - minYpx + tx) >> 1, 90);
         } else {
-          dc.DrawText(m_name, extend - tx - 4, orgy - 4 - ty);
+          r.DrawText(m_name, orgx + 4, 4);
         }
       } break;
       case mpALIGN_CENTER:
-        dc.DrawText(m_name, extend - tx - 4, orgy - 4 - ty);
+        r.DrawText(m_name, orgx + 4, 4);
         break;
-      case mpALIGN_TOP: {
-        if ((!m_drawOutsideMargins) && (w.GetMarginTop() > (ty + labelH + 8))) {
-          dc.DrawText(m_name, (endPx - startPx - tx) >> 1, orgy - 6 - ty - labelH);
+      case mpALIGN_RIGHT: {
+        if ((!m_drawOutsideMargins) && (w.GetMarginRight() > (ty + labelW + 8))) {
+          r.DrawRotatedText(m_name, orgx + 6 + labelW, (maxYpx - minYpx + tx) >> 1, 90);
         } else {
-          dc.DrawText(m_name, extend - tx - 4, orgy + 4);
+          r.DrawText(m_name, orgx - tx - 4, 4);
         }
       } break;
-      case mpALIGN_BORDER_TOP:
-        dc.DrawText(m_name, extend - tx - 4, orgy + 6 + labelH);
+      case mpALIGN_BORDER_RIGHT:
+        r.DrawText(m_name, orgx - 6 - tx - labelW, 4);
         break;
       default:
         break;
@@ -788,151 +3538,406 @@ void mpScaleX::Plot(wxDC &dc, mpWindow &w) {
   }
 }
 
-IMPLEMENT_DYNAMIC_CLASS(mpScaleY, mpLayer)
+//-----------------------------------------------------------------------------
+// mpPlotView
+//-----------------------------------------------------------------------------
 
-mpScaleY::mpScaleY(wxString name, int flags, bool ticks) {
-  SetName(name);
-  SetFont((wxFont &)*wxSMALL_FONT);
-  SetPen((wxPen &)*wxGREY_PEN);
-  m_flags = flags;
-  m_ticks = ticks;
-  m_type = mpLAYER_AXIS;
-  m_labelFormat = wxT("");
+mpPlotView::mpPlotView() {
+  m_scaleX = m_scaleY = 1.0;
+  m_posX = m_posY = 0;
+  m_desiredXmin = m_desiredYmin = 0;
+  m_desiredXmax = m_desiredYmax = 1;
+  m_scrX = m_scrY = 64;
+  m_minX = m_minY = 0;
+  m_maxX = m_maxY = 0;
+  m_threadPool = NULL;
+  m_marginTop = 0;
+  m_marginRight = 0;
+  m_marginBottom = 0;
+  m_marginLeft = 0;
+  m_lockaspect = false;
+  m_bgColour = *wxWHITE;
+  m_fgColour = *wxBLACK;
 }
 
-void mpScaleY::Plot(wxDC &dc, mpWindow &w) {
-  if (m_visible) {
-    dc.SetPen(m_pen);
-    dc.SetFont(m_font);
+mpPlotView::~mpPlotView() {
+  delete m_threadPool;
+  DelAllLayers(true, false);
+}
 
-    int orgx = 0;
-    const int extend = w.GetScrY();                  // /2;
-    if (m_flags == mpALIGN_CENTER) orgx = w.x2p(0);  //(int)(w.GetPosX() * w.GetScaleX());
-    if (m_flags == mpALIGN_LEFT) {
-      if (m_drawOutsideMargins)
-        orgx = Y_BORDER_SEPARATION;
-      else
-        orgx = w.GetMarginLeft();
+void mpPlotView::LockAspect(bool enable) {
+  m_lockaspect = enable;
+
+  // Try to fit again with the new config:
+  Fit(m_desiredXmin, m_desiredXmax, m_desiredYmin, m_desiredYmax);
+}
+
+void mpPlotView::UpdateAll() { UpdateBBox(); }
+
+void mpPlotView::Fit() {
+  if (UpdateBBox()) Fit(m_minX, m_maxX, m_minY, m_maxY);
+}
+
+void mpPlotView::Fit(double xMin, double xMax, double yMin, double yMax, wxCoord *printSizeX, wxCoord *printSizeY) {
+  // Save desired borders:
+  m_desiredXmin = xMin;
+  m_desiredXmax = xMax;
+  m_desiredYmin = yMin;
+  m_desiredYmax = yMax;
+
+  if (printSizeX != NULL && printSizeY != NULL) {
+    // Printer:
+    m_scrX = *printSizeX;
+    m_scrY = *printSizeY;
+  } else {
+    // Normal case (screen):
+    GetPlotAreaSize(&m_scrX, &m_scrY);
+  }
+
+  double Ax, Ay;
+
+  Ax = xMax - xMin;
+  Ay = yMax - yMin;
+
+  m_scaleX = (Ax != 0) ? (m_scrX - m_marginLeft - m_marginRight) / Ax : 1;  // m_scaleX = (Ax!=0) ? m_scrX/Ax : 1;
+  m_scaleY = (Ay != 0) ? (m_scrY - m_marginTop - m_marginBottom) / Ay : 1;  // m_scaleY = (Ay!=0) ? m_scrY/Ay : 1;
+
+  if (m_lockaspect) {
+    // Keep the lowest "scale" to fit the whole range required by that axis (to actually "fit"!):
+    double s = m_scaleX < m_scaleY ? m_scaleX : m_scaleY;
+    m_scaleX = s;
+    m_scaleY = s;
+  }
+
+  // Adjusts corner coordinates: This should be simply:
+  //   m_posX = m_minX;
+  //   m_posY = m_maxY;
+  // But account for centering if we have lock aspect:
+  m_posX = (xMin + xMax) / 2 - ((m_scrX - m_marginLeft - m_marginRight) / 2 + m_marginLeft) / m_scaleX;
+  m_posY = (yMin + yMax) / 2 + ((m_scrY - m_marginTop - m_marginBottom) / 2 + m_marginTop) / m_scaleY;
+
+  // It is VERY IMPORTANT to DO NOT call Refresh if we are drawing to the
+  // printer!!
+  // Otherwise, the DC dimensions will be those of the window instead of the
+  // printer device
+  if (printSizeX == NULL || printSizeY == NULL) UpdateAll();
+}
+
+bool mpPlotView::AddLayer(mpLayer *layer, bool refreshDisplay) {
+  if (layer != NULL) {
+    m_layers.push_back(layer);
+    if (refreshDisplay) UpdateAll();
+    return true;
+  };
+  return false;
+}
+
+bool mpPlotView::DelLayer(mpLayer *layer, bool alsoDeleteObject, bool refreshDisplay) {
+  wxLayerList::iterator layIt;
+  for (layIt = m_layers.begin(); layIt != m_layers.end(); ++layIt) {
+    if (*layIt == layer) {
+      if (alsoDeleteObject) delete *layIt;
+      m_layers.erase(layIt);
+      if (refreshDisplay) UpdateAll();
+      return true;
+    }
+  }
+  return false;
+}
+
+void mpPlotView::DelAllLayers(bool alsoDeleteObject, bool refreshDisplay) {
+  while (m_layers.size() > 0) {
+    if (alsoDeleteObject) delete m_layers[0];
+    m_layers.erase(m_layers.begin());
+  }
+  if (refreshDisplay) UpdateAll();
+}
+
+void mpPlotView::ParallelFor(size_t count, const std::function<void(size_t)> &task) {
+  if (!m_threadPool) {
+    unsigned cores = std::thread::hardware_concurrency();
+    m_threadPool = new mpThreadPool(cores > 1 ? cores - 1 : 0);
+  }
+  m_threadPool->Run(count, task);
+}
+
+bool mpPlotView::UpdateBBox() {
+  mpTRACE_SCOPE("view", "UpdateBBox");
+  bool first = true;
+
+  for (wxLayerList::iterator li = m_layers.begin(); li != m_layers.end(); ++li) {
+    mpLayer *f = *li;
+
+    if (f->HasBBox()) {
+      if (first) {
+        first = false;
+        m_minX = f->GetMinX();
+        m_maxX = f->GetMaxX();
+        m_minY = f->GetMinY();
+        m_maxY = f->GetMaxY();
+      } else {
+        if (f->GetMinX() < m_minX) m_minX = f->GetMinX();
+        if (f->GetMaxX() > m_maxX) m_maxX = f->GetMaxX();
+        if (f->GetMinY() < m_minY) m_minY = f->GetMinY();
+        if (f->GetMaxY() > m_maxY) m_maxY = f->GetMaxY();
+      }
+    }
+    // node = node->GetNext();
+  }
+  return first == false;
+}
+
+void mpPlotView::SetScaleX(double scaleX) {
+  if (scaleX != 0) m_scaleX = scaleX;
+  UpdateAll();
+}
+
+unsigned int mpPlotView::CountLayers() {
+  // wxNode *node = m_layers.GetFirst();
+  unsigned int layerNo = 0;
+  for (wxLayerList::iterator li = m_layers.begin(); li != m_layers.end(); ++li)  // while(node)
+  {
+    if ((*li)->HasBBox()) layerNo++;
+    // node = node->GetNext();
+  };
+  return layerNo;
+}
+
+mpLayer *mpPlotView::GetLayer(int position) {
+  if ((position >= (int)m_layers.size()) || position < 0) return NULL;
+  return m_layers[position];
+}
+
+mpLayer *mpPlotView::GetLayerByName(const wxString &name) {
+  for (wxLayerList::iterator it = m_layers.begin(); it != m_layers.end(); ++it)
+    if (!(*it)->GetName().Cmp(name)) return *it;
+  return NULL;  // Not found
+}
+
+void mpPlotView::GetBoundingBox(double *bbox) {
+  bbox[0] = m_minX;
+  bbox[1] = m_maxX;
+  bbox[2] = m_minY;
+  bbox[3] = m_maxY;
+}
+
+void mpPlotView::SetMargins(int top, int right, int bottom, int left) {
+  m_marginTop = top;
+  m_marginRight = right;
+  m_marginBottom = bottom;
+  m_marginLeft = left;
+}
+
+void mpPlotView::SetLayerVisible(const wxString &name, bool viewable) {
+  mpLayer *lx = GetLayerByName(name);
+  if (lx) {
+    lx->SetVisible(viewable);
+    UpdateAll();
+  }
+}
+
+bool mpPlotView::IsLayerVisible(const wxString &name) {
+  mpLayer *lx = GetLayerByName(name);
+  return (lx) ? lx->IsVisible() : false;
+}
+
+void mpPlotView::SetLayerVisible(const unsigned int position, bool viewable) {
+  mpLayer *lx = GetLayer(position);
+  if (lx) {
+    lx->SetVisible(viewable);
+    UpdateAll();
+  }
+}
+
+bool mpPlotView::IsLayerVisible(const unsigned int position) {
+  mpLayer *lx = GetLayer(position);
+  return (lx) ? lx->IsVisible() : false;
+}
+
+void mpPlotView::SetColourTheme(const wxColour &bgColour, const wxColour &drawColour, const wxColour &axesColour) {
+  m_bgColour = bgColour;
+  m_fgColour = drawColour;
+  m_axColour = axesColour;
+  // cycle between layers to set colours and properties to them
+  wxLayerList::iterator li;
+  for (li = m_layers.begin(); li != m_layers.end(); ++li) {
+    if ((*li)->GetLayerType() == mpLAYER_AXIS) {
+      wxPen axisPen = (*li)->GetPen();  // Get the old pen to modify only colour,
+                                        // not style or width
+      axisPen.SetColour(axesColour);
+      (*li)->SetPen(axisPen);
     }
-    if (m_flags == mpALIGN_RIGHT) {
-      if (m_drawOutsideMargins)
-        orgx = w.GetScrX() - Y_BORDER_SEPARATION;
-      else
-        orgx = w.GetScrX() - w.GetMarginRight();
+    if ((*li)->GetLayerType() == mpLAYER_INFO) {
+      wxPen infoPen = (*li)->GetPen();  // Get the old pen to modify only colour,
+                                        // not style or width
+      infoPen.SetColour(drawColour);
+      (*li)->SetPen(infoPen);
     }
-    if (m_flags == mpALIGN_BORDER_RIGHT) orgx = w.GetScrX() - 1;  // dc.LogicalToDeviceX(0) - 1;
-    if (m_flags == mpALIGN_BORDER_LEFT) orgx = 1;                 //-dc.LogicalToDeviceX(0);
+  }
+}
 
-    dc.DrawLine(orgx, 0, orgx, extend);
+mpPlotView::ViewState mpPlotView::SaveView() const {
+  ViewState state;
+  state.scaleX = m_scaleX;
+  state.scaleY = m_scaleY;
+  state.posX = m_posX;
+  state.posY = m_posY;
+  state.desiredXmin = m_desiredXmin;
+  state.desiredXmax = m_desiredXmax;
+  state.desiredYmin = m_desiredYmin;
+  state.desiredYmax = m_desiredYmax;
+  state.scrX = m_scrX;
+  state.scrY = m_scrY;
+  for (wxLayerList::const_iterator li = m_layers.begin(); li != m_layers.end(); ++li) (*li)->SaveViewState();
+  return state;
+}
 
-    // To cut the axis line when draw outside margin is false, use this code
-    /* if (m_drawOutsideMargins == true)
-                dc.DrawLine( orgx, 0, orgx, extend);
-    else
-                dc.DrawLine( orgx, w.GetMarginTop(), orgx, w.GetScrY() -
-    w.GetMarginBottom()); */
+mpPlotView::ViewState mpPlotView::FitToImage(int width, int height, bool fit) {
+  const ViewState state = SaveView();
 
-    const double dig = floor(log(128.0 / w.GetScaleY()) / mpLN10);
-    const double step = exp(mpLN10 * dig);
-    const double end = w.GetPosY() + (double)extend / w.GetScaleY();
+  bool dataChanged = false;
+  for (wxLayerList::iterator li = m_layers.begin(); li != m_layers.end(); ++li)
+    if ((*li)->UpdateData()) dataChanged = true;
+  if (dataChanged) UpdateBBox();
 
-    wxCoord tx, ty;
-    wxString s;
-    wxString fmt;
-    int tmp = (int)dig;
-    double maxScaleAbs = fabs(w.GetDesiredYmax());
-    double minScaleAbs = fabs(w.GetDesiredYmin());
-    double endscale = (maxScaleAbs > minScaleAbs) ? maxScaleAbs : minScaleAbs;
-    if (m_labelFormat.IsEmpty()) {
-      if ((endscale < 1e4) && (endscale > 1e-3))
-        fmt = wxT("%.2f");
-      else
-        fmt = wxT("%.1e");
-    } else {
-      fmt = m_labelFormat;
-    }
+  wxCoord sizeX = width, sizeY = height;
+  if (fit)
+    Fit(m_minX, m_maxX, m_minY, m_maxY, &sizeX, &sizeY);
+  else
+    Fit(m_desiredXmin, m_desiredXmax, m_desiredYmin, m_desiredYmax, &sizeX, &sizeY);
+  return state;
+}
 
-    double n =
-        floor((w.GetPosY() - (double)(extend - w.GetMarginTop() - w.GetMarginBottom()) / w.GetScaleY()) / step) * step;
+void mpPlotView::RestoreView(const ViewState &state) {
+  m_scaleX = state.scaleX;
+  m_scaleY = state.scaleY;
+  m_posX = state.posX;
+  m_posY = state.posY;
+  m_desiredXmin = state.desiredXmin;
+  m_desiredXmax = state.desiredXmax;
+  m_desiredYmin = state.desiredYmin;
+  m_desiredYmax = state.desiredYmax;
+  m_scrX = state.scrX;
+  m_scrY = state.scrY;
+  for (wxLayerList::iterator li = m_layers.begin(); li != m_layers.end(); ++li) (*li)->RestoreViewState();
+}
 
-    wxCoord endPx = m_drawOutsideMargins ? w.GetScrX() : w.GetScrX() - w.GetMarginRight();
-    wxCoord minYpx = m_drawOutsideMargins ? 0 : w.GetMarginTop();
-    wxCoord maxYpx = m_drawOutsideMargins ? w.GetScrY() : w.GetScrY() - w.GetMarginBottom();
+bool mpPlotView::IsLayerInArea(mpLayer *layer, const wxRect &area) {
+  if (area.IsEmpty()) return true;
+  wxRect bounds;
+  return !layer->GetScreenBounds(*this, bounds) || bounds.Intersects(area);
+}
 
-    tmp = 65536;
-    int labelW = 0;
-    // Before staring cycle, calculate label height
-    int labelHeigth = 0;
-    s.Printf(fmt, n);
-    dc.GetTextExtent(s, &tx, &labelHeigth);
-    for (; n < end; n += step) {
-      const int p = (int)((w.GetPosY() - n) * w.GetScaleY());
-      if ((p >= minYpx) && (p <= maxYpx)) {
-        if (m_ticks) {  // Draw axis ticks
-          if (m_flags == mpALIGN_BORDER_LEFT) {
-            dc.DrawLine(orgx, p, orgx + 4, p);
-          } else {
-            dc.DrawLine(orgx - 4, p, orgx, p);  //( orgx, p, orgx+4, p);
-          }
-        } else {
-          m_pen.SetStyle(wxPENSTYLE_DOT);
-          dc.SetPen(m_pen);
-          if ((m_flags == mpALIGN_LEFT) && !m_drawOutsideMargins) {
-            dc.DrawLine(orgx - 4, p, endPx, p);
-          } else {
-            if ((m_flags == mpALIGN_RIGHT) && !m_drawOutsideMargins) {
-              dc.DrawLine(minYpx, p, orgx + 4, p);
-            } else {
-              dc.DrawLine(0 /*-w.GetScrX()*/, p, w.GetScrX(), p);
-            }
-          }
-          m_pen.SetStyle(wxPENSTYLE_SOLID);
-          dc.SetPen(m_pen);
-        }
-        // Print ticks labels
-        s.Printf(fmt, n);
-        dc.GetTextExtent(s, &tx, &ty);
-        labelW = (labelW <= tx) ? tx : labelW;
-        if ((tmp - p + labelHeigth / 2) > mpMIN_Y_AXIS_LABEL_SEPARATION) {
-          if ((m_flags == mpALIGN_BORDER_LEFT) || (m_flags == mpALIGN_RIGHT))
-            dc.DrawText(s, orgx + 4, p - ty / 2);
-          else
-            dc.DrawText(s, orgx - 4 - tx, p - ty / 2);  //( s, orgx+4, p-ty/2);
-          tmp = p - labelHeigth / 2;
-        }
-      }
+bool mpPlotView::ExportPNG(const wxString &filename, int width, int height, bool fit, int bandHeight,
+                           bool parallel) {
+#if wxUSE_GRAPHICS_CONTEXT
+  if (width <= 0 || height <= 0) {
+    wxLogError(_("wxMathPlot error: invalid image size %dx%d"), width, height);
+    return false;
+  }
+  if (bandHeight <= 0 || bandHeight > height) bandHeight = height;
+
+  wxFileOutputStream file(filename);
+  if (!file.IsOk()) return false;
+  mpPNGWriter png(file, width, height);
+
+  const ViewState view = FitToImage(width, height, fit);
+
+  // Two bands, so that one can be compressed while the other is rendered
+  wxImage bands[2];
+  std::thread encoder;
+  bool ok = true;
+  for (int top = 0, band = 0; top < height && ok; top += bandHeight, band = 1 - band) {
+    const int rows = (height - top < bandHeight) ? height - top : bandHeight;
+    wxImage &image = bands[band];
+    if (!image.IsOk() || image.GetHeight() != rows) image.Create(width, rows, false);
+    unsigned char *rgb = image.GetData();
+    const size_t count = (size_t)width * (size_t)rows;
+    for (size_t i = 0; i < count; ++i) {
+      rgb[3 * i] = m_bgColour.Red();
+      rgb[3 * i + 1] = m_bgColour.Green();
+      rgb[3 * i + 2] = m_bgColour.Blue();
     }
 
-    // Draw axis name
-    dc.GetTextExtent(m_name, &tx, &ty);
-    switch (m_flags) {
-      case mpALIGN_BORDER_LEFT:
-        dc.DrawText(m_name, labelW + 8, 4);
-        break;
-      case mpALIGN_LEFT: {
-        if ((!m_drawOutsideMargins) && (w.GetMarginLeft() > (ty + labelW + 8))) {
-          dc.DrawRotatedText(m_name, orgx - 6 - labelW - ty, (maxYpx - minYpx + tx) >> 1, 90);
-        } else {
-          dc.DrawText(m_name, orgx + 4, 4);
-        }
-      } break;
-      case mpALIGN_CENTER:
-        dc.DrawText(m_name, orgx + 4, 4);
-        break;
-      case mpALIGN_RIGHT: {
-        if ((!m_drawOutsideMargins) && (w.GetMarginRight() > (ty + labelW + 8))) {
-          dc.DrawRotatedText(m_name, orgx + 6 + labelW, (maxYpx - minYpx + tx) >> 1, 90);
-        } else {
-          dc.DrawText(m_name, orgx - tx - 4, 4);
-        }
-      } break;
-      case mpALIGN_BORDER_RIGHT:
-        dc.DrawText(m_name, orgx - 6 - tx - labelW, 4);
-        break;
-      default:
-        break;
+    wxGraphicsContext *gc = wxGraphicsContext::Create(image);
+    if (!gc) {
+      wxLogError(_("wxMathPlot error: cannot create a graphics context for the image"));
+      ok = false;
+      break;
+    }
+    gc->Translate(0, -top);
+    {
+      mpGCRenderer renderer(gc);  // The drawing reaches the image when the context is destroyed
+      const wxRect area(0, top, width, rows);
+      renderer.SetVisibleArea(area);
+      renderer.SetTextForeground(m_fgColour);
+      for (wxLayerList::iterator li = m_layers.begin(); li != m_layers.end(); ++li)
+        if (IsLayerInArea(*li, area)) (*li)->Render(renderer, *this);
     }
+
+    if (encoder.joinable()) encoder.join();
+    ok = ok && png.IsOk();
+    if (parallel)
+      encoder = std::thread([&png, rgb, rows] { png.WriteRows(rgb, rows); });
+    else
+      png.WriteRows(rgb, rows);
+  }
+  if (encoder.joinable()) encoder.join();
+  ok = png.Close() && ok;
+  ok = file.Close() && ok;
+  RestoreView(view);
+
+  if (!ok) {
+    wxLogError(_("wxMathPlot error: cannot write the image \"%s\""), filename);
+    wxRemoveFile(filename);  // Do not leave a truncated image
+  }
+  return ok;
+#else
+  wxUnusedVar(filename);
+  wxUnusedVar(width);
+  wxUnusedVar(height);
+  wxUnusedVar(fit);
+  wxUnusedVar(bandHeight);
+  wxUnusedVar(parallel);
+  wxLogError(_("wxMathPlot error: exporting images needs wxUSE_GRAPHICS_CONTEXT"));
+  return false;
+#endif
+}
+
+bool mpPlotView::ExportSVG(const wxString &filename, int width, int height, double dpi, bool fit) {
+#if wxUSE_GRAPHICS_CONTEXT
+  if (width <= 0 || height <= 0) {
+    wxLogError(_("wxMathPlot error: invalid image size %dx%d"), width, height);
+    return false;
   }
+  if (!(dpi > 0)) {
+    wxLogError(_("wxMathPlot error: invalid resolution %g dpi"), dpi);
+    return false;
+  }
+  wxFileOutputStream file(filename);
+  if (!file.IsOk()) return false;
+
+  const ViewState view = FitToImage(width, height, fit);
+  mpSVGRenderer renderer(file, width, height, dpi);
+  renderer.SetPen(wxPen(m_bgColour, 1, wxPENSTYLE_TRANSPARENT));
+  renderer.SetBrush(wxBrush(m_bgColour));
+  renderer.DrawRectangle(0, 0, width, height);
+  renderer.SetTextForeground(m_fgColour);
+  for (wxLayerList::iterator li = m_layers.begin(); li != m_layers.end(); ++li) (*li)->Render(renderer, *this);
+  const bool ok = renderer.Close();
+  RestoreView(view);
+
+  if (!ok) wxLogError(_("wxMathPlot error: cannot write the image \"%s\""), filename);
+  return ok;
+#else
+  wxUnusedVar(filename);
+  wxUnusedVar(width);
+  wxUnusedVar(height);
+  wxUnusedVar(dpi);
+  wxUnusedVar(fit);
+  wxLogError(_("wxMathPlot error: exporting images needs wxUSE_GRAPHICS_CONTEXT"));
+  return false;
+#endif
 }
 
 //-----------------------------------------------------------------------------
@@ -966,28 +3971,28 @@ EVT_MENU(mpID_ZOOM_IN, mpWindow::OnZoomIn)
 EVT_MENU(mpID_ZOOM_OUT, mpWindow::OnZoomOut)
 EVT_MENU(mpID_LOCKASPECT, mpWindow::OnLockAspect)
 EVT_MENU(mpID_HELP_MOUSE, mpWindow::OnMouseHelp)
+EVT_TIMER(mpID_DATA_POLL, mpWindow::OnDataPoll)
+EVT_TIMER(mpID_RESIZE, mpWindow::OnResizeTimer)
 END_EVENT_TABLE()
 
 mpWindow::mpWindow(wxWindow *parent, wxWindowID id, const wxPoint &pos, const wxSize &size, long flag)
-    : wxWindow(parent, id, pos, size, flag, wxT("mathplot")) {
-  m_scaleX = m_scaleY = 1.0;
-  m_posX = m_posY = 0;
-  m_desiredXmin = m_desiredYmin = 0;
-  m_desiredXmax = m_desiredYmax = 1;
-  m_scrX = m_scrY = 64;
-  m_minX = m_minY = 0;
-  m_maxX = m_maxY = 0;
+    : wxWindow(parent, id, pos, size, flag, wxT("mathplot")),
+      m_dataPollTimer(this, mpID_DATA_POLL),
+      m_resizeTimer(this, mpID_RESIZE) {
   m_last_lx = m_last_ly = 0;
+  m_resizeDelay = 100;
+  m_resizing = false;
   m_buff_bmp = NULL;
+  m_frameDirty = true;
   m_enableMouseNavigation = true;
   m_mouseMovedAfterRightClick = false;
   m_movingInfoLayer = NULL;
-  m_marginTop = 0;
-  m_marginRight = 0;
-  m_marginBottom = 0;
-  m_marginLeft = 0;
-
-  m_lockaspect = false;
+  m_parallelPlot = false;
+  m_rendererType = mpRENDERER_DC;
+  m_recordFile = NULL;
+  m_recordOperation = mpVIEW_OTHER;
+  m_recordView[0] = m_recordView[1] = m_recordView[2] = m_recordView[3] = 0;
+  m_recordScr[0] = m_recordScr[1] = -1;
 
   m_popmenu.Append(mpID_CENTER, _("Center"), _("Center plot view to this position"));
   m_popmenu.Append(mpID_FIT, _("Fit"), _("Set plot view to show all items"));
@@ -996,10 +4001,7 @@ mpWindow::mpWindow(wxWindow *parent, wxWindowID id, const wxPoint &pos, const wx
   m_popmenu.AppendCheckItem(mpID_LOCKASPECT, _("Lock aspect"), _("Lock horizontal and vertical zoom aspect."));
   m_popmenu.Append(mpID_HELP_MOUSE, _("Show mouse commands..."), _("Show help about the mouse commands."));
 
-  m_layers.clear();
   SetBackgroundColour(*wxWHITE);
-  m_bgColour = *wxWHITE;
-  m_fgColour = *wxBLACK;
 
   m_enableScrollBars = false;
   SetSizeHints(128, 128);
@@ -1010,9 +4012,12 @@ mpWindow::mpWindow(wxWindow *parent, wxWindowID id, const wxPoint &pos, const wx
 }
 
 mpWindow::~mpWindow() {
-  DelAllLayers(true, false);
+  m_dataPollTimer.Stop();
+  m_resizeTimer.Stop();
+  StopRecording();
 
   if (m_buff_bmp) {
+    m_buff_dc.SelectObject(wxNullBitmap);
     delete m_buff_bmp;
     m_buff_bmp = NULL;
   }
@@ -1020,6 +4025,7 @@ mpWindow::~mpWindow() {
 
 // Mouse handler, for detecting when the user drag with the right button or just "clicks" for the menu
 void mpWindow::OnMouseRightDown(wxMouseEvent &event) {
+  mpTRACE_SCOPE("event", "OnMouseRightDown");
   m_mouseMovedAfterRightClick = false;
   m_mouseRClick_X = event.GetX();
   m_mouseRClick_Y = event.GetY();
@@ -1031,6 +4037,7 @@ void mpWindow::OnMouseRightDown(wxMouseEvent &event) {
 // Process mouse wheel events
 // JLB
 void mpWindow::OnMouseWheel(wxMouseEvent &event) {
+  mpTRACE_SCOPE("event", "OnMouseWheel");
   if (!m_enableMouseNavigation) {
     event.Skip();
     return;
@@ -1058,12 +4065,14 @@ void mpWindow::OnMouseWheel(wxMouseEvent &event) {
       m_desiredYmax -= changeUnitsY;
     }
 
+    m_recordOperation = mpVIEW_PAN;
     UpdateAll();
   }
 }
 
 // If the user "drags" with the right buttom pressed, do "pan"
 void mpWindow::OnMouseMove(wxMouseEvent &event) {
+  mpTRACE_SCOPE("event", "OnMouseMove");
   if (!m_enableMouseNavigation) {
     event.Skip();
     return;
@@ -1089,20 +4098,23 @@ void mpWindow::OnMouseMove(wxMouseEvent &event) {
     m_desiredYmax += Ay_units;
     m_desiredYmin += Ay_units;
 
+    m_recordOperation = mpVIEW_PAN;
     UpdateAll();
   } else {
     if (event.m_leftDown) {
       if (m_movingInfoLayer == NULL) {
-        wxClientDC dc(this);
-        dc.SetPen(wxPen(*wxBLACK, 1, wxPENSTYLE_DOT));
-        dc.SetBrush(*wxTRANSPARENT_BRUSH);
-        dc.DrawRectangle(m_mouseLClick_X, m_mouseLClick_Y, event.GetX() - m_mouseLClick_X,
-                         event.GetY() - m_mouseLClick_Y);
+        // The rectangle is drawn on the overlay, the window is not repainted
+        m_zoomRect = wxRect(wxPoint(wxMin(m_mouseLClick_X, event.GetX()), wxMin(m_mouseLClick_Y, event.GetY())),
+                            wxPoint(wxMax(m_mouseLClick_X, event.GetX()), wxMax(m_mouseLClick_Y, event.GetY())));
+        DrawZoomRect();
       } else {
+        // Only the info layer moves: repaint its old and new areas over the frame
+        wxRect changed = m_movingInfoLayer->GetRectangle();
         wxPoint moveVector(event.GetX() - m_mouseLClick_X, event.GetY() - m_mouseLClick_Y);
         m_movingInfoLayer->Move(moveVector);
+        changed.Union(m_movingInfoLayer->GetRectangle());
+        RefreshRect(changed.Inflate(1), false);
       }
-      UpdateAll();
     } else {
       wxLayerList::iterator li;
       for (li = m_layers.begin(); li != m_layers.end(); ++li) {
@@ -1128,9 +4140,20 @@ void mpWindow::OnMouseMove(wxMouseEvent &event) {
   event.Skip();
 }
 
+void mpWindow::DrawZoomRect() {
+  wxClientDC dc(this);
+  wxDCOverlay overlayDC(m_overlay, &dc);
+  overlayDC.Clear();
+  dc.SetPen(wxPen(*wxBLACK, 1, wxPENSTYLE_DOT));
+  dc.SetBrush(*wxTRANSPARENT_BRUSH);
+  dc.DrawRectangle(m_zoomRect);
+}
+
 void mpWindow::OnMouseLeftDown(wxMouseEvent &event) {
+  mpTRACE_SCOPE("event", "OnMouseLeftDown");
   m_mouseLClick_X = event.GetX();
   m_mouseLClick_Y = event.GetY();
+  m_zoomRect = wxRect();
   wxPoint pointClicked = event.GetPosition();
   m_movingInfoLayer = IsInsideInfoLayer(pointClicked);
   if (m_movingInfoLayer != NULL) {
@@ -1139,8 +4162,18 @@ void mpWindow::OnMouseLeftDown(wxMouseEvent &event) {
 }
 
 void mpWindow::OnMouseLeftRelease(wxMouseEvent &event) {
+  mpTRACE_SCOPE("event", "OnMouseLeftRelease");
   wxPoint release(event.GetX(), event.GetY());
   wxPoint press(m_mouseLClick_X, m_mouseLClick_Y);
+  if (!m_zoomRect.IsEmpty()) {
+    {
+      wxClientDC dc(this);
+      wxDCOverlay overlayDC(m_overlay, &dc);
+      overlayDC.Clear();
+    }
+    m_overlay.Reset();
+    m_zoomRect = wxRect();
+  }
   if (m_movingInfoLayer != NULL) {
     m_movingInfoLayer->UpdateReference();
     m_movingInfoLayer = NULL;
@@ -1159,55 +4192,6 @@ void mpWindow::OnMouseLeftRelease(wxMouseEvent &event) {
   event.Skip();
 }
 
-void mpWindow::Fit() {
-  if (UpdateBBox()) Fit(m_minX, m_maxX, m_minY, m_maxY);
-}
-
-void mpWindow::Fit(double xMin, double xMax, double yMin, double yMax, wxCoord *printSizeX, wxCoord *printSizeY) {
-  // Save desired borders:
-  m_desiredXmin = xMin;
-  m_desiredXmax = xMax;
-  m_desiredYmin = yMin;
-  m_desiredYmax = yMax;
-
-  if (printSizeX != NULL && printSizeY != NULL) {
-    // Printer:
-    m_scrX = *printSizeX;
-    m_scrY = *printSizeY;
-  } else {
-    // Normal case (screen):
-    GetClientSize(&m_scrX, &m_scrY);
-  }
-
-  double Ax, Ay;
-
-  Ax = xMax - xMin;
-  Ay = yMax - yMin;
-
-  m_scaleX = (Ax != 0) ? (m_scrX - m_marginLeft - m_marginRight) / Ax : 1;  // m_scaleX = (Ax!=0) ? m_scrX/Ax : 1;
-  m_scaleY = (Ay != 0) ? (m_scrY - m_marginTop - m_marginBottom) / Ay : 1;  // m_scaleY = (Ay!=0) ? m_scrY/Ay : 1;
-
-  if (m_lockaspect) {
-    // Keep the lowest "scale" to fit the whole range required by that axis (to actually "fit"!):
-    double s = m_scaleX < m_scaleY ? m_scaleX : m_scaleY;
-    m_scaleX = s;
-    m_scaleY = s;
-  }
-
-  // Adjusts corner coordinates: This should be simply:
-  //   m_posX = m_minX;
-  //   m_posY = m_maxY;
-  // But account for centering if we have lock aspect:
-  m_posX = (xMin + xMax) / 2 - ((m_scrX - m_marginLeft - m_marginRight) / 2 + m_marginLeft) / m_scaleX;
-  m_posY = (yMin + yMax) / 2 + ((m_scrY - m_marginTop - m_marginBottom) / 2 + m_marginTop) / m_scaleY;
-
-  // It is VERY IMPORTANT to DO NOT call Refresh if we are drawing to the
-  // printer!!
-  // Otherwise, the DC dimensions will be those of the window instead of the
-  // printer device
-  if (printSizeX == NULL || printSizeY == NULL) UpdateAll();
-}
-
 // Patch ngpaton
 void mpWindow::DoZoomInXCalc(const int staticXpixel) {
   // Preserve the position of the clicked point:
@@ -1282,6 +4266,7 @@ void mpWindow::ZoomIn(const wxPoint &centerPoint) {
   m_desiredYmax = m_posY;
   m_desiredYmin = m_posY - (m_scrY - m_marginTop - m_marginBottom) / m_scaleY;
 
+  m_recordOperation = mpVIEW_ZOOM_IN;
   UpdateAll();
 }
 
@@ -1310,25 +4295,30 @@ void mpWindow::ZoomOut(const wxPoint &centerPoint) {
   m_desiredYmax = m_posY;
   m_desiredYmin = m_posY - (m_scrY - m_marginTop - m_marginBottom) / m_scaleY;
 
+  m_recordOperation = mpVIEW_ZOOM_OUT;
   UpdateAll();
 }
 
 void mpWindow::ZoomInX() {
+  m_recordOperation = mpVIEW_ZOOM_IN;
   m_scaleX = m_scaleX * zoomIncrementalFactor;
   UpdateAll();
 }
 
 void mpWindow::ZoomOutX() {
+  m_recordOperation = mpVIEW_ZOOM_OUT;
   m_scaleX = m_scaleX / zoomIncrementalFactor;
   UpdateAll();
 }
 
 void mpWindow::ZoomInY() {
+  m_recordOperation = mpVIEW_ZOOM_IN;
   m_scaleY = m_scaleY * zoomIncrementalFactor;
   UpdateAll();
 }
 
 void mpWindow::ZoomOutY() {
+  m_recordOperation = mpVIEW_ZOOM_OUT;
   m_scaleY = m_scaleY / zoomIncrementalFactor;
   UpdateAll();
 }
@@ -1346,15 +4336,13 @@ void mpWindow::ZoomRect(wxPoint p0, wxPoint p1) {
   double zoom_y_min = p0y < p1y ? p0y : p1y;
   double zoom_y_max = p0y > p1y ? p0y : p1y;
 
-  Fit(zoom_x_min, zoom_x_max, zoom_y_min, zoom_y_max);
+  m_recordOperation = mpVIEW_ZOOM_RECT;
+  mpPlotView::Fit(zoom_x_min, zoom_x_max, zoom_y_min, zoom_y_max);
 }
 
 void mpWindow::LockAspect(bool enable) {
-  m_lockaspect = enable;
   m_popmenu.Check(mpID_LOCKASPECT, enable);
-
-  // Try to fit again with the new config:
-  Fit(m_desiredXmin, m_desiredXmax, m_desiredYmin, m_desiredYmax);
+  mpPlotView::LockAspect(enable);
 }
 
 void mpWindow::OnShowPopupMenu(wxMouseEvent &event) {
@@ -1395,54 +4383,293 @@ void mpWindow::OnZoomIn(wxCommandEvent &WXUNUSED(event)) { ZoomIn(wxPoint(m_mous
 
 void mpWindow::OnZoomOut(wxCommandEvent &WXUNUSED(event)) { ZoomOut(); }
 
-void mpWindow::OnSize(wxSizeEvent &WXUNUSED(event)) { Fit(m_desiredXmin, m_desiredXmax, m_desiredYmin, m_desiredYmax); }
+void mpWindow::OnSize(wxSizeEvent &WXUNUSED(event)) {
+  mpTRACE_SCOPE("event", "OnSize");
+  // Window managers send many size events while the border is dragged: show
+  // the last frame stretched, and render once the size stops changing
+  if (m_resizeDelay > 0 && m_buff_bmp) {
+    m_resizing = true;
+    m_resizeTimer.StartOnce(m_resizeDelay);
+    Refresh(false);
+    return;
+  }
+  m_recordOperation = mpVIEW_RESIZE;
+  mpPlotView::Fit(m_desiredXmin, m_desiredXmax, m_desiredYmin, m_desiredYmax);
+}
 
-bool mpWindow::AddLayer(mpLayer *layer, bool refreshDisplay) {
-  if (layer != NULL) {
-    m_layers.push_back(layer);
-    if (refreshDisplay) UpdateAll();
-    return true;
-  };
-  return false;
+void mpWindow::OnResizeTimer(wxTimerEvent &WXUNUSED(event)) {
+  mpTRACE_SCOPE("event", "OnResizeTimer");
+  m_resizing = false;
+  m_recordOperation = mpVIEW_RESIZE;
+  mpPlotView::Fit(m_desiredXmin, m_desiredXmax, m_desiredYmin, m_desiredYmax);
 }
 
-bool mpWindow::DelLayer(mpLayer *layer, bool alsoDeleteObject, bool refreshDisplay) {
-  wxLayerList::iterator layIt;
-  for (layIt = m_layers.begin(); layIt != m_layers.end(); ++layIt) {
-    if (*layIt == layer) {
-      if (alsoDeleteObject) delete *layIt;
-      m_layers.erase(layIt);
-      if (refreshDisplay) UpdateAll();
-      return true;
+void mpWindow::OnPaint(wxPaintEvent &WXUNUSED(event)) {
+#ifdef MATHPLOT_ENABLE_STATS
+  const std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+  if (m_frameTimes.GetCount() > 0)
+    m_frameIntervals.Add(std::chrono::duration<double>(frameStart - m_lastFrame).count());
+  m_lastFrame = frameStart;
+#endif
+  mpTRACE_SCOPE("event", "OnPaint");
+  {
+#ifdef MATHPLOT_ENABLE_TRACE
+    // Restarted once drawn, to end after the blit made by the destructor of dc
+    mpTraceScope blitScope("paint", "blit");
+#endif
+    wxAutoBufferedPaintDC dc(this);
+
+    // The paint covers the zoom rectangle, drawn again once the paint is done
+    m_overlay.Reset();
+
+    PaintWindow(dc, GetUpdateRegion().GetBox());
+#ifdef MATHPLOT_ENABLE_TRACE
+    blitScope.Restart();
+#endif
+  }
+  if (!m_zoomRect.IsEmpty()) DrawZoomRect();
+#ifdef MATHPLOT_ENABLE_STATS
+  m_frameTimes.Add(std::chrono::duration<double>(std::chrono::steady_clock::now() - frameStart).count());
+#endif
+}
+
+void mpWindow::PaintWindow(wxDC &dc, const wxRect &updateBox) {
+  // Take in the data pushed by other threads since the last paint. Only the
+  // area covered by the changed layers before and after must be drawn again.
+  bool dataChanged = false;
+  {
+    mpTRACE_SCOPE("paint", "UpdateData");
+    for (wxLayerList::iterator li = m_layers.begin(); li != m_layers.end(); ++li) {
+      wxRect before, after;
+      const bool known = (*li)->HasPendingData() && (*li)->GetScreenBounds(*this, before);
+      if (!(*li)->UpdateData()) continue;
+      dataChanged = true;
+      if (known && !(*li)->IsInfo() && (*li)->GetScreenBounds(*this, after))
+        m_frameDirtyArea.Union(before).Union(after);
+      else
+        m_frameDirty = true;
+    }
+  }
+  if (dataChanged) UpdateBBox();
+
+  int width, height;
+  dc.GetSize(&width, &height);  // This is the size of the visible area only!
+  if (width <= 0 || height <= 0) return;  // Minimized or collapsed: nothing to draw into
+
+  if (m_resizing && m_buff_bmp && (m_last_lx != width || m_last_ly != height)) {
+    // The window is being resized: stretch the last frame, the layers are drawn once it stops.
+    // The view keeps the size of the frame, which its scale was fitted to.
+    mpTRACE_SCOPE("paint", "stretch");
+    m_scrX = m_last_lx;
+    m_scrY = m_last_ly;
+    dc.StretchBlit(0, 0, width, height, &m_buff_dc, 0, 0, m_last_lx, m_last_ly);
+    dc.SetTextForeground(m_fgColour);
+    PlotOverlays(dc, wxRect());
+  } else {
+    m_scrX = width;
+    m_scrY = height;
+    if (!m_buff_bmp || m_last_lx != m_scrX || m_last_ly != m_scrY) {
+      m_buff_dc.SelectObject(wxNullBitmap);
+      delete m_buff_bmp;
+      m_buff_bmp = new wxBitmap(m_scrX, m_scrY);
+      m_buff_dc.SelectObject(*m_buff_bmp);
+      m_last_lx = m_scrX;
+      m_last_ly = m_scrY;
+      m_frameDirty = true;
+    }
+
+    // Draw the frame, or the part of it, where the data or the view changed
+    const wxRect window(0, 0, m_scrX, m_scrY);
+    if (m_frameDirty)
+      DrawFrame(window);
+    else if (!m_frameDirtyArea.IsEmpty())
+      DrawFrame(m_frameDirtyArea.Intersect(window));
+    m_frameDirty = false;
+    m_frameDirtyArea = wxRect();
+
+    // Only the invalidated part of the window is composited, RefreshRect is
+    // used for example when an info layer changes
+    wxRect update = updateBox.Intersect(window);
+    if (update.IsEmpty()) update = window;
+    mpTRACE_SCOPE("paint", "composite");
+    dc.SetClippingRegion(update);
+    dc.Blit(update.x, update.y, update.width, update.height, &m_buff_dc, update.x, update.y);
+    dc.SetTextForeground(m_fgColour);
+    PlotOverlays(dc, update == window ? wxRect() : update);
+    dc.DestroyClippingRegion();
+  }
+}
+
+#ifdef MATHPLOT_ENABLE_STATS
+double mpWindow::GetFPS() const {
+  const double interval = m_frameIntervals.GetMean();
+  return interval > 0 ? 1 / interval : 0;
+}
+
+void mpWindow::GetSlowestLayers(std::vector<mpLayer *> &layers, size_t count) {
+  layers.clear();
+  for (wxLayerList::iterator li = m_layers.begin(); li != m_layers.end(); ++li)
+    if ((*li)->IsVisible() && (*li)->GetStats().time.GetCount() > 0) layers.push_back(*li);
+  std::sort(layers.begin(), layers.end(), [](mpLayer *a, mpLayer *b) {
+    return a->GetStats().time.GetLast() > b->GetStats().time.GetLast();
+  });
+  if (layers.size() > count) layers.resize(count);
+}
+#endif
+
+void mpWindow::Refresh(bool eraseBackground, const wxRect *rect) {
+  if (!rect) m_frameDirty = true;
+  wxWindow::Refresh(eraseBackground, rect);
+}
+
+void mpWindow::InvalidateFrame(const wxRect &area) {
+  if (area.IsEmpty())
+    m_frameDirty = true;
+  else
+    m_frameDirtyArea.Union(area);
+}
+
+void mpWindow::DrawFrame(const wxRect &area) {
+  if (area.IsEmpty()) return;
+  mpTRACE_SCOPE("paint", "frame");
+  const bool partial = area != wxRect(0, 0, m_scrX, m_scrY);
+  if (partial) m_buff_dc.SetClippingRegion(area);
+  wxBrush brush(GetBackgroundColour());
+  m_buff_dc.SetPen(*wxTRANSPARENT_PEN);
+  m_buff_dc.SetBrush(brush);
+  m_buff_dc.SetTextForeground(m_fgColour);
+  m_buff_dc.DrawRectangle(area);
+  if (m_parallelPlot)
+    PlotLayersParallel(m_buff_dc, false, partial ? area : wxRect());
+  else
+    PlotLayers(m_buff_dc, false, partial ? area : wxRect());
+  if (partial) m_buff_dc.DestroyClippingRegion();
+}
+
+void mpWindow::PlotOverlays(wxDC &dc, const wxRect &area) {
+  // As in PlotLayers, the layers only get the area through a renderer
+  mpDCRenderer renderer(dc);
+  renderer.SetVisibleArea(area);
+  for (wxLayerList::iterator li = m_layers.begin(); li != m_layers.end(); ++li) {
+    if (!(*li)->IsInfo() || !IsLayerInArea(*li, area)) continue;
+    mpSTATS_LAYER(*li);
+    mpTRACE_SCOPE("layer", (*li)->GetName());
+    if (area.IsEmpty())
+      (*li)->Plot(dc, *this);
+    else
+      (*li)->Render(renderer, *this);
+  }
+}
+
+void mpWindow::PlotLayers(wxDC &dc, bool info, const wxRect &area) {
+  std::unique_ptr<mpRenderer> renderer;
+#if wxUSE_GRAPHICS_CONTEXT
+  if (m_rendererType == mpRENDERER_GC) {
+    std::unique_ptr<mpGCRenderer> gc(new mpGCRenderer(dc));
+    if (gc->IsOk()) {
+      gc->Clip(area);
+      renderer = std::move(gc);
+    }
+  }
+#endif
+  if (m_rendererType == mpRENDERER_RASTER)
+    renderer.reset(area.IsEmpty() ? new mpRasterRenderer(dc, m_scrX, m_scrY) : new mpRasterRenderer(dc, area));
+  // The layers only get the area through a renderer
+  if (!renderer && !area.IsEmpty()) renderer.reset(new mpDCRenderer(dc));
+
+  wxLayerList::iterator li;
+  if (!renderer) {
+    for (li = m_layers.begin(); li != m_layers.end(); ++li) {
+      if (!info && (*li)->IsInfo()) continue;
+      mpSTATS_LAYER(*li);
+      mpTRACE_SCOPE("layer", (*li)->GetName());
+      (*li)->Plot(dc, *this);
     }
+    return;
+  }
+  renderer->SetTextForeground(m_fgColour);
+  renderer->SetVisibleArea(area);
+  for (li = m_layers.begin(); li != m_layers.end(); ++li) {
+    if ((!info && (*li)->IsInfo()) || !IsLayerInArea(*li, area)) continue;
+    mpSTATS_LAYER(*li);
+    mpTRACE_SCOPE("layer", (*li)->GetName());
+    (*li)->Render(*renderer, *this);
   }
-  return false;
+  renderer->Flush();
 }
 
-void mpWindow::DelAllLayers(bool alsoDeleteObject, bool refreshDisplay) {
-  while (m_layers.size() > 0) {
-    if (alsoDeleteObject) delete m_layers[0];
-    m_layers.erase(m_layers.begin());
+void mpWindow::PlotLayersParallel(wxDC &dc, bool info, const wxRect &area) {
+  const wxRect window(0, 0, m_scrX, m_scrY);
+  const wxRect box = area.IsEmpty() ? window : area.Intersect(window);
+  if (box.IsEmpty()) return;
+
+  // The frame renderer, as PlotLayers creates it for mpRENDERER_RASTER
+  mpRasterRenderer renderer(dc, box);
+  renderer.SetTextForeground(m_fgColour);
+  renderer.SetVisibleArea(area);
+
+  std::vector<mpLayer *> parallel;
+  for (wxLayerList::iterator li = m_layers.begin(); li != m_layers.end(); ++li)
+    if ((*li)->GetParallelPlot() && (*li)->IsVisible() && (info || !(*li)->IsInfo()) && IsLayerInArea(*li, area))
+      parallel.push_back(*li);
+
+  // The renderers are created and destroyed in the GUI thread, as the wx objects they hold
+  // do not have atomic reference counts: the workers only draw, with objects of their own
+  std::mutex textLock;
+  std::vector<std::unique_ptr<mpRasterRenderer>> renderers(parallel.size());
+  for (size_t i = 0; i < parallel.size(); ++i) {
+    parallel[i]->UnshareDrawingObjects();
+    renderers[i].reset(new mpRasterRenderer(dc, box));
+    renderers[i]->SetTextForeground(m_fgColour);
+    renderers[i]->SetVisibleArea(area);
+    renderers[i]->SetWorker(&textLock);
   }
-  if (refreshDisplay) UpdateAll();
-}
 
-void mpWindow::OnPaint(wxPaintEvent &WXUNUSED(event)) {
-  wxAutoBufferedPaintDC dc(this);
-  dc.GetSize(&m_scrX, &m_scrY);  // This is the size of the visible area only!
+  if (!parallel.empty())
+    ParallelFor(parallel.size(), [&](size_t i) {
+      mpSTATS_LAYER(parallel[i]);
+      mpTRACE_SCOPE("layer", parallel[i]->GetName());
+      parallel[i]->Render(*renderers[i], *this);
+    });
 
-  wxBrush brush(GetBackgroundColour());
-  dc.SetPen(*wxTRANSPARENT_PEN);
-  dc.SetBrush(brush);
-  dc.SetTextForeground(m_fgColour);
-  dc.DrawRectangle(0, 0, m_scrX, m_scrY);
+  // Merge in the order of the layers, which gives the drawing of the serial plot whatever the number of threads
+  size_t next = 0;
+  for (wxLayerList::iterator li = m_layers.begin(); li != m_layers.end(); ++li) {
+    if ((!info && (*li)->IsInfo()) || !IsLayerInArea(*li, area)) continue;
+    if (next < parallel.size() && *li == parallel[next]) {
+      mpRasterRenderer &layer = *renderers[next++];
+      if (!layer.IsDCRequested()) {
+        mpTRACE_SCOPE("paint", "merge");
+        layer.MergeInto(renderer);
+        continue;
+      }
+      // The layer needs the wxDC: its drawing is dropped and it renders again here
+    }
+    mpSTATS_LAYER(*li);
+    mpTRACE_SCOPE("layer", (*li)->GetName());
+    (*li)->Render(renderer, *this);
+  }
+  mpTRACE_SCOPE("paint", "flush");
+  renderer.Flush();
+}
 
-  // Draw all the layers:
-  // trgDc->SetDeviceOrigin( m_scrX>>1, m_scrY>>1);  // Origin at the center
-  wxLayerList::iterator li;
-  for (li = m_layers.begin(); li != m_layers.end(); ++li) {
-    (*li)->Plot(dc, *this);
-  };
+void mpWindow::SetDataPollInterval(int milliseconds) {
+  if (milliseconds > 0)
+    m_dataPollTimer.Start(milliseconds);
+  else
+    m_dataPollTimer.Stop();
+}
+
+void mpWindow::OnDataPoll(wxTimerEvent &WXUNUSED(event)) {
+  mpTRACE_SCOPE("event", "OnDataPoll");
+  for (wxLayerList::iterator li = m_layers.begin(); li != m_layers.end(); ++li) {
+    if ((*li)->HasPendingData()) {
+      // Not mpWindow::Refresh, which would draw the whole frame again: the
+      // paint only draws the area covered by the layers getting data
+      wxWindow::Refresh(false);
+      return;
+    }
+  }
 }
 
 void mpWindow::SetMPScrollbars(bool status) {
@@ -1454,34 +4681,11 @@ void mpWindow::SetMPScrollbars(bool status) {
   UpdateAll();
 };
 
-bool mpWindow::UpdateBBox() {
-  bool first = true;
-
-  for (wxLayerList::iterator li = m_layers.begin(); li != m_layers.end(); ++li) {
-    mpLayer *f = *li;
-
-    if (f->HasBBox()) {
-      if (first) {
-        first = false;
-        m_minX = f->GetMinX();
-        m_maxX = f->GetMaxX();
-        m_minY = f->GetMinY();
-        m_maxY = f->GetMaxY();
-      } else {
-        if (f->GetMinX() < m_minX) m_minX = f->GetMinX();
-        if (f->GetMaxX() > m_maxX) m_maxX = f->GetMaxX();
-        if (f->GetMinY() < m_minY) m_minY = f->GetMinY();
-        if (f->GetMaxY() > m_maxY) m_maxY = f->GetMaxY();
-      }
-    }
-    // node = node->GetNext();
-  }
-  return first == false;
-}
-
 void mpWindow::UpdateAll() {
+  mpTRACE_SCOPE("view", "UpdateAll");
   if (UpdateBBox()) {
     if (m_enableScrollBars) {
+      mpTRACE_SCOPE("view", "scrollbars");
       int cx, cy;
       GetClientSize(&cx, &cy);
       // Do x scroll bar
@@ -1513,10 +4717,118 @@ void mpWindow::UpdateAll() {
     }
   }
 
+  if (m_recordFile) RecordView();
+  m_recordOperation = mpVIEW_OTHER;
   Refresh(false);
 }
 
+// Recordings start with this tag, followed by records of mpRECORD_SIZE bytes:
+// operation (1 byte), microseconds from the start (uint64), posX, posY,
+// scaleX, scaleY (doubles) and window size (2 int32)
+static const char mpRECORD_TAG[8] = {'M', 'P', 'V', 'I', 'E', 'W', '0', '1'};
+static const size_t mpRECORD_SIZE = 1 + 8 + 4 * 8 + 2 * 4;
+
+bool mpWindow::StartRecording(const wxString &filename) {
+  StopRecording();
+  m_recordFile = new wxFFile(filename, wxT("wb"));
+  if (!m_recordFile->IsOpened() || m_recordFile->Write(mpRECORD_TAG, sizeof(mpRECORD_TAG)) != sizeof(mpRECORD_TAG)) {
+    wxLogError(_("wxMathPlot error: cannot create the recording \"%s\""), filename);
+    StopRecording();
+    return false;
+  }
+  m_recordStart = std::chrono::steady_clock::now();
+  // Record the starting view
+  m_recordOperation = mpVIEW_OTHER;
+  m_recordView[0] = m_recordView[1] = m_recordView[2] = m_recordView[3] = 0;
+  m_recordScr[0] = m_recordScr[1] = -1;
+  RecordView();
+  return true;
+}
+
+void mpWindow::StopRecording() {
+  delete m_recordFile;  // Closes the file
+  m_recordFile = NULL;
+}
+
+void mpWindow::RecordView() {
+  const double view[4] = {m_posX, m_posY, m_scaleX, m_scaleY};
+  const wxInt32 scr[2] = {m_scrX, m_scrY};
+  if (m_recordOperation == mpVIEW_OTHER && scr[0] == m_recordScr[0] && scr[1] == m_recordScr[1] &&
+      memcmp(view, m_recordView, sizeof(view)) == 0)
+    return;
+
+  const wxUint64 micros = (wxUint64)std::chrono::duration_cast<std::chrono::microseconds>(
+                              std::chrono::steady_clock::now() - m_recordStart)
+                              .count();
+  unsigned char record[mpRECORD_SIZE];
+  record[0] = (unsigned char)m_recordOperation;
+  memcpy(record + 1, &micros, 8);
+  memcpy(record + 9, view, sizeof(view));
+  memcpy(record + 9 + sizeof(view), scr, sizeof(scr));
+  if (m_recordFile->Write(record, sizeof(record)) != sizeof(record)) {
+    wxLogError(_("wxMathPlot error: cannot write the recording, it is stopped"));
+    StopRecording();
+    return;
+  }
+  memcpy(m_recordView, view, sizeof(view));
+  m_recordScr[0] = m_scrX;
+  m_recordScr[1] = m_scrY;
+}
+
+bool mpWindow::Replay(const wxString &filename, std::vector<mpReplayStep> &steps) {
+  steps.clear();
+  wxFFile file(filename, wxT("rb"));
+  if (!file.IsOpened()) return false;
+  char tag[sizeof(mpRECORD_TAG)];
+  if (file.Read(tag, sizeof(tag)) != sizeof(tag) || memcmp(tag, mpRECORD_TAG, sizeof(tag)) != 0) {
+    wxLogError(_("wxMathPlot error: \"%s\" is not a recording of mpWindow"), filename);
+    return false;
+  }
+
+  // The replay does not record itself
+  wxFFile *recording = m_recordFile;
+  m_recordFile = NULL;
+  const ViewState state = SaveView();
+  unsigned char record[mpRECORD_SIZE];
+  while (file.Read(record, sizeof(record)) == sizeof(record)) {
+    wxUint64 micros;
+    double view[4];
+    wxInt32 scr[2];
+    memcpy(&micros, record + 1, 8);
+    memcpy(view, record + 9, sizeof(view));
+    memcpy(scr, record + 9 + sizeof(view), sizeof(scr));
+
+    mpReplayStep step;
+    step.operation = record[0] <= mpVIEW_RESIZE ? (mpViewOperation)record[0] : mpVIEW_OTHER;
+    step.time = (double)micros * 1e-6;
+    step.renderTime = 0;
+    if (scr[0] > 0 && scr[1] > 0 && view[2] != 0 && view[3] != 0) {
+      wxBitmap bitmap(scr[0], scr[1]);
+      wxMemoryDC dc(bitmap);
+      const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      m_scrX = scr[0];
+      m_scrY = scr[1];
+      if (step.operation == mpVIEW_FIT && UpdateBBox())
+        mpPlotView::Fit(m_minX, m_maxX, m_minY, m_maxY, &m_scrX, &m_scrY);
+      m_posX = view[0];
+      m_posY = view[1];
+      m_scaleX = view[2];
+      m_scaleY = view[3];
+      UpdateAll();
+      PaintWindow(dc, wxRect());
+      step.renderTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    steps.push_back(step);
+  }
+  RestoreView(state);
+  m_recordFile = recording;
+  UpdateAll();
+  return true;
+}
+
 void mpWindow::DoScrollCalc(const int position, const int orientation) {
+  mpTRACE_SCOPE("event", "DoScrollCalc");
+  m_recordOperation = mpVIEW_PAN;
   if (orientation == wxVERTICAL) {
     // Y axis
     // Get top margin in coord units
@@ -1607,40 +4919,6 @@ void mpWindow::OnScrollBottom(wxScrollWinEvent &event) {
 }
 // End patch ngpaton
 
-void mpWindow::SetScaleX(double scaleX) {
-  if (scaleX != 0) m_scaleX = scaleX;
-  UpdateAll();
-}
-
-unsigned int mpWindow::CountLayers() {
-  // wxNode *node = m_layers.GetFirst();
-  unsigned int layerNo = 0;
-  for (wxLayerList::iterator li = m_layers.begin(); li != m_layers.end(); ++li)  // while(node)
-  {
-    if ((*li)->HasBBox()) layerNo++;
-    // node = node->GetNext();
-  };
-  return layerNo;
-}
-
-mpLayer *mpWindow::GetLayer(int position) {
-  if ((position >= (int)m_layers.size()) || position < 0) return NULL;
-  return m_layers[position];
-}
-
-mpLayer *mpWindow::GetLayerByName(const wxString &name) {
-  for (wxLayerList::iterator it = m_layers.begin(); it != m_layers.end(); ++it)
-    if (!(*it)->GetName().Cmp(name)) return *it;
-  return NULL;  // Not found
-}
-
-void mpWindow::GetBoundingBox(double *bbox) {
-  bbox[0] = m_minX;
-  bbox[1] = m_maxX;
-  bbox[2] = m_minY;
-  bbox[3] = m_maxY;
-}
-
 bool mpWindow::SaveScreenshot(const wxString &filename, wxBitmapType type, wxSize imageSize, bool fit) {
   int sizeX, sizeY;
   int bk_scrX, bk_scrY;
@@ -1683,11 +4961,10 @@ bool mpWindow::SaveScreenshot(const wxString &filename, wxBitmapType type, wxSiz
   return screenImage.SaveFile(filename, type);
 }
 
-void mpWindow::SetMargins(int top, int right, int bottom, int left) {
-  m_marginTop = top;
-  m_marginRight = right;
-  m_marginBottom = bottom;
-  m_marginLeft = left;
+void mpWindow::SetColourTheme(const wxColour &bgColour, const wxColour &drawColour, const wxColour &axesColour) {
+  SetBackgroundColour(bgColour);
+  SetForegroundColour(drawColour);
+  mpPlotView::SetColourTheme(bgColour, drawColour, axesColour);
 }
 
 mpInfoLayer *mpWindow::IsInsideInfoLayer(wxPoint &point) {
@@ -1703,54 +4980,54 @@ mpInfoLayer *mpWindow::IsInsideInfoLayer(wxPoint &point) {
   return NULL;
 }
 
-void mpWindow::SetLayerVisible(const wxString &name, bool viewable) {
-  mpLayer *lx = GetLayerByName(name);
-  if (lx) {
-    lx->SetVisible(viewable);
-    UpdateAll();
-  }
-}
+//-----------------------------------------------------------------------------
+// mpOffscreenPlot
+//-----------------------------------------------------------------------------
 
-bool mpWindow::IsLayerVisible(const wxString &name) {
-  mpLayer *lx = GetLayerByName(name);
-  return (lx) ? lx->IsVisible() : false;
-}
+mpOffscreenPlot::mpOffscreenPlot(int width, int height) { SetScr(width, height); }
 
-void mpWindow::SetLayerVisible(const unsigned int position, bool viewable) {
-  mpLayer *lx = GetLayer(position);
-  if (lx) {
-    lx->SetVisible(viewable);
-    UpdateAll();
+wxImage mpOffscreenPlot::RenderImage() {
+  bool dataChanged = false;
+  for (wxLayerList::iterator li = m_layers.begin(); li != m_layers.end(); ++li)
+    if ((*li)->UpdateData()) dataChanged = true;
+  if (dataChanged) UpdateBBox();
+
+  if (m_scrX <= 0 || m_scrY <= 0) {
+    wxLogError(_("wxMathPlot error: invalid image size %dx%d"), m_scrX, m_scrY);
+    return wxImage();
+  }
+  wxImage image(m_scrX, m_scrY, false);
+  if (!image.IsOk()) return image;
+
+  unsigned char *rgb = image.GetData();
+  const size_t count = (size_t)m_scrX * (size_t)m_scrY;
+  for (size_t i = 0; i < count; ++i) {
+    rgb[3 * i] = m_bgColour.Red();
+    rgb[3 * i + 1] = m_bgColour.Green();
+    rgb[3 * i + 2] = m_bgColour.Blue();
   }
-}
 
-bool mpWindow::IsLayerVisible(const unsigned int position) {
-  mpLayer *lx = GetLayer(position);
-  return (lx) ? lx->IsVisible() : false;
+#if wxUSE_GRAPHICS_CONTEXT
+  wxGraphicsContext *gc = wxGraphicsContext::Create(image);
+  if (!gc) {
+    wxLogError(_("wxMathPlot error: cannot create a graphics context for the image"));
+    return wxImage();
+  }
+  {
+    mpGCRenderer renderer(gc);  // The drawing reaches the image when the context is destroyed
+    renderer.SetTextForeground(m_fgColour);
+    for (wxLayerList::iterator li = m_layers.begin(); li != m_layers.end(); ++li) (*li)->Render(renderer, *this);
+  }
+  return image;
+#else
+  wxLogError(_("wxMathPlot error: offscreen plots need wxUSE_GRAPHICS_CONTEXT"));
+  return wxImage();
+#endif
 }
 
-void mpWindow::SetColourTheme(const wxColour &bgColour, const wxColour &drawColour, const wxColour &axesColour) {
-  SetBackgroundColour(bgColour);
-  SetForegroundColour(drawColour);
-  m_bgColour = bgColour;
-  m_fgColour = drawColour;
-  m_axColour = axesColour;
-  // cycle between layers to set colours and properties to them
-  wxLayerList::iterator li;
-  for (li = m_layers.begin(); li != m_layers.end(); ++li) {
-    if ((*li)->GetLayerType() == mpLAYER_AXIS) {
-      wxPen axisPen = (*li)->GetPen();  // Get the old pen to modify only colour,
-                                        // not style or width
-      axisPen.SetColour(axesColour);
-      (*li)->SetPen(axisPen);
-    }
-    if ((*li)->GetLayerType() == mpLAYER_INFO) {
-      wxPen infoPen = (*li)->GetPen();  // Get the old pen to modify only colour,
-                                        // not style or width
-      infoPen.SetColour(drawColour);
-      (*li)->SetPen(infoPen);
-    }
-  }
+bool mpOffscreenPlot::SaveFile(const wxString &filename, wxBitmapType type) {
+  wxImage image = RenderImage();
+  return image.IsOk() && image.SaveFile(filename, type);
 }
 
 //-----------------------------------------------------------------------------
@@ -1761,6 +5038,7 @@ IMPLEMENT_DYNAMIC_CLASS(mpFXYVector, mpFXY)
 
 mpFXYVector::mpFXYVector(wxString name, int flags) : mpFXY(name, flags) {
   m_index = 0;
+  m_nonFinite = 0;
   m_minX = -1;
   m_maxX = 1;
   m_minY = -1;
@@ -1771,6 +5049,13 @@ mpFXYVector::mpFXYVector(wxString name, int flags) : mpFXY(name, flags) {
 
 void mpFXYVector::Rewind() { m_index = 0; }
 
+size_t mpFXYVector::GetChunk(size_t start, size_t maxCount, const double *&xs, const double *&ys) {
+  if (start >= m_xs.size()) return 0;
+  xs = &m_xs[start];
+  ys = &m_ys[start];
+  return (m_xs.size() - start < maxCount) ? m_xs.size() - start : maxCount;
+}
+
 bool mpFXYVector::GetNextXY(double &x, double &y) {
   if (m_index >= m_xs.size())
     return false;
@@ -1784,6 +5069,7 @@ bool mpFXYVector::GetNextXY(double &x, double &y) {
 void mpFXYVector::Clear() {
   m_xs.clear();
   m_ys.clear();
+  m_nonFinite = 0;
 }
 
 void mpFXYVector::SetData(const std::vector<double> &xs, const std::vector<double> &ys) {
@@ -1796,22 +5082,12 @@ void mpFXYVector::SetData(const std::vector<double> &xs, const std::vector<doubl
   m_ys = ys;
 
   // Update internal variables for the bounding box.
-  if (xs.size() > 0) {
-    m_minX = xs[0];
-    m_maxX = xs[0];
-    m_minY = ys[0];
-    m_maxY = ys[0];
+  m_nonFinite = mpComputeBounds(xs.data(), ys.data(), xs.size(), m_minX, m_maxX, m_minY, m_maxY);
+  if (m_nonFinite > 0)
+    wxLogVerbose(_("wxMathPlot: %s: ignoring %lu points with non-finite coordinates"), m_name,
+                 (unsigned long)m_nonFinite);
 
-    std::vector<double>::const_iterator it;
-
-    for (it = xs.begin(); it != xs.end(); ++it) {
-      if (*it < m_minX) m_minX = *it;
-      if (*it > m_maxX) m_maxX = *it;
-    }
-    for (it = ys.begin(); it != ys.end(); ++it) {
-      if (*it < m_minY) m_minY = *it;
-      if (*it > m_maxY) m_maxY = *it;
-    }
+  if (m_minX <= m_maxX) {
     m_minX -= 0.5f;
     m_minY -= 0.5f;
     m_maxX += 0.5f;
@@ -1829,6 +5105,186 @@ void mpFXYVector::GetData(std::vector<double> &xs, std::vector<double> &ys) {
   ys = m_ys;
 }
 
+//-----------------------------------------------------------------------------
+// mpSampleQueue, mpFXYSeries and mpFXYSnapshot - streaming data
+//-----------------------------------------------------------------------------
+
+mpSampleQueue::mpSampleQueue(size_t capacity) : m_head(0), m_dropped(0), m_tail(0) {
+  size_t size = 1;
+  while (size < capacity) size <<= 1;
+  m_xs.resize(size);
+  m_ys.resize(size);
+  m_mask = size - 1;
+}
+
+bool mpSampleQueue::Push(const double *xs, const double *ys, size_t n) {
+  const size_t head = m_head.load(std::memory_order_relaxed);
+  const size_t tail = m_tail.load(std::memory_order_acquire);
+  if (n > m_mask + 1 - (head - tail)) {
+    m_dropped.fetch_add(n, std::memory_order_relaxed);
+    return false;
+  }
+  for (size_t i = 0; i < n; ++i) {
+    m_xs[(head + i) & m_mask] = xs[i];
+    m_ys[(head + i) & m_mask] = ys[i];
+  }
+  // Publish the samples written above
+  m_head.store(head + n, std::memory_order_release);
+  return true;
+}
+
+size_t mpSampleQueue::Pop(std::vector<double> &xs, std::vector<double> &ys) {
+  const size_t tail = m_tail.load(std::memory_order_relaxed);
+  const size_t head = m_head.load(std::memory_order_acquire);
+  const size_t n = head - tail;
+  if (n == 0) return 0;
+
+  // Copy the at most two contiguous parts of the ring
+  const size_t start = tail & m_mask;
+  const size_t first = (n < m_mask + 1 - start) ? n : m_mask + 1 - start;
+  xs.insert(xs.end(), m_xs.begin() + (ptrdiff_t)start, m_xs.begin() + (ptrdiff_t)(start + first));
+  ys.insert(ys.end(), m_ys.begin() + (ptrdiff_t)start, m_ys.begin() + (ptrdiff_t)(start + first));
+  xs.insert(xs.end(), m_xs.begin(), m_xs.begin() + (ptrdiff_t)(n - first));
+  ys.insert(ys.end(), m_ys.begin(), m_ys.begin() + (ptrdiff_t)(n - first));
+
+  // Give the space back to the producer
+  m_tail.store(head, std::memory_order_release);
+  return n;
+}
+
+IMPLEMENT_DYNAMIC_CLASS(mpFXYSeries, mpFXY)
+
+mpFXYSeries::mpFXYSeries(wxString name, int flags) : mpFXY(name, flags) {
+  m_index = 0;
+  m_nonFinite = 0;
+  m_minX = m_minY = 1e300;
+  m_maxX = m_maxY = -1e300;
+  m_queue = NULL;
+  m_type = mpLAYER_PLOT;
+}
+
+mpFXYSeries::~mpFXYSeries() { delete m_queue; }
+
+void mpFXYSeries::AddData(const double *xs, const double *ys, size_t n) {
+  const size_t start = m_xs.size();
+  m_xs.insert(m_xs.end(), xs, xs + n);
+  m_ys.insert(m_ys.end(), ys, ys + n);
+  UpdateBounds(start);
+}
+
+void mpFXYSeries::Clear() {
+  m_xs.clear();
+  m_ys.clear();
+  m_index = 0;
+  m_nonFinite = 0;
+  m_minX = m_minY = 1e300;
+  m_maxX = m_maxY = -1e300;
+}
+
+mpSampleQueue *mpFXYSeries::CreateQueue(size_t capacity) {
+  delete m_queue;
+  m_queue = new mpSampleQueue(capacity);
+  return m_queue;
+}
+
+bool mpFXYSeries::UpdateData() {
+  if (!m_queue) return false;
+  const size_t start = m_xs.size();
+  if (m_queue->Pop(m_xs, m_ys) == 0) return false;
+  UpdateBounds(start);
+  return true;
+}
+
+void mpFXYSeries::UpdateBounds(size_t start) {
+  double minX, maxX, minY, maxY;
+  m_nonFinite += mpComputeBounds(m_xs.data() + start, m_ys.data() + start, m_xs.size() - start, minX, maxX, minY, maxY);
+  if (minX > maxX) return;  // No finite point added
+  if (minX < m_minX) m_minX = minX;
+  if (maxX > m_maxX) m_maxX = maxX;
+  if (minY < m_minY) m_minY = minY;
+  if (maxY > m_maxY) m_maxY = maxY;
+}
+
+size_t mpFXYSeries::GetChunk(size_t start, size_t maxCount, const double *&xs, const double *&ys) {
+  if (start >= m_xs.size()) return 0;
+  xs = &m_xs[start];
+  ys = &m_ys[start];
+  return (m_xs.size() - start < maxCount) ? m_xs.size() - start : maxCount;
+}
+
+bool mpFXYSeries::GetNextXY(double &x, double &y) {
+  if (m_index >= m_xs.size()) return false;
+  x = m_xs[m_index];
+  y = m_ys[m_index++];
+  return true;
+}
+
+IMPLEMENT_DYNAMIC_CLASS(mpFXYSnapshot, mpFXY)
+
+mpFXYSnapshot::mpFXYSnapshot(wxString name, int flags) : mpFXY(name, flags), m_front(0), m_back(1), m_ready(2) {
+  for (int i = 0; i < 3; ++i) {
+    m_buffers[i].minX = m_buffers[i].minY = 1e300;
+    m_buffers[i].maxX = m_buffers[i].maxY = -1e300;
+    m_buffers[i].nonFinite = 0;
+  }
+  m_index = 0;
+  m_type = mpLAYER_PLOT;
+}
+
+void mpFXYSnapshot::Reserve(size_t n) {
+  for (int i = 0; i < 3; ++i) {
+    m_buffers[i].xs.reserve(n);
+    m_buffers[i].ys.reserve(n);
+  }
+}
+
+void mpFXYSnapshot::BeginWrite(size_t n, double *&xs, double *&ys) {
+  Buffer &back = m_buffers[m_back];
+  // resize does not allocate while n is within the capacity
+  back.xs.resize(n);
+  back.ys.resize(n);
+  xs = back.xs.data();
+  ys = back.ys.data();
+}
+
+void mpFXYSnapshot::Publish() {
+  Buffer &back = m_buffers[m_back];
+  back.nonFinite = mpComputeBounds(back.xs.data(), back.ys.data(), back.xs.size(), back.minX, back.maxX, back.minY,
+                                   back.maxY);
+  // Hand the back buffer over, and take the previous ready one (shown or not) to write the next data set
+  m_back = m_ready.exchange(m_back | mpSNAPSHOT_FRESH, std::memory_order_acq_rel) & ~mpSNAPSHOT_FRESH;
+}
+
+void mpFXYSnapshot::SetData(const double *xs, const double *ys, size_t n) {
+  double *bx, *by;
+  BeginWrite(n, bx, by);
+  std::copy(xs, xs + n, bx);
+  std::copy(ys, ys + n, by);
+  Publish();
+}
+
+bool mpFXYSnapshot::UpdateData() {
+  if ((m_ready.load(std::memory_order_relaxed) & mpSNAPSHOT_FRESH) == 0) return false;
+  m_front = m_ready.exchange(m_front, std::memory_order_acq_rel) & ~mpSNAPSHOT_FRESH;
+  return true;
+}
+
+size_t mpFXYSnapshot::GetChunk(size_t start, size_t maxCount, const double *&xs, const double *&ys) {
+  const Buffer &front = m_buffers[m_front];
+  if (start >= front.xs.size()) return 0;
+  xs = &front.xs[start];
+  ys = &front.ys[start];
+  return (front.xs.size() - start < maxCount) ? front.xs.size() - start : maxCount;
+}
+
+bool mpFXYSnapshot::GetNextXY(double &x, double &y) {
+  const Buffer &front = m_buffers[m_front];
+  if (m_index >= front.xs.size()) return false;
+  x = front.xs[m_index];
+  y = front.ys[m_index++];
+  return true;
+}
+
 //-----------------------------------------------------------------------------
 // mpText - provided by Val Greene
 //-----------------------------------------------------------------------------
@@ -1858,13 +5314,18 @@ mpText::mpText(wxString name, int offsetx, int offsety) {
 This implementation will plot the text adjusted to the visible area.
 */
 
-void mpText::Plot(wxDC &dc, mpWindow &w) {
+void mpText::Plot(wxDC &dc, mpPlotView &w) {
+  mpDCRenderer r(dc);
+  Render(r, w);
+}
+
+void mpText::Render(mpRenderer &r, mpPlotView &w) {
   if (m_visible) {
-    dc.SetPen(m_pen);
-    dc.SetFont(m_font);
+    r.SetPen(m_pen);
+    r.SetFont(m_font);
 
     wxCoord tw = 0, th = 0;
-    dc.GetTextExtent(GetName(), &tw, &th);
+    r.GetTextExtent(GetName(), &tw, &th);
 
     //     int left = -dc.LogicalToDeviceX(0);
     //     int width = dc.LogicalToDeviceX(0) - left;
@@ -1876,7 +5337,7 @@ void mpText::Plot(wxDC &dc, mpWindow &w) {
             (int)((((float)height/100.0) * m_offsetx) - bottom) );*/
     int px = m_offsetx * (w.GetScrX() - w.GetMarginLeft() - w.GetMarginRight()) / 100;
     int py = m_offsety * (w.GetScrY() - w.GetMarginTop() - w.GetMarginBottom()) / 100;
-    dc.DrawText(GetName(), px, py);
+    r.DrawText(GetName(), px, py);
   }
 }
 
@@ -1885,7 +5346,7 @@ void mpText::Plot(wxDC &dc, mpWindow &w) {
 //-----------------------------------------------------------------------------
 
 mpPrintout::mpPrintout(mpWindow *drawWindow, const wxChar *title)
-    : wxPrintout(title), drawn(false), plotWindow(drawWindow) {}
+    : wxPrintout(title), drawn(false), plotWindow(drawWindow), m_bandPixels(4 * 1024 * 1024) {}
 
 bool mpPrintout::OnPrintPage(int page) {
   wxDC *trgDc = GetDC();
@@ -1899,37 +5360,45 @@ bool mpPrintout::OnPrintPage(int page) {
     m_prnY -= (2 * marginY);
     trgDc->SetDeviceOrigin(marginX, marginY);
 
-    // Set the scale according to the page:
-    plotWindow->Fit(plotWindow->GetDesiredXmin(), plotWindow->GetDesiredXmax(), plotWindow->GetDesiredYmin(),
-                    plotWindow->GetDesiredYmax(), &m_prnX, &m_prnY);
-
-    // Get the colours of the plotWindow to restore them ath the end
-    wxColour oldBgColour = plotWindow->GetBackgroundColour();
-    wxColour oldFgColour = plotWindow->GetForegroundColour();
-    wxColour oldAxColour = plotWindow->GetAxesColour();
+    // Set the scale according to the page, keeping the view of the window
+    const mpPlotView::ViewState view = plotWindow->FitToImage(m_prnX, m_prnY, false);
 
     // Draw background, ensuring to use white background for printing.
     trgDc->SetPen(*wxTRANSPARENT_PEN);
-    // wxBrush brush( plotWindow->GetBackgroundColour() );
     wxBrush brush = *wxWHITE_BRUSH;
     trgDc->SetBrush(brush);
     trgDc->DrawRectangle(0, 0, m_prnX, m_prnY);
 
-    // Draw all the layers:
-    // trgDc->SetDeviceOrigin( m_prnX>>1, m_prnY>>1);  // Origin at the center
+    // The layers drawing into memory allocate the area they draw, so they
+    // get the page in bands; the others draw the page at once.
+    int bandHeight = m_prnY;
     for (unsigned int li = 0; li < plotWindow->CountAllLayers(); ++li) {
-      mpLayer *layer;
-      layer = plotWindow->GetLayer(li);
-      layer->Plot(*trgDc, *plotWindow);
-    };
-    // Restore device origin
-    // trgDc->SetDeviceOrigin(0, 0);
-    // Restore colours
-    plotWindow->SetColourTheme(oldBgColour, oldFgColour, oldAxColour);
-    // Restore drawing
-    plotWindow->Fit(plotWindow->GetDesiredXmin(), plotWindow->GetDesiredXmax(), plotWindow->GetDesiredYmin(),
-                    plotWindow->GetDesiredYmax(), NULL, NULL);
-    plotWindow->UpdateAll();
+      mpLayer *layer = plotWindow->GetLayer(li);
+      mpFXY *fxy = wxDynamicCast(layer, mpFXY);
+      const bool inMemory = (fxy && fxy->GetRasterTiles() != 0) || dynamic_cast<mpBitmapLayer *>(layer);
+      if (inMemory && layer->IsVisible() && m_bandPixels > 0 && m_prnX > 0)
+        bandHeight = wxMax(1, wxMin(m_prnY, m_bandPixels / m_prnX));
+    }
+
+    // Draw the layers reaching each band, reduced to the resolution of the printer
+    mpDCRenderer target(*trgDc);
+    mpDecimatingRenderer renderer(target, m_prnX, m_prnY);
+    for (int top = 0; top < m_prnY; top += bandHeight) {
+      const int rows = wxMin(bandHeight, m_prnY - top);
+      const wxRect band = (rows < m_prnY) ? wxRect(0, top, m_prnX, rows) : wxRect();
+      if (rows < m_prnY) {
+        trgDc->SetClippingRegion(band);
+        renderer.SetVisibleArea(band);
+      }
+      for (unsigned int li = 0; li < plotWindow->CountAllLayers(); ++li)
+        if (plotWindow->IsLayerInArea(plotWindow->GetLayer(li), band))
+          plotWindow->GetLayer(li)->Render(renderer, *plotWindow);
+      renderer.Flush();
+      if (rows < m_prnY) trgDc->DestroyClippingRegion();
+    }
+
+    // Restore the view of the window, which needs no drawing
+    plotWindow->RestoreView(view);
   }
   return true;
 }
@@ -1958,75 +5427,62 @@ m_shape_ys have different lengths!"));
     double ccos = cos(m_reference_phi);  // Avoid computing cos/sin twice.
     double csin = sin(m_reference_phi);
 
-    m_trans_shape_xs.resize(m_shape_xs.size());
-    m_trans_shape_ys.resize(m_shape_xs.size());
+    const size_t n = m_shape_xs.size();
+    m_trans_shape_xs.resize(n);
+    m_trans_shape_ys.resize(n);
 
-    std::vector<double>::iterator itXi, itXo;
-    std::vector<double>::iterator itYi, itYo;
-
-    m_bbox_min_x = 1e300;
-    m_bbox_max_x = -1e300;
-    m_bbox_min_y = 1e300;
-    m_bbox_max_y = -1e300;
-
-    for (itXo = m_trans_shape_xs.begin(), itYo = m_trans_shape_ys.begin(), itXi = m_shape_xs.begin(),
-        itYi = m_shape_ys.begin();
-         itXo != m_trans_shape_xs.end(); ++itXo, ++itYo, ++itXi, ++itYi) {
-      *itXo = m_reference_x + ccos * (*itXi) - csin * (*itYi);
-      *itYo = m_reference_y + csin * (*itXi) + ccos * (*itYi);
+    const double *xi = m_shape_xs.data(), *yi = m_shape_ys.data();
+    double *xo = m_trans_shape_xs.data(), *yo = m_trans_shape_ys.data();
+    for (size_t i = 0; i < n; ++i) {
+      xo[i] = m_reference_x + ccos * xi[i] - csin * yi[i];
+      yo[i] = m_reference_y + csin * xi[i] + ccos * yi[i];
+    }
 
-      // Keep BBox:
-      if (*itXo < m_bbox_min_x) m_bbox_min_x = *itXo;
-      if (*itXo > m_bbox_max_x) m_bbox_max_x = *itXo;
-      if (*itYo < m_bbox_min_y) m_bbox_min_y = *itYo;
-      if (*itYo > m_bbox_max_y) m_bbox_max_y = *itYo;
+    // Keep BBox:
+    m_nonFinite = mpComputeBounds(xo, yo, n, m_bbox_min_x, m_bbox_max_x, m_bbox_min_y, m_bbox_max_y);
+    if (m_nonFinite > 0)
+      wxLogVerbose(_("wxMathPlot: %s: ignoring %lu points with non-finite coordinates"), m_name,
+                   (unsigned long)m_nonFinite);
+    if (m_bbox_min_x > m_bbox_max_x) {
+      m_bbox_min_x = 1e300;
+      m_bbox_max_x = -1e300;
+      m_bbox_min_y = 1e300;
+      m_bbox_max_y = -1e300;
     }
   }
 }
 
-void mpMovableObject::Plot(wxDC &dc, mpWindow &w) {
+bool mpMovableObject::GetScreenBounds(mpPlotView &w, wxRect &bounds) {
+  if (!m_name.IsEmpty() && m_showName) return false;
+  return GetBBoxScreenBounds(w, bounds, m_pen.GetWidth() + 1);
+}
+
+void mpMovableObject::Plot(wxDC &dc, mpPlotView &w) {
+  mpDCRenderer r(dc);
+  Render(r, w);
+}
+
+void mpMovableObject::Render(mpRenderer &r, mpPlotView &w) {
   if (m_visible) {
-    dc.SetPen(m_pen);
+    r.SetPen(m_pen);
 
+    std::vector<wxPoint> points;
+    points.reserve(m_trans_shape_xs.size());
     std::vector<double>::iterator itX = m_trans_shape_xs.begin();
     std::vector<double>::iterator itY = m_trans_shape_ys.begin();
+    while (itX != m_trans_shape_xs.end()) points.push_back(wxPoint(w.x2p(*(itX++)), w.y2p(*(itY++))));
+    mpSTATS_COUNT(pointsVisited, points.size());
 
-    if (!m_continuous) {
-      // for some reason DrawPoint does not use the current pen,
-      // so we use DrawLine for fat pens
-      if (m_pen.GetWidth() <= 1) {
-        while (itX != m_trans_shape_xs.end()) {
-          dc.DrawPoint(w.x2p(*(itX++)), w.y2p(*(itY++)));
-        }
-      } else {
-        while (itX != m_trans_shape_xs.end()) {
-          wxCoord cx = w.x2p(*(itX++));
-          wxCoord cy = w.y2p(*(itY++));
-          dc.DrawLine(cx, cy, cx, cy);
-        }
-      }
-    } else {
-      wxCoord cx0 = 0, cy0 = 0;
-      bool first = true;
-      while (itX != m_trans_shape_xs.end()) {
-        wxCoord cx = w.x2p(*(itX++));
-        wxCoord cy = w.y2p(*(itY++));
-        if (first) {
-          first = false;
-          cx0 = cx;
-          cy0 = cy;
-        }
-        dc.DrawLine(cx0, cy0, cx, cy);
-        cx0 = cx;
-        cy0 = cy;
-      }
-    }
+    if (!m_continuous)
+      r.DrawPoints(points.data(), points.size());
+    else
+      r.DrawLines(points.data(), points.size());
 
     if (!m_name.IsEmpty() && m_showName) {
-      dc.SetFont(m_font);
+      r.SetFont(m_font);
 
       wxCoord tx, ty;
-      dc.GetTextExtent(m_name, &tx, &ty);
+      r.GetTextExtent(m_name, &tx, &ty);
 
       if (HasBBox()) {
         wxCoord sx = (wxCoord)((m_bbox_max_x - w.GetPosX()) * w.GetScaleX());
@@ -2053,7 +5509,7 @@ void mpMovableObject::Plot(wxDC &dc, mpWindow &w) {
         }
       }
 
-      dc.DrawText(m_name, tx, ty);
+      r.DrawText(m_name, tx, ty);
     }
   }
 }
@@ -2203,100 +5659,116 @@ void mpBitmapLayer::SetBitmap(const wxImage &inBmp, double x, double y, double l
   }
 }
 
-void mpBitmapLayer::Plot(wxDC &dc, mpWindow &w) {
-  if (m_visible && m_validImg) {
-    /*	1st: We compute (x0,y0)-(x1,y1), the pixel coordinates of the real outer
-    limits
-                 of the image rectangle within the (screen) mpWindow. Note that
-    these coordinates
-                 might fall well far away from the real view limits when the
-    user zoom in.
-
-            2nd: We compute (dx0,dy0)-(dx1,dy1), the pixel coordinates the
-    rectangle that will
-                 be actually drawn into the mpWindow, i.e. the clipped real
-    rectangle that
-                 avoids the non-visible parts. (offset_x,offset_y) are the pixel
-    coordinates
-                 that correspond to the window point (dx0,dy0) within the image
-    "m_bitmap", and
-                 (b_width,b_height) is the size of the bitmap patch that will be
-    drawn.
-
-    (x0,y0) .................  (x1,y0)
-        .                          .
-        .                          .
-    (x0,y1) ................   (x1,y1)
-              (In pixels!!)
-    */
-
-    // 1st step -------------------------------
-    wxCoord x0 = w.x2p(m_min_x);
-    wxCoord y0 = w.y2p(m_max_y);
-    wxCoord x1 = w.x2p(m_max_x);
-    wxCoord y1 = w.y2p(m_min_y);
-
-    // 2nd step -------------------------------
-    // Precompute the size of the actual bitmap pixel on the screen (e.g. will
-    // be >1 if zoomed in)
-    double screenPixelX = (x1 - x0) / (double)m_bitmap.GetWidth();
-    double screenPixelY = (y1 - y0) / (double)m_bitmap.GetHeight();
-
-    // The minimum number of pixels that the streched image will overpass the
-    // actual mpWindow borders:
-    wxCoord borderMarginX = (wxCoord)(screenPixelX + 1);  // ceil
-    wxCoord borderMarginY = (wxCoord)(screenPixelY + 1);  // ceil
-
-    // The actual drawn rectangle (dx0,dy0)-(dx1,dy1) is (x0,y0)-(x1,y1)
-    // clipped:
-    wxCoord dx0 = x0, dx1 = x1, dy0 = y0, dy1 = y1;
-    if (dx0 < 0) dx0 = -borderMarginX;
-    if (dy0 < 0) dy0 = -borderMarginY;
-    if (dx1 > w.GetScrX()) dx1 = w.GetScrX() + borderMarginX;
-    if (dy1 > w.GetScrY()) dy1 = w.GetScrY() + borderMarginY;
-
-    // For convenience, compute the width/height of the rectangle to be actually
-    // drawn:
-    wxCoord d_width = dx1 - dx0 + 1;
-    wxCoord d_height = dy1 - dy0 + 1;
-
-    // Compute the pixel offsets in the internally stored bitmap:
-    wxCoord offset_x = (wxCoord)((dx0 - x0) / screenPixelX);
-    wxCoord offset_y = (wxCoord)((dy0 - y0) / screenPixelY);
-
-    // and the size in pixel of the area to be actually drawn from the
-    // internally stored bitmap:
-    wxCoord b_width = (wxCoord)((dx1 - dx0 + 1) / screenPixelX);
-    wxCoord b_height = (wxCoord)((dy1 - dy0 + 1) / screenPixelY);
-
-    // Is there any visible region?
-    if (d_width > 0 && d_height > 0) {
-      // Build the scaled bitmap from the image, only if it has changed:
-      if (m_scaledBitmap.GetWidth() != d_width || m_scaledBitmap.GetHeight() != d_height ||
-          m_scaledBitmap_offset_x != offset_x || m_scaledBitmap_offset_y != offset_y) {
-        wxRect r(wxRect(offset_x, offset_y, b_width, b_height));
-        // Just for the case....
-        if (r.x < 0) r.x = 0;
-        if (r.y < 0) r.y = 0;
-        if (r.width > m_bitmap.GetWidth()) r.width = m_bitmap.GetWidth();
-        if (r.height > m_bitmap.GetHeight()) r.height = m_bitmap.GetHeight();
-
-        m_scaledBitmap = wxBitmap(wxBitmap(m_bitmap).GetSubBitmap(r).ConvertToImage().Scale(d_width, d_height));
-        m_scaledBitmap_offset_x = offset_x;
-        m_scaledBitmap_offset_y = offset_y;
-      }
+bool mpBitmapLayer::GetDrawnRect(mpPlotView &w, const wxRect &area, wxRect &dest, wxRect &src) {
+  /*	1st: We compute (x0,y0)-(x1,y1), the pixel coordinates of the real outer
+  limits
+               of the image rectangle within the (screen) mpWindow. Note that
+  these coordinates
+               might fall well far away from the real view limits when the
+  user zoom in.
+
+          2nd: We compute (dx0,dy0)-(dx1,dy1), the pixel coordinates the
+  rectangle that will
+               be actually drawn into the mpWindow, i.e. the clipped real
+  rectangle that
+               avoids the non-visible parts. (offset_x,offset_y) are the pixel
+  coordinates
+               that correspond to the window point (dx0,dy0) within the image
+  "m_bitmap", and
+               (b_width,b_height) is the size of the bitmap patch that will be
+  drawn.
+
+  (x0,y0) .................  (x1,y0)
+      .                          .
+      .                          .
+  (x0,y1) ................   (x1,y1)
+            (In pixels!!)
+  */
+
+  // 1st step -------------------------------
+  wxCoord x0 = w.x2p(m_min_x);
+  wxCoord y0 = w.y2p(m_max_y);
+  wxCoord x1 = w.x2p(m_max_x);
+  wxCoord y1 = w.y2p(m_min_y);
+
+  // 2nd step -------------------------------
+  // Precompute the size of the actual bitmap pixel on the screen (e.g. will
+  // be >1 if zoomed in)
+  double screenPixelX = (x1 - x0) / (double)m_bitmap.GetWidth();
+  double screenPixelY = (y1 - y0) / (double)m_bitmap.GetHeight();
+
+  // The minimum number of pixels that the streched image will overpass the
+  // area borders:
+  wxCoord borderMarginX = (wxCoord)(screenPixelX + 1);  // ceil
+  wxCoord borderMarginY = (wxCoord)(screenPixelY + 1);  // ceil
+
+  // The actual drawn rectangle (dx0,dy0)-(dx1,dy1) is (x0,y0)-(x1,y1)
+  // clipped to the area, which is the window or the band being drawn:
+  wxCoord dx0 = x0, dx1 = x1, dy0 = y0, dy1 = y1;
+  if (dx0 < area.x) dx0 = area.x - borderMarginX;
+  if (dy0 < area.y) dy0 = area.y - borderMarginY;
+  if (dx1 > area.x + area.width) dx1 = area.x + area.width + borderMarginX;
+  if (dy1 > area.y + area.height) dy1 = area.y + area.height + borderMarginY;
+
+  // For convenience, compute the width/height of the rectangle to be actually
+  // drawn:
+  dest = wxRect(dx0, dy0, dx1 - dx0 + 1, dy1 - dy0 + 1);
+
+  // Is there any visible region?
+  if (dest.width <= 0 || dest.height <= 0 || screenPixelX <= 0 || screenPixelY <= 0) return false;
+
+  // Compute the pixel offsets in the internally stored bitmap, and the size
+  // in pixel of the area to be actually drawn from it:
+  src = wxRect((wxCoord)((dx0 - x0) / screenPixelX), (wxCoord)((dy0 - y0) / screenPixelY),
+               (wxCoord)((dx1 - dx0 + 1) / screenPixelX), (wxCoord)((dy1 - dy0 + 1) / screenPixelY));
+  // Just for the case....
+  src = src.Intersect(wxRect(0, 0, m_bitmap.GetWidth(), m_bitmap.GetHeight()));
+  return !src.IsEmpty();
+}
 
-      // Draw it:
-      dc.DrawBitmap(m_scaledBitmap, dx0, dy0, true);
+void mpBitmapLayer::Plot(wxDC &dc, mpPlotView &w) {
+  wxRect dest, src;
+  if (m_visible && m_validImg && GetDrawnRect(w, wxRect(0, 0, w.GetScrX(), w.GetScrY()), dest, src)) {
+    // Build the scaled bitmap from the image, only if it has changed:
+    if (m_scaledBitmap.GetWidth() != dest.width || m_scaledBitmap.GetHeight() != dest.height ||
+        m_scaledBitmap_offset_x != src.x || m_scaledBitmap_offset_y != src.y) {
+      m_scaledBitmap = wxBitmap(m_bitmap.GetSubImage(src).Scale(dest.width, dest.height));
+      m_scaledBitmap_offset_x = src.x;
+      m_scaledBitmap_offset_y = src.y;
     }
+
+    // Draw it:
+    dc.DrawBitmap(m_scaledBitmap, dest.x, dest.y, true);
+  }
+
+  mpDCRenderer r(dc);
+  DrawLabel(r, w);
+}
+
+void mpBitmapLayer::Render(mpRenderer &r, mpPlotView &w) {
+  // Only the part of the image in the area being drawn is scaled, so that
+  // the memory used when exporting in bands does not grow with the page
+  wxRect area(0, 0, w.GetScrX(), w.GetScrY()), dest, src;
+  if (!r.GetVisibleArea().IsEmpty()) area = area.Intersect(r.GetVisibleArea());
+  if (m_visible && m_validImg && GetDrawnRect(w, area, dest, src)) {
+    if (dest != m_scaledImageDest || src != m_scaledImageSrc || !m_scaledImage.IsOk()) {
+      m_scaledImage = m_bitmap.GetSubImage(src).Scale(dest.width, dest.height);
+      m_scaledImageDest = dest;
+      m_scaledImageSrc = src;
+    }
+    r.DrawImage(m_scaledImage, dest.x, dest.y);
   }
 
+  DrawLabel(r, w);
+}
+
+void mpBitmapLayer::DrawLabel(mpRenderer &r, mpPlotView &w) {
   // Draw the name label
   if (!m_name.IsEmpty() && m_showName) {
-    dc.SetFont(m_font);
+    r.SetFont(m_font);
 
     wxCoord tx, ty;
-    dc.GetTextExtent(m_name, &tx, &ty);
+    r.GetTextExtent(m_name, &tx, &ty);
 
     if (HasBBox()) {
       wxCoord sx = (wxCoord)((m_max_x - w.GetPosX()) * w.GetScaleX());
@@ -2323,6 +5795,6 @@ void mpBitmapLayer::Plot(wxDC &dc, mpWindow &w) {
       }
     }
 
-    dc.DrawText(m_name, tx, ty);
+    r.DrawText(m_name, tx, ty);
   }
 }
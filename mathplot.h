@@ -72,10 +72,21 @@
 #define WXDLLIMPEXP_DATA_MATHPLOT(type) type
 #endif
 
+#include <wx/overlay.h>
 #include <wx/print.h>
+#include <wx/timer.h>
 #include <wx/wx.h>
+#if wxUSE_GRAPHICS_CONTEXT
+#include <wx/dcgraph.h>
+#endif
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
 #include <vector>
 
 // Separation for axes when set close to border
@@ -93,9 +104,16 @@ class WXDLLIMPEXP_MATHPLOT mpFXY;
 class WXDLLIMPEXP_MATHPLOT mpFXYVector;
 class WXDLLIMPEXP_MATHPLOT mpScaleX;
 class WXDLLIMPEXP_MATHPLOT mpScaleY;
+class WXDLLIMPEXP_MATHPLOT mpPlotView;
 class WXDLLIMPEXP_MATHPLOT mpWindow;
 class WXDLLIMPEXP_MATHPLOT mpText;
 class WXDLLIMPEXP_MATHPLOT mpPrintout;
+class WXDLLIMPEXP_MATHPLOT mpRenderer;
+class mpThreadPool;
+class mpByteStream;
+class wxOutputStream;
+class wxFFile;
+class wxZlibOutputStream;
 
 /** Command IDs used by mpWindow */
 enum {
@@ -104,9 +122,162 @@ enum {
   mpID_ZOOM_OUT,    //!< Zoom out
   mpID_CENTER,      //!< Center view on click position
   mpID_LOCKASPECT,  //!< Lock x/y scaling aspect
-  mpID_HELP_MOUSE   //!< Shows information about the mouse commands
+  mpID_HELP_MOUSE,  //!< Shows information about the mouse commands
+  mpID_DATA_POLL,   //!< Timer polling the layers for pending data
+  mpID_RESIZE       //!< Timer rendering the plot once the window stops being resized
+};
+
+/** Compute the bounding box of a set of points in a single pass.
+    Points having a NaN or infinite coordinate are skipped and counted, so
+    that they do not end up in the bounding box. Large sets are split across
+    the available processor cores.
+    @param xs X coordinates of the points
+    @param ys Y coordinates of the points
+    @param n Number of points
+    @param minX Returns the minimum finite X value
+    @param maxX Returns the maximum finite X value
+    @param minY Returns the minimum finite Y value
+    @param maxY Returns the maximum finite Y value
+    @return Number of skipped non-finite points. When no point is finite, minX > maxX and minY > maxY.
+*/
+WXDLLIMPEXP_MATHPLOT size_t mpComputeBounds(const double *xs, const double *ys, size_t n, double &minX, double &maxX,
+                                            double &minY, double &maxY);
+
+//-----------------------------------------------------------------------------
+// Render statistics
+//-----------------------------------------------------------------------------
+
+#ifdef MATHPLOT_ENABLE_STATS
+/** Number of frames kept by mpRollingStats. */
+#define mpSTATS_WINDOW 256
+
+/** Statistics of a measure over the last mpSTATS_WINDOW frames, one value per frame. */
+class WXDLLIMPEXP_MATHPLOT mpRollingStats {
+ public:
+  mpRollingStats() : m_count(0), m_next(0) {}
+
+  /** Add the value of a frame, replacing the oldest one when the window is full. */
+  void Add(double value);
+
+  /** Forget all the values. */
+  void Clear() { m_count = m_next = 0; }
+
+  /** Get the number of values in the window. */
+  size_t GetCount() const { return m_count; }
+
+  /** Get the value of the last frame, 0 if none. */
+  double GetLast() const { return m_count ? m_values[(m_next + mpSTATS_WINDOW - 1) % mpSTATS_WINDOW] : 0; }
+
+  /** Get the mean of the values in the window, 0 if none. */
+  double GetMean() const;
+
+  /** Get the largest value in the window, 0 if none. */
+  double GetMax() const;
+
+  /** Get a percentile of the values in the window, by the nearest rank.
+      @param p Percentile, from 0 to 100 */
+  double GetPercentile(double p) const;
+
+  /** Count the values in the window in buckets growing by powers of two:
+      bucket 0 holds the values below unit, bucket i those from unit * 2^(i-1)
+      to unit * 2^i, and the last bucket also holds all the larger values.
+      @param buckets Returns the counts; its size gives the number of buckets
+      @param unit Upper bound of the first bucket */
+  void GetHistogram(std::vector<size_t> &buckets, double unit) const;
+
+ private:
+  double m_values[mpSTATS_WINDOW];  //!< Ring of the last values
+  size_t m_count;                   //!< Number of values in the ring
+  size_t m_next;                    //!< Index of the next value
+};
+
+/** Counters of the layer being drawn by a thread, see mpGetLayerCounters. */
+struct mpLayerCounters {
+  size_t pointsVisited;  //!< Data points read by the layer
+  size_t pointsDrawn;    //!< Points passed to the drawing backend
+  size_t primitives;     //!< Drawing calls of the backend; wxDC calls for the wxDC backend
+};
+
+/** Statistics of the drawing of a layer by mpWindow, see mpLayer::GetStats. */
+struct mpLayerStats {
+  mpRollingStats time;           //!< Seconds spent in the layer
+  mpRollingStats pointsVisited;  //!< See mpLayerCounters
+  mpRollingStats pointsDrawn;    //!< See mpLayerCounters
+  mpRollingStats primitives;     //!< See mpLayerCounters
+};
+
+/** Get the counters of the layer drawn by the calling thread.
+    @return The counters, NULL when the thread is not drawing a layer of an mpWindow */
+WXDLLIMPEXP_MATHPLOT mpLayerCounters *mpGetLayerCounters();
+
+/** Add n to a field of the counters of the layer being drawn, if any. */
+#define mpSTATS_COUNT(field, n)                                                                 \
+  do {                                                                                          \
+    if (mpLayerCounters *mpCounters_ = mpGetLayerCounters()) mpCounters_->field += (size_t)(n); \
+  } while (0)
+#else
+#define mpSTATS_COUNT(field, n) \
+  do {                          \
+  } while (0)
+#endif  // MATHPLOT_ENABLE_STATS
+
+//-----------------------------------------------------------------------------
+// Tracing
+//-----------------------------------------------------------------------------
+
+#ifdef MATHPLOT_ENABLE_TRACE
+/** Maximum length of the names of trace events; longer names are truncated. */
+#define mpTRACE_NAME 48
+
+/** Start tracing the paint pipeline of the library, and the scopes of the
+    application marked with mpTRACE_SCOPE, into a Chrome Trace Event file that
+    can be loaded in Perfetto or chrome://tracing. The events are kept in
+    memory, in a buffer per thread, and written by mpTraceStop. The buffer of
+    a thread which ended goes to the next new thread, so worker threads
+    following each other share a timeline. Call it from the GUI thread,
+    outside of a paint.
+    @param filename Name of the JSON file to write
+    @return true if the file could be created */
+WXDLLIMPEXP_MATHPLOT bool mpTraceStart(const wxString &filename);
+
+/** Stop tracing and write the events recorded since mpTraceStart. Call it
+    from the GUI thread, outside of a paint.
+    @return true if the file was written */
+WXDLLIMPEXP_MATHPLOT bool mpTraceStop();
+
+/** Check whether tracing is running. */
+WXDLLIMPEXP_MATHPLOT bool mpTraceIsActive();
+
+/** Record the lifetime of the object as a trace event, when tracing is running.
+    Recording does not lock: each thread appends to its own buffer. */
+class WXDLLIMPEXP_MATHPLOT mpTraceScope {
+ public:
+  /** @param category Category of the event; must be a string literal
+      @param name Name of the event */
+  mpTraceScope(const char *category, const char *name);
+  mpTraceScope(const char *category, const wxString &name);
+  ~mpTraceScope();
+
+  /** Start the event again from now, for events ending with the destruction
+      of another object. */
+  void Restart() { m_start = std::chrono::steady_clock::now(); }
+
+ private:
+  const char *m_category;                         //!< NULL when tracing was not running at construction
+  char m_name[mpTRACE_NAME];                      //!< Name of the event
+  std::chrono::steady_clock::time_point m_start;  //!< Start of the event
 };
 
+#define mpTRACE_CONCAT_(a, b) a##b
+#define mpTRACE_CONCAT(a, b) mpTRACE_CONCAT_(a, b)
+/** Record the rest of the enclosing block as a trace event. */
+#define mpTRACE_SCOPE(category, name) mpTraceScope mpTRACE_CONCAT(mpTraceScope_, __LINE__)(category, name)
+#else
+#define mpTRACE_SCOPE(category, name) \
+  do {                                \
+  } while (0)
+#endif  // MATHPLOT_ENABLE_TRACE
+
 //-----------------------------------------------------------------------------
 // mpLayer
 //-----------------------------------------------------------------------------
@@ -174,6 +345,32 @@ class WXDLLIMPEXP_MATHPLOT mpLayer : public wxObject {
   */
   virtual double GetMaxY() { return 1.0; }
 
+  /** Get the area of the window the layer draws into.
+      mpWindow skips the layers not drawing into the part of the window being
+      repainted. The default implementation returns \a FALSE, so that the
+      layer is always drawn.
+      @param w View the layer is plotted in.
+      @param bounds Returns the area in window pixels, possibly larger than the window.
+      @retval TRUE The layer draws nothing outside \a bounds
+      @retval FALSE The area is not known
+  */
+  virtual bool GetScreenBounds(mpPlotView &WXUNUSED(w), wxRect &WXUNUSED(bounds)) { return false; }
+
+  /** Bring the layer data up to date before painting.
+      Called by mpWindow in the GUI thread at the start of each paint, for
+      layers receiving data from other threads. The default implementation
+      does nothing.
+      @retval TRUE The data changed, the bounding box must be recomputed
+      @retval FALSE Nothing changed
+  */
+  virtual bool UpdateData() { return false; }
+
+  /** Check whether data is waiting to be taken in by UpdateData.
+      Polled by mpWindow to repaint when new data arrives, see mpWindow::SetDataPollInterval.
+      The default implementation returns \a FALSE.
+  */
+  virtual bool HasPendingData() { return false; }
+
   /** Plot given view of layer to the given device context.
       An implementation of this function has to transform layer coordinates to
       wxDC coordinates based on the view parameters retrievable from the
@@ -224,12 +421,36 @@ class WXDLLIMPEXP_MATHPLOT mpLayer : public wxObject {
      Y-orientation
       @endcode
 
+      The default implementation calls Plot(wxDC &, mpWindow &) when the
+      view is a window, for the layers written for older versions, and draws
+      nothing otherwise.
+
       @param dc Device context to plot to.
       @param w  View to plot. The visible area can be retrieved from this
      object.
       @sa mpWindow::p2x,mpWindow::p2y,mpWindow::x2p,mpWindow::y2p
   */
-  virtual void Plot(wxDC &dc, mpWindow &w) = 0;
+  virtual void Plot(wxDC &dc, mpPlotView &w);
+
+  /** Plot the layer on a window, the signature of Plot before mpPlotView.
+      mpWindow draws the layers through this overload, so that layers written
+      for older versions, which override it, are still drawn on windows. The
+      default implementation calls Plot(wxDC &, mpPlotView &).
+      @deprecated Override Plot(wxDC &, mpPlotView &) instead: this overload is
+      not called by mpOffscreenPlot. */
+  virtual void Plot(wxDC &dc, mpWindow &w);
+
+  /** Plot given view of layer through a render backend.
+      mpWindow calls this function instead of Plot when a backend other than
+      #mpRENDERER_DC is selected with mpWindow::SetRendererType. The default
+      implementation calls Plot on the wxDC of the renderer, so that layers
+      only implementing Plot keep working with every backend; the plot layers
+      of the library draw through the primitives of \a r instead.
+      @param r Renderer to draw with.
+      @param w View to plot.
+      @sa mpRenderer::GetDC
+  */
+  virtual void Render(mpRenderer &r, mpPlotView &w);
 
   /** Get layer name.
       @return Name
@@ -313,6 +534,44 @@ class WXDLLIMPEXP_MATHPLOT mpLayer : public wxObject {
           @param brush brush, will be copied to internal class member	*/
   void SetBrush(wxBrush brush) { m_brush = brush; };
 
+  /** Allow the layer to be plotted by a worker thread when the parallel plot of mpWindow is enabled.
+      Only enable it if Render is safe to run outside the GUI thread, concurrently with the Render of
+      other layers, on an mpRasterRenderer of its own (default is false). The reference counts of
+      wx objects are not atomic: Render must not copy objects shared with other threads, such as the
+      stock pens and fonts. The pen, brush and font of the layer are made unique before each plot, see
+      UnshareDrawingObjects.
+      @sa mpWindow::EnableParallelPlot */
+  void SetParallelPlot(bool parallel) { m_parallelPlot = parallel; };
+
+  /** Give the pen, brush and font of the layer reference data of their own.
+      Called by mpWindow in the GUI thread before plotting the layer in a worker
+      thread, so that the copies made by the worker do not share a reference
+      count with objects used by other threads.
+      @sa SetParallelPlot */
+  void UnshareDrawingObjects();
+
+  /** Keep the state the layer adapts to the size of the view while drawing,
+      before the view is fitted to an image or a page.
+      @sa mpPlotView::FitToImage, RestoreViewState */
+  virtual void SaveViewState() {}
+
+  /** Restore the state kept by SaveViewState, once the view is back.
+      @sa mpPlotView::RestoreView */
+  virtual void RestoreViewState() {}
+
+  /** Check whether the layer can be plotted by a worker thread.
+      @sa SetParallelPlot */
+  bool GetParallelPlot() const { return m_parallelPlot; };
+
+#ifdef MATHPLOT_ENABLE_STATS
+  /** Get the statistics of the drawing of the layer by mpWindow, updated at each paint.
+      Only available when the library is built with MATHPLOT_ENABLE_STATS. */
+  const mpLayerStats &GetStats() const { return m_stats; }
+
+  /** Get the statistics of the layer for updating, see GetStats. */
+  mpLayerStats &GetStats() { return m_stats; }
+#endif
+
  protected:
   wxFont m_font;              //!< Layer's font
   wxPen m_pen;                //!< Layer's pen
@@ -326,6 +585,20 @@ class WXDLLIMPEXP_MATHPLOT mpLayer : public wxObject {
                               // margins or over all DC
   mpLayerType m_type;         //!< Define layer type, which is assigned by constructor
   bool m_visible;             //!< Toggles layer visibility
+  bool m_parallelPlot;        //!< The layer can be plotted by a worker thread
+  bool m_plottingWindow;      //!< Plot(wxDC &, mpPlotView &) is calling Plot(wxDC &, mpWindow &)
+#ifdef MATHPLOT_ENABLE_STATS
+  mpLayerStats m_stats;  //!< Statistics of the drawing, see GetStats
+#endif
+
+  /** Map the bounding box to window pixels, for GetScreenBounds.
+      @param w View the layer is plotted in.
+      @param bounds Returns the box, clamped to just outside the window and inflated by \a margin.
+      @param margin Pixels drawn around the box, for example by a wide pen.
+      @return \a FALSE when the layer has no finite bounding box
+  */
+  bool GetBBoxScreenBounds(mpPlotView &w, wxRect &bounds, int margin);
+
   DECLARE_DYNAMIC_CLASS(mpLayer)
 };
 
@@ -364,11 +637,21 @@ class WXDLLIMPEXP_MATHPLOT mpInfoLayer : public mpLayer {
       @return always \a FALSE */
   virtual bool HasBBox() { return false; };
 
+  /** The info box draws inside its rectangle. @sa mpLayer::GetScreenBounds */
+  virtual bool GetScreenBounds(mpPlotView &WXUNUSED(w), wxRect &bounds) {
+    bounds = m_dim;
+    return true;
+  }
+
   /** Plot method. Can be overidden by derived classes.
       @param dc the device content where to plot
       @param w the window to plot
       @sa mpLayer::Plot */
-  virtual void Plot(wxDC &dc, mpWindow &w);
+  virtual void Plot(wxDC &dc, mpPlotView &w);
+
+  /** Render the layer through a render backend, see mpLayer::Render. Plot
+      renders through an mpDCRenderer. */
+  virtual void Render(mpRenderer &r, mpPlotView &w);
 
   /** Specifies that this is an Info box layer.
       @return always \a TRUE
@@ -401,12 +684,19 @@ class WXDLLIMPEXP_MATHPLOT mpInfoLayer : public mpLayer {
       @return The info layer rectangle */
   const wxRect &GetRectangle() { return m_dim; };
 
+  /** Keep the box, which is moved and resized with the view. */
+  virtual void SaveViewState();
+  virtual void RestoreViewState();
+
  protected:
   wxRect m_dim;         //!< The bounding rectangle of the box. It may be resized
                         // dynamically by the Plot method.
   wxPoint m_reference;  //!< Holds the reference point for movements
   int m_winX, m_winY;   //!< Holds the mpWindow size. Used to rescale position
                         // when window is resized.
+  wxRect m_savedDim;         //!< m_dim kept by SaveViewState
+  wxPoint m_savedReference;  //!< m_reference kept by SaveViewState
+  int m_savedWinX, m_savedWinY;
 
   DECLARE_DYNAMIC_CLASS(mpInfoLayer)
 };
@@ -439,7 +729,11 @@ class WXDLLIMPEXP_MATHPLOT mpInfoCoords : public mpInfoLayer {
       @param dc the device content where to plot
       @param w the window to plot
       @sa mpLayer::Plot */
-  virtual void Plot(wxDC &dc, mpWindow &w);
+  virtual void Plot(wxDC &dc, mpPlotView &w);
+
+  /** Render the layer through a render backend, see mpLayer::Render. Plot
+      renders through an mpDCRenderer. */
+  virtual void Render(mpRenderer &r, mpPlotView &w);
 
  protected:
   wxString m_content;  //!< string holding the coordinates to be drawn.
@@ -474,10 +768,587 @@ class WXDLLIMPEXP_MATHPLOT mpInfoLegend : public mpInfoLayer {
       @param dc the device content where to plot
       @param w the window to plot
       @sa mpLayer::Plot */
-  virtual void Plot(wxDC &dc, mpWindow &w);
+  virtual void Plot(wxDC &dc, mpPlotView &w);
+
+  /** Render the layer through a render backend, see mpLayer::Render. Plot
+      renders through an mpDCRenderer. */
+  virtual void Render(mpRenderer &r, mpPlotView &w);
+
+ protected:
+};
+
+#ifdef MATHPLOT_ENABLE_STATS
+/** @class mpInfoPerf
+    @brief Info box showing the frame rate and the slowest layers
+    Shows the frames per second and frame time of the mpWindow, followed by
+    the layers which took the longest time to draw in the last frame. Only
+    available when the library is built with MATHPLOT_ENABLE_STATS. */
+class WXDLLIMPEXP_MATHPLOT mpInfoPerf : public mpInfoLayer {
+ public:
+  /** Default constructor */
+  mpInfoPerf();
+
+  /** Complete constructor, setting initial rectangle and background brush.
+      @param rect The initial bounding rectangle.
+      @param brush The wxBrush to be used for box background: default is
+     transparent
+      @param layers Number of layers listed */
+  mpInfoPerf(wxRect rect, const wxBrush *brush = wxTRANSPARENT_BRUSH, size_t layers = 5);
+
+  /** Set the number of layers listed. */
+  void SetLayerCount(size_t layers) { m_layerCount = layers; }
+
+  /** Updates the content of the info box. Unused in this class. */
+  virtual void UpdateInfo(mpWindow &w, wxEvent &event);
+
+  /** Plot method, see mpLayer::Plot. */
+  virtual void Plot(wxDC &dc, mpPlotView &w);
+
+  /** Render the layer through a render backend, see mpLayer::Render. Plot
+      renders through an mpDCRenderer. */
+  virtual void Render(mpRenderer &r, mpPlotView &w);
+
+ protected:
+  size_t m_layerCount;  //!< Number of layers listed
+};
+#endif  // MATHPLOT_ENABLE_STATS
+
+//-----------------------------------------------------------------------------
+// mpRasterBuffer
+//-----------------------------------------------------------------------------
+
+/** An in-memory ARGB image, drawn on directly by the layers for speed.
+    Pixels are stored row by row as 0xAARRGGBB values, without blending: a
+    drawn pixel replaces the previous value. Every drawing function takes a
+    clipping rectangle, so that several threads can draw at once on disjoint
+    areas of the same buffer. The drawing functions take plot coordinates: a
+    buffer with an origin only holds the part of the plot starting there.
+*/
+class WXDLLIMPEXP_MATHPLOT mpRasterBuffer {
+ public:
+  /** Create a transparent buffer of the given size. */
+  mpRasterBuffer(int width = 0, int height = 0) : m_originX(0), m_originY(0) { Create(width, height); }
+
+  /** Resize the buffer, making it transparent. Memory is kept when the buffer shrinks.
+      @param x,y Plot coordinates of the top left pixel of the buffer */
+  void Create(int width, int height, int x = 0, int y = 0);
+
+  /** Get the area of the plot held by the buffer. */
+  wxRect GetRect() const { return wxRect(m_originX, m_originY, m_width, m_height); }
+
+  /** Fill the whole buffer with a colour.
+      @param argb Colour, 0 for transparent */
+  void Clear(wxUint32 argb = 0);
+
+  int GetWidth() const { return m_width; }
+  int GetHeight() const { return m_height; }
+
+  /** Get the pixel row y, counted from the top of the buffer. */
+  wxUint32 *GetRow(int y) { return &m_pixels[(size_t)y * (size_t)m_width]; }
+
+  /** Get the pixel row y, counted from the top of the buffer. */
+  const wxUint32 *GetRow(int y) const { return &m_pixels[(size_t)y * (size_t)m_width]; }
+
+  /** Draw a point as a square of side width, centred on (x, y).
+      @param clip Only the pixels in this rectangle are drawn */
+  void DrawPoint(int x, int y, wxUint32 argb, int width, const wxRect &clip);
+
+  /** Draw a line with the Bresenham algorithm, both end points included.
+      The end points must be within a few million pixels from the origin:
+      clip long lines with ClipLine first.
+      @param clip Only the pixels in this rectangle are drawn */
+  void DrawLine(int x0, int y0, int x1, int y1, wxUint32 argb, int width, const wxRect &clip);
+
+  /** Clip a line to a rectangle, in floating point.
+      @return false if the line lies outside the rectangle */
+  static bool ClipLine(double &x0, double &y0, double &x1, double &y1, const wxRect &clip);
+
+  /** Convert a colour to the pixel format of the buffer. */
+  static wxUint32 ToARGB(const wxColour &colour) {
+    return ((wxUint32)colour.Alpha() << 24) | ((wxUint32)colour.Red() << 16) | ((wxUint32)colour.Green() << 8) |
+           (wxUint32)colour.Blue();
+  }
+
+  /** Fill a rectangle with a colour.
+      @param clip Only the pixels in this rectangle are drawn */
+  void FillRect(const wxRect &rect, wxUint32 argb, const wxRect &clip);
+
+  /** Blend an image over the buffer, using the alpha channel or the mask of
+      the image when it has one.
+      @param clip Only the pixels in this rectangle are drawn */
+  void DrawImage(const wxImage &image, int x, int y, const wxRect &clip);
+
+  /** Draw another buffer over this one: its opaque pixels replace the pixels
+      below, and its translucent ones are blended as in DrawImage.
+      @param clip Only the pixels in this rectangle are drawn */
+  void DrawBuffer(const mpRasterBuffer &buffer, const wxRect &clip);
+
+  /** Copy the buffer to an image with alpha channel. */
+  wxImage ToImage() const;
+
+ protected:
+  std::vector<wxUint32> m_pixels;
+  int m_width, m_height;
+  int m_originX, m_originY;  //!< Plot coordinates of the first pixel
+};
+
+/** Value for mpFXY::SetRasterTiles: one tile per processor core. */
+#define mpRASTER_TILES_AUTO -1
+
+//-----------------------------------------------------------------------------
+// mpPNGWriter
+//-----------------------------------------------------------------------------
+
+/** PNG encoder taking the image a few rows at a time, for images too large
+    to be held in memory at once (see mpPlotView::ExportPNG). The rows are
+    compressed as they come, each call of WriteRows ending one IDAT chunk.
+    The image is written as 8 bit RGB, or RGBA.
+*/
+class WXDLLIMPEXP_MATHPLOT mpPNGWriter {
+ public:
+  /** Write the PNG signature and header.
+      @param stream Output stream, which must outlive the writer
+      @param alpha Write an alpha channel */
+  mpPNGWriter(wxOutputStream &stream, int width, int height, bool alpha = false);
+  ~mpPNGWriter();
+
+  /** Append rows to the image.
+      @param rgb Pixels of the rows, 3 bytes per pixel, as in wxImage::GetData
+      @param rows Number of rows
+      @param alpha Alpha of the pixels, as in wxImage::GetAlpha, if the image has an alpha channel
+      @return false on write error, or if the image already has all its rows */
+  bool WriteRows(const unsigned char *rgb, int rows, const unsigned char *alpha = NULL);
+
+  /** Finish the file.
+      @return true if every row was written without error */
+  bool Close();
+
+  /** Check that nothing failed so far. */
+  bool IsOk() const { return m_ok; }
+
+ private:
+  void WriteChunk(const char *type, const unsigned char *data, size_t size);
+  void WriteData();
+
+  wxOutputStream &m_stream;
+  mpByteStream *m_data;        //!< Compressed bytes of the next IDAT chunk
+  wxZlibOutputStream *m_zlib;  //!< Compressor writing to m_data
+  int m_width, m_height;
+  int m_rows;  //!< Rows written so far
+  bool m_alpha;
+  bool m_ok;
+  std::vector<unsigned char> m_line;  //!< Row being interleaved with its alpha
+
+  mpPNGWriter(const mpPNGWriter &);
+  mpPNGWriter &operator=(const mpPNGWriter &);
+};
+
+//-----------------------------------------------------------------------------
+// mpRenderer - render backends
+//-----------------------------------------------------------------------------
+
+/** Render backends, selected with mpWindow::SetRendererType. */
+typedef enum __mp_Renderer_Type {
+  mpRENDERER_DC,     //!< Layers plot directly on the wxDC (default)
+  mpRENDERER_GC,     //!< Antialiased wxGraphicsContext, batching the lines and points of a layer in one path
+  mpRENDERER_RASTER  //!< In-memory image drawn on the wxDC at once, text being drawn afterwards; always used by
+                     //!< the parallel plot, see mpWindow::EnableParallelPlot
+} mpRendererType;
+
+/** Abstract drawing interface used by mpLayer::Render.
+    Coordinates are in pixels, as for the wxDC passed to mpLayer::Plot. The
+    primitives take whole batches of points, so that a backend can draw them
+    with as few calls as possible: a backend may also defer the drawing until
+    Flush, or until the pen changes.
+*/
+class WXDLLIMPEXP_MATHPLOT mpRenderer {
+ public:
+  virtual ~mpRenderer() {}
+
+  /** Set the pen used for lines, points and rectangle outlines. */
+  virtual void SetPen(const wxPen &pen) = 0;
+
+  /** Set the brush used to fill rectangles. */
+  virtual void SetBrush(const wxBrush &brush) = 0;
+
+  /** Set the font used by DrawText and GetTextExtent. */
+  virtual void SetFont(const wxFont &font) = 0;
+
+  /** Set the colour of the text. */
+  virtual void SetTextForeground(const wxColour &colour) = 0;
+
+  /** Draw a polyline linking n points. */
+  virtual void DrawLines(const wxPoint *points, size_t n) = 0;
+
+  /** Draw n separate points, as squares of the pen width. */
+  virtual void DrawPoints(const wxPoint *points, size_t n) = 0;
+
+  /** Draw n rectangles, filled with the brush and outlined with the pen. */
+  virtual void DrawRectangles(const wxRect *rects, size_t n) = 0;
+
+  /** Draw a text with its top-left corner at (x, y). */
+  virtual void DrawText(const wxString &text, wxCoord x, wxCoord y) = 0;
+
+  /** Draw a text rotated around its top-left corner (x, y), as wxDC::DrawRotatedText.
+      @param angle Counterclockwise angle in degrees */
+  virtual void DrawRotatedText(const wxString &text, wxCoord x, wxCoord y, double angle) = 0;
+
+  /** Get the size of a text drawn with the current font. */
+  virtual void GetTextExtent(const wxString &text, wxCoord *w, wxCoord *h) = 0;
+
+  /** Draw an image with its top-left corner at (x, y), blending it with
+      its alpha channel or mask. */
+  virtual void DrawImage(const wxImage &image, wxCoord x, wxCoord y) = 0;
+
+  /** Draw everything still pending. The backends deferring the drawing also
+      flush when destroyed. */
+  virtual void Flush() {}
+
+  /** Get a wxDC drawing on the same target, for layers only implementing
+      mpLayer::Plot. The pending primitives are drawn first, so that the
+      order of the layers is kept.
+      @return The DC, or NULL if the backend cannot provide one */
+  virtual wxDC *GetDC() = 0;
+
+  /** Tell the layers that only a part of the plot is being drawn, as when
+      exporting in bands (see mpPlotView::ExportPNG). Layers may skip what
+      lies outside; the drawing is not clipped to it.
+      @param area Area in plot pixels, empty for the whole plot */
+  void SetVisibleArea(const wxRect &area) { m_visibleArea = area; }
+
+  /** Get the part of the plot being drawn, empty for the whole plot. */
+  const wxRect &GetVisibleArea() const { return m_visibleArea; }
+
+  /** Draw a single line. As with wxDC::DrawLine, the last point may be left
+      out: mpDCRenderer does, the renderers drawing in their own buffers do not. */
+  void DrawLine(wxCoord x1, wxCoord y1, wxCoord x2, wxCoord y2) {
+    const wxPoint points[2] = {wxPoint(x1, y1), wxPoint(x2, y2)};
+    DrawLines(points, 2);
+  }
+
+  /** Draw a single rectangle. */
+  void DrawRectangle(wxCoord x, wxCoord y, wxCoord width, wxCoord height) {
+    const wxRect rect(x, y, width, height);
+    DrawRectangles(&rect, 1);
+  }
+
+ protected:
+  wxRect m_visibleArea;  //!< Part of the plot being drawn, empty for the whole plot
+};
+
+/** Renderer drawing directly on a wxDC, as mpLayer::Plot does.
+    The ported layers draw as their Plot did before the renderers, except that
+    consecutive segments of one pixel wide lines are drawn as a single polyline.
+    Wider lines are still drawn segment by segment, with the same joins as
+    before. */
+class WXDLLIMPEXP_MATHPLOT mpDCRenderer : public mpRenderer {
+ public:
+  mpDCRenderer(wxDC &dc) : m_dc(dc), m_fat(false) {}
+
+  virtual void SetPen(const wxPen &pen);
+  virtual void SetBrush(const wxBrush &brush) { m_dc.SetBrush(brush); }
+  virtual void SetFont(const wxFont &font) { m_dc.SetFont(font); }
+  virtual void SetTextForeground(const wxColour &colour) { m_dc.SetTextForeground(colour); }
+  virtual void DrawLines(const wxPoint *points, size_t n);
+  virtual void DrawPoints(const wxPoint *points, size_t n);
+  virtual void DrawRectangles(const wxRect *rects, size_t n);
+  virtual void DrawText(const wxString &text, wxCoord x, wxCoord y) {
+    mpSTATS_COUNT(primitives, 1);
+    m_dc.DrawText(text, x, y);
+  }
+  virtual void DrawRotatedText(const wxString &text, wxCoord x, wxCoord y, double angle) {
+    mpSTATS_COUNT(primitives, 1);
+    m_dc.DrawRotatedText(text, x, y, angle);
+  }
+  virtual void GetTextExtent(const wxString &text, wxCoord *w, wxCoord *h) { m_dc.GetTextExtent(text, w, h); }
+  virtual void DrawImage(const wxImage &image, wxCoord x, wxCoord y);
+  virtual wxDC *GetDC() { return &m_dc; }
+
+ protected:
+  wxDC &m_dc;
+  bool m_fat;  //!< The pen is wider than one pixel
+};
+
+#if wxUSE_GRAPHICS_CONTEXT
+/** Renderer drawing with an antialiased wxGraphicsContext on a wxDC.
+    The lines of a layer are collected in a single wxGraphicsPath, and its
+    points in another one, which are stroked and filled once when the pen
+    changes, before any other primitive, or on Flush. This saves most of
+    the per-call overhead of the graphics backends.
+*/
+class WXDLLIMPEXP_MATHPLOT mpGCRenderer : public mpRenderer {
+ public:
+  mpGCRenderer(wxDC &dc);
+
+  /** Draw on an existing graphics context, e.g. one created on a wxImage.
+      The renderer takes ownership of the context. It uses no stock object
+      until GetDC is called, for layers which only implement Plot. */
+  mpGCRenderer(wxGraphicsContext *context);
+  virtual ~mpGCRenderer();
+
+  /** Check whether a graphics context could be created for the DC. */
+  bool IsOk() const { return m_gc != NULL; }
+
+  /** Clip the drawing to a part of the plot, also set as the visible area.
+      A context created for a wxDC does not always get the clipping region
+      of the DC.
+      @param area Area in plot pixels, empty for the whole plot */
+  void Clip(const wxRect &area);
+
+  virtual void SetPen(const wxPen &pen);
+  virtual void SetBrush(const wxBrush &brush) { m_brush = brush; }
+  virtual void SetFont(const wxFont &font) {
+    if (font.IsOk()) m_font = font;
+  }
+  virtual void SetTextForeground(const wxColour &colour);
+  virtual void DrawLines(const wxPoint *points, size_t n);
+  virtual void DrawPoints(const wxPoint *points, size_t n);
+  virtual void DrawRectangles(const wxRect *rects, size_t n);
+  virtual void DrawText(const wxString &text, wxCoord x, wxCoord y);
+  virtual void DrawRotatedText(const wxString &text, wxCoord x, wxCoord y, double angle);
+  virtual void GetTextExtent(const wxString &text, wxCoord *w, wxCoord *h);
+  virtual void DrawImage(const wxImage &image, wxCoord x, wxCoord y);
+  virtual void Flush();
+  virtual wxDC *GetDC();
+
+ protected:
+  wxDC *m_dc;                //!< Target DC, NULL when drawing on a given graphics context
+  wxGCDC *m_gcdc;            //!< Created by GetDC, then owns m_gc
+  wxGraphicsContext *m_gc;   //!< NULL if it could not be created
+  wxGraphicsPath m_lines;    //!< Pending lines, stroked with m_pen
+  wxGraphicsPath m_points;   //!< Pending points, filled with the colour of m_pen
+  bool m_hasLines, m_hasPoints;
+  wxPen m_pen;
+  wxBrush m_brush;
+  wxFont m_font;
+  wxColour m_textColour;
+};
+#endif  // wxUSE_GRAPHICS_CONTEXT
+
+/** Renderer drawing lines, points, rectangles and images into an
+    mpRasterBuffer, without antialiasing. The buffer is drawn on the target
+    DC on Flush, followed by the texts, which the buffer cannot draw. This
+    changes the stacking order: all the texts are drawn over the lines and
+    images drawn since the previous Flush, even those of later layers.
+*/
+class WXDLLIMPEXP_MATHPLOT mpRasterRenderer : public mpRenderer {
+ public:
+  /** @param dc Target DC, also used to measure the texts
+      @param width Width of the drawn area
+      @param height Height of the drawn area */
+  mpRasterRenderer(wxDC &dc, int width, int height);
+
+  /** Renderer with a buffer only covering a part of the plot, which is also
+      set as the visible area.
+      @param dc Target DC, also used to measure the texts
+      @param area Area drawn, in plot pixels */
+  mpRasterRenderer(wxDC &dc, const wxRect &area);
+  virtual ~mpRasterRenderer();
+
+  virtual void SetPen(const wxPen &pen);
+  virtual void SetBrush(const wxBrush &brush);
+  virtual void SetFont(const wxFont &font) { m_font = font; }
+  virtual void SetTextForeground(const wxColour &colour) { m_textColour = colour; }
+  virtual void DrawLines(const wxPoint *points, size_t n);
+  virtual void DrawPoints(const wxPoint *points, size_t n);
+  virtual void DrawRectangles(const wxRect *rects, size_t n);
+  virtual void DrawText(const wxString &text, wxCoord x, wxCoord y);
+  virtual void DrawRotatedText(const wxString &text, wxCoord x, wxCoord y, double angle);
+  virtual void GetTextExtent(const wxString &text, wxCoord *w, wxCoord *h);
+  virtual void DrawImage(const wxImage &image, wxCoord x, wxCoord y);
+  virtual void Flush();
+  virtual wxDC *GetDC();
+
+  /** Get the buffer drawn into. */
+  const mpRasterBuffer &GetBuffer() const { return m_buffer; }
+
+  /** Let a worker thread draw a layer with the renderer, as the parallel plot
+      of mpWindow does. Called in the GUI thread, this gives the font and the
+      text colour reference data of their own. The drawing then stays in the
+      renderer until it is merged with MergeInto: Flush does nothing, and
+      GetDC returns NULL, the layer being plotted again in the GUI thread.
+      @param textLock Lock taken to measure the texts on the shared DC */
+  void SetWorker(std::mutex *textLock);
+
+  /** Check whether GetDC was called while drawing in a worker thread. */
+  bool IsDCRequested() const { return m_dcRequested; }
+
+  /** Move the drawing to another renderer, as if it had been drawn there:
+      the buffer is drawn over the other buffer with mpRasterBuffer::DrawBuffer
+      and the texts are appended to its texts. Lines and points drawn with a
+      translucent pen are blended instead of replacing the pixels below. */
+  void MergeInto(mpRasterRenderer &target);
+
+ protected:
+  /** Text waiting for the buffer to be drawn. */
+  struct Text {
+    wxString text;
+    wxCoord x, y;
+    double angle;
+    wxFont font;
+    wxColour colour;
+  };
+
+  wxDC &m_dc;
+  mpRasterBuffer m_buffer;
+  wxRect m_clip;            //!< Area of the plot held by the buffer
+  bool m_dirty;             //!< Something was drawn since the last Flush
+  wxUint32 m_penColour;     //!< 0 for a transparent pen
+  int m_penWidth;
+  wxUint32 m_brushColour;   //!< 0 for a transparent brush
+  wxFont m_font;
+  wxColour m_textColour;
+  std::vector<Text> m_texts;
+  std::mutex *m_textLock;   //!< Set by SetWorker
+  bool m_dcRequested;       //!< GetDC was called by a worker thread
+};
+
+/** Renderer reducing the lines and points to the pixels they cover before
+    passing them to another renderer, for targets drawing every primitive
+    they get, such as printers. Runs of consecutive line points in the same
+    pixel column are reduced to their first, lowest, highest and last points,
+    which cover the same pixels. A point is dropped when the same pen drew
+    one in its pixel since the last other primitive, which a bitmap of the
+    plot, or else of the visible area, tells. The other primitives are
+    passed unchanged.
+*/
+class WXDLLIMPEXP_MATHPLOT mpDecimatingRenderer : public mpRenderer {
+ public:
+  /** @param target Renderer drawing the reduced primitives
+      @param width,height Size of the plot, covered by the bitmap of the
+      drawn points, one bit per pixel. When 0, the bitmap covers the
+      visible area. */
+  mpDecimatingRenderer(mpRenderer &target, int width = 0, int height = 0)
+      : m_target(target), m_width(width), m_height(height) {}
+
+  virtual void SetPen(const wxPen &pen);
+  virtual void SetBrush(const wxBrush &brush) { m_target.SetBrush(brush); }
+  virtual void SetFont(const wxFont &font) { m_target.SetFont(font); }
+  virtual void SetTextForeground(const wxColour &colour) { m_target.SetTextForeground(colour); }
+  virtual void DrawLines(const wxPoint *points, size_t n);
+  virtual void DrawPoints(const wxPoint *points, size_t n);
+  virtual void DrawRectangles(const wxRect *rects, size_t n) {
+    ClearPoints();
+    m_target.DrawRectangles(rects, n);
+  }
+  virtual void DrawText(const wxString &text, wxCoord x, wxCoord y) {
+    ClearPoints();
+    m_target.DrawText(text, x, y);
+  }
+  virtual void DrawRotatedText(const wxString &text, wxCoord x, wxCoord y, double angle) {
+    ClearPoints();
+    m_target.DrawRotatedText(text, x, y, angle);
+  }
+  virtual void GetTextExtent(const wxString &text, wxCoord *w, wxCoord *h) { m_target.GetTextExtent(text, w, h); }
+  virtual void DrawImage(const wxImage &image, wxCoord x, wxCoord y) {
+    ClearPoints();
+    m_target.DrawImage(image, x, y);
+  }
+  virtual void Flush() {
+    ClearPoints();
+    m_target.Flush();
+  }
+  virtual wxDC *GetDC() {
+    ClearPoints();
+    return m_target.GetDC();
+  }
+
+ protected:
+  void ClearPoints();  //!< Forget the pixels of the points drawn so far
+
+  mpRenderer &m_target;
+  int m_width, m_height;
+  std::vector<wxPoint> m_reduced;     //!< Reduced points, reused between calls
+  wxRect m_pointArea;                 //!< Area covered by m_pointMask
+  std::vector<uint64_t> m_pointMask;  //!< Pixels of m_pointArea holding a point, one bit each
+  std::vector<size_t> m_pointWords;   //!< Words of m_pointMask which are not 0
+};
+
+#if wxUSE_GRAPHICS_CONTEXT
+/** Renderer writing an SVG document, used by mpPlotView::ExportSVG.
+    Consecutive lines drawn with the same pen make a single path element,
+    and the points a single path of squares, so that a layer usually ends
+    up as one element whatever its number of points. The polylines are
+    simplified first: runs of points in the same pixel column are reduced to
+    their first, lowest, highest and last points, then the Douglas-Peucker
+    algorithm removes the points closer to the line than the tolerance, in
+    pieces of a few hundred lines so that its time stays linear in the number
+    of points.
+    Layers only implementing mpLayer::Plot are drawn on a transparent image,
+    embedded as PNG.
+*/
+class WXDLLIMPEXP_MATHPLOT mpSVGRenderer : public mpRenderer {
+ public:
+  /** Write the header of the document.
+      @param stream Output stream, which must outlive the renderer
+      @param width,height Size of the plot in pixels
+      @param dpi Resolution of the target, giving the physical size of the
+      image: one pixel of the plot is one dot of the target. The texts keep
+      their size in points, so they take more pixels at higher resolutions */
+  mpSVGRenderer(wxOutputStream &stream, int width, int height, double dpi = 96);
+
+  /** Close the document if Close was not called. */
+  virtual ~mpSVGRenderer();
+
+  /** Draw everything pending and write the end of the document.
+      @return true if the whole document was written */
+  bool Close();
+
+  /** Set the largest distance between a simplified polyline and the
+      original one, in pixels. The default is half a pixel, which no target
+      of the given resolution can show; 0 only removes the aligned points. */
+  void SetTolerance(double tolerance) { m_tolerance = tolerance; }
+
+  /** Check that nothing failed so far. */
+  bool IsOk() const { return m_ok; }
+
+  virtual void SetPen(const wxPen &pen);
+  virtual void SetBrush(const wxBrush &brush) { m_brush = brush; }
+  virtual void SetFont(const wxFont &font) { m_font = font; }
+  virtual void SetTextForeground(const wxColour &colour) { m_textColour = colour; }
+  virtual void DrawLines(const wxPoint *points, size_t n);
+  virtual void DrawPoints(const wxPoint *points, size_t n);
+  virtual void DrawRectangles(const wxRect *rects, size_t n);
+  virtual void DrawText(const wxString &text, wxCoord x, wxCoord y) { DrawRotatedText(text, x, y, 0); }
+  virtual void DrawRotatedText(const wxString &text, wxCoord x, wxCoord y, double angle);
+  virtual void GetTextExtent(const wxString &text, wxCoord *w, wxCoord *h);
+  virtual void DrawImage(const wxImage &image, wxCoord x, wxCoord y);
+  virtual void Flush();
+  virtual wxDC *GetDC();
 
  protected:
+  void Write(const wxString &text);
+  void EndPolyline();     //!< Simplify m_polyline and append it to m_path
+  void EndColumn();       //!< Append the reduced run of m_column to m_polyline
+  void EndFallback();     //!< Embed the drawing of the layers only implementing Plot
+  wxString PenStyle() const;  //!< Stroke attributes of m_pen
+
+  wxOutputStream &m_stream;
+  std::string m_buffer;  //!< Output not yet written to m_stream
+  int m_width, m_height;
+  double m_tolerance;
+  bool m_ok;
+  bool m_closed;
+
+  wxPen m_pen;
+  wxBrush m_brush;
+  wxFont m_font;
+  wxColour m_textColour;
+  wxGraphicsContext *m_measure;  //!< Measures the texts
+  double m_textScale;            //!< Plot pixels per pixel of m_measure, from the resolution
+
+  std::string m_path;                 //!< Path data of the pending lines
+  std::vector<wxPoint> m_polyline;    //!< Polyline being drawn, after the column reduction
+  wxPoint m_column[4];                //!< Run of points in the same column: first, lowest, highest, last
+  bool m_hasColumn;                   //!< m_column holds a run
+  bool m_lowFirst;                    //!< The lowest point of the run comes before the highest one
+  std::vector<wxPoint> m_points;      //!< Pending points, one per pixel
+  std::vector<uint64_t> m_pointMask;  //!< Pixels of the plot in m_points, one bit each
+
+  wxImage m_fallbackImage;  //!< Target of GetDC
+  wxGCDC *m_fallbackDC;     //!< Draws on m_fallbackImage, NULL if unused
 };
+#endif  // wxUSE_GRAPHICS_CONTEXT
 
 //-----------------------------------------------------------------------------
 // mpLayer implementations - functions
@@ -530,6 +1401,9 @@ class WXDLLIMPEXP_MATHPLOT mpInfoLegend : public mpInfoLayer {
 /** Aligns label to south-east. For use with mpFXY. */
 #define mpALIGN_SE 0x03
 
+/** Number of values mpFXY::Plot requests at once through mpFXY::GetChunk. */
+#define mpFXY_CHUNK_SIZE 1024
+
 /*@}*/
 
 /** @name mpLayer implementations - functions
@@ -558,11 +1432,25 @@ class WXDLLIMPEXP_MATHPLOT mpFX : public mpLayer {
   */
   virtual double GetY(double x) = 0;
 
+  /** Get function values for a batch of arguments.
+      mpFX::Plot evaluates the whole visible range with a single call to this
+      function. The default implementation calls GetY for each argument;
+      override it when the function can be evaluated more efficiently in bulk.
+      @param xs Arguments
+      @param ys Returns the function values, same length as \a xs
+      @param n Number of arguments
+  */
+  virtual void GetYs(const double *xs, double *ys, size_t n);
+
   /** Layer plot handler.
       This implementation will plot the function in the visible area and
       put a label according to the aligment specified.
   */
-  virtual void Plot(wxDC &dc, mpWindow &w);
+  virtual void Plot(wxDC &dc, mpPlotView &w);
+
+  /** Render the function through a render backend, see mpLayer::Render. Plot
+      renders through an mpDCRenderer. */
+  virtual void Render(mpRenderer &r, mpPlotView &w);
 
  protected:
   int m_flags;  //!< Holds label alignment
@@ -597,7 +1485,11 @@ class WXDLLIMPEXP_MATHPLOT mpFY : public mpLayer {
       This implementation will plot the function in the visible area and
       put a label according to the aligment specified.
   */
-  virtual void Plot(wxDC &dc, mpWindow &w);
+  virtual void Plot(wxDC &dc, mpPlotView &w);
+
+  /** Render the function through a render backend, see mpLayer::Render. Plot
+      renders through an mpDCRenderer. */
+  virtual void Render(mpRenderer &r, mpPlotView &w);
 
  protected:
   int m_flags;  //!< Holds label alignment
@@ -636,17 +1528,76 @@ class WXDLLIMPEXP_MATHPLOT mpFXY : public mpLayer {
   */
   virtual bool GetNextXY(double &x, double &y) = 0;
 
+  /** Tell whether the layer implements mpFXY::GetChunk.
+      Override this function together with GetChunk: mpFXY::Plot then reads
+      the locus in chunks instead of using Rewind and GetNextXY.
+  */
+  virtual bool SupportsChunks() { return false; }
+
+  /** Get a chunk of consecutive locus values, without copying them.
+      Unlike GetNextXY this does not depend on an enumeration state, so
+      several readers may access the layer at once.
+      @param start Index of the first requested value
+      @param maxCount Maximum number of requested values
+      @param xs Returns a pointer to the X values
+      @param ys Returns a pointer to the Y values
+      @return Number of values available at xs and ys, 0 when start is past the end
+  */
+  virtual size_t GetChunk(size_t start, size_t maxCount, const double *&xs, const double *&ys);
+
   /** Layer plot handler.
       This implementation will plot the locus in the visible area and
       put a label according to the alignment specified.
   */
-  virtual void Plot(wxDC &dc, mpWindow &w);
+  virtual void Plot(wxDC &dc, mpPlotView &w);
+
+  /** Render the locus through a render backend, see mpLayer::Render. Plot
+      renders through an mpDCRenderer. */
+  virtual void Render(mpRenderer &r, mpPlotView &w);
+
+  /** Draw the locus into an image instead of the wxDC, splitting the plot
+      area in vertical strips (tiles) rasterized concurrently.
+      This is meant for layers with millions of points. The locus is
+      converted to pixels as Render does, then each tile only draws the
+      blocks of lines or points whose X range overlaps it, writing only its
+      own pixels of a shared mpRasterBuffer, which is then drawn at once.
+      The pixels are those drawn by mpRasterRenderer, whatever the number
+      of tiles.
+      @param tiles Number of tiles, 0 to plot on the wxDC (default),
+      1 to rasterize in the GUI thread, #mpRASTER_TILES_AUTO for one per core
+  */
+  void SetRasterTiles(int tiles) { m_rasterTiles = tiles; }
+
+  /** Get the number of tiles set with SetRasterTiles. */
+  int GetRasterTiles() const { return m_rasterTiles; }
 
  protected:
-  int m_flags;  //!< Holds label alignment
+  int m_flags;        //!< Holds label alignment
+  int m_rasterTiles;  //!< Number of raster tiles, 0 to plot on the wxDC
+  mpRasterBuffer m_raster;  //!< Image of the locus, kept between plots when rasterizing
+
+  /** Rasterize the locus in tiles and draw the image with the renderer.
+      @sa SetRasterTiles */
+  void PlotRaster(mpRenderer &r, mpPlotView &w);
+
+  /** Convert the locus to pixels as Render draws it: the points within the
+      margins, or the lines clipped to them when continuous, leaving out
+      what does not reach the visible area. Also updates the label
+      positioning data.
+      @param visible Visible area of the renderer, empty for the whole plot
+      @param draw Receives the points, or the lines as polylines */
+  void TraceLocus(mpPlotView &w, const wxRect &visible, const std::function<void(const wxPoint *, size_t)> &draw);
+
+  /** Read the next chunk of values for mpFXY::Plot, using GetChunk when
+      supported and filling bufX and bufY through GetNextXY otherwise.
+      @return Number of values available at xs and ys, 0 at the end of the locus
+  */
+  size_t ReadChunk(size_t start, const double *&xs, const double *&ys, std::vector<double> &bufX,
+                   std::vector<double> &bufY);
 
   // Data to calculate label positioning
   wxCoord maxDrawX, minDrawX, maxDrawY, minDrawY;
+  wxCoord m_savedDraw[4];  //!< Label positioning data kept by SaveViewState
   // int drawnPoints;
 
   /** Update label positioning data
@@ -655,6 +1606,16 @@ class WXDLLIMPEXP_MATHPLOT mpFXY : public mpLayer {
       */
   void UpdateViewBoundary(wxCoord xnew, wxCoord ynew);
 
+  /** Keep the label positioning data of the window. */
+  virtual void SaveViewState();
+  virtual void RestoreViewState();
+
+  /** Get the screen bounds of the locus from the bounding box, for the
+      subclasses knowing it. The label, placed from the drawn points, is not
+      covered: the bounds are not known when it is shown.
+      @sa mpLayer::GetScreenBounds */
+  bool GetLocusScreenBounds(mpPlotView &w, wxRect &bounds);
+
   DECLARE_DYNAMIC_CLASS(mpFXY)
 };
 
@@ -689,7 +1650,11 @@ class WXDLLIMPEXP_MATHPLOT mpProfile : public mpLayer {
       This implementation will plot the function in the visible area and
       put a label according to the aligment specified.
   */
-  virtual void Plot(wxDC &dc, mpWindow &w);
+  virtual void Plot(wxDC &dc, mpPlotView &w);
+
+  /** Render the function through a render backend, see mpLayer::Render. Plot
+      renders through an mpDCRenderer. */
+  virtual void Render(mpRenderer &r, mpPlotView &w);
 
  protected:
   int m_flags;  //!< Holds label alignment
@@ -697,6 +1662,155 @@ class WXDLLIMPEXP_MATHPLOT mpProfile : public mpLayer {
   DECLARE_DYNAMIC_CLASS(mpProfile)
 };
 
+/** Compiled mathematical expression of the variable \a x.
+    The expression string is parsed once by Compile() into a compact stack
+    bytecode, with constant sub-expressions folded and constant operands merged
+    into the instructions. EvalBatch() then runs each instruction over a whole
+    block of arguments, so the interpretation cost is paid once per block and
+    not once per point, and the inner loops are simple enough for the compiler
+    to vectorize.
+
+    Supported syntax: numbers, the variable \a x, the constants \a pi and \a e,
+    the operators + - * / and ^ (power, right associative), parentheses, the
+    functions sin, cos, tan, asin, acos, atan, sinh, cosh, tanh, exp, log, log10,
+    sqrt, abs, floor, ceil and the two-argument functions pow, atan2, min, max.
+    Example: \c "sin(3*x)*exp(-x/5)". Expressions nested more than 100 levels
+    deep, or with chains of more than about 1000 operators, are rejected.
+*/
+class WXDLLIMPEXP_MATHPLOT mpExpression {
+ public:
+  /** Default constructor: an empty, invalid expression. */
+  mpExpression();
+
+  /** Constructor compiling the given expression. Check IsOk() afterwards.
+      @param expr The expression string */
+  mpExpression(const wxString &expr);
+
+  /** Parse and compile an expression, replacing the current program.
+      @param expr The expression string
+      @return \a true on success; on failure GetError() describes the problem
+     and the expression is left invalid. */
+  bool Compile(const wxString &expr);
+
+  /** Check whether a valid program has been compiled.
+      @return \a true if the expression can be evaluated */
+  bool IsOk() const { return !m_program.empty(); };
+
+  /** Get the source string of the last compiled expression. */
+  const wxString &GetExpression() const { return m_expression; };
+
+  /** Get the description of the last compilation error, empty on success. */
+  const wxString &GetError() const { return m_error; };
+
+  /** Get the number of bytecode instructions of the compiled program. */
+  size_t GetProgramSize() const { return m_program.size(); };
+
+  /** Evaluate the expression for a single argument.
+      @param x Argument
+      @return Expression value, NaN if the expression is not valid */
+  double Eval(double x) const;
+
+  /** Evaluate the expression for a batch of arguments.
+      @param xs Arguments
+      @param ys Returns the values, same length as \a xs. It may be the same
+     array as \a xs.
+      @param n Number of arguments */
+  void EvalBatch(const double *xs, double *ys, size_t n) const;
+
+  /** Bytecode operation codes. The ones ending in C take their second operand
+      from the instruction constant instead of the stack; the R variants swap
+      the operands (constant on the left). */
+  enum Opcode {
+    opX,       //!< push the argument
+    opConst,   //!< push the constant
+    opAdd,     //!< binary operators on the two topmost values
+    opSub,
+    opMul,
+    opDiv,
+    opPow,
+    opAtan2,
+    opMin,
+    opMax,
+    opAddC,    //!< binary operators with a constant operand
+    opSubC,
+    opRSubC,
+    opMulC,
+    opDivC,
+    opRDivC,
+    opPowC,
+    opRPowC,
+    opSqr,     //!< unary operators and functions on the topmost value
+    opNeg,
+    opSin,
+    opCos,
+    opTan,
+    opAsin,
+    opAcos,
+    opAtan,
+    opSinh,
+    opCosh,
+    opTanh,
+    opExp,
+    opLog,
+    opLog10,
+    opSqrt,
+    opAbs,
+    opFloor,
+    opCeil
+  };
+
+  /** A bytecode instruction. */
+  struct Instruction {
+    Opcode op;     //!< Operation
+    double value;  //!< Constant operand, for opConst and the C variants
+  };
+
+ protected:
+  wxString m_expression;               //!< Source string
+  wxString m_error;                    //!< Last compilation error
+  std::vector<Instruction> m_program;  //!< Compiled bytecode
+  size_t m_depth;                      //!< Maximum stack depth needed by the program
+};
+
+/** A function layer F:X->Y defined by an expression string, like
+    \c "sin(3*x)*exp(-x/5)". It needs no subclassing: the expression is compiled
+    once by mpExpression and the visible range is evaluated in batches.
+    @sa mpExpression
+*/
+class WXDLLIMPEXP_MATHPLOT mpFXExpression : public mpFX {
+ public:
+  /** @param expr  The expression of \a x to plot
+      @param name  Label. If empty, the expression string is used.
+      @param flags Label alignment, pass one of #mpALIGN_RIGHT, #mpALIGN_CENTER,
+     #mpALIGN_LEFT.
+  */
+  mpFXExpression(const wxString &expr = wxEmptyString, wxString name = wxEmptyString, int flags = mpALIGN_RIGHT);
+
+  /** Change the plotted expression. This method DOES NOT refresh the mpWindow.
+      @param expr The new expression
+      @return \a true if the expression compiled; otherwise the error is logged
+     and the layer draws nothing. */
+  bool SetExpression(const wxString &expr);
+
+  /** Get the compiled expression. */
+  const mpExpression &GetExpression() const { return m_expression; };
+
+  /** Check whether the layer holds a valid expression. */
+  bool IsOk() const { return m_expression.IsOk(); };
+
+  virtual double GetY(double x);
+
+  virtual void GetYs(const double *xs, double *ys, size_t n);
+
+  /** Layer render handler. Draws nothing if the expression is not valid. */
+  virtual void Render(mpRenderer &r, mpPlotView &w);
+
+ protected:
+  mpExpression m_expression;  //!< The compiled expression
+
+  DECLARE_DYNAMIC_CLASS(mpFXExpression)
+};
+
 /*@}*/
 
 //-----------------------------------------------------------------------------
@@ -725,7 +1839,11 @@ class WXDLLIMPEXP_MATHPLOT mpScaleX : public mpLayer {
 
   /** Layer plot handler.
       This implementation will plot the ruler adjusted to the visible area. */
-  virtual void Plot(wxDC &dc, mpWindow &w);
+  virtual void Plot(wxDC &dc, mpPlotView &w);
+
+  /** Render the ruler through a render backend, see mpLayer::Render. Plot
+      renders through an mpDCRenderer. */
+  virtual void Render(mpRenderer &r, mpPlotView &w);
 
   /** Check whether this layer has a bounding box.
       This implementation returns \a FALSE thus making the ruler invisible
@@ -794,7 +1912,11 @@ class WXDLLIMPEXP_MATHPLOT mpScaleY : public mpLayer {
   /** Layer plot handler.
       This implementation will plot the ruler adjusted to the visible area.
   */
-  virtual void Plot(wxDC &dc, mpWindow &w);
+  virtual void Plot(wxDC &dc, mpPlotView &w);
+
+  /** Render the ruler through a render backend, see mpLayer::Render. Plot
+      renders through an mpDCRenderer. */
+  virtual void Render(mpRenderer &r, mpPlotView &w);
 
   /** Check whether this layer has a bounding box.
       This implementation returns \a FALSE thus making the ruler invisible
@@ -850,44 +1972,16 @@ class WXDLLIMPEXP_MATHPLOT mpScaleY : public mpLayer {
 // wxLayerList );
 typedef std::deque<mpLayer *> wxLayerList;
 
-/** Canvas for plotting mpLayer implementations.
-
-    This class defines a zoomable and moveable 2D plot canvas. Any number
-    of mpLayer implementations (scale rulers, function plots, ...) can be
-    attached using mpWindow::AddLayer.
-
-    The canvas window provides a context menu with actions for navigating the
-   view.
-    The context menu can be retrieved with mpWindow::GetPopupMenu, e.g. for
-   extending it
-    externally.
-
-    Since wxMathPlot version 0.03, the mpWindow incorporates the following
-   features:
-        - DoubleBuffering (Default=disabled): Can be set with EnableDoubleBuffer
-        - Mouse based pan/zoom (Default=enabled): Can be set with
-   EnableMousePanZoom.
-
-    The mouse commands can be visualized by the user through the popup menu, and
-   are:
-        - Mouse Move+CTRL: Pan (Move)
-        - Mouse Wheel: Vertical scroll
-        - Mouse Wheel+SHIFT: Horizontal scroll
-        - Mouse Wheel UP+CTRL: Zoom in
-        - Mouse Wheel DOWN+CTRL: Zoom out
-
+/** View state and layers of a plot, without any window.
+    This holds what the layers need to plot: the layer list, the scales,
+    position and size of the view, and its margins and colours. mpWindow
+    adds the interaction and the drawing on the screen, mpOffscreenPlot the
+    rendering to images.
 */
-class WXDLLIMPEXP_MATHPLOT mpWindow : public wxWindow {
+class WXDLLIMPEXP_MATHPLOT mpPlotView {
  public:
-  mpWindow() {}
-  mpWindow(wxWindow *parent, wxWindowID id, const wxPoint &pos = wxDefaultPosition, const wxSize &size = wxDefaultSize,
-           long flags = 0);
-  ~mpWindow();
-
-  /** Get reference to context menu of the plot canvas.
-      @return Pointer to menu. The menu can be modified.
-  */
-  wxMenu *GetPopupMenu() { return &m_popmenu; }
+  mpPlotView();
+  virtual ~mpPlotView();
 
   /** Add a plot layer to the canvas.
       @param layer Pointer to layer. The mpLayer object will get under control
@@ -1064,9 +2158,12 @@ class WXDLLIMPEXP_MATHPLOT mpWindow : public wxWindow {
   //     (m_posY-y) * m_scaleY); }
   inline wxCoord y2p(double y) { return (wxCoord)((m_posY - y) * m_scaleY); }
 
-  /** Enable/disable the feature of pan/zoom with the mouse (default=enabled)
-   */
-  void EnableMousePanZoom(bool enabled) { m_enableMouseNavigation = enabled; }
+  /** Run independent tasks on the worker threads of the view and the
+      calling thread, and return when all are done. Called from a task,
+      or while the workers are busy, the tasks run in the calling thread.
+      @param count Number of tasks
+      @param task Function called with each index in [0, count) */
+  void ParallelFor(size_t count, const std::function<void(size_t)> &task);
 
   /** Enable or disable X/Y scale aspect locking for the view.
       @note Explicit calls to mpWindow::SetScaleX and mpWindow::SetScaleY will
@@ -1075,7 +2172,7 @@ class WXDLLIMPEXP_MATHPLOT mpWindow : public wxWindow {
      will
             lock the aspect again.
   */
-  void LockAspect(bool enable = TRUE);
+  virtual void LockAspect(bool enable = TRUE);
 
   /** Checks whether the X/Y scale aspect is locked.
       @retval TRUE Locked
@@ -1101,35 +2198,8 @@ class WXDLLIMPEXP_MATHPLOT mpWindow : public wxWindow {
   */
   void Fit(double xMin, double xMax, double yMin, double yMax, wxCoord *printSizeX = NULL, wxCoord *printSizeY = NULL);
 
-  /** Zoom into current view and refresh display
-   * @param centerPoint The point (pixel coordinates) that will stay in the
-   * same position on the screen after the zoom (by default, the center of the
-   * mpWindow).
-   */
-  void ZoomIn(const wxPoint &centerPoint = wxDefaultPosition);
-
-  /** Zoom out current view and refresh display
-   * @param centerPoint The point (pixel coordinates) that will stay in the
-   * same position on the screen after the zoom (by default, the center of the
-   * mpWindow).
-   */
-  void ZoomOut(const wxPoint &centerPoint = wxDefaultPosition);
-
-  /** Zoom in current view along X and refresh display */
-  void ZoomInX();
-  /** Zoom out current view along X and refresh display */
-  void ZoomOutX();
-  /** Zoom in current view along Y and refresh display */
-  void ZoomInY();
-  /** Zoom out current view along Y and refresh display */
-  void ZoomOutY();
-
-  /** Zoom view fitting given coordinates to the window (p0 and p1 do not need
-   * to be in any specific order) */
-  void ZoomRect(wxPoint p0, wxPoint p1);
-
   /** Refresh display */
-  void UpdateAll();
+  virtual void UpdateAll();
 
   // Added methods by Davide Rondini
 
@@ -1180,29 +2250,6 @@ class WXDLLIMPEXP_MATHPLOT mpWindow : public wxWindow {
      bounding box coordinates. */
   void GetBoundingBox(double *bbox);
 
-  /** Enable/disable scrollbars
-    @param status Set to true to show scrollbars */
-  void SetMPScrollbars(bool status);
-
-  /** Get scrollbars status.
-    @return true if scrollbars are visible */
-  bool GetMPScrollbars() { return m_enableScrollBars; };
-
-  /** Draw the window on a wxBitmap, then save it to a file.
-    @param filename File name where to save the screenshot
-    @param type image type to be saved: see wxImage output file types for flags
-        @param imageSize Set a size for the output image. Default is the same as
-    the screen size
-        @param fit Decide whether to fit the plot into the size*/
-  bool SaveScreenshot(const wxString &filename, wxBitmapType type = wxBITMAP_TYPE_BMP, wxSize imageSize = wxDefaultSize,
-                      bool fit = false);
-
-  /** This value sets the zoom steps whenever the user clicks "Zoom in/out" or
-   * performs zoom with the mouse wheel.
-   *  It must be a number above unity. This number is used for zoom in, and its
-   * inverse for zoom out. Set to 1.5 by default. */
-  static double zoomIncrementalFactor;
-
   /** Set window margins, creating a blank area where some kinds of layers
      cannot draw. This is useful for example to draw axes outside the area where
      the plots are drawn.
@@ -1230,19 +2277,6 @@ class WXDLLIMPEXP_MATHPLOT mpWindow : public wxWindow {
   /** Get the left margin. @param left Left Margin */
   int GetMarginLeft() { return m_marginLeft; };
 
-  /** Sets whether to show coordinate tooltip when mouse passes over the plot.
-   * \param value true for enable, false for disable */
-  // void EnableCoordTooltip(bool value = true);
-  /** Gets coordinate tooltip status. \return true for enable, false for disable
-   */
-  // bool GetCoordTooltip() { return m_coordTooltip; };
-
-  /** Check if a given point is inside the area of a mpInfoLayer and eventually
-     returns its pointer.
-      @param point The position to be checked
-      @return If an info layer is found, returns its pointer, NULL otherwise */
-  mpInfoLayer *IsInsideInfoLayer(wxPoint &point);
-
   /** Sets the visibility of a layer by its name.
           @param name The layer name to set visibility
           @param viewable the view status to be set */
@@ -1268,12 +2302,361 @@ class WXDLLIMPEXP_MATHPLOT mpWindow : public wxWindow {
       @param drawColour The colour used to draw all elements in foreground,
       axes excluded
       @param axesColour The colour used to draw axes (but not their labels)*/
-  void SetColourTheme(const wxColour &bgColour, const wxColour &drawColour, const wxColour &axesColour);
+  virtual void SetColourTheme(const wxColour &bgColour, const wxColour &drawColour, const wxColour &axesColour);
 
   /** Get axes draw colour
           @return reference to axis colour used in theme */
   const wxColour &GetAxesColour() { return m_axColour; };
 
+  /** Export the plot to a PNG file of any size, for example a poster. The
+      image is rendered in horizontal bands, each one streamed to the PNG
+      encoder before the next one is drawn, so that the memory used depends
+      on the band size and not on the image size. The current view is kept.
+      @param filename File name
+      @param width,height Size of the image
+      @param fit Fit the bounding box of the layers into the image, instead of the current view
+      @param bandHeight Number of rows rendered at once
+      @param parallel Compress each band on a worker thread while the next one is rendered
+      @return true on success */
+  bool ExportPNG(const wxString &filename, int width, int height, bool fit = false, int bandHeight = 256,
+                 bool parallel = true);
+
+  /** Export the plot to an SVG file, for publications. Each layer is
+      written as a single path, simplified to the resolution of the target
+      (see mpSVGRenderer), so that the size of the file depends on the size
+      of the image rather than on the number of points. The current view is kept.
+      @param filename File name
+      @param width,height Size of the image, in pixels of the target
+      @param dpi Resolution of the target: the image measures width / dpi inches
+      @param fit Fit the bounding box of the layers into the image, instead of the current view
+      @return true on success */
+  bool ExportSVG(const wxString &filename, int width, int height, double dpi = 300, bool fit = false);
+
+  /** Scales, position and size of the view, kept while drawing at another size. */
+  struct ViewState {
+    double scaleX, scaleY, posX, posY;
+    double desiredXmin, desiredXmax, desiredYmin, desiredYmax;
+    int scrX, scrY;
+  };
+
+  /** Get the view, to restore it later with RestoreView. The layers keep
+      the state they adapt to the view, see mpLayer::SaveViewState. */
+  ViewState SaveView() const;
+
+  /** Save the view, then fit it to an image or page of the given size.
+      The bounding box of the layers is only computed again when their data changed.
+      @param fit Fit the bounding box of the layers, instead of the current view */
+  ViewState FitToImage(int width, int height, bool fit);
+
+  /** Restore a view saved by SaveView or FitToImage, and the state of the
+      layers, without refreshing. */
+  void RestoreView(const ViewState &state);
+
+  /** Check whether a layer may draw into an area, see mpLayer::GetScreenBounds.
+      @param area Part of the window, empty for all of it */
+  bool IsLayerInArea(mpLayer *layer, const wxRect &area);
+
+ protected:
+  /** Get the size of the drawing area, used by Fit when no print size is
+      given. The default implementation keeps the size set with SetScr. */
+  virtual void GetPlotAreaSize(int *width, int *height) {
+    *width = m_scrX;
+    *height = m_scrY;
+  }
+
+  /** Recalculate global layer bounding box, and save it in m_minX,...
+   * \return true if there is any valid BBox information.
+   */
+  virtual bool UpdateBBox();
+
+  // wxList m_layers;    //!< List of attached plot layers
+  wxLayerList m_layers;  //!< List of attached plot layers
+  bool m_lockaspect;     //!< Scale aspect is locked or not
+  wxColour m_bgColour;  //!< Background Colour
+  wxColour m_fgColour;  //!< Foreground Colour
+  wxColour m_axColour;  //!< Axes Colour
+
+  double m_minX;    //!< Global layer bounding box, left border incl.
+  double m_maxX;    //!< Global layer bounding box, right border incl.
+  double m_minY;    //!< Global layer bounding box, bottom border incl.
+  double m_maxY;    //!< Global layer bounding box, top border incl.
+  double m_scaleX;  //!< Current view's X scale
+  double m_scaleY;  //!< Current view's Y scale
+  double m_posX;    //!< Current view's X position
+  double m_posY;    //!< Current view's Y position
+  int m_scrX;       //!< Current view's X dimension
+  int m_scrY;       //!< Current view's Y dimension
+
+  /** These are updated in Fit() only, and may be different from the real
+   * borders (layer coordinates) only if lock aspect ratio is true.
+   */
+  double m_desiredXmin, m_desiredXmax, m_desiredYmin, m_desiredYmax;
+
+  int m_marginTop, m_marginRight, m_marginBottom, m_marginLeft;
+
+  mpThreadPool *m_threadPool;  //!< Worker threads for ParallelFor, created on demand
+
+ private:
+  mpPlotView(const mpPlotView &);
+  mpPlotView &operator=(const mpPlotView &);
+};
+
+/** View changes recorded by mpWindow::StartRecording. */
+enum mpViewOperation {
+  mpVIEW_OTHER,      //!< Other change of the view, e.g. SetPos or SetScaleX
+  mpVIEW_FIT,        //!< Fit, to the layers or to given bounds
+  mpVIEW_ZOOM_IN,    //!< ZoomIn, ZoomInX, ZoomInY
+  mpVIEW_ZOOM_OUT,   //!< ZoomOut, ZoomOutX, ZoomOutY
+  mpVIEW_ZOOM_RECT,  //!< ZoomRect, from the mouse or not
+  mpVIEW_PAN,        //!< Pan with the mouse, the wheel or the scroll bars
+  mpVIEW_RESIZE      //!< Resize of the window
+};
+
+/** Step of a recording, as replayed by mpWindow::Replay. */
+struct mpReplayStep {
+  mpViewOperation operation;  //!< Change of the view
+  double time;                //!< Seconds from the start of the recording
+  double renderTime;          //!< Seconds spent updating and painting the view in the replay
+};
+
+/** Canvas for plotting mpLayer implementations.
+
+    This class defines a zoomable and moveable 2D plot canvas. Any number
+    of mpLayer implementations (scale rulers, function plots, ...) can be
+    attached using mpWindow::AddLayer.
+
+    The canvas window provides a context menu with actions for navigating the
+   view.
+    The context menu can be retrieved with mpWindow::GetPopupMenu, e.g. for
+   extending it
+    externally.
+
+    Since wxMathPlot version 0.03, the mpWindow incorporates the following
+   features:
+        - DoubleBuffering (Default=disabled): Can be set with EnableDoubleBuffer
+        - Mouse based pan/zoom (Default=enabled): Can be set with
+   EnableMousePanZoom.
+
+    The mouse commands can be visualized by the user through the popup menu, and
+   are:
+        - Mouse Move+CTRL: Pan (Move)
+        - Mouse Wheel: Vertical scroll
+        - Mouse Wheel+SHIFT: Horizontal scroll
+        - Mouse Wheel UP+CTRL: Zoom in
+        - Mouse Wheel DOWN+CTRL: Zoom out
+
+*/
+class WXDLLIMPEXP_MATHPLOT mpWindow : public wxWindow, public mpPlotView {
+ public:
+  mpWindow() : m_recordFile(NULL), m_recordOperation(mpVIEW_OTHER) {}
+  mpWindow(wxWindow *parent, wxWindowID id, const wxPoint &pos = wxDefaultPosition, const wxSize &size = wxDefaultSize,
+           long flags = 0);
+  ~mpWindow();
+
+  /** Get reference to context menu of the plot canvas.
+      @return Pointer to menu. The menu can be modified.
+  */
+  wxMenu *GetPopupMenu() { return &m_popmenu; }
+
+  /** Set view to fit global bounding box of all plot layers and refresh
+      display. Overrides wxWindow::Fit.
+      @sa mpPlotView::Fit */
+  virtual void Fit() {
+    m_recordOperation = mpVIEW_FIT;
+    mpPlotView::Fit();
+  }
+
+  /** Set view to fit a given bounding box and refresh display, recorded as
+      mpVIEW_FIT (see StartRecording).
+      @sa mpPlotView::Fit */
+  void Fit(double xMin, double xMax, double yMin, double yMax, wxCoord *printSizeX = NULL, wxCoord *printSizeY = NULL) {
+    if (printSizeX == NULL || printSizeY == NULL) m_recordOperation = mpVIEW_FIT;
+    mpPlotView::Fit(xMin, xMax, yMin, yMax, printSizeX, printSizeY);
+  }
+
+  virtual void LockAspect(bool enable = TRUE);
+
+  virtual void UpdateAll();
+
+  /** Repaint the window. The layers other than the info layers are kept in
+      a frame drawn again only when the data or the view change, and the info
+      layers are drawn over it on each paint, after all the other layers.
+      Refreshing the whole window, as done by UpdateAll, draws the frame
+      again; refreshing a rectangle (see wxWindow::RefreshRect) only repaints
+      the info layers over the kept frame. After changing a layer without
+      UpdateAll, call InvalidateFrame before refreshing a rectangle, or the
+      rectangle shows the frame as it was. */
+  virtual void Refresh(bool eraseBackground = true, const wxRect *rect = NULL);
+
+  /** Mark the frame as out of date, without repainting: the next paint draws
+      it again, whatever part of the window it covers.
+      @param area Part of the window to draw again, empty for all of it */
+  void InvalidateFrame(const wxRect &area = wxRect());
+
+  virtual void SetColourTheme(const wxColour &bgColour, const wxColour &drawColour, const wxColour &axesColour);
+
+  /** Enable/disable the feature of pan/zoom with the mouse (default=enabled)
+   */
+  void EnableMousePanZoom(bool enabled) { m_enableMouseNavigation = enabled; }
+
+  /** Enable/disable the parallel plot of layers (default=disabled).
+      When enabled, the frame is drawn by an mpRasterRenderer, whatever the
+      backend selected with SetRendererType. The layers allowing it with
+      mpLayer::SetParallelPlot are rendered concurrently by worker threads,
+      each one into an mpRasterRenderer of its own, which is then merged into
+      the renderer of the frame in the order of the layers; the other layers
+      render into it directly. The result does not depend on the number of
+      threads, and is the serial plot with #mpRENDERER_RASTER, except where
+      a layer draws over itself with a translucent pen. A parallel layer
+      asking for the wxDC with mpRenderer::GetDC is plotted again in the GUI
+      thread.
+  */
+  void EnableParallelPlot(bool enabled) { m_parallelPlot = enabled; }
+
+  /** Check whether the parallel plot of layers is enabled.
+      @sa EnableParallelPlot */
+  bool IsParallelPlotEnabled() { return m_parallelPlot; }
+
+  /** Select the backend drawing the layers (default #mpRENDERER_DC).
+      With #mpRENDERER_DC the layers plot on the wxDC with mpLayer::Plot,
+      otherwise they draw through mpLayer::Render. While the parallel plot
+      is enabled (see EnableParallelPlot), the frame is always drawn with
+      #mpRENDERER_RASTER. If a graphics context cannot be created,
+      #mpRENDERER_GC falls back to the wxDC. This method DOES NOT refresh
+      the window.
+      @sa mpRenderer */
+  void SetRendererType(mpRendererType type) { m_rendererType = type; }
+
+  /** Get the backend drawing the layers, when the parallel plot is disabled.
+      @sa SetRendererType */
+  mpRendererType GetRendererType() const { return m_rendererType; }
+
+  /** Zoom into current view and refresh display
+   * @param centerPoint The point (pixel coordinates) that will stay in the
+   * same position on the screen after the zoom (by default, the center of the
+   * mpWindow).
+   */
+  void ZoomIn(const wxPoint &centerPoint = wxDefaultPosition);
+
+  /** Zoom out current view and refresh display
+   * @param centerPoint The point (pixel coordinates) that will stay in the
+   * same position on the screen after the zoom (by default, the center of the
+   * mpWindow).
+   */
+  void ZoomOut(const wxPoint &centerPoint = wxDefaultPosition);
+
+  /** Zoom in current view along X and refresh display */
+  void ZoomInX();
+  /** Zoom out current view along X and refresh display */
+  void ZoomOutX();
+  /** Zoom in current view along Y and refresh display */
+  void ZoomInY();
+  /** Zoom out current view along Y and refresh display */
+  void ZoomOutY();
+
+  /** Zoom view fitting given coordinates to the window (p0 and p1 do not need
+   * to be in any specific order) */
+  void ZoomRect(wxPoint p0, wxPoint p1);
+
+  /** Enable/disable scrollbars
+    @param status Set to true to show scrollbars */
+  void SetMPScrollbars(bool status);
+
+  /** Get scrollbars status.
+    @return true if scrollbars are visible */
+  bool GetMPScrollbars() { return m_enableScrollBars; };
+
+  /** Draw the window on a wxBitmap, then save it to a file.
+    @param filename File name where to save the screenshot
+    @param type image type to be saved: see wxImage output file types for flags
+        @param imageSize Set a size for the output image. Default is the same as
+    the screen size
+        @param fit Decide whether to fit the plot into the size
+    @sa ExportPNG for images too large for a wxBitmap */
+  bool SaveScreenshot(const wxString &filename, wxBitmapType type = wxBITMAP_TYPE_BMP, wxSize imageSize = wxDefaultSize,
+                      bool fit = false);
+
+  /** This value sets the zoom steps whenever the user clicks "Zoom in/out" or
+   * performs zoom with the mouse wheel.
+   *  It must be a number above unity. This number is used for zoom in, and its
+   * inverse for zoom out. Set to 1.5 by default. */
+  static double zoomIncrementalFactor;
+
+  /** Sets whether to show coordinate tooltip when mouse passes over the plot.
+   * \param value true for enable, false for disable */
+  // void EnableCoordTooltip(bool value = true);
+  /** Gets coordinate tooltip status. \return true for enable, false for disable
+   */
+  // bool GetCoordTooltip() { return m_coordTooltip; };
+
+  /** Check if a given point is inside the area of a mpInfoLayer and eventually
+     returns its pointer.
+      @param point The position to be checked
+      @return If an info layer is found, returns its pointer, NULL otherwise */
+  mpInfoLayer *IsInsideInfoLayer(wxPoint &point);
+
+  /** Periodically check the layers for data pushed by other threads, and repaint when some is pending.
+      @param milliseconds Polling interval, 0 to stop polling
+      @sa mpLayer::HasPendingData, mpFXYSeries::CreateQueue */
+  void SetDataPollInterval(int milliseconds);
+
+  /** Get the interval set with SetDataPollInterval, 0 when not polling. */
+  int GetDataPollInterval() { return m_dataPollTimer.IsRunning() ? m_dataPollTimer.GetInterval() : 0; }
+
+  /** Set how long the window must stay at the same size before the plot is rendered for it.
+      Until then the last rendered frame is stretched to the window, so that dragging its
+      border stays fluid however long the layers take to draw. The info layers are drawn
+      over it unstretched, and the view keeps the size of the frame until then.
+      @param milliseconds Delay after the last size change, 0 to render at each one (default is 100) */
+  void SetResizeDelay(int milliseconds) { m_resizeDelay = milliseconds; }
+
+  /** Get the delay set with SetResizeDelay. */
+  int GetResizeDelay() const { return m_resizeDelay; }
+
+  /** Record the changes of the view into a file, for replaying them later
+      with Replay, e.g. to reproduce a slow interaction. Each change is
+      written as its operation, time and resulting view (49 bytes per change,
+      in the byte order of the machine). Changes keeping the view, such as
+      the drawing of the zoom rectangle, are not recorded.
+      @param filename File created or overwritten
+      @return false if the file cannot be created */
+  bool StartRecording(const wxString &filename);
+
+  /** Stop the recording started by StartRecording and close the file. */
+  void StopRecording();
+
+  /** Check whether the changes of the view are being recorded. */
+  bool IsRecording() const { return m_recordFile != NULL; }
+
+  /** Replay a recording made by StartRecording against the current layers.
+      Each step goes through the path of a real change of the view: a fit
+      computes the bounding box and fits the view again, then the recorded
+      view is set, the bounding box and scroll bars are updated as by
+      UpdateAll, and the window is painted as by a paint event, frame cache,
+      compositing and info layers included, into a bitmap of the recorded
+      window size. The time of each step is measured from the change to the
+      end of its paint. The view is restored afterwards, and the window
+      drawn again.
+      @param filename Recording
+      @param steps Returns the recorded steps and the time of their update and paint
+      @return false if the file cannot be read or is not a recording */
+  bool Replay(const wxString &filename, std::vector<mpReplayStep> &steps);
+
+#ifdef MATHPLOT_ENABLE_STATS
+  /** Get the time spent in each of the last paints, in seconds.
+      The time of each layer is given by mpLayer::GetStats. Only available
+      when the library is built with MATHPLOT_ENABLE_STATS. */
+  const mpRollingStats &GetFrameTimes() const { return m_frameTimes; }
+
+  /** Get the number of frames painted per second, over the last frames. */
+  double GetFPS() const;
+
+  /** Get the layers which took the longest to draw in the last paint, slowest first.
+      @param layers Returns the layers
+      @param count Maximum number of layers */
+  void GetSlowestLayers(std::vector<mpLayer *> &layers, size_t count);
+#endif
+
  protected:
   void OnPaint(wxPaintEvent &event);  //!< Paint handler, will plot all attached layers
   void OnSize(wxSizeEvent &event);    //!< Size handler, will update scroll bar sizes
@@ -1301,53 +2684,60 @@ class WXDLLIMPEXP_MATHPLOT mpWindow : public wxWindow {
   void OnScrollLineDown(wxScrollWinEvent &event);    //!< Scroll line down
   void OnScrollTop(wxScrollWinEvent &event);         //!< Scroll to top
   void OnScrollBottom(wxScrollWinEvent &event);      //!< Scroll to bottom
+  void OnDataPoll(wxTimerEvent &event);              //!< Timer handler, repaints when layers have pending data
+  void OnResizeTimer(wxTimerEvent &event);           //!< Timer handler, renders the plot at the new size
 
   void DoScrollCalc(const int position, const int orientation);
 
+  virtual void GetPlotAreaSize(int *width, int *height) { GetClientSize(width, height); }
+
+  /** Plot the layers on the given DC with the selected backend.
+      @param info false to leave out the info layers
+      @param area Part of the window being drawn, the layers outside are skipped; empty for all of it
+      @sa SetRendererType */
+  void PlotLayers(wxDC &dc, bool info = true, const wxRect &area = wxRect());
+
+  /** Plot the visible layers on the given DC through an mpRasterRenderer,
+      whatever backend SetRendererType selected, using worker threads for
+      the layers allowing it. The other layers render in the GUI thread.
+      @param info false to leave out the info layers
+      @param area Part of the window being drawn, see PlotLayers
+      @sa EnableParallelPlot */
+  void PlotLayersParallel(wxDC &dc, bool info = true, const wxRect &area = wxRect());
+
+  /** Draw the info layers reaching the area over the frame. */
+  void PlotOverlays(wxDC &dc, const wxRect &area);
+
+  /** Draw again the given part of the frame, clipped to it. */
+  void DrawFrame(const wxRect &area);
+
+  /** Draw m_zoomRect on the overlay, replacing the previous one. */
+  void DrawZoomRect();
+
+  /** Paint the window on a DC of its size: take in the pending data, bring
+      the frame up to date and composite it with the info layers.
+      @param update Part of the window to composite, empty for all of it */
+  void PaintWindow(wxDC &dc, const wxRect &update);
+
   void DoZoomInXCalc(const int staticXpixel);
   void DoZoomInYCalc(const int staticYpixel);
   void DoZoomOutXCalc(const int staticXpixel);
   void DoZoomOutYCalc(const int staticYpixel);
 
-  /** Recalculate global layer bounding box, and save it in m_minX,...
-   * \return true if there is any valid BBox information.
-   */
-  virtual bool UpdateBBox();
-
-  // wxList m_layers;    //!< List of attached plot layers
-  wxLayerList m_layers;  //!< List of attached plot layers
   wxMenu m_popmenu;      //!< Canvas' context menu
-  bool m_lockaspect;     //!< Scale aspect is locked or not
   // bool   m_coordTooltip; //!< Selects whether to show coordinate tooltip
-  wxColour m_bgColour;  //!< Background Colour
-  wxColour m_fgColour;  //!< Foreground Colour
-  wxColour m_axColour;  //!< Axes Colour
-
-  double m_minX;    //!< Global layer bounding box, left border incl.
-  double m_maxX;    //!< Global layer bounding box, right border incl.
-  double m_minY;    //!< Global layer bounding box, bottom border incl.
-  double m_maxY;    //!< Global layer bounding box, top border incl.
-  double m_scaleX;  //!< Current view's X scale
-  double m_scaleY;  //!< Current view's Y scale
-  double m_posX;    //!< Current view's X position
-  double m_posY;    //!< Current view's Y position
-  int m_scrX;       //!< Current view's X dimension
-  int m_scrY;       //!< Current view's Y dimension
   int m_clickedX;   //!< Last mouse click X position, for centering and zooming
                     // the view
   int m_clickedY;   //!< Last mouse click Y position, for centering and zooming
                     // the view
 
-  /** These are updated in Fit() only, and may be different from the real
-   * borders (layer coordinates) only if lock aspect ratio is true.
-   */
-  double m_desiredXmin, m_desiredXmax, m_desiredYmin, m_desiredYmax;
-
-  int m_marginTop, m_marginRight, m_marginBottom, m_marginLeft;
-
-  int m_last_lx, m_last_ly;      //!< For double buffering
-  wxMemoryDC m_buff_dc;          //!< For double buffering
-  wxBitmap *m_buff_bmp;          //!< For double buffering
+  int m_last_lx, m_last_ly;      //!< Size of the frame
+  wxMemoryDC m_buff_dc;          //!< Selects the frame
+  wxBitmap *m_buff_bmp;          //!< Frame: background and layers other than the info layers
+  bool m_frameDirty;             //!< The frame must be drawn again on the next paint
+  wxRect m_frameDirtyArea;       //!< Part of the frame to draw again, when not all of it is dirty
+  wxRect m_zoomRect;             //!< Zoom rectangle being dragged, empty if none
+  wxOverlay m_overlay;           //!< Shows the zoom rectangle over the window without repainting it
   bool m_enableMouseNavigation;  //!< For pan/zoom with the mouse.
   bool m_mouseMovedAfterRightClick;
   int m_mouseRClick_X,
@@ -1357,11 +2747,79 @@ class WXDLLIMPEXP_MATHPLOT mpWindow : public wxWindow {
   bool m_enableScrollBars;
   int m_scrollX, m_scrollY;
   mpInfoLayer *m_movingInfoLayer;  //!< For moving info layers over the window area
+  wxTimer m_dataPollTimer;         //!< Polls the layers for pending data
+  wxTimer m_resizeTimer;           //!< Fires when the window stops being resized
+  int m_resizeDelay;               //!< Delay of m_resizeTimer, see SetResizeDelay
+  bool m_resizing;                 //!< The frame is stretched to the window until m_resizeTimer fires
+  bool m_parallelPlot;             //!< Layers are plotted by worker threads when allowed
+  mpRendererType m_rendererType;       //!< Backend drawing the layers
+  wxFFile *m_recordFile;               //!< Recording of the view changes, NULL when not recording
+  std::chrono::steady_clock::time_point m_recordStart;  //!< Start of the recording
+  mpViewOperation m_recordOperation;   //!< Operation of the next recorded view change
+  double m_recordView[4];              //!< Last recorded position and scales
+  int m_recordScr[2];                  //!< Last recorded window size
+
+  /** Write the view to the recording, if it changed or an operation is pending. */
+  void RecordView();
+
+#ifdef MATHPLOT_ENABLE_STATS
+  mpRollingStats m_frameTimes;      //!< Duration of the last paints
+  mpRollingStats m_frameIntervals;  //!< Time between the starts of the last paints
+  std::chrono::steady_clock::time_point m_lastFrame;  //!< Start of the last paint
+#endif
 
   DECLARE_DYNAMIC_CLASS(mpWindow)
   DECLARE_EVENT_TABLE()
 };
 
+//-----------------------------------------------------------------------------
+// mpOffscreenPlot
+//-----------------------------------------------------------------------------
+
+/** Plot rendered into an image, without any window.
+    Layers are added and the view is set up as with mpWindow; RenderImage
+    then draws the layers through mpLayer::Render on an antialiased
+    wxGraphicsContext created on the image. Layers which only implement Plot
+    draw through a wxGCDC on that context, created only for them as it copies
+    the stock pens, brushes and fonts, and mpBitmapLayer scales its
+    bitmap as a wxImage. Several offscreen plots can render at once, each one
+    in its own thread, as far as the layers do not create wxBitmap objects,
+    which some platforms only allow on the main thread. A plot and its layers
+    must only be used by one thread at a time.
+    wxWidgets pens, brushes and fonts are reference counted without locking:
+    do not share them between plots rendered by different threads.
+
+    @code
+    mpOffscreenPlot plot(800, 600);
+    plot.AddLayer(new mpScaleX());
+    plot.AddLayer(new mpScaleY());
+    plot.AddLayer(vector);
+    plot.Fit();
+    plot.SaveFile(wxT("plot.png"));
+    @endcode
+*/
+class WXDLLIMPEXP_MATHPLOT mpOffscreenPlot : public mpPlotView {
+ public:
+  /** @param width Width of the image in pixels
+      @param height Height of the image in pixels */
+  mpOffscreenPlot(int width = 640, int height = 480);
+
+  /** Change the size of the image. The view is not fitted again. */
+  void SetSize(int width, int height) { SetScr(width, height); }
+
+  /** Render the layers into a new image, after taking in the data pushed
+      by other threads (see mpLayer::UpdateData).
+      @return The image, invalid if the graphics context could not be created */
+  wxImage RenderImage();
+
+  /** Render the layers and save the image to a file. The image handler for
+      the type must have been added, e.g. with wxInitAllImageHandlers.
+      @param filename File name
+      @param type Image type, see wxImage::SaveFile
+      @return true on success */
+  bool SaveFile(const wxString &filename, wxBitmapType type = wxBITMAP_TYPE_PNG);
+};
+
 //-----------------------------------------------------------------------------
 // mpFXYVector - provided by Jose Luis Blanco
 //-----------------------------------------------------------------------------
@@ -1410,11 +2868,21 @@ class WXDLLIMPEXP_MATHPLOT mpFXYVector : public mpFXY {
    */
   void Clear();
 
+  /** Get the number of points with a NaN or infinite coordinate in the data.
+      Those points are ignored by the bounding box. SetData also reports them
+      with wxLogVerbose, shown when verbose logging is enabled (see wxLog::SetVerbose).
+   */
+  size_t GetNonFiniteCount() const { return m_nonFinite; }
+
  protected:
   /** The internal copy of the set of data to draw.
    */
   std::vector<double> m_xs, m_ys;
 
+  /** Number of non-finite points, loaded at SetData
+   */
+  size_t m_nonFinite;
+
   /** The internal counter for the "GetNextXY" interface
    */
   size_t m_index;
@@ -1435,6 +2903,14 @@ class WXDLLIMPEXP_MATHPLOT mpFXYVector : public mpFXY {
   */
   bool GetNextXY(double &x, double &y);
 
+  /** mpFXYVector returns chunks pointing directly into its data. */
+  bool SupportsChunks() { return true; }
+
+  /** Get a chunk of the stored points, without copying them.
+      Overridden in this implementation.
+  */
+  size_t GetChunk(size_t start, size_t maxCount, const double *&xs, const double *&ys);
+
   /** Returns the actual minimum X data (loaded in SetData).
    */
   double GetMinX() { return m_minX; }
@@ -1451,11 +2927,239 @@ class WXDLLIMPEXP_MATHPLOT mpFXYVector : public mpFXY {
    */
   double GetMaxY() { return m_maxY; }
 
+  /** The locus lies in the bounding box, see mpFXY::GetLocusScreenBounds. */
+  bool GetScreenBounds(mpPlotView &w, wxRect &bounds) { return GetLocusScreenBounds(w, bounds); }
+
   int m_flags;  //!< Holds label alignment
 
   DECLARE_DYNAMIC_CLASS(mpFXYVector)
 };
 
+//-----------------------------------------------------------------------------
+// mpSampleQueue, mpFXYSeries and mpFXYSnapshot - streaming data
+//-----------------------------------------------------------------------------
+
+/** Lock-free queue of (x, y) samples, from one producer thread to the GUI thread.
+    The queue is a fixed size ring buffer: Push never blocks nor allocates,
+    and a batch not fitting in the free space is dropped as a whole and
+    counted by GetDropped. Exactly one thread may call Push, and exactly one
+    thread (the one painting the mpWindow) may call Pop.
+    @sa mpFXYSeries::CreateQueue
+*/
+class WXDLLIMPEXP_MATHPLOT mpSampleQueue {
+ public:
+  /** @param capacity Maximum number of queued samples, rounded up to a power of two */
+  mpSampleQueue(size_t capacity);
+
+  /** Queue a batch of samples. Producer thread only.
+      @param xs X values
+      @param ys Y values
+      @param n Number of samples
+      @return false if the batch did not fit and was dropped */
+  bool Push(const double *xs, const double *ys, size_t n);
+
+  /** Queue a single sample. Producer thread only. */
+  bool Push(double x, double y) { return Push(&x, &y, 1); }
+
+  /** Move all the queued samples to the end of the given vectors. Consumer thread only.
+      @return Number of samples moved */
+  size_t Pop(std::vector<double> &xs, std::vector<double> &ys);
+
+  /** Get the number of queued samples. The value may be outdated as soon as it is returned. */
+  size_t GetSize() const { return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire); }
+
+  /** Get the capacity of the queue. */
+  size_t GetCapacity() const { return m_mask + 1; }
+
+  /** Get the number of samples dropped because the queue was full. */
+  size_t GetDropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+ protected:
+  std::vector<double> m_xs, m_ys;  //!< Ring storage
+  size_t m_mask;                   //!< Capacity - 1, used to wrap the indices
+  // The counters written by each thread are on their own cache line
+  alignas(64) std::atomic<size_t> m_head;  //!< Count of pushed samples, written by the producer
+  std::atomic<size_t> m_dropped;           //!< Count of dropped samples, written by the producer
+  alignas(64) std::atomic<size_t> m_tail;  //!< Count of popped samples, written by the consumer
+};
+
+/** A growing series of points, which can be fed from another thread.
+    Points are appended with mpFXYSeries::AddData from the GUI thread, or
+    pushed by a producer thread into the queue created with
+    mpFXYSeries::CreateQueue. The queue is drained by mpWindow at the start
+    of each paint, so that appending and the bounding box update happen in the
+    GUI thread, once per frame.
+
+    \code
+    mpSampleQueue *queue = series->CreateQueue(1 << 16);
+    plot->AddLayer(series);
+    plot->SetDataPollInterval(30);
+    // In the acquisition thread:
+    queue->Push(xs, ys, n);
+    \endcode
+*/
+class WXDLLIMPEXP_MATHPLOT mpFXYSeries : public mpFXY {
+ public:
+  /** @param name  Label
+      @param flags Label alignment, pass one of #mpALIGN_NE, #mpALIGN_NW,
+     #mpALIGN_SW, #mpALIGN_SE.
+  */
+  mpFXYSeries(wxString name = wxEmptyString, int flags = mpALIGN_NE);
+
+  virtual ~mpFXYSeries();
+
+  /** Append points to the series. GUI thread only.
+      This method DOES NOT refresh the mpWindow; do it manually.
+      @param xs X values
+      @param ys Y values
+      @param n Number of points */
+  void AddData(const double *xs, const double *ys, size_t n);
+
+  /** Remove all the points. Queued samples are kept. */
+  void Clear();
+
+  /** Get the number of points in the series. */
+  size_t GetCount() const { return m_xs.size(); }
+
+  /** Get the number of points with a NaN or infinite coordinate, ignored by the bounding box. */
+  size_t GetNonFiniteCount() const { return m_nonFinite; }
+
+  /** Create the queue used by a producer thread to feed the series, replacing any previous one.
+      The queue is owned by the layer: the producer must stop pushing before the layer is deleted.
+      @param capacity Maximum number of samples waiting for the next paint
+      @return The queue to be used by the producer thread */
+  mpSampleQueue *CreateQueue(size_t capacity);
+
+  /** Get the queue created with CreateQueue, NULL if none. */
+  mpSampleQueue *GetQueue() { return m_queue; }
+
+  /** Append the queued samples to the series. */
+  virtual bool UpdateData();
+
+  /** Check whether the queue holds samples not yet appended. */
+  virtual bool HasPendingData() { return m_queue && m_queue->GetSize() > 0; }
+
+  virtual bool HasBBox() { return m_minX <= m_maxX; }
+  virtual double GetMinX() { return m_minX; }
+  virtual double GetMaxX() { return m_maxX; }
+  virtual double GetMinY() { return m_minY; }
+  virtual double GetMaxY() { return m_maxY; }
+  virtual bool GetScreenBounds(mpPlotView &w, wxRect &bounds) { return GetLocusScreenBounds(w, bounds); }
+
+  virtual bool SupportsChunks() { return true; }
+  virtual size_t GetChunk(size_t start, size_t maxCount, const double *&xs, const double *&ys);
+
+ protected:
+  std::vector<double> m_xs, m_ys;  //!< The points of the series
+  size_t m_index;                  //!< The internal counter for the "GetNextXY" interface
+  double m_minX, m_maxX, m_minY, m_maxY;  //!< Bounding box of the finite points
+  size_t m_nonFinite;                     //!< Number of non-finite points
+  mpSampleQueue *m_queue;                 //!< Queue filled by the producer thread
+
+  /** Extend the bounding box with the points from index start to the end. */
+  void UpdateBounds(size_t start);
+
+  virtual void Rewind() { m_index = 0; }
+  virtual bool GetNextXY(double &x, double &y);
+
+  DECLARE_DYNAMIC_CLASS(mpFXYSeries)
+};
+
+/** Flag set in mpFXYSnapshot::m_ready when the ready buffer holds data not yet shown */
+#define mpSNAPSHOT_FRESH 4u
+
+/** A set of points replaced as a whole by another thread, without blocking the painting.
+    The layer holds three buffers: the front one read by Plot, the back one
+    filled by the writer thread, and a ready one exchanged between them with
+    an atomic operation. The writer fills the back buffer with
+    mpFXYSnapshot::BeginWrite (or SetData) and publishes it with
+    mpFXYSnapshot::Publish, which also computes its bounding box in the
+    writer thread. mpWindow picks up the latest published buffer at the
+    start of each paint, so Plot always sees one consistent data set.
+    Buffers keep their capacity: once they are large enough, no allocation
+    happens per frame.
+
+    Exactly one thread may write, and only the GUI thread may read the layer.
+
+    \code
+    // In the writer thread, for each frame:
+    double *xs, *ys;
+    snapshot->BeginWrite(n, xs, ys);
+    ... fill xs[0 .. n-1], ys[0 .. n-1] ...
+    snapshot->Publish();
+    \endcode
+    @sa mpWindow::SetDataPollInterval
+*/
+class WXDLLIMPEXP_MATHPLOT mpFXYSnapshot : public mpFXY {
+ public:
+  /** @param name  Label
+      @param flags Label alignment, pass one of #mpALIGN_NE, #mpALIGN_NW,
+     #mpALIGN_SW, #mpALIGN_SE.
+  */
+  mpFXYSnapshot(wxString name = wxEmptyString, int flags = mpALIGN_NE);
+
+  /** Reserve memory for the given number of points in all the buffers, to avoid allocating later.
+      Must be called before the writer thread starts. */
+  void Reserve(size_t n);
+
+  /** Get the back buffer, sized to hold n points. Writer thread only.
+      @param n Number of points of the new data set
+      @param xs Returns the X values to be filled
+      @param ys Returns the Y values to be filled */
+  void BeginWrite(size_t n, double *&xs, double *&ys);
+
+  /** Make the back buffer the data shown at the next paint. Writer thread only.
+      A buffer published before, but not painted yet, is discarded. */
+  void Publish();
+
+  /** Copy and publish a whole data set. Writer thread only.
+      @param xs X values
+      @param ys Y values
+      @param n Number of points */
+  void SetData(const double *xs, const double *ys, size_t n);
+
+  /** Get the number of points shown. */
+  size_t GetCount() const { return m_buffers[m_front].xs.size(); }
+
+  /** Get the number of shown points with a NaN or infinite coordinate, ignored by the bounding box. */
+  size_t GetNonFiniteCount() const { return m_buffers[m_front].nonFinite; }
+
+  /** Switch to the last published data set, if any. */
+  virtual bool UpdateData();
+
+  /** Check whether a data set was published and not yet shown. */
+  virtual bool HasPendingData() { return (m_ready.load(std::memory_order_relaxed) & mpSNAPSHOT_FRESH) != 0; }
+
+  virtual bool HasBBox() { return m_buffers[m_front].minX <= m_buffers[m_front].maxX; }
+  virtual double GetMinX() { return m_buffers[m_front].minX; }
+  virtual double GetMaxX() { return m_buffers[m_front].maxX; }
+  virtual double GetMinY() { return m_buffers[m_front].minY; }
+  virtual double GetMaxY() { return m_buffers[m_front].maxY; }
+  virtual bool GetScreenBounds(mpPlotView &w, wxRect &bounds) { return GetLocusScreenBounds(w, bounds); }
+
+  virtual bool SupportsChunks() { return true; }
+  virtual size_t GetChunk(size_t start, size_t maxCount, const double *&xs, const double *&ys);
+
+ protected:
+  /** One data set with its bounding box */
+  struct Buffer {
+    std::vector<double> xs, ys;
+    double minX, maxX, minY, maxY;
+    size_t nonFinite;
+  };
+
+  Buffer m_buffers[3];
+  unsigned m_front;              //!< Index of the buffer shown, owned by the GUI thread
+  unsigned m_back;               //!< Index of the buffer written, owned by the writer thread
+  std::atomic<unsigned> m_ready;  //!< Index of the exchanged buffer, plus mpSNAPSHOT_FRESH
+  size_t m_index;                //!< The internal counter for the "GetNextXY" interface
+
+  virtual void Rewind() { m_index = 0; }
+  virtual bool GetNextXY(double &x, double &y);
+
+  DECLARE_DYNAMIC_CLASS(mpFXYSnapshot)
+};
+
 //-----------------------------------------------------------------------------
 // mpText - provided by Val Greene
 //-----------------------------------------------------------------------------
@@ -1475,7 +3179,11 @@ class WXDLLIMPEXP_MATHPLOT mpText : public mpLayer {
 
   /** Text Layer plot handler.
       This implementation will plot text adjusted to the visible area. */
-  virtual void Plot(wxDC &dc, mpWindow &w);
+  virtual void Plot(wxDC &dc, mpPlotView &w);
+
+  /** Render the text through a render backend, see mpLayer::Render. Plot
+      renders through an mpDCRenderer. */
+  virtual void Render(mpRenderer &r, mpPlotView &w);
 
   /** mpText should not be used for scaling decisions. */
   virtual bool HasBBox() { return FALSE; }
@@ -1501,13 +3209,26 @@ class WXDLLIMPEXP_MATHPLOT mpPrintout : public wxPrintout {
   virtual ~mpPrintout() {};
 
   void SetDrawState(bool drawState) { drawn = drawState; };
+
+  /** Set the number of pixels of the page rendered at once by the layers
+      drawing into memory (see mpFXY::SetRasterTiles and mpBitmapLayer), which
+      bounds their memory use at printer resolution. When there are none, the
+      page is drawn at once. Each band only draws the layers reaching it.
+      @param pixels Pixels per band, the default is 4M */
+  void SetBandPixels(int pixels) { m_bandPixels = pixels; }
+
+  /** Print the plot as seen in the window, fitted to the page. The lines
+      and points are reduced to the printer resolution (see
+      mpDecimatingRenderer), and the view of the window is restored
+      afterwards without drawing it again. */
   bool OnPrintPage(int page);
   bool HasPage(int page);
 
  private:
-  mpPrintout() : drawn(false), plotWindow(NULL) {};
+  mpPrintout() : drawn(false), plotWindow(NULL), m_bandPixels(0) {};
   bool drawn;
   mpWindow *plotWindow;
+  int m_bandPixels;  //!< Pixels per band for the layers drawing into memory
 };
 
 //-----------------------------------------------------------------------------
@@ -1524,7 +3245,8 @@ class WXDLLIMPEXP_MATHPLOT mpMovableObject : public mpLayer {
  public:
   /** Default constructor (sets location and rotation to (0,0,0))
    */
-  mpMovableObject() : m_reference_x(0), m_reference_y(0), m_reference_phi(0), m_shape_xs(0), m_shape_ys(0) {
+  mpMovableObject()
+      : m_reference_x(0), m_reference_y(0), m_reference_phi(0), m_shape_xs(0), m_shape_ys(0), m_nonFinite(0) {
     m_type = mpLAYER_PLOT;
   }
 
@@ -1566,7 +3288,21 @@ class WXDLLIMPEXP_MATHPLOT mpMovableObject : public mpLayer {
    */
   virtual double GetMaxY() { return m_bbox_max_y; }
 
-  virtual void Plot(wxDC &dc, mpWindow &w);
+  /** Get the number of shape points with a NaN or infinite coordinate.
+      Those points are ignored by the bounding box, and reported with
+      wxLogVerbose when the shape is updated.
+   */
+  size_t GetNonFiniteCount() const { return m_nonFinite; }
+
+  /** The shape lies in the bounding box, the label above it: the bounds are
+      not known when the label is shown. @sa mpLayer::GetScreenBounds */
+  virtual bool GetScreenBounds(mpPlotView &w, wxRect &bounds);
+
+  virtual void Plot(wxDC &dc, mpPlotView &w);
+
+  /** Render the shape through a render backend, see mpLayer::Render. Plot
+      renders through an mpDCRenderer. */
+  virtual void Render(mpRenderer &r, mpPlotView &w);
 
   /** Set label axis alignment.
    *  @param align alignment (choose between mpALIGN_NE, mpALIGN_NW,
@@ -1602,6 +3338,10 @@ class WXDLLIMPEXP_MATHPLOT mpMovableObject : public mpLayer {
    */
   double m_bbox_min_x, m_bbox_max_x, m_bbox_min_y, m_bbox_max_y;
 
+  /** Number of non-finite transformed points, updated by ShapeUpdated.
+   */
+  size_t m_nonFinite;
+
   /** Must be called by the descendent class after updating the shape
    * (m_shape_xs/ys), or when the transformation changes.
    *  This method updates the buffers m_trans_shape_xs/ys, and the precomputed
@@ -1775,7 +3515,18 @@ class WXDLLIMPEXP_MATHPLOT mpBitmapLayer : public mpLayer {
    */
   virtual double GetMaxY() { return m_max_y; }
 
-  virtual void Plot(wxDC &dc, mpWindow &w);
+  /** The image covers the bounding box, the label lies outside of it: the
+      bounds are not known when the label is shown. @sa mpLayer::GetScreenBounds */
+  virtual bool GetScreenBounds(mpPlotView &w, wxRect &bounds) {
+    return m_validImg && (m_name.IsEmpty() || !m_showName) && GetBBoxScreenBounds(w, bounds, 2);
+  }
+
+  virtual void Plot(wxDC &dc, mpPlotView &w);
+
+  /** Render the image through a render backend, see mpLayer::Render. Only
+      the part in the visible area of the renderer is scaled and drawn. Plot
+      keeps drawing a cached wxBitmap on the DC. */
+  virtual void Render(mpRenderer &r, mpPlotView &w);
 
   /** Set label axis alignment.
    *  @param align alignment (choose between mpALIGN_NE, mpALIGN_NW,
@@ -1792,6 +3543,22 @@ class WXDLLIMPEXP_MATHPLOT mpBitmapLayer : public mpLayer {
   wxBitmap m_scaledBitmap;
   wxCoord m_scaledBitmap_offset_x, m_scaledBitmap_offset_y;
 
+  /** The scaled part of the image drawn by Render, with its place in the
+      window and in m_bitmap. */
+  wxImage m_scaledImage;
+  wxRect m_scaledImageDest, m_scaledImageSrc;
+
+  /** Compute the part of the image covering the given area of the window.
+      @param w View to plot
+      @param area Part of the window being drawn
+      @param dest Returns the rectangle to draw in the window, slightly larger than the area
+      @param src Returns the matching part of m_bitmap
+      @return false when no part of the image is visible */
+  bool GetDrawnRect(mpPlotView &w, const wxRect &area, wxRect &dest, wxRect &src);
+
+  /** Draw the name label of the layer. */
+  void DrawLabel(mpRenderer &r, mpPlotView &w);
+
   bool m_validImg;
 
   /** The shape of the bitmap:
@@ -0,0 +1,724 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:            mathplot_golden.cpp
+// Purpose:         Checks the fast rendering paths against golden images
+// Licence:         wxWindows licence
+/////////////////////////////////////////////////////////////////////////////
+
+#include <wx/filefn.h>
+#include <wx/filename.h>
+#include <wx/graphics.h>
+#include <wx/wx.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "mathplot.h"
+
+// Size of the rendered images
+#define GOLDEN_WIDTH 800
+#define GOLDEN_HEIGHT 600
+
+//-----------------------------------------------------------------------------
+// Scenes
+//-----------------------------------------------------------------------------
+
+// Layers of the first example
+class MySIN : public mpFX {
+  double m_freq, m_amp;
+
+ public:
+  MySIN(double freq, double amp) : mpFX(wxT("f(x) = SIN(x)"), mpALIGN_LEFT) {
+    m_freq = freq;
+    m_amp = amp;
+    m_drawOutsideMargins = false;
+  }
+  virtual double GetY(double x) { return m_amp * sin(x / 6.283185 / m_freq); }
+  virtual double GetMinY() { return -m_amp; }
+  virtual double GetMaxY() { return m_amp; }
+};
+
+class MyCOSinverse : public mpFY {
+  double m_freq, m_amp;
+
+ public:
+  MyCOSinverse(double freq, double amp) : mpFY(wxT("g(y) = COS(y)"), mpALIGN_BOTTOM) {
+    m_freq = freq;
+    m_amp = amp;
+    m_drawOutsideMargins = false;
+  }
+  virtual double GetX(double y) { return m_amp * cos(y / 6.283185 / m_freq); }
+  virtual double GetMinX() { return -m_amp; }
+  virtual double GetMaxX() { return m_amp; }
+};
+
+class MyLissajoux : public mpFXY {
+  double m_rad;
+  int m_idx;
+
+ public:
+  MyLissajoux(double rad) : mpFXY(wxT("Lissajoux")) {
+    m_rad = rad;
+    m_idx = 0;
+    m_drawOutsideMargins = false;
+  }
+  virtual bool GetNextXY(double &x, double &y) {
+    if (m_idx < 360) {
+      x = m_rad * cos(m_idx / 6.283185 * 360);
+      y = m_rad * sin(m_idx / 6.283185 * 360 * 3);
+      m_idx++;
+      return TRUE;
+    }
+    return FALSE;
+  }
+  virtual void Rewind() { m_idx = 0; }
+  virtual double GetMinX() { return -m_rad; }
+  virtual double GetMaxX() { return m_rad; }
+  virtual double GetMinY() { return -m_rad; }
+  virtual double GetMaxY() { return m_rad; }
+};
+
+static void AddScales(mpPlotView &plot) {
+  mpScaleX *xaxis = new mpScaleX(wxT("X"), mpALIGN_BOTTOM, true, mpX_NORMAL);
+  mpScaleY *yaxis = new mpScaleY(wxT("Y"), mpALIGN_LEFT, true);
+  xaxis->SetDrawOutsideMargins(false);
+  yaxis->SetDrawOutsideMargins(false);
+  plot.AddLayer(xaxis, false);
+  plot.AddLayer(yaxis, false);
+}
+
+// The functions, series, text and legend of the first example
+static void BuildExample1(mpPlotView &plot, size_t) {
+  AddScales(plot);
+  plot.AddLayer(new MySIN(10.0, 220.0), false);
+  plot.AddLayer(new MyCOSinverse(10.0, 100.0), false);
+  plot.AddLayer(new MyLissajoux(125.0), false);
+
+  std::vector<double> xs, ys;
+  for (unsigned int p = 0; p < 100; p++) {
+    const double x = ((double)p - 50.0) * 5.0;
+    xs.push_back(x);
+    ys.push_back(0.0001 * pow(x, 3));
+  }
+  mpFXYVector *vector = new mpFXYVector(wxT("Vector"));
+  vector->SetData(xs, ys);
+  vector->SetContinuity(true);
+  vector->SetPen(wxPen(*wxBLUE, 2, wxPENSTYLE_SOLID));
+  vector->SetDrawOutsideMargins(false);
+  plot.AddLayer(vector, false);
+  plot.AddLayer(new mpText(wxT("mpText sample"), 10, 10), false);
+  plot.AddLayer(new mpInfoLegend(wxRect(200, 20, 40, 40), wxTRANSPARENT_BRUSH), false);
+  plot.Fit();
+}
+
+// The image, ellipses and polygon of the third example
+static void BuildExample3(mpPlotView &plot, size_t) {
+  AddScales(plot);
+
+  // Checkerboard standing for the grid map of the example
+  wxImage image(64, 64, false);
+  unsigned char *rgb = image.GetData();
+  for (int y = 0; y < 64; ++y)
+    for (int x = 0; x < 64; ++x, rgb += 3) rgb[0] = rgb[1] = rgb[2] = (((x / 8) + (y / 8)) & 1) ? 200 : 240;
+  mpBitmapLayer *bitmap = new mpBitmapLayer();
+  bitmap->SetBitmap(image, -40, -40, 120, 120);
+  plot.AddLayer(bitmap, false);
+
+  mpCovarianceEllipse *cov1 = new mpCovarianceEllipse(0.4, 0.4, 0.2, 2, 32, wxT("Cov1"));
+  cov1->SetPen(wxPen(*wxRED, 2, wxPENSTYLE_SOLID));
+  cov1->SetCoordinateBase(-4, -4, 1);
+  plot.AddLayer(cov1, false);
+  mpCovarianceEllipse *cov2 = new mpCovarianceEllipse(0.2, 0.2, -0.1, 2, 32, wxT("Cov2"));
+  cov2->SetPen(wxPen(*wxBLUE, 2, wxPENSTYLE_SOLID));
+  cov2->SetCoordinateBase(12, 7, 0);
+  plot.AddLayer(cov2, false);
+
+  static const double car[][2] = {{-0.5, -0.5}, {-0.2, -0.5}, {-0.2, -0.6}, {0, -0.6}, {0, -0.5},
+                                  {0.6, -0.5},  {0.6, -0.6},  {0.8, -0.6},  {0.8, -0.5}, {1.0, -0.5},
+                                  {1.0, 0.5},   {0.8, 0.5},   {0.8, 0.6},   {0.6, 0.6},  {0.6, 0.5},
+                                  {0, 0.5},     {0, 0.6},     {-0.2, 0.6},  {-0.2, 0.5}, {-0.5, 0.5}};
+  std::vector<double> xs, ys;
+  for (size_t i = 0; i < sizeof(car) / sizeof(car[0]); ++i) {
+    xs.push_back(car[i][0] * 10);
+    ys.push_back(car[i][1] * 10);
+  }
+  mpPolygon *polygon = new mpPolygon(wxT("car"));
+  polygon->SetPen(wxPen(*wxBLACK, 3, wxPENSTYLE_SOLID));
+  polygon->setPoints(xs, ys, true);
+  plot.AddLayer(polygon, false);
+  plot.Fit(-45, 85, -45, 85);
+}
+
+// Reproducible noise in [-1, 1)
+static double Noise(unsigned int &state) {
+  state = state * 1664525u + 1013904223u;
+  return (double)(state >> 8) / (double)(1u << 23) - 1;
+}
+
+// Large series, continuous or not: a noisy sine, and steps with spikes
+// which stress the reduction of many points per pixel column
+static void BuildLarge(mpPlotView &plot, size_t points, bool continuous) {
+  AddScales(plot);
+  std::vector<double> xs(points), noisy(points), steps(points);
+  unsigned int state = 1;
+  for (size_t i = 0; i < points; ++i) {
+    xs[i] = (double)i;
+    noisy[i] = sin((double)i * 2e-5) + 0.2 * Noise(state);
+    steps[i] = (double)((i / 50000) % 4) - 3 + ((i % 9973) == 0 ? 1.5 : 0);
+  }
+  static const wxColour colours[] = {wxColour(31, 119, 180), wxColour(214, 39, 40)};
+  const std::vector<double> *ys[] = {&noisy, &steps};
+  for (int s = 0; s < 2; ++s) {
+    mpFXYVector *series = new mpFXYVector(s ? wxT("steps") : wxT("noise"));
+    series->SetData(xs, *ys[s]);
+    series->SetContinuity(continuous);
+    series->SetPen(wxPen(colours[s], 1, wxPENSTYLE_SOLID));
+    series->SetDrawOutsideMargins(false);
+    series->ShowName(false);
+    plot.AddLayer(series, false);
+  }
+  plot.Fit();
+}
+
+static void BuildLargeLines(mpPlotView &plot, size_t points) { BuildLarge(plot, points, true); }
+
+static void BuildLargePoints(mpPlotView &plot, size_t points) { BuildLarge(plot, points, false); }
+
+// A series zoomed in, so that most of its points are outside of the view
+static void BuildZoomed(mpPlotView &plot, size_t points) {
+  BuildLarge(plot, points, true);
+  plot.Fit((double)points * 0.4, (double)points * 0.41, -1.5, 1.5);
+}
+
+// A portable scene only has series, whose pixels do not depend on the
+// platform when drawn into an mpRasterBuffer: its golden images are committed
+struct Scene {
+  const char *name;
+  void (*build)(mpPlotView &plot, size_t points);
+  bool portable;
+};
+
+static const Scene scenes[] = {{"example1", BuildExample1, false},
+                               {"example3", BuildExample3, false},
+                               {"large-lines", BuildLargeLines, true},
+                               {"large-points", BuildLargePoints, true},
+                               {"large-zoomed", BuildZoomed, true}};
+
+// Set up a plot as for all the scenes
+static void SetUpScene(mpPlotView &plot, const Scene &scene, size_t points) {
+  plot.SetMargins(30, 30, 50, 100);
+  plot.SetColourTheme(*wxWHITE, *wxBLACK, *wxBLACK);
+  scene.build(plot, points);
+}
+
+//-----------------------------------------------------------------------------
+// Render paths
+//-----------------------------------------------------------------------------
+
+// Size of the window once resized
+#define GOLDEN_RESIZED_WIDTH 960
+#define GOLDEN_RESIZED_HEIGHT 720
+
+// Points of the large series of the committed golden images
+#define GOLDEN_POINTS 1000000
+
+enum {
+  PATH_DC,                // Reference: mpLayer::Plot on a wxMemoryDC
+  PATH_DECIMATED,         // mpDecimatingRenderer over mpDCRenderer, as when printing
+  PATH_RASTER_TILES,      // mpFXY::SetRasterTiles as set by the application, through mpRasterRenderer
+  PATH_RASTER,            // mpRasterRenderer, as with mpRENDERER_RASTER
+  PATH_GC,                // mpGCRenderer without antialiasing, as with mpRENDERER_GC
+  PATH_OFFSCREEN,         // mpOffscreenPlot::RenderImage, antialiased
+  PATH_EXPORT,            // mpPlotView::ExportPNG, in bands of a few rows
+  PATH_WINDOW,            // mpWindow paint, through its frame and the overlays
+  PATH_WINDOW_RASTER,     // Same, with mpRENDERER_RASTER
+  PATH_PARALLEL,          // mpWindow paint with the parallel plot of the series
+  PATH_PARTIAL,           // Repaint of the area where a series changed, see mpWindow::InvalidateFrame
+  PATH_PARALLEL_PARTIAL,  // Same, with the parallel plot
+  PATH_STRETCH,           // Last frame stretched while the window is being resized
+  PATH_RESIZED,           // Frame drawn once the window stops being resized
+  PATH_COUNT
+};
+
+// Tolerances: two pixels match when no channel differs by more than
+// threshold. A pixel is displaced when the other image has no matching pixel
+// at its position or next to it, and the share of displaced pixels must not
+// exceed tolerance. Each path is compared to the image of another path; the
+// stretched frame to the window image scaled to the new size, and the resized
+// window to a window created at that size. The paths drawing the same pixels
+// in another order must match exactly. The graphics contexts antialias the
+// texts, and the offscreen plot also the lines.
+struct RenderPath {
+  const char *name;
+  int against;  // Path of the expected image
+  int threshold;
+  double tolerance;
+};
+
+static const RenderPath paths[PATH_COUNT] = {{"dc", PATH_DC, 0, 0},
+                                             {"decimated", PATH_DC, 0, 0.001},
+                                             {"raster-tiles", PATH_RASTER, 0, 0},
+                                             {"raster", PATH_DC, 0, 0.01},
+                                             {"gc", PATH_DC, 64, 0.01},
+                                             {"offscreen", PATH_DC, 64, 0.03},
+                                             {"export", PATH_OFFSCREEN, 0, 0},
+                                             {"window", PATH_DC, 0, 0},
+                                             {"window-raster", PATH_WINDOW, 0, 0.01},
+                                             {"parallel", PATH_WINDOW_RASTER, 0, 0},
+                                             {"partial", PATH_WINDOW, 0, 0},
+                                             {"par-partial", PATH_PARALLEL, 0, 0},
+                                             {"stretch", PATH_WINDOW, 0, 0.01},
+                                             {"resized", PATH_WINDOW, 0, 0}};
+
+// Share of displaced pixels allowed against the committed golden images,
+// for the last bit of the functions of the C library
+#define GOLDEN_TOLERANCE 0.0005
+
+// Render a scene without a window
+static wxImage RenderScene(const Scene &scene, int path, size_t points, const wxString &exportFile) {
+  mpOffscreenPlot plot(GOLDEN_WIDTH, GOLDEN_HEIGHT);
+  SetUpScene(plot, scene, points);
+  if (path == PATH_RASTER_TILES) {
+    for (unsigned int i = 0; i < plot.CountAllLayers(); ++i) {
+      mpFXY *fxy = dynamic_cast<mpFXY *>(plot.GetLayer((int)i));
+      if (fxy) fxy->SetRasterTiles(mpRASTER_TILES_AUTO);
+    }
+  }
+  if (path == PATH_OFFSCREEN) return plot.RenderImage();
+  if (path == PATH_EXPORT) {
+    // Bands of a few rows, so that many layers and texts cross their edges
+    wxImage image;
+    if (plot.ExportPNG(exportFile, GOLDEN_WIDTH, GOLDEN_HEIGHT, false, 37))
+      image.LoadFile(exportFile, wxBITMAP_TYPE_PNG);
+    wxRemoveFile(exportFile);
+    return image;
+  }
+  if (path == PATH_GC) {
+    wxImage image(GOLDEN_WIDTH, GOLDEN_HEIGHT, false);
+    memset(image.GetData(), 255, 3 * (size_t)GOLDEN_WIDTH * GOLDEN_HEIGHT);
+    wxGraphicsContext *gc = wxGraphicsContext::Create(image);
+    if (!gc) return wxImage();
+    gc->SetAntialiasMode(wxANTIALIAS_NONE);
+    {
+      mpGCRenderer renderer(gc);  // The drawing reaches the image when the context is destroyed
+      renderer.SetTextForeground(*wxBLACK);
+      for (unsigned int i = 0; i < plot.CountAllLayers(); ++i) plot.GetLayer((int)i)->Render(renderer, plot);
+    }
+    return image;
+  }
+
+  wxBitmap bitmap(GOLDEN_WIDTH, GOLDEN_HEIGHT);
+  {
+    wxMemoryDC dc(bitmap);
+    dc.SetBackground(*wxWHITE_BRUSH);
+    dc.Clear();
+    dc.SetTextForeground(*wxBLACK);
+    if (path == PATH_DC) {
+      for (unsigned int i = 0; i < plot.CountAllLayers(); ++i) plot.GetLayer((int)i)->Plot(dc, plot);
+    } else {
+      mpDCRenderer target(dc);
+      std::unique_ptr<mpRenderer> renderer;
+      if (path == PATH_RASTER || path == PATH_RASTER_TILES)
+        renderer.reset(new mpRasterRenderer(dc, GOLDEN_WIDTH, GOLDEN_HEIGHT));
+      else
+        renderer.reset(new mpDecimatingRenderer(target));
+      renderer->SetTextForeground(*wxBLACK);
+      for (unsigned int i = 0; i < plot.CountAllLayers(); ++i) plot.GetLayer((int)i)->Render(*renderer, plot);
+      renderer->Flush();
+    }
+  }
+  return bitmap.ConvertToImage();
+}
+
+// Copy a raster buffer to an image, over a white background
+static wxImage FlattenOnWhite(const mpRasterBuffer &buffer) {
+  wxImage image(buffer.GetWidth(), buffer.GetHeight(), false);
+  unsigned char *rgb = image.GetData();
+  for (int y = 0; y < buffer.GetHeight(); ++y) {
+    const wxUint32 *row = buffer.GetRow(y);
+    for (int x = 0; x < buffer.GetWidth(); ++x, rgb += 3) {
+      const wxUint32 a = row[x] >> 24;
+      for (int c = 0; c < 3; ++c)
+        rgb[c] = (unsigned char)((((row[x] >> (16 - 8 * c)) & 0xFF) * a + 255 * (255 - a)) / 255);
+    }
+  }
+  return image;
+}
+
+// Render the series of a portable scene into an mpRasterBuffer, whose
+// pixels are the same on every platform. The texts, drawn by the DC, are left out.
+static wxImage RenderPortable(const Scene &scene, int path, size_t points) {
+  mpOffscreenPlot plot(GOLDEN_WIDTH, GOLDEN_HEIGHT);
+  SetUpScene(plot, scene, points);
+  wxBitmap bitmap(GOLDEN_WIDTH, GOLDEN_HEIGHT);
+  wxMemoryDC dc(bitmap);
+  mpRasterRenderer renderer(dc, GOLDEN_WIDTH, GOLDEN_HEIGHT);
+  for (unsigned int i = 0; i < plot.CountAllLayers(); ++i) {
+    mpFXY *fxy = dynamic_cast<mpFXY *>(plot.GetLayer((int)i));
+    if (!fxy) continue;
+    if (path == PATH_RASTER_TILES) fxy->SetRasterTiles(mpRASTER_TILES_AUTO);
+    fxy->Render(renderer, plot);
+  }
+  return FlattenOnWhite(renderer.GetBuffer());  // Before the renderer flushes it to the DC
+}
+
+// Window painted into images, as OnPaint paints it on the screen
+class GoldenWindow : public mpWindow {
+ public:
+  GoldenWindow(wxWindow *parent, const Scene &scene, size_t points, int width, int height)
+      : mpWindow(parent, wxID_ANY) {
+    SetClientSize(width, height);
+    SetUpScene(*this, scene, points);
+  }
+
+  // Paint the window into an image of its size, over a previous image when given
+  wxImage Paint(const wxRect &update = wxRect(), const wxImage &previous = wxImage()) {
+    int width, height;
+    GetClientSize(&width, &height);
+    wxBitmap bitmap = previous.IsOk() ? wxBitmap(previous) : wxBitmap(width, height);
+    {
+      wxMemoryDC dc(bitmap);
+      PaintWindow(dc, update);
+    }
+    return bitmap.ConvertToImage();
+  }
+
+  // Resize the window as a window manager does: the paints stretch the
+  // last frame until the resize timer fires
+  void Resize(int width, int height) {
+    m_resizing = true;
+    SetClientSize(width, height);
+  }
+
+  void EndResize() {
+    wxTimerEvent event;
+    OnResizeTimer(event);
+  }
+};
+
+// Find the last series which tells the area it covers, to be changed
+static mpFXYVector *FindChangingSeries(mpWindow &w) {
+  mpFXYVector *found = NULL;
+  wxRect bounds;
+  for (unsigned int i = 0; i < w.CountAllLayers(); ++i) {
+    mpFXYVector *series = dynamic_cast<mpFXYVector *>(w.GetLayer((int)i));
+    if (series && w.GetLayer((int)i)->GetScreenBounds(w, bounds)) found = series;
+  }
+  return found;
+}
+
+// Paint the window with a series halved, then put the series back and only
+// repaint the area it covered before and after, as done for new data
+static wxImage PaintChange(GoldenWindow &w, mpFXYVector &series) {
+  std::vector<double> xs, ys, halved;
+  series.GetData(xs, ys);
+  for (size_t i = 0; i < ys.size(); ++i) halved.push_back(ys[i] / 2);
+  mpLayer &layer = series;
+  wxRect before, after;
+  series.SetData(xs, halved);
+  w.InvalidateFrame();
+  const wxImage image = w.Paint();
+  layer.GetScreenBounds(w, before);
+  series.SetData(xs, ys);
+  layer.GetScreenBounds(w, after);
+  const wxRect area = before.Union(after);
+  w.InvalidateFrame(area);
+  return w.Paint(area, image);
+}
+
+// Render a scene through the window paths. The view must keep the size of
+// the frame while it is stretched.
+static void RenderWindow(wxWindow *parent, const Scene &scene, size_t points, std::vector<wxImage> &images,
+                         bool &viewKept) {
+  GoldenWindow *w = new GoldenWindow(parent, scene, points, GOLDEN_WIDTH, GOLDEN_HEIGHT);
+  images[PATH_WINDOW] = w->Paint();
+  mpFXYVector *series = FindChangingSeries(*w);
+  if (series) images[PATH_PARTIAL] = PaintChange(*w, *series);
+
+  // The parallel plot draws the frame as the raster renderer does
+  w->SetRendererType(mpRENDERER_RASTER);
+  w->InvalidateFrame();
+  images[PATH_WINDOW_RASTER] = w->Paint();
+  w->EnableParallelPlot(true);
+  for (unsigned int i = 0; i < w->CountAllLayers(); ++i)
+    if (dynamic_cast<mpFXY *>(w->GetLayer((int)i))) w->GetLayer((int)i)->SetParallelPlot(true);
+  w->InvalidateFrame();
+  images[PATH_PARALLEL] = w->Paint();
+  if (series) images[PATH_PARALLEL_PARTIAL] = PaintChange(*w, *series);
+  w->EnableParallelPlot(false);
+  w->SetRendererType(mpRENDERER_DC);
+  w->InvalidateFrame();
+  w->Paint();
+
+  w->Resize(GOLDEN_RESIZED_WIDTH, GOLDEN_RESIZED_HEIGHT);
+  images[PATH_STRETCH] = w->Paint();
+  viewKept = w->GetScrX() == GOLDEN_WIDTH && w->GetScrY() == GOLDEN_HEIGHT;
+  w->EndResize();
+  images[PATH_RESIZED] = w->Paint();
+  delete w;
+}
+
+// Render a scene in a window created at the resized size
+static wxImage RenderResized(wxWindow *parent, const Scene &scene, size_t points) {
+  GoldenWindow *w = new GoldenWindow(parent, scene, points, GOLDEN_RESIZED_WIDTH, GOLDEN_RESIZED_HEIGHT);
+  const wxImage image = w->Paint();
+  delete w;
+  return image;
+}
+
+//-----------------------------------------------------------------------------
+// Comparison
+//-----------------------------------------------------------------------------
+
+struct DiffMetrics {
+  size_t differing;  // Pixels not matching at the same position
+  size_t displaced;  // Pixels not matching at the same position or next to it
+  int maxDelta;      // Largest channel difference
+  double psnr;       // Peak signal to noise ratio in dB, infinite for equal images
+};
+
+static bool Matches(const unsigned char *a, const unsigned char *b, int threshold) {
+  return abs(a[0] - b[0]) <= threshold && abs(a[1] - b[1]) <= threshold && abs(a[2] - b[2]) <= threshold;
+}
+
+// Check whether the pixel (x, y) of a has a match in b at the same position or next to it
+static bool HasNeighbour(const wxImage &a, const wxImage &b, int x, int y, int threshold) {
+  const int width = a.GetWidth(), height = a.GetHeight();
+  const unsigned char *pa = a.GetData() + 3 * ((size_t)y * (size_t)width + (size_t)x);
+  for (int dy = -1; dy <= 1; ++dy) {
+    for (int dx = -1; dx <= 1; ++dx) {
+      const int nx = x + dx, ny = y + dy;
+      if (nx < 0 || ny < 0 || nx >= width || ny >= height) continue;
+      if (Matches(pa, b.GetData() + 3 * ((size_t)ny * (size_t)width + (size_t)nx), threshold)) return true;
+    }
+  }
+  return false;
+}
+
+// Compare two images and draw the differences over a faded copy of a:
+// displaced pixels in red, other differing pixels in orange
+static DiffMetrics Compare(const wxImage &a, const wxImage &b, int threshold, wxImage &diff) {
+  DiffMetrics m = {0, 0, 0, 0};
+  const int width = a.GetWidth(), height = a.GetHeight();
+  if (!a.IsOk() || !b.IsOk() || b.GetWidth() != width || b.GetHeight() != height) {
+    m.differing = m.displaced = std::max((size_t)width * (size_t)height, (size_t)b.GetWidth() * (size_t)b.GetHeight());
+    m.maxDelta = 255;
+    return m;
+  }
+  diff = a.Copy();
+  unsigned char *pd = diff.GetData();
+  const unsigned char *pa = a.GetData(), *pb = b.GetData();
+  double squares = 0;
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x, pa += 3, pb += 3, pd += 3) {
+      for (int c = 0; c < 3; ++c) {
+        const int delta = abs(pa[c] - pb[c]);
+        if (delta > m.maxDelta) m.maxDelta = delta;
+        squares += (double)(delta * delta);
+        pd[c] = (unsigned char)(192 + pd[c] / 4);
+      }
+      if (Matches(pa, pb, threshold)) continue;
+      m.differing++;
+      if (!HasNeighbour(a, b, x, y, threshold) || !HasNeighbour(b, a, x, y, threshold)) {
+        m.displaced++;
+        pd[0] = 255;
+        pd[1] = pd[2] = 0;
+      } else {
+        pd[0] = 255;
+        pd[1] = 160;
+        pd[2] = 0;
+      }
+    }
+  }
+  const double mse = squares / (3.0 * (double)width * (double)height);
+  m.psnr = mse > 0 ? 10 * log10(255.0 * 255.0 / mse) : INFINITY;
+  return m;
+}
+
+//-----------------------------------------------------------------------------
+// Application
+//-----------------------------------------------------------------------------
+
+static void Usage() {
+  printf(
+      "Usage: mathplot-golden [options]\n"
+      "Render canonical scenes through the reference wxDC path, the fast paths and the paint\n"
+      "of mpWindow, and compare each image to the image it must match. The series drawn into\n"
+      "a raster buffer are also compared to the committed golden images.\n\n"
+      "  -g, --golden DIR     directory of the golden images (default: golden)\n"
+      "  -p, --platform DIR   directory of golden images of the reference, made on this platform\n"
+      "  -o, --output DIR     directory of the images of the failures (default: current directory)\n"
+      "  -n, --points N       points of the large series (default: 1e6, as the golden images)\n"
+      "  -u, --update         replace the golden images, and those of the platform when given\n");
+}
+
+class MyApp : public wxApp {
+ public:
+  virtual bool OnInit() { return true; }
+  virtual int OnRun();
+
+ private:
+  bool Check(const wxString &scene, const RenderPath &path, const wxString &against, const wxImage &image,
+             const wxImage &expected);
+  bool Update(const wxString &file, const wxImage &image);
+
+  wxString m_outputDir;
+};
+
+IMPLEMENT_APP(MyApp)
+
+// Compare an image to the expected one and print the result. On failure,
+// the image and the differences are saved in the output directory.
+bool MyApp::Check(const wxString &scene, const RenderPath &path, const wxString &against, const wxImage &image,
+                  const wxImage &expected) {
+  wxImage diff;
+  const DiffMetrics m = Compare(expected, image, path.threshold, diff);
+  const wxImage &sized = expected.IsOk() ? expected : image;
+  const double total = sized.IsOk() ? (double)sized.GetWidth() * sized.GetHeight() : 1;
+  const bool ok = image.IsOk() && expected.IsOk() && (double)m.displaced <= path.tolerance * total;
+  printf("%-14s %-14s %-14s %10.4f %12.4f %10d %10.2f %12.4f %s\n", (const char *)scene.utf8_str(), path.name,
+         (const char *)against.utf8_str(), 100.0 * (double)m.differing / total, 100.0 * (double)m.displaced / total,
+         m.maxDelta, m.psnr, 100.0 * path.tolerance, ok ? "ok" : "FAILED");
+  fflush(stdout);
+  if (!ok) {
+    const wxString name = scene + wxT("-") + path.name + wxT("-") + against;
+    if (image.IsOk()) image.SaveFile(wxFileName(m_outputDir, name, wxT("png")).GetFullPath(), wxBITMAP_TYPE_PNG);
+    if (diff.IsOk())
+      diff.SaveFile(wxFileName(m_outputDir, name + wxT("-diff"), wxT("png")).GetFullPath(), wxBITMAP_TYPE_PNG);
+  }
+  return ok;
+}
+
+// Save a golden image and print the result
+bool MyApp::Update(const wxString &file, const wxImage &image) {
+  const bool saved = image.IsOk() && image.SaveFile(file, wxBITMAP_TYPE_PNG);
+  printf("%s %s\n", (const char *)file.utf8_str(), saved ? "updated" : "FAILED");
+  return saved;
+}
+
+int MyApp::OnRun() {
+  wxString goldenDir = wxT("golden"), platformDir;
+  size_t points = GOLDEN_POINTS;
+  bool update = false;
+  for (int i = 1; i < argc; ++i) {
+    const wxString arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    double value;
+    if (arg == wxT("-h") || arg == wxT("--help")) {
+      Usage();
+      return 0;
+    } else if ((arg == wxT("-g") || arg == wxT("--golden")) && hasValue) {
+      goldenDir = argv[++i];
+    } else if ((arg == wxT("-p") || arg == wxT("--platform")) && hasValue) {
+      platformDir = argv[++i];
+    } else if ((arg == wxT("-o") || arg == wxT("--output")) && hasValue) {
+      m_outputDir = argv[++i];
+    } else if ((arg == wxT("-n") || arg == wxT("--points")) && hasValue && wxString(argv[++i]).ToDouble(&value) &&
+               value >= 1) {
+      points = (size_t)value;
+    } else if (arg == wxT("-u") || arg == wxT("--update")) {
+      update = true;
+    } else {
+      Usage();
+      return 2;
+    }
+  }
+  wxInitAllImageHandlers();
+  // The golden images are only valid for their number of points
+  const bool golden = points == GOLDEN_POINTS;
+  if (update && !golden) {
+    printf("the golden images are made with %d points\n", GOLDEN_POINTS);
+    return 2;
+  }
+
+  size_t failed = 0, checked = 0;
+  if (update) {
+    const wxString dirs[] = {goldenDir, platformDir};
+    for (size_t d = 0; d < 2; ++d)
+      if (!dirs[d].IsEmpty() && !wxFileName::DirExists(dirs[d]))
+        wxFileName::Mkdir(dirs[d], wxS_DIR_DEFAULT, wxPATH_MKDIR_FULL);
+    for (size_t s = 0; s < sizeof(scenes) / sizeof(scenes[0]); ++s) {
+      const wxString scene = scenes[s].name;
+      for (int p = PATH_RASTER_TILES; scenes[s].portable && p <= PATH_RASTER; ++p) {
+        const wxString file = wxFileName(goldenDir, scene + wxT("-") + paths[p].name, wxT("png")).GetFullPath();
+        if (!Update(file, RenderPortable(scenes[s], p, points))) failed++;
+      }
+      const wxString file = wxFileName(platformDir, scene, wxT("png")).GetFullPath();
+      if (!platformDir.IsEmpty() && !Update(file, RenderScene(scenes[s], PATH_DC, points, wxEmptyString))) failed++;
+    }
+    return failed ? 1 : 0;
+  }
+
+  // The windows are never shown
+  wxFrame *frame = new wxFrame(NULL, wxID_ANY, wxT("mathplot-golden"));
+  printf("%-14s %-14s %-14s %10s %12s %10s %10s %12s\n", "scene", "path", "against", "differ %", "displaced %",
+         "max delta", "PSNR [dB]", "tolerance %");
+  for (size_t s = 0; s < sizeof(scenes) / sizeof(scenes[0]); ++s) {
+    const wxString scene = scenes[s].name;
+
+    // The series of the portable scenes against the committed golden images, and the tiles against the raster
+    // renderer, which must draw the same pixels
+    if (scenes[s].portable) {
+      wxImage portable[PATH_RASTER + 1];
+      for (int p = PATH_RASTER_TILES; p <= PATH_RASTER; ++p) {
+        portable[p] = RenderPortable(scenes[s], p, points);
+        if (!golden) continue;
+        const wxString file = wxFileName(goldenDir, scene + wxT("-") + paths[p].name, wxT("png")).GetFullPath();
+        wxImage expected;
+        if (!wxFileName::FileExists(file) || !expected.LoadFile(file, wxBITMAP_TYPE_PNG))
+          printf("%-14s missing golden image %s, see --update\n", (const char *)scene.utf8_str(),
+                 (const char *)file.utf8_str());
+        const RenderPath path = {paths[p].name, p, 0, GOLDEN_TOLERANCE};
+        checked++;
+        if (!Check(scene, path, wxT("golden"), portable[p], expected)) failed++;
+      }
+      checked++;
+      if (!Check(scene, paths[PATH_RASTER_TILES], wxT("raster-series"), portable[PATH_RASTER_TILES],
+                 portable[PATH_RASTER]))
+        failed++;
+    }
+
+    std::vector<wxImage> images(PATH_COUNT);
+    const wxString exportFile = wxFileName(m_outputDir, scene + wxT("-export"), wxT("png")).GetFullPath();
+    for (int p = PATH_DC; p <= PATH_EXPORT; ++p) images[p] = RenderScene(scenes[s], p, points, exportFile);
+    bool viewKept = false;
+    RenderWindow(frame, scenes[s], points, images, viewKept);
+    if (!viewKept) {
+      printf("%-14s %-14s the view changed size while the frame was stretched FAILED\n",
+             (const char *)scene.utf8_str(), paths[PATH_STRETCH].name);
+      failed++;
+    }
+
+    if (!platformDir.IsEmpty()) {
+      const wxString file = wxFileName(platformDir, scene, wxT("png")).GetFullPath();
+      wxImage expected;
+      if (!wxFileName::FileExists(file) || !expected.LoadFile(file, wxBITMAP_TYPE_PNG))
+        printf("%-14s missing golden image %s, see --update\n", (const char *)scene.utf8_str(),
+               (const char *)file.utf8_str());
+      checked++;
+      if (!Check(scene, paths[PATH_DC], wxT("platform"), images[PATH_DC], expected)) failed++;
+    }
+
+    for (int p = PATH_DC + 1; p < PATH_COUNT; ++p) {
+      // Scenes without a series telling its area have no partial repaint
+      if ((p == PATH_PARTIAL || p == PATH_PARALLEL_PARTIAL) && !images[p].IsOk()) continue;
+      wxImage expected = images[paths[p].against];
+      wxString against = paths[paths[p].against].name;
+      if (p == PATH_STRETCH) {
+        expected = expected.Scale(GOLDEN_RESIZED_WIDTH, GOLDEN_RESIZED_HEIGHT, wxIMAGE_QUALITY_NEAREST);
+      } else if (p == PATH_RESIZED) {
+        expected = RenderResized(frame, scenes[s], points);
+        against = wxT("new-window");
+      }
+      checked++;
+      if (!Check(scene, paths[p], against, images[p], expected)) failed++;
+    }
+  }
+  frame->Destroy();
+  printf("%zu comparisons, %zu failed\n", checked, failed);
+  return failed ? 1 : 0;
+}
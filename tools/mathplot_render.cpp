@@ -0,0 +1,329 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:            mathplot_render.cpp
+// Purpose:         Command line tool rendering data files to PNG images
+// Licence:         wxWindows licence
+/////////////////////////////////////////////////////////////////////////////
+
+#include <wx/ffile.h>
+#include <wx/filename.h>
+#include <wx/wx.h>
+
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "mathplot.h"
+
+// Colours of the series, in order
+static const unsigned char palette[][3] = {{31, 119, 180}, {255, 127, 14}, {44, 160, 44}, {214, 39, 40},
+                                           {148, 103, 189}, {140, 86, 75},  {227, 119, 194}, {127, 127, 127}};
+
+// Options of the whole run
+struct RenderOptions {
+  wxString outputDir;
+  std::vector<wxSize> sizes;
+  unsigned jobs;
+  int columns;  // Values per record of binary files
+  bool points;
+  bool quiet;
+};
+
+// Series read from one file: xs, then one vector of y values per series
+struct SeriesData {
+  std::vector<double> xs;
+  std::vector<std::vector<double> > ys;
+  std::vector<wxString> names;
+};
+
+// wxWidgets pens, brushes and fonts are reference counted without locking:
+// they are created one plot at a time, and each layer gets its own objects
+// instead of sharing the stock ones with the other threads.
+static std::mutex layerMutex;
+
+static void OwnStyle(mpLayer *layer, const wxColour &colour) {
+  layer->SetPen(wxPen(wxColour(colour.Red(), colour.Green(), colour.Blue()), 1));
+  layer->SetBrush(wxBrush(wxColour(255, 255, 255), wxBRUSHSTYLE_TRANSPARENT));
+  layer->SetFont(wxFont(9, wxFONTFAMILY_SWISS, wxFONTSTYLE_NORMAL, wxFONTWEIGHT_NORMAL));
+}
+
+static void Usage() {
+  printf(
+      "Usage: mathplot-render [options] file...\n"
+      "Render each data file to a PNG image.\n\n"
+      "Files ending in .csv hold one record per line: x, then one column per series,\n"
+      "separated by commas, semicolons, tabs or spaces. A first line which is not\n"
+      "numeric gives the series names; lines starting with # are skipped.\n"
+      "Other files hold records of native doubles: x, then one value per series.\n\n"
+      "  -o, --output DIR     output directory (default: current directory)\n"
+      "  -s, --size WxH[,..]  image sizes (default: 800x600)\n"
+      "  -j, --jobs N         files rendered at once (default: number of cores)\n"
+      "  -c, --columns N      values per record of binary files (default: 2)\n"
+      "  -p, --points         draw points instead of lines\n"
+      "  -q, --quiet          only print the summary\n");
+}
+
+// Split a CSV line into fields, returning false if one is not a number
+static bool ParseRecord(const char *begin, const char *end, std::vector<double> &values,
+                        std::vector<wxString> *fields = NULL) {
+  values.clear();
+  bool numeric = true;
+  const char *p = begin;
+  while (p < end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    const char *q = p;
+    while (q < end && *q != ',' && *q != ';' && *q != '\t' && *q != '\r' && !(*q == ' ' && fields == NULL)) q++;
+    if (q > p) {
+      double v = 0;
+      std::from_chars_result r = std::from_chars(p, q, v);
+      if (r.ec != std::errc() || r.ptr != q) numeric = false;
+      values.push_back(v);
+      if (fields) fields->push_back(wxString::FromUTF8(std::string(p, q)).Trim());
+    }
+    p = (q < end) ? q + 1 : q;
+  }
+  return numeric;
+}
+
+static bool ReadCSV(const std::vector<char> &text, SeriesData &data) {
+  std::vector<double> values;
+  std::vector<wxString> header;
+  size_t columns = 0;
+  bool first = true;
+  const char *p = text.data(), *end = text.data() + text.size();
+  while (p < end) {
+    const char *eol = p;
+    while (eol < end && *eol != '\n') eol++;
+    if (eol > p && *p != '#') {
+      if (!ParseRecord(p, eol, values)) {
+        if (!first) {
+          wxLogError(_("mathplot-render: invalid record \"%s\""), wxString::FromUTF8(std::string(p, eol)));
+          return false;
+        }
+        ParseRecord(p, eol, values, &header);
+      } else if (!values.empty()) {
+        if (columns == 0) {
+          columns = values.size();
+          data.ys.resize(columns > 1 ? columns - 1 : 0);
+        }
+        if (values.size() == columns) {
+          data.xs.push_back(values[0]);
+          for (size_t c = 1; c < columns; ++c) data.ys[c - 1].push_back(values[c]);
+        }
+      }
+      first = false;
+    }
+    p = eol + 1;
+  }
+  for (size_t c = 0; c < data.ys.size(); ++c)
+    data.names.push_back(c + 1 < header.size() ? header[c + 1] : wxString::Format(wxT("y%d"), (int)c + 1));
+  return !data.xs.empty();
+}
+
+static bool ReadBinary(const std::vector<char> &bytes, int columns, SeriesData &data) {
+  if (columns < 2) return false;
+  const size_t record = (size_t)columns * sizeof(double), count = bytes.size() / record;
+  data.xs.resize(count);
+  data.ys.assign((size_t)columns - 1, std::vector<double>(count));
+  for (size_t i = 0; i < count; ++i) {
+    double values[64];
+    memcpy(values, &bytes[i * record], record);
+    data.xs[i] = values[0];
+    for (int c = 1; c < columns; ++c) data.ys[(size_t)c - 1][i] = values[c];
+  }
+  for (int c = 1; c < columns; ++c) data.names.push_back(wxString::Format(wxT("y%d"), c));
+  return count > 0;
+}
+
+static bool ReadSeries(const wxString &path, const RenderOptions &options, SeriesData &data) {
+  wxFFile file(path, wxT("rb"));
+  if (!file.IsOpened()) return false;
+  const wxFileOffset length = file.Length();
+  if (length <= 0) {
+    wxLogError(_("mathplot-render: \"%s\" is empty"), path);
+    return false;
+  }
+  std::vector<char> bytes((size_t)length);
+  if (file.Read(bytes.data(), bytes.size()) != bytes.size()) return false;
+  if (wxFileName(path).GetExt().Lower() == wxT("csv")) return ReadCSV(bytes, data);
+  return ReadBinary(bytes, options.columns, data);
+}
+
+// Timings of one file, in seconds
+struct FileReport {
+  double read, render, write;
+  size_t points;
+  bool ok;
+  wxString error;  // Cause of the failure
+};
+
+static FileReport RenderFile(const wxString &path, const RenderOptions &options) {
+  typedef std::chrono::steady_clock clock;
+  FileReport report = {0, 0, 0, 0, false, wxString()};
+
+  clock::time_point start = clock::now();
+  SeriesData data;
+  bool ok = ReadSeries(path, options, data);
+  report.read = std::chrono::duration<double>(clock::now() - start).count();
+  if (!ok) {
+    report.error = wxT("cannot read the data");
+    return report;
+  }
+  report.points = data.xs.size() * data.ys.size();
+
+  for (size_t s = 0; s < options.sizes.size(); ++s) {
+    const wxSize size = options.sizes[s];
+    start = clock::now();
+    // Only the wx objects are created under the lock, as their reference counts are not atomic: the layers
+    // and the plot then hold objects of their own, so the data is set and the plot deleted out of it
+    mpOffscreenPlot *plot;
+    mpLayer *scales[2];
+    std::vector<mpFXYVector *> layers(data.ys.size());
+    {
+      std::lock_guard<std::mutex> lock(layerMutex);
+      plot = new mpOffscreenPlot(size.x, size.y);
+      plot->SetColourTheme(wxColour(255, 255, 255), wxColour(0, 0, 0), wxColour(0, 0, 0));
+      scales[0] = new mpScaleX(wxT("x"), mpALIGN_BORDER_BOTTOM, true);
+      scales[1] = new mpScaleY(wxT("y"), mpALIGN_BORDER_LEFT, true);
+      for (size_t i = 0; i < 2; ++i) OwnStyle(scales[i], wxColour(0, 0, 0));
+      for (size_t c = 0; c < layers.size(); ++c) {
+        layers[c] = new mpFXYVector(data.names[c]);
+        const unsigned char *rgb = palette[c % (sizeof(palette) / sizeof(palette[0]))];
+        OwnStyle(layers[c], wxColour(rgb[0], rgb[1], rgb[2]));
+      }
+    }
+    plot->SetMargins(20, 20, 40, 60);
+    for (size_t i = 0; i < 2; ++i) plot->AddLayer(scales[i]);
+    for (size_t c = 0; c < layers.size(); ++c) {
+      layers[c]->SetContinuity(!options.points);
+      layers[c]->SetDrawOutsideMargins(false);
+      layers[c]->ShowName(false);
+      layers[c]->SetData(data.xs, data.ys[c]);
+      plot->AddLayer(layers[c]);
+    }
+    plot->Fit();
+    // All the layers implement Render, so that no wxGCDC nor stock object is used out of the lock
+    wxImage image = plot->RenderImage();
+    report.render += std::chrono::duration<double>(clock::now() - start).count();
+
+    start = clock::now();
+    wxString name = wxFileName(path).GetName();
+    if (options.sizes.size() > 1) name += wxString::Format(wxT("_%dx%d"), size.x, size.y);
+    const wxFileName output(options.outputDir, name, wxT("png"));
+    ok = image.IsOk() && image.SaveFile(output.GetFullPath(), wxBITMAP_TYPE_PNG);
+    report.write += std::chrono::duration<double>(clock::now() - start).count();
+    delete plot;
+    if (!ok) {
+      report.error = wxString::Format(image.IsOk() ? wxT("cannot write %s") : wxT("cannot render %s"),
+                                      output.GetFullName());
+      return report;
+    }
+  }
+  report.ok = true;
+  return report;
+}
+
+static bool ParseSizes(const wxString &text, std::vector<wxSize> &sizes) {
+  sizes.clear();
+  wxString rest = text;
+  while (!rest.IsEmpty()) {
+    const wxString item = rest.BeforeFirst(','), w = item.BeforeFirst('x'), h = item.AfterFirst('x');
+    long width, height;
+    if (!w.ToLong(&width) || !h.ToLong(&height) || width <= 0 || height <= 0) return false;
+    sizes.push_back(wxSize((int)width, (int)height));
+    rest = rest.AfterFirst(',');
+  }
+  return !sizes.empty();
+}
+
+class MyApp : public wxApp {
+ public:
+  virtual bool OnInit() { return true; }
+  virtual int OnRun();
+};
+
+IMPLEMENT_APP(MyApp)
+
+int MyApp::OnRun() {
+  RenderOptions options;
+  options.sizes.push_back(wxSize(800, 600));
+  options.jobs = std::thread::hardware_concurrency();
+  options.columns = 2;
+  options.points = false;
+  options.quiet = false;
+
+  std::vector<wxString> files;
+  for (int i = 1; i < argc; ++i) {
+    const wxString arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    long value = 0;
+    if (arg == wxT("-h") || arg == wxT("--help")) {
+      Usage();
+      return 0;
+    } else if ((arg == wxT("-o") || arg == wxT("--output")) && hasValue) {
+      options.outputDir = argv[++i];
+    } else if ((arg == wxT("-s") || arg == wxT("--size")) && hasValue) {
+      if (!ParseSizes(argv[++i], options.sizes)) {
+        Usage();
+        return 2;
+      }
+    } else if ((arg == wxT("-j") || arg == wxT("--jobs")) && hasValue && wxString(argv[++i]).ToLong(&value)) {
+      options.jobs = (value > 0) ? (unsigned)value : 1;
+    } else if ((arg == wxT("-c") || arg == wxT("--columns")) && hasValue && wxString(argv[++i]).ToLong(&value) &&
+               value >= 2 && value <= 64) {
+      options.columns = (int)value;
+    } else if (arg == wxT("-p") || arg == wxT("--points")) {
+      options.points = true;
+    } else if (arg == wxT("-q") || arg == wxT("--quiet")) {
+      options.quiet = true;
+    } else if (arg.StartsWith(wxT("-"))) {
+      Usage();
+      return 2;
+    } else {
+      files.push_back(arg);
+    }
+  }
+  if (files.empty()) {
+    Usage();
+    return 2;
+  }
+  if (options.jobs < 1) options.jobs = 1;
+  if (options.jobs > files.size()) options.jobs = (unsigned)files.size();
+
+  wxInitAllImageHandlers();
+
+  // Each worker takes the next file until none is left
+  std::atomic<size_t> next(0);
+  std::atomic<size_t> failed(0), points(0);
+  std::mutex printMutex;
+  typedef std::chrono::steady_clock clock;
+  const clock::time_point start = clock::now();
+  std::vector<std::thread> workers;
+  if (!options.quiet) printf("%-40s %12s %10s %10s %10s\n", "file", "points", "read [ms]", "plot [ms]", "save [ms]");
+  for (unsigned j = 0; j < options.jobs; ++j) {
+    workers.push_back(std::thread([&] {
+      size_t i;
+      while ((i = next++) < files.size()) {
+        const FileReport r = RenderFile(files[i], options);
+        points += r.points;
+        if (!r.ok) failed++;
+        if (!options.quiet || !r.ok) {
+          std::lock_guard<std::mutex> lock(printMutex);
+          printf("%-40s %12zu %10.3f %10.3f %10.3f %s\n", (const char *)files[i].utf8_str(), r.points, r.read * 1e3,
+                 r.render * 1e3, r.write * 1e3, r.ok ? "ok" : (const char *)("FAILED: " + r.error).utf8_str());
+          fflush(stdout);
+        }
+      }
+    }));
+  }
+  for (size_t j = 0; j < workers.size(); ++j) workers[j].join();
+
+  const double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+  printf("%zu files, %zu images, %zu points in %.3f s with %u jobs: %.1f files/s, %zu failed\n", files.size(),
+         files.size() * options.sizes.size(), (size_t)points, elapsed, options.jobs,
+         elapsed > 0 ? (double)files.size() / elapsed : 0.0, (size_t)failed);
+  return failed ? 1 : 0;
+}